@@ -0,0 +1,235 @@
+#include "src/argument_normalizer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "src/config.h"
+#include "src/driver_options.h"
+#include "src/perfect_hash.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+std::string_view constexpr kNormalizeArgumentsEnvVar = "COMP_DB_HOOK_NORMALIZE_ARGUMENTS";
+std::string_view constexpr kStripArgumentsEnvVar = "COMP_DB_HOOK_STRIP_ARGUMENTS";
+std::string_view constexpr kKeepArgumentsEnvVar = "COMP_DB_HOOK_KEEP_ARGUMENTS";
+
+enum class RuleAction : uint8_t {
+  kStrip,
+  kCanonicalize,
+};
+
+struct Rule {
+  RuleAction action = RuleAction::kStrip;
+
+  // For `kCanonicalize` rules, the spelling to which the value is joined.
+  std::string_view canonical_spelling;
+
+  // For `kCanonicalize` rules, whether repeated occurrences must be dropped.
+  bool dedupe = false;
+};
+
+Rule constexpr kStrip{RuleAction::kStrip};
+
+constexpr Rule Join(std::string_view const spelling) {
+  return Rule{RuleAction::kCanonicalize, spelling, /*dedupe=*/false};
+}
+
+constexpr Rule JoinUnique(std::string_view const spelling) {
+  return Rule{RuleAction::kCanonicalize, spelling, /*dedupe=*/true};
+}
+
+// Default rules, keyed by the spellings in the driver option table.
+auto constexpr kDefaultRules = MakePerfectHashMap<Rule>({
+    // Output and dependency files.
+    {"-o", kStrip},
+    {"--output", kStrip},
+    {"--output=", kStrip},
+    {"-MD", kStrip},
+    {"-MMD", kStrip},
+    {"-MF", kStrip},
+    {"-MG", kStrip},
+    {"-MJ", kStrip},
+    {"-MP", kStrip},
+    {"-MQ", kStrip},
+    {"-MT", kStrip},
+    {"-MV", kStrip},
+    {"--write-dependencies", kStrip},
+    {"--write-user-dependencies", kStrip},
+    {"-dependency-dot", kStrip},
+    {"-dependency-file", kStrip},
+    {"-serialize-diagnostics", kStrip},
+    {"--serialize-diagnostics", kStrip},
+    {"-aux-info", kStrip},
+    {"-dumpbase", kStrip},
+    {"-dumpbase-ext", kStrip},
+    {"-dumpdir", kStrip},
+    {"-save-temps", kStrip},
+    {"-save-temps=", kStrip},
+
+    // Options affecting only the generated code or debug info, with per-build values.
+    {"-frandom-seed=", kStrip},
+    {"-fdebug-prefix-map=", kStrip},
+    {"-ffile-prefix-map=", kStrip},
+    {"-fmacro-prefix-map=", kStrip},
+    {"-fcoverage-prefix-map=", kStrip},
+    {"-fprofile-prefix-map=", kStrip},
+    {"-fdebug-compilation-dir", kStrip},
+    {"-fdebug-compilation-dir=", kStrip},
+    {"-ffile-compilation-dir=", kStrip},
+    {"-fcoverage-compilation-dir=", kStrip},
+    {"-fcrash-diagnostics-dir=", kStrip},
+
+    // Search paths.
+    {"-I", JoinUnique("-I")},
+    {"--include-directory", JoinUnique("-I")},
+    {"--include-directory=", JoinUnique("-I")},
+    {"-iquote", JoinUnique("-iquote")},
+    {"-isystem", JoinUnique("-isystem")},
+    {"-isystem-after", JoinUnique("-isystem-after")},
+    {"-cxx-isystem", JoinUnique("-cxx-isystem")},
+    {"-idirafter", JoinUnique("-idirafter")},
+    {"--include-directory-after", JoinUnique("-idirafter")},
+    {"--include-directory-after=", JoinUnique("-idirafter")},
+    {"-iframework", JoinUnique("-iframework")},
+    {"-F", JoinUnique("-F")},
+    {"-L", JoinUnique("-L")},
+    {"--library-directory", JoinUnique("-L")},
+    {"--library-directory=", JoinUnique("-L")},
+
+    // Other options with a value.
+    {"-D", Join("-D")},
+    {"--define-macro", Join("-D")},
+    {"--define-macro=", Join("-D")},
+    {"-U", Join("-U")},
+    {"--undefine-macro", Join("-U")},
+    {"--undefine-macro=", Join("-U")},
+    {"-include", Join("-include")},
+    {"--include", Join("-include")},
+    {"--include=", Join("-include")},
+    {"-imacros", Join("-imacros")},
+    {"--imacros", Join("-imacros")},
+    {"--imacros=", Join("-imacros")},
+    {"-x", Join("-x")},
+    {"--language", Join("-x")},
+    {"--language=", Join("-x")},
+    {"--std", Join("-std=")},
+    {"--std=", Join("-std=")},
+    {"--stdlib", Join("-stdlib=")},
+    {"--stdlib=", Join("-stdlib=")},
+    {"--sysroot", Join("--sysroot=")},
+    {"-isysroot", Join("-isysroot")},
+    {"-iprefix", Join("-iprefix")},
+    {"-iwithprefix", Join("-iwithprefix")},
+    {"-iwithprefixbefore", Join("-iwithprefixbefore")},
+    {"-iwithsysroot", Join("-iwithsysroot")},
+    {"-ivfsoverlay", Join("-ivfsoverlay")},
+    {"--param", Join("--param=")},
+    {"-resource-dir", Join("-resource-dir=")},
+    {"--rtlib", Join("-rtlib=")},
+    {"--rtlib=", Join("-rtlib=")},
+    {"-B", Join("-B")},
+    {"-l", Join("-l")},
+});
+
+}  // namespace
+
+ArgumentNormalizer::Options ArgumentNormalizer::GetOptionsFromEnvironment() {
+  return Options{
+      .enabled = GetBoolEnv(kNormalizeArgumentsEnvVar, /*default_value=*/true),
+      .strip = GetListEnv(kStripArgumentsEnvVar),
+      .keep = GetListEnv(kKeepArgumentsEnvVar),
+  };
+}
+
+ArgumentNormalizer::ArgumentNormalizer(Options options) : enabled_(options.enabled) {
+  for (auto& element : options.strip) {
+    if (absl::EndsWith(element, "*")) {
+      element.pop_back();
+      strip_prefixes_.emplace_back(std::move(element));
+    } else {
+      strip_.emplace(std::move(element));
+    }
+  }
+  for (auto& spelling : options.keep) {
+    keep_.emplace(std::move(spelling));
+  }
+}
+
+bool ArgumentNormalizer::IsStripped(std::string_view const arg,
+                                    std::string_view const spelling) const {
+  if (strip_.contains(arg) || (!spelling.empty() && strip_.contains(spelling))) {
+    return true;
+  }
+  for (auto const& prefix : strip_prefixes_) {
+    if (absl::StartsWith(arg, prefix)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<std::string> ArgumentNormalizer::Normalize(
+    absl::Span<std::string const> const args) const {
+  if (!enabled_ || args.empty()) {
+    return std::vector<std::string>(args.begin(), args.end());
+  }
+  std::vector<std::string> result;
+  result.reserve(args.size());
+  result.emplace_back(args.front());
+  absl::flat_hash_set<std::string> search_paths;
+  for (size_t i = 1; i < args.size(); ++i) {
+    std::string_view const arg = args[i];
+    if (arg.size() < 2 || arg.front() != '-') {
+      // Input files are never rewritten.
+      if (!IsStripped(arg, /*spelling=*/"")) {
+        result.emplace_back(arg);
+      }
+      continue;
+    }
+    auto const match = MatchDriverOption(args, i);
+    size_t const num_args = match.has_value() ? match->num_args : 1;
+    std::string_view const spelling = match.has_value() ? match->option->spelling : "";
+    if (IsStripped(arg, spelling)) {
+      i += num_args - 1;
+      continue;
+    }
+    Rule const* const rule =
+        match.has_value() && !keep_.contains(spelling) ? kDefaultRules.Find(spelling) : nullptr;
+    if (rule == nullptr) {
+      for (size_t j = 0; j < num_args; ++j) {
+        result.emplace_back(args[i + j]);
+      }
+      i += num_args - 1;
+      continue;
+    }
+    if (rule->action == RuleAction::kStrip) {
+      i += num_args - 1;
+      continue;
+    }
+    if (match->value.empty() && num_args < 2) {
+      // Separate option with a missing value at the end of the command line, or a joined spelling
+      // with an empty value: leave it alone.
+      result.emplace_back(arg);
+      continue;
+    }
+    auto canonical = absl::StrCat(rule->canonical_spelling, match->value);
+    i += num_args - 1;
+    if (rule->dedupe && !search_paths.emplace(canonical).second) {
+      continue;
+    }
+    result.emplace_back(std::move(canonical));
+  }
+  return result;
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,69 @@
+#ifndef __COMP_DB_HOOK_ARGUMENT_NORMALIZER_H__
+#define __COMP_DB_HOOK_ARGUMENT_NORMALIZER_H__
+
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// Rewrites the arguments of a compiler invocation before they are recorded in the compilation
+// database, so that the entries are as small as possible and don't change across rebuilds. The
+// pipeline applies three kinds of rules:
+//
+//   * strip: options that don't matter to Clang-based tools and whose values typically vary from
+//     build to build are removed along with their values (`-o`, `-MD`, `-MF`, `-frandom-seed=`,
+//     `-fdebug-prefix-map=`, etc.);
+//   * canonicalize: options taking a value are rewritten in their canonical joined form, e.g.
+//     `-I foo`, `--include-directory foo` and `--include-directory=foo` all become `-Ifoo`;
+//   * dedupe: repeated search path options (`-I`, `-isystem`, `-iquote`, `-idirafter`, `-L`, ...)
+//     with the same value are dropped, as the compiler ignores them anyway.
+//
+// The default rules are compiled in a perfect hash table keyed by option spelling. Additional
+// options can be stripped and default rules can be disabled at runtime.
+class ArgumentNormalizer {
+ public:
+  struct Options {
+    // Whether to apply the pipeline at all.
+    bool enabled = true;
+
+    // Additional arguments to strip. An element matches an argument if it's equal to either the
+    // argument or the spelling of the option the argument matches (e.g. `-Wl,` matches all
+    // arguments starting with `-Wl,`). A trailing `*` makes the element a prefix match. The values
+    // of stripped options are stripped as well.
+    std::vector<std::string> strip;
+
+    // Spellings of the options whose default rules must not be applied, e.g. `-o` to preserve the
+    // output file.
+    std::vector<std::string> keep;
+  };
+
+  // Reads the options from the environment variables `COMP_DB_HOOK_NORMALIZE_ARGUMENTS` (boolean),
+  // `COMP_DB_HOOK_STRIP_ARGUMENTS` and `COMP_DB_HOOK_KEEP_ARGUMENTS` (comma-separated lists).
+  static Options GetOptionsFromEnvironment();
+
+  explicit ArgumentNormalizer(Options options);
+  ~ArgumentNormalizer() = default;
+
+  ArgumentNormalizer(ArgumentNormalizer&&) noexcept = default;
+  ArgumentNormalizer& operator=(ArgumentNormalizer&&) noexcept = default;
+  ArgumentNormalizer(ArgumentNormalizer const&) = default;
+  ArgumentNormalizer& operator=(ArgumentNormalizer const&) = default;
+
+  // Returns the normalized version of `args`. `args[0]` is the compiler name and is preserved.
+  std::vector<std::string> Normalize(absl::Span<std::string const> args) const;
+
+ private:
+  bool IsStripped(std::string_view arg, std::string_view spelling) const;
+
+  bool enabled_;
+  absl::flat_hash_set<std::string> strip_;
+  std::vector<std::string> strip_prefixes_;
+  absl::flat_hash_set<std::string> keep_;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_ARGUMENT_NORMALIZER_H__
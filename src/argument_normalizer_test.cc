@@ -0,0 +1,64 @@
+#include "src/argument_normalizer.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::ArgumentNormalizer;
+using ::testing::ElementsAre;
+
+std::vector<std::string> Normalize(ArgumentNormalizer::Options options,
+                                   std::vector<std::string> const& args) {
+  return ArgumentNormalizer(std::move(options)).Normalize(args);
+}
+
+TEST(ArgumentNormalizerTest, StripsOutputAndDependencyFiles) {
+  EXPECT_THAT(Normalize({}, {"clang", "-c", "foo.cc", "-o", "foo.o", "-MD", "-MF", "foo.d",
+                             "-frandom-seed=foo.o"}),
+              ElementsAre("clang", "-c", "foo.cc"));
+}
+
+TEST(ArgumentNormalizerTest, CanonicalizesValues) {
+  EXPECT_THAT(Normalize({}, {"clang", "-I", "foo", "--include-directory=bar", "-D", "X=1",
+                             "--std", "c++17", "-x", "c++"}),
+              ElementsAre("clang", "-Ifoo", "-Ibar", "-DX=1", "-std=c++17", "-xc++"));
+}
+
+TEST(ArgumentNormalizerTest, DedupesSearchPaths) {
+  EXPECT_THAT(Normalize({}, {"clang", "-Ifoo", "-I", "foo", "-isystem", "foo", "-isystemfoo",
+                             "-DX", "-DX"}),
+              ElementsAre("clang", "-Ifoo", "-isystemfoo", "-DX", "-DX"));
+}
+
+TEST(ArgumentNormalizerTest, PreservesCompilerAndInputs) {
+  EXPECT_THAT(Normalize({}, {"/usr/bin/clang", "foo.cc", "-", "-Wall"}),
+              ElementsAre("/usr/bin/clang", "foo.cc", "-", "-Wall"));
+}
+
+TEST(ArgumentNormalizerTest, MissingValueIsLeftAlone) {
+  EXPECT_THAT(Normalize({}, {"clang", "foo.cc", "-I"}), ElementsAre("clang", "foo.cc", "-I"));
+}
+
+TEST(ArgumentNormalizerTest, Disabled) {
+  EXPECT_THAT(Normalize({.enabled = false}, {"clang", "-o", "foo.o", "-I", "foo"}),
+              ElementsAre("clang", "-o", "foo.o", "-I", "foo"));
+}
+
+TEST(ArgumentNormalizerTest, StripsAdditionalArguments) {
+  EXPECT_THAT(Normalize({.strip = {"-Wl,", "-fplugin*", "-include", "extra.cc"}},
+                        {"clang", "-Wl,-rpath,foo", "-fplugin=foo.so", "-include", "foo.h",
+                         "foo.cc", "extra.cc", "-Wall"}),
+              ElementsAre("clang", "foo.cc", "-Wall"));
+}
+
+TEST(ArgumentNormalizerTest, KeepsDisabledRules) {
+  EXPECT_THAT(Normalize({.keep = {"-o", "-I"}}, {"clang", "-o", "foo.o", "-I", "foo", "-Ifoo"}),
+              ElementsAre("clang", "-o", "foo.o", "-I", "foo", "-Ifoo"));
+}
+
+}  // namespace
@@ -0,0 +1,86 @@
+#include "src/background_task.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+
+#include "absl/functional/function_ref.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "io/fd.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+void RedirectStandardStreams() {
+  FD const null{::open("/dev/null", O_RDWR | O_CLOEXEC)};  // NOLINT
+  if (null) {
+    ::dup2(null.get(), STDIN_FILENO);
+    ::dup2(null.get(), STDOUT_FILENO);
+    ::dup2(null.get(), STDERR_FILENO);
+  }
+}
+
+// Closes all the file descriptors but the standard ones, e.g. those inherited from the build tool
+// or other descriptors opened without `O_CLOEXEC`, which would otherwise stay open for as long as
+// the task runs.
+void CloseInheritedFileDescriptors() {
+#ifdef SYS_close_range
+  if (::syscall(SYS_close_range, 3, ~0U, 0) == 0) {
+    return;
+  }
+#endif  // SYS_close_range
+  auto const max_fd = ::sysconf(_SC_OPEN_MAX);
+  for (long fd = 3; fd < max_fd; ++fd) {
+    ::close(fd);
+  }
+}
+
+}  // namespace
+
+bool ClaimPendingTask(std::string const& path, int64_t const delay) {
+  FD const fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      path.c_str(), /*flags=*/O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, /*mode=*/0664)};
+  if (fd) {
+    return true;
+  } else if (errno != EEXIST) {
+    return false;
+  }
+  struct stat stat {};
+  if (::stat(path.c_str(), &stat) < 0 ||
+      ::time(nullptr) - stat.st_mtime < delay + kPendingTaskTimeout) {
+    return false;
+  }
+  return ::utimensat(AT_FDCWD, path.c_str(), nullptr, 0) == 0;
+}
+
+bool RunDetached(absl::FunctionRef<int()> const task) {
+  pid_t const pid = ::fork();
+  if (pid < 0) {
+    LOG(WARNING) << absl::ErrnoToStatus(errno, "fork");
+    return false;
+  } else if (pid > 0) {
+    ::waitpid(pid, nullptr, 0);
+    return true;
+  }
+  ::setsid();
+  if (::fork() != 0) {
+    ::_exit(0);
+  }
+  RedirectStandardStreams();
+  CloseInheritedFileDescriptors();
+  ::_exit(task());
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,37 @@
+#ifndef __COMP_DB_HOOK_BACKGROUND_TASK_H__
+#define __COMP_DB_HOOK_BACKGROUND_TASK_H__
+
+#include <cstdint>
+#include <string>
+
+#include "absl/functional/function_ref.h"
+
+namespace comp_db_hook {
+
+// Debounced background tasks, e.g. the concatenation of the shards or the persistence of the staged
+// database: the hook that commits a change claims a pending task with `ClaimPendingTask` and, if it
+// got it, starts it with `RunDetached`. The task waits for the changes to settle and removes its
+// marker right before doing its work, so that changes committed after that schedule a new task and
+// are never left out.
+
+// A pending task marker that hasn't been touched for this many seconds on top of the delay of the
+// task was left behind by a process that died before running it, and is taken over.
+inline int64_t constexpr kPendingTaskTimeout = 60;
+
+// Creates the marker of a pending task at `path`, returning false if there's already one that isn't
+// stale. Tasks that wait longer than `delay` seconds must touch their marker while waiting.
+//
+// A stale marker is touched so that concurrent hooks don't take it over as well. Two hooks may
+// still race there, so the tasks must be serialized by other means, e.g. the database lock.
+bool ClaimPendingTask(std::string const& path, int64_t delay);
+
+// Runs `task` in a detached process and returns right away. The process is double forked so that
+// it's reparented to init and doesn't hold on to the pipes of the build tool, which would otherwise
+// wait for it. Its standard streams are redirected to `/dev/null` and its other file descriptors
+// are closed. It exits with the status returned by `task`. Returns false if the process couldn't be
+// started.
+bool RunDetached(absl::FunctionRef<int()> task);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_BACKGROUND_TASK_H__
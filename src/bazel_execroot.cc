@@ -0,0 +1,243 @@
+#include "src/bazel_execroot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "absl/types/span.h"
+#include "io/fd.h"
+#include "src/config.h"
+#include "src/driver_options.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kRemapExecrootEnvVar = "COMP_DB_HOOK_REMAP_EXECROOT";
+
+std::string_view constexpr kExecrootComponent = "/execroot/";
+std::string_view constexpr kSandboxComponent = "/sandbox/";
+
+// Returns the part of `path` following `root` and a slash, or an empty optional if `path` is not
+// under `root`. Returns an empty string if `path` is `root` itself.
+std::optional<std::string_view> GetPathUnder(std::string_view const root, std::string_view path) {
+  if (!absl::ConsumePrefix(&path, root)) {
+    return std::nullopt;
+  }
+  if (path.empty()) {
+    return path;
+  }
+  if (path.front() != '/') {
+    return std::nullopt;
+  }
+  path.remove_prefix(1);
+  return path;
+}
+
+}  // namespace
+
+std::optional<BazelOutputPaths> DetectBazelOutputPaths(std::string_view const cwd) {
+  auto const execroot_pos = cwd.rfind(kExecrootComponent);
+  if (execroot_pos == std::string_view::npos) {
+    return std::nullopt;
+  }
+  auto const name_begin = execroot_pos + kExecrootComponent.size();
+  auto name_end = cwd.find('/', name_begin);
+  if (name_end == std::string_view::npos) {
+    name_end = cwd.size();
+  }
+  if (name_begin == name_end) {
+    return std::nullopt;
+  }
+  auto const name = cwd.substr(name_begin, name_end - name_begin);
+  auto output_base = cwd.substr(0, execroot_pos);
+  // Sandboxed actions run in `<output_base>/sandbox/<strategy>/<id>/execroot/<name>`.
+  auto const sandbox_pos = output_base.rfind(kSandboxComponent);
+  if (sandbox_pos != std::string_view::npos) {
+    std::vector<std::string_view> const components = absl::StrSplit(
+        output_base.substr(sandbox_pos + kSandboxComponent.size()), '/', absl::SkipEmpty());
+    if (components.size() == 2) {
+      output_base = output_base.substr(0, sandbox_pos);
+    }
+  }
+  if (output_base.empty()) {
+    return std::nullopt;
+  }
+  return BazelOutputPaths{
+      .output_base = std::string(output_base),
+      .execroot = std::string(cwd.substr(0, name_end)),
+      .main_execroot = absl::StrCat(output_base, kExecrootComponent, name),
+  };
+}
+
+std::optional<std::string> ReadBazelWorkspaceDirectory(BazelOutputPaths const& paths) {
+  auto const file_path = absl::StrCat(paths.output_base, "/DO_NOT_BUILD_HERE");
+  FD const fd{::open(file_path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!fd) {
+    return std::nullopt;
+  }
+  char buffer[PATH_MAX + 1];
+  auto const result = ::read(fd.get(), buffer, sizeof(buffer));
+  if (result <= 0) {
+    return std::nullopt;
+  }
+  auto const directory = absl::StripAsciiWhitespace(std::string_view(buffer, result));
+  if (!absl::StartsWith(directory, "/")) {
+    return std::nullopt;
+  }
+  return std::string(directory);
+}
+
+ExecrootPathMapper ExecrootPathMapper::Create(std::string_view const cwd,
+                                              std::string_view const workspace_directory) {
+  if (!GetBoolEnv(kRemapExecrootEnvVar, /*default_value=*/true)) {
+    return ExecrootPathMapper();
+  }
+  auto maybe_paths = DetectBazelOutputPaths(cwd);
+  if (!maybe_paths.has_value() ||
+      GetPathUnder(maybe_paths->execroot, workspace_directory).has_value()) {
+    // Either we're not running under Bazel or the database is kept in the execution root itself.
+    return ExecrootPathMapper();
+  }
+  return ExecrootPathMapper(std::move(maybe_paths).value(), std::string(workspace_directory));
+}
+
+std::optional<std::string> ExecrootPathMapper::MapPath(std::string_view const path) {
+  if (!active()) {
+    return std::nullopt;
+  }
+  if (paths_->execroot != paths_->main_execroot) {
+    // The sandbox is deleted when the action completes, so paths under it are moved to the main
+    // execution root even if they have no workspace counterpart.
+    auto const maybe_relative_path = GetPathUnder(paths_->execroot, path);
+    if (maybe_relative_path.has_value()) {
+      auto const& relative_path = maybe_relative_path.value();
+      return MapPathUnder(paths_->main_execroot, relative_path)
+          .value_or(relative_path.empty()
+                        ? paths_->main_execroot
+                        : absl::StrCat(paths_->main_execroot, "/", relative_path));
+    }
+  }
+  std::string_view const roots[] = {paths_->main_execroot, paths_->output_base};
+  for (std::string_view const root : roots) {
+    auto const maybe_relative_path = GetPathUnder(root, path);
+    if (maybe_relative_path.has_value()) {
+      return MapPathUnder(root, maybe_relative_path.value());
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<std::string> ExecrootPathMapper::MapArguments(
+    absl::Span<std::string const> const args) {
+  if (!active()) {
+    return std::vector<std::string>(args.begin(), args.end());
+  }
+  std::vector<std::string> result;
+  result.reserve(args.size());
+  if (!args.empty()) {
+    result.emplace_back(args[0]);
+  }
+  for (size_t i = 1; i < args.size(); ++i) {
+    auto const& arg = args[i];
+    if (!absl::StartsWith(arg, "-")) {
+      result.emplace_back(MapArgumentPath(arg).value_or(arg));
+      continue;
+    }
+    auto const maybe_match = MatchDriverOption(args, i);
+    if (!maybe_match.has_value() || maybe_match->value.empty()) {
+      result.emplace_back(arg);
+      continue;
+    }
+    auto const maybe_mapped = MapArgumentPath(maybe_match->value);
+    if (maybe_match->num_args > 1) {
+      result.emplace_back(arg);
+      result.emplace_back(maybe_mapped.value_or(args[i + 1]));
+      ++i;
+    } else if (maybe_mapped.has_value()) {
+      auto const spelling_size = arg.size() - maybe_match->value.size();
+      result.emplace_back(absl::StrCat(arg.substr(0, spelling_size), maybe_mapped.value()));
+    } else {
+      result.emplace_back(arg);
+    }
+  }
+  return result;
+}
+
+ExecrootPathMapper::EntryLocation ExecrootPathMapper::LocateEntry(std::string_view const root,
+                                                                  std::string_view const entry) {
+  auto const root_path = absl::StrCat(root, "/", entry);
+  auto const it = memo_.find(root_path);
+  if (it != memo_.end()) {
+    return it->second;
+  }
+  auto const workspace_path = absl::StrCat(workspace_directory_, "/", entry);
+  struct stat root_stat {};
+  struct stat workspace_stat {};
+  EntryLocation location = EntryLocation::kMissing;
+  if (::stat(root_path.c_str(), &root_stat) == 0) {
+    if (::stat(workspace_path.c_str(), &workspace_stat) == 0 &&
+        root_stat.st_dev == workspace_stat.st_dev && root_stat.st_ino == workspace_stat.st_ino) {
+      location = EntryLocation::kWorkspace;
+    } else {
+      location = EntryLocation::kRootOnly;
+    }
+  }
+  memo_.try_emplace(root_path, location);
+  return location;
+}
+
+std::optional<std::string> ExecrootPathMapper::MapPathUnder(std::string_view const root,
+                                                            std::string_view const path) {
+  if (path.empty()) {
+    return std::nullopt;
+  }
+  auto const entry = path.substr(0, path.find('/'));
+  if (LocateEntry(root, entry) == EntryLocation::kWorkspace) {
+    return absl::StrCat(workspace_directory_, "/", path);
+  } else {
+    return std::nullopt;
+  }
+}
+
+std::optional<std::string> ExecrootPathMapper::MapArgumentPath(std::string_view const value) {
+  if (absl::StartsWith(value, "/")) {
+    return MapPath(value);
+  }
+  // Relative paths refer to the execution root. Since the database records the workspace as the
+  // working directory, the ones that don't exist in the workspace (e.g. `external/...`) must be
+  // made absolute. Values without a slash are left alone: they're usually not paths, and if they
+  // are we'd pay a `stat` per argument for little benefit.
+  auto const slash = value.find('/');
+  if (slash == std::string_view::npos || slash == 0) {
+    return std::nullopt;
+  }
+  auto const entry = value.substr(0, slash);
+  if (entry == "." || entry == "..") {
+    return std::nullopt;
+  }
+  if (LocateEntry(paths_->main_execroot, entry) == EntryLocation::kRootOnly) {
+    return absl::StrCat(paths_->main_execroot, "/", value);
+  } else {
+    return std::nullopt;
+  }
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,112 @@
+#ifndef __COMP_DB_HOOK_BAZEL_EXECROOT_H__
+#define __COMP_DB_HOOK_BAZEL_EXECROOT_H__
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// The Bazel directories an action runs in.
+struct BazelOutputPaths {
+  // The output base, e.g. `~/.cache/bazel/_bazel_user/<hash>`.
+  std::string output_base;
+
+  // The execution root the action runs in, e.g. `<output_base>/execroot/_main`. For sandboxed
+  // actions this is the sandbox's execution root.
+  std::string execroot;
+
+  // The execution root shared by all non-sandboxed actions, `<output_base>/execroot/<name>`. Same
+  // as `execroot` for non-sandboxed actions.
+  std::string main_execroot;
+};
+
+// Detects whether `cwd` is a Bazel execution root, sandboxed or not. This is a purely lexical check
+// based on Bazel's directory layout.
+std::optional<BazelOutputPaths> DetectBazelOutputPaths(std::string_view cwd);
+
+// Returns the workspace directory that Bazel records in the `DO_NOT_BUILD_HERE` file of the output
+// base, or an empty optional if the file can't be read.
+std::optional<std::string> ReadBazelWorkspaceDirectory(BazelOutputPaths const& paths);
+
+// Remaps paths under the Bazel execution root (or output base) to the corresponding workspace
+// paths, so that clangd doesn't index the same file once under the workspace and once under the
+// symlink forest Bazel creates in the execution root.
+//
+// A top-level entry of the execution root (e.g. `src` or `bazel-out`) is remapped iff the workspace
+// contains an entry with the same name referring to the same directory, which is the case for
+// source directories and for Bazel's convenience symlinks. Other paths, e.g. the ones of external
+// repositories, are left alone because they don't have a workspace counterpart. The check costs two
+// `stat` calls per top-level entry and is memoized, while the execution root and the output base
+// are detected lexically from the working directory, so setting up the mapping is cheap.
+class ExecrootPathMapper {
+ public:
+  // Returns a mapper for the current process, which is a no-op unless the process runs inside a
+  // Bazel execution root that's not the workspace itself. Remapping can be disabled by setting
+  // `COMP_DB_HOOK_REMAP_EXECROOT` to false.
+  static ExecrootPathMapper Create(std::string_view cwd, std::string_view workspace_directory);
+
+  // Constructs a no-op mapper.
+  explicit ExecrootPathMapper() = default;
+
+  explicit ExecrootPathMapper(BazelOutputPaths paths, std::string workspace_directory)
+      : paths_(std::move(paths)), workspace_directory_(std::move(workspace_directory)) {}
+
+  ~ExecrootPathMapper() = default;
+
+  ExecrootPathMapper(ExecrootPathMapper&&) noexcept = default;
+  ExecrootPathMapper& operator=(ExecrootPathMapper&&) noexcept = default;
+  ExecrootPathMapper(ExecrootPathMapper const&) = delete;
+  ExecrootPathMapper& operator=(ExecrootPathMapper const&) = delete;
+
+  bool active() const { return paths_.has_value(); }
+
+  // The execution root, which relative paths of the compiler invocation refer to. Must only be
+  // called on an active mapper.
+  std::string_view execroot() const { return paths_->execroot; }
+
+  // Returns the workspace path corresponding to the absolute, normalized `path`, or an empty
+  // optional if `path` has no workspace counterpart.
+  std::optional<std::string> MapPath(std::string_view path);
+
+  // Remaps the paths found in the arguments, either as whole arguments or as option values (e.g.
+  // `-I/path` or `-isystem /path`). Absolute paths are remapped like `MapPath` does, and relative
+  // paths referring to entries of the execution root that don't exist in the workspace (e.g.
+  // `external/...`) are made absolute, since the database entries use the workspace as their
+  // working directory.
+  std::vector<std::string> MapArguments(absl::Span<std::string const> args);
+
+ private:
+  enum class EntryLocation : uint8_t {
+    // `<root>/<entry>` doesn't exist.
+    kMissing,
+
+    // `<root>/<entry>` exists but the workspace doesn't have the same entry.
+    kRootOnly,
+
+    // `<root>/<entry>` and `<workspace>/<entry>` are the same file or directory.
+    kWorkspace,
+  };
+
+  EntryLocation LocateEntry(std::string_view root, std::string_view entry);
+
+  std::optional<std::string> MapPathUnder(std::string_view root, std::string_view path);
+
+  std::optional<std::string> MapArgumentPath(std::string_view value);
+
+  std::optional<BazelOutputPaths> paths_;
+  std::string workspace_directory_;
+
+  // Memoized results of `LocateEntry`, keyed by `<root>/<entry>`.
+  absl::flat_hash_map<std::string, EntryLocation> memo_;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_BAZEL_EXECROOT_H__
@@ -0,0 +1,162 @@
+#include "src/bazel_execroot.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::BazelOutputPaths;
+using ::comp_db_hook::DetectBazelOutputPaths;
+using ::comp_db_hook::ExecrootPathMapper;
+using ::testing::ElementsAre;
+
+TEST(DetectBazelOutputPathsTest, NotAnExecroot) {
+  EXPECT_FALSE(DetectBazelOutputPaths("/home/user/workspace").has_value());
+  EXPECT_FALSE(DetectBazelOutputPaths("/base/execroot/").has_value());
+  EXPECT_FALSE(DetectBazelOutputPaths("/execroot/_main").has_value());
+}
+
+TEST(DetectBazelOutputPathsTest, Execroot) {
+  auto const maybe_paths = DetectBazelOutputPaths("/base/execroot/_main");
+  ASSERT_TRUE(maybe_paths.has_value());
+  EXPECT_EQ(maybe_paths->output_base, "/base");
+  EXPECT_EQ(maybe_paths->execroot, "/base/execroot/_main");
+  EXPECT_EQ(maybe_paths->main_execroot, "/base/execroot/_main");
+}
+
+TEST(DetectBazelOutputPathsTest, SubdirectoryOfExecroot) {
+  auto const maybe_paths = DetectBazelOutputPaths("/base/execroot/_main/src/foo");
+  ASSERT_TRUE(maybe_paths.has_value());
+  EXPECT_EQ(maybe_paths->output_base, "/base");
+  EXPECT_EQ(maybe_paths->execroot, "/base/execroot/_main");
+}
+
+TEST(DetectBazelOutputPathsTest, SandboxedExecroot) {
+  auto const maybe_paths =
+      DetectBazelOutputPaths("/base/sandbox/linux-sandbox/42/execroot/_main");
+  ASSERT_TRUE(maybe_paths.has_value());
+  EXPECT_EQ(maybe_paths->output_base, "/base");
+  EXPECT_EQ(maybe_paths->execroot, "/base/sandbox/linux-sandbox/42/execroot/_main");
+  EXPECT_EQ(maybe_paths->main_execroot, "/base/execroot/_main");
+}
+
+class ExecrootPathMapperTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/bazel_execroot_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    char buffer[PATH_MAX + 1];
+    ASSERT_NE(::realpath(directory_.c_str(), buffer), nullptr);
+    directory_ = buffer;
+    // The workspace has a `src` directory, which the execution root links to, while `external`
+    // only exists in the execution root.
+    workspace_ = MakeDirectory("workspace");
+    MakeDirectory("workspace/src");
+    MakeDirectory("base");
+    MakeDirectory("base/execroot");
+    execroot_ = MakeDirectory("base/execroot/_main");
+    MakeSymlink("base/execroot/_main/src", GetPath("workspace/src"));
+    MakeDirectory("base/execroot/_main/external");
+  }
+
+  void TearDown() override {
+    for (auto it = paths_.rbegin(); it != paths_.rend(); ++it) {
+      if (::unlink(it->c_str()) < 0) {
+        ::rmdir(it->c_str());
+      }
+    }
+    ::rmdir(directory_.c_str());
+  }
+
+  std::string GetPath(std::string_view const name) const {
+    return absl::StrCat(directory_, "/", name);
+  }
+
+  std::string MakeDirectory(std::string_view const name) {
+    auto path = GetPath(name);
+    EXPECT_EQ(::mkdir(path.c_str(), 0755), 0);
+    paths_.push_back(path);
+    return path;
+  }
+
+  std::string MakeSymlink(std::string_view const name, std::string const& target) {
+    auto path = GetPath(name);
+    EXPECT_EQ(::symlink(target.c_str(), path.c_str()), 0);
+    paths_.push_back(path);
+    return path;
+  }
+
+  ExecrootPathMapper MakeMapper(std::string const& execroot) const {
+    BazelOutputPaths paths{
+        .output_base = GetPath("base"),
+        .execroot = execroot,
+        .main_execroot = execroot_,
+    };
+    return ExecrootPathMapper(std::move(paths), workspace_);
+  }
+
+  std::string directory_;
+  std::string workspace_;
+  std::string execroot_;
+  std::vector<std::string> paths_;
+};
+
+TEST_F(ExecrootPathMapperTest, Inactive) {
+  ExecrootPathMapper mapper;
+  EXPECT_FALSE(mapper.active());
+  EXPECT_FALSE(mapper.MapPath(absl::StrCat(execroot_, "/src/foo.cc")).has_value());
+  std::vector<std::string> const args{"clang", "-Iexternal/foo", "src/foo.cc"};
+  EXPECT_EQ(mapper.MapArguments(args), args);
+}
+
+TEST_F(ExecrootPathMapperTest, MapsWorkspaceEntries) {
+  auto mapper = MakeMapper(execroot_);
+  EXPECT_EQ(mapper.MapPath(absl::StrCat(execroot_, "/src/foo.cc")),
+            absl::StrCat(workspace_, "/src/foo.cc"));
+  EXPECT_FALSE(mapper.MapPath(absl::StrCat(execroot_, "/external/foo.h")).has_value());
+  EXPECT_FALSE(mapper.MapPath(absl::StrCat(execroot_, "/missing/foo.h")).has_value());
+  EXPECT_FALSE(mapper.MapPath("/usr/include/stdio.h").has_value());
+}
+
+TEST_F(ExecrootPathMapperTest, MovesSandboxedPathsToTheMainExecroot) {
+  auto const sandbox = GetPath("base/sandbox/linux-sandbox/42/execroot/_main");
+  auto mapper = MakeMapper(sandbox);
+  EXPECT_EQ(mapper.MapPath(absl::StrCat(sandbox, "/src/foo.cc")),
+            absl::StrCat(workspace_, "/src/foo.cc"));
+  EXPECT_EQ(mapper.MapPath(absl::StrCat(sandbox, "/external/foo.h")),
+            absl::StrCat(execroot_, "/external/foo.h"));
+  EXPECT_EQ(mapper.MapPath(sandbox), execroot_);
+}
+
+TEST_F(ExecrootPathMapperTest, MapsArguments) {
+  auto mapper = MakeMapper(execroot_);
+  EXPECT_THAT(mapper.MapArguments({
+                  "clang",
+                  absl::StrCat("-I", execroot_, "/src"),
+                  "-isystem",
+                  absl::StrCat(execroot_, "/src/include"),
+                  "-Iexternal/foo",
+                  "-Isrc/bar",
+                  "-DFOO=external/bar",
+                  "-c",
+                  "src/foo.cc",
+              }),
+              ElementsAre("clang", absl::StrCat("-I", workspace_, "/src"), "-isystem",
+                          absl::StrCat(workspace_, "/src/include"),
+                          absl::StrCat("-I", execroot_, "/external/foo"), "-Isrc/bar",
+                          "-DFOO=external/bar", "-c", "src/foo.cc"));
+}
+
+}  // namespace
@@ -0,0 +1,257 @@
+#include "src/change_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/types/span.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "src/file_io.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kAddedName = "added";
+std::string_view constexpr kChangedName = "changed";
+std::string_view constexpr kRemovedName = "removed";
+
+// Writes a temporary file and renames it over `path`, so that readers never see a partial file.
+absl::Status ReplaceFile(std::string const& path, std::string_view const contents) {
+  auto const temp_path = absl::StrCat(path, ".tmp");
+  {
+    FD const fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+        temp_path.c_str(), /*flags=*/O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0664)};
+    if (!fd) {
+      return absl::ErrnoToStatus(errno, "open");
+    }
+    RETURN_IF_ERROR(WriteAll(fd, contents));
+  }
+  if (::rename(temp_path.c_str(), path.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rename");
+  }
+  return absl::OkStatus();
+}
+
+// The generation file contains the generation and the base, separated by a space.
+absl::Status WriteDatabaseGeneration(std::string const& path,
+                                     DatabaseGeneration const& generation) {
+  return ReplaceFile(path, absl::StrCat(generation.generation, " ", generation.base, "\n"));
+}
+
+std::optional<ChangeKind> ParseChangeKind(std::string_view const name) {
+  if (name == kAddedName) {
+    return ChangeKind::kAdded;
+  } else if (name == kChangedName) {
+    return ChangeKind::kChanged;
+  } else if (name == kRemovedName) {
+    return ChangeKind::kRemoved;
+  } else {
+    return std::nullopt;
+  }
+}
+
+// A line of the change log. Each line contains the generation, the kind of the change and the path
+// of the source file, separated by tabs.
+struct LogRecord {
+  std::string_view line;
+  int64_t generation;
+  ChangeKind kind;
+  std::string_view path;
+};
+
+// Parses the change log, skipping malformed lines (e.g. the last one of a log truncated by a
+// crash).
+std::vector<LogRecord> ParseLog(std::string_view const contents) {
+  std::vector<LogRecord> records;
+  for (std::string_view const line : absl::StrSplit(contents, '\n', absl::SkipEmpty())) {
+    std::vector<std::string_view> const fields = absl::StrSplit(line, absl::MaxSplits('\t', 2));
+    int64_t generation = 0;
+    if (fields.size() != 3 || !absl::SimpleAtoi(fields[0], &generation) || fields[2].empty()) {
+      continue;
+    }
+    auto const maybe_kind = ParseChangeKind(fields[1]);
+    if (!maybe_kind.has_value()) {
+      continue;
+    }
+    records.push_back(LogRecord{
+        .line = line,
+        .generation = generation,
+        .kind = maybe_kind.value(),
+        .path = fields[2],
+    });
+  }
+  return records;
+}
+
+// Rewrites the log at `path` keeping only the most recent generations, up to half of
+// `kMaxChangeLogSize` so that compactions are infrequent. Generations are never split. Returns the
+// new base, i.e. the generation after which all changes are still in the log.
+absl::StatusOr<int64_t> CompactLog(std::string const& path, int64_t const generation) {
+  DEFINE_CONST_OR_RETURN(maybe_contents, ReadFile(path));
+  // The records refer to the contents, so they must not be parsed out of a temporary.
+  auto const records =
+      maybe_contents.has_value() ? ParseLog(maybe_contents.value()) : std::vector<LogRecord>();
+  size_t begin = records.size();
+  size_t retained_size = 0;
+  while (begin > 0) {
+    auto const last_generation = records[begin - 1].generation;
+    size_t generation_begin = begin;
+    size_t generation_size = 0;
+    while (generation_begin > 0 && records[generation_begin - 1].generation == last_generation) {
+      --generation_begin;
+      generation_size += records[generation_begin].line.size() + 1;
+    }
+    if (retained_size + generation_size > kMaxChangeLogSize / 2) {
+      break;
+    }
+    retained_size += generation_size;
+    begin = generation_begin;
+  }
+  std::string contents;
+  contents.reserve(retained_size);
+  for (size_t i = begin; i < records.size(); ++i) {
+    absl::StrAppend(&contents, records[i].line, "\n");
+  }
+  RETURN_IF_ERROR(ReplaceFile(path, contents));
+  return begin < records.size() ? records[begin].generation - 1 : generation;
+}
+
+}  // namespace
+
+std::string_view GetChangeKindName(ChangeKind const kind) {
+  switch (kind) {
+    case ChangeKind::kAdded:
+      return kAddedName;
+    case ChangeKind::kChanged:
+      return kChangedName;
+    case ChangeKind::kRemoved:
+      return kRemovedName;
+  }
+  return "";
+}
+
+absl::StatusOr<DatabaseGeneration> ReadDatabaseGeneration(std::string const& path) {
+  DEFINE_CONST_OR_RETURN(maybe_contents, ReadFile(path));
+  DatabaseGeneration generation;
+  if (!maybe_contents.has_value()) {
+    return generation;
+  }
+  std::vector<std::string_view> const fields =
+      absl::StrSplit(maybe_contents.value(), absl::ByAnyChar(" \n"), absl::SkipEmpty());
+  if (fields.size() != 2 || !absl::SimpleAtoi(fields[0], &generation.generation) ||
+      !absl::SimpleAtoi(fields[1], &generation.base)) {
+    return absl::DataLossError(absl::StrCat("malformed generation file \"", path, "\""));
+  }
+  return generation;
+}
+
+absl::StatusOr<int64_t> CommitChanges(std::string const& generation_path,
+                                      std::string const& log_path,
+                                      absl::Span<Change const> const changes) {
+  DEFINE_VAR_OR_RETURN(generation, ReadDatabaseGeneration(generation_path));
+  ++generation.generation;
+  std::string records;
+  bool untracked = false;
+  for (auto const& change : changes) {
+    if (change.path.find('\n') != std::string::npos) {
+      // The log is line-based, so this change can't be recorded. Rather than dropping it, the log
+      // is cut off at this generation as by `ResetChanges`, so that consumers read the whole
+      // database again.
+      untracked = true;
+      break;
+    }
+    absl::StrAppend(&records, generation.generation, "\t", GetChangeKindName(change.kind), "\t",
+                    change.path, "\n");
+  }
+  if (untracked) {
+    generation.base = generation.generation;
+  } else if (!records.empty()) {
+    FD const fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+        log_path.c_str(), /*flags=*/O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, /*mode=*/0664)};
+    if (!fd) {
+      return absl::ErrnoToStatus(errno, "open");
+    }
+    RETURN_IF_ERROR(WriteAll(fd, records));
+    struct stat stat {};
+    if (::fstat(fd.get(), &stat) < 0) {
+      return absl::ErrnoToStatus(errno, "fstat");
+    }
+    if (static_cast<size_t>(stat.st_size) > kMaxChangeLogSize) {
+      DEFINE_CONST_OR_RETURN(base, CompactLog(log_path, generation.generation));
+      generation.base = std::max(generation.base, base);
+    }
+  }
+  RETURN_IF_ERROR(WriteDatabaseGeneration(generation_path, generation));
+  return generation.generation;
+}
+
+absl::StatusOr<int64_t> ResetChanges(std::string const& generation_path,
+                                     std::string const& log_path) {
+  DEFINE_VAR_OR_RETURN(generation, ReadDatabaseGeneration(generation_path));
+  ++generation.generation;
+  generation.base = generation.generation;
+  RETURN_IF_ERROR(ReplaceFile(log_path, ""));
+  RETURN_IF_ERROR(WriteDatabaseGeneration(generation_path, generation));
+  return generation.generation;
+}
+
+absl::StatusOr<ChangesSince> ReadChangesSince(std::string const& generation_path,
+                                              std::string const& log_path, int64_t const since) {
+  DEFINE_CONST_OR_RETURN(generation, ReadDatabaseGeneration(generation_path));
+  ChangesSince result{.generation = generation.generation};
+  if (since < generation.base || since > generation.generation) {
+    return result;
+  }
+  result.complete = true;
+  DEFINE_CONST_OR_RETURN(maybe_contents, ReadFile(log_path));
+  if (!maybe_contents.has_value()) {
+    return result;
+  }
+  // The first and the last change of each file.
+  std::map<std::string_view, std::pair<ChangeKind, ChangeKind>> net_changes;
+  for (auto const& record : ParseLog(maybe_contents.value())) {
+    if (record.generation <= since || record.generation > generation.generation) {
+      continue;
+    }
+    auto const it =
+        net_changes.try_emplace(record.path, std::make_pair(record.kind, record.kind)).first;
+    it->second.second = record.kind;
+  }
+  for (auto const& [path, kinds] : net_changes) {
+    auto const [first, last] = kinds;
+    auto kind = last;
+    if (first == ChangeKind::kAdded) {
+      if (last == ChangeKind::kRemoved) {
+        continue;
+      }
+      kind = ChangeKind::kAdded;
+    } else if (first == ChangeKind::kRemoved && last != ChangeKind::kRemoved) {
+      kind = ChangeKind::kChanged;
+    }
+    result.changes.push_back(Change{.kind = kind, .path = std::string(path)});
+  }
+  return result;
+}
+
+}  // namespace comp_db_hook
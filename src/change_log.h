@@ -0,0 +1,84 @@
+#ifndef __COMP_DB_HOOK_CHANGE_LOG_H__
+#define __COMP_DB_HOOK_CHANGE_LOG_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// The change log is compacted when it grows larger than this, dropping the oldest generations.
+inline size_t constexpr kMaxChangeLogSize = 1 << 20;
+
+enum class ChangeKind { kAdded, kChanged, kRemoved };
+
+// Returns `added`, `changed` or `removed`.
+std::string_view GetChangeKindName(ChangeKind kind);
+
+// A change to the entry of a source file.
+struct Change {
+  ChangeKind kind;
+
+  // Normalized absolute path of the source file (see `GetEntryPath`).
+  std::string path;
+};
+
+// The generation of the compilation database, stored in the `.compile_commands.json.generation`
+// sidecar file, is bumped by every write that changes the entries. The changes of each generation
+// are appended to the `.compile_commands.json.changes` log, so that consumers can find out what
+// changed since the generation they last saw without reading the whole database.
+struct DatabaseGeneration {
+  int64_t generation = 0;
+
+  // The oldest generation whose changes are fully logged: "what changed since G" can only be
+  // answered for G >= `base`. It advances when the log is compacted or when the database is
+  // rewritten in a way that isn't tracked (e.g. by a merge).
+  int64_t base = 0;
+};
+
+// Reads the generation file at `path`. Returns generation 0 if the file doesn't exist.
+absl::StatusOr<DatabaseGeneration> ReadDatabaseGeneration(std::string const& path);
+
+// Bumps the generation in the file at `generation_path` and appends `changes` to the log at
+// `log_path`, compacting it if it exceeds `kMaxChangeLogSize`. Returns the new generation. If the
+// path of a change contains a newline, which the log can't represent, the changes aren't logged and
+// the base advances to the new generation instead.
+//
+// The caller must hold the database lock.
+absl::StatusOr<int64_t> CommitChanges(std::string const& generation_path,
+                                      std::string const& log_path,
+                                      absl::Span<Change const> changes);
+
+// Bumps the generation and clears the log, for writes whose changes aren't tracked. Consumers then
+// have to read the whole database. Returns the new generation.
+//
+// The caller must hold the database lock.
+absl::StatusOr<int64_t> ResetChanges(std::string const& generation_path,
+                                     std::string const& log_path);
+
+struct ChangesSince {
+  // The current generation.
+  int64_t generation = 0;
+
+  // False if the changes since the requested generation are no longer (or were never) logged, in
+  // which case `changes` is empty and the whole database must be read again.
+  bool complete = false;
+
+  // The net change of each source file that changed, sorted by path. E.g. a file that was added and
+  // then changed is reported as added, and one that was added and then removed isn't reported.
+  std::vector<Change> changes;
+};
+
+// Returns the changes since generation `since`. The caller must hold the database lock.
+absl::StatusOr<ChangesSince> ReadChangesSince(std::string const& generation_path,
+                                              std::string const& log_path, int64_t since);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_CHANGE_LOG_H__
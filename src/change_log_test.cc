@@ -0,0 +1,230 @@
+#include "src/change_log.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/file_io.h"
+
+namespace {
+
+using ::comp_db_hook::Change;
+using ::comp_db_hook::ChangeKind;
+using ::comp_db_hook::ChangesSince;
+using ::comp_db_hook::CommitChanges;
+using ::comp_db_hook::DatabaseGeneration;
+using ::comp_db_hook::kMaxChangeLogSize;
+using ::comp_db_hook::ReadChangesSince;
+using ::comp_db_hook::ReadDatabaseGeneration;
+using ::comp_db_hook::ResetChanges;
+using ::testing::Contains;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Not;
+using ::tsdb2::io::FD;
+
+std::vector<std::string> Describe(std::vector<Change> const& changes) {
+  std::vector<std::string> descriptions;
+  descriptions.reserve(changes.size());
+  for (auto const& change : changes) {
+    descriptions.push_back(
+        absl::StrCat(comp_db_hook::GetChangeKindName(change.kind), " ", change.path));
+  }
+  return descriptions;
+}
+
+class ChangeLogTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/change_log_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    generation_path_ = absl::StrCat(directory_, "/.compile_commands.json.generation");
+    log_path_ = absl::StrCat(directory_, "/.compile_commands.json.changes");
+  }
+
+  void TearDown() override {
+    ::unlink(generation_path_.c_str());
+    ::unlink(log_path_.c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  int64_t Commit(absl::Span<Change const> const changes) {
+    auto const status_or_generation = CommitChanges(generation_path_, log_path_, changes);
+    EXPECT_TRUE(status_or_generation.ok()) << status_or_generation.status();
+    return status_or_generation.value_or(-1);
+  }
+
+  DatabaseGeneration ReadGeneration() const {
+    auto const status_or_generation = ReadDatabaseGeneration(generation_path_);
+    EXPECT_TRUE(status_or_generation.ok()) << status_or_generation.status();
+    return status_or_generation.value_or(DatabaseGeneration{.generation = -1, .base = -1});
+  }
+
+  ChangesSince ReadSince(int64_t const since) const {
+    auto status_or_changes = ReadChangesSince(generation_path_, log_path_, since);
+    EXPECT_TRUE(status_or_changes.ok()) << status_or_changes.status();
+    return std::move(status_or_changes).value_or(ChangesSince{});
+  }
+
+  std::string ReadLog() const {
+    auto status_or_contents = comp_db_hook::ReadFile(log_path_);
+    EXPECT_TRUE(status_or_contents.ok()) << status_or_contents.status();
+    return std::move(status_or_contents).value_or(std::nullopt).value_or("");
+  }
+
+  std::string directory_;
+  std::string generation_path_;
+  std::string log_path_;
+};
+
+TEST_F(ChangeLogTest, Initial) {
+  auto const generation = ReadGeneration();
+  EXPECT_EQ(generation.generation, 0);
+  EXPECT_EQ(generation.base, 0);
+  auto const changes = ReadSince(0);
+  EXPECT_EQ(changes.generation, 0);
+  EXPECT_TRUE(changes.complete);
+  EXPECT_THAT(changes.changes, IsEmpty());
+}
+
+TEST_F(ChangeLogTest, CommitChanges) {
+  EXPECT_EQ(Commit({{ChangeKind::kAdded, "/w/b.cc"}, {ChangeKind::kAdded, "/w/a.cc"}}), 1);
+  EXPECT_EQ(Commit({{ChangeKind::kChanged, "/w/c.cc"}}), 2);
+  EXPECT_EQ(Commit({}), 3);
+  auto const generation = ReadGeneration();
+  EXPECT_EQ(generation.generation, 3);
+  EXPECT_EQ(generation.base, 0);
+  EXPECT_EQ(ReadLog(), "1\tadded\t/w/b.cc\n1\tadded\t/w/a.cc\n2\tchanged\t/w/c.cc\n");
+  auto const changes = ReadSince(0);
+  EXPECT_EQ(changes.generation, 3);
+  EXPECT_TRUE(changes.complete);
+  EXPECT_THAT(Describe(changes.changes),
+              ElementsAre("added /w/a.cc", "added /w/b.cc", "changed /w/c.cc"));
+  EXPECT_THAT(Describe(ReadSince(1).changes), ElementsAre("changed /w/c.cc"));
+  EXPECT_THAT(ReadSince(2).changes, IsEmpty());
+  EXPECT_TRUE(ReadSince(3).complete);
+  EXPECT_THAT(ReadSince(3).changes, IsEmpty());
+}
+
+TEST_F(ChangeLogTest, FoldsChangesOfTheSameFile) {
+  Commit({
+      {ChangeKind::kAdded, "/w/added_removed.cc"},
+      {ChangeKind::kRemoved, "/w/removed_added.cc"},
+      {ChangeKind::kAdded, "/w/added_changed.cc"},
+      {ChangeKind::kChanged, "/w/changed_removed.cc"},
+      {ChangeKind::kRemoved, "/w/removed_added_removed.cc"},
+  });
+  Commit({
+      {ChangeKind::kRemoved, "/w/added_removed.cc"},
+      {ChangeKind::kAdded, "/w/removed_added.cc"},
+      {ChangeKind::kChanged, "/w/added_changed.cc"},
+      {ChangeKind::kRemoved, "/w/changed_removed.cc"},
+      {ChangeKind::kAdded, "/w/removed_added_removed.cc"},
+  });
+  Commit({{ChangeKind::kRemoved, "/w/removed_added_removed.cc"}});
+  EXPECT_THAT(Describe(ReadSince(0).changes),
+              ElementsAre("added /w/added_changed.cc", "removed /w/changed_removed.cc",
+                          "changed /w/removed_added.cc", "removed /w/removed_added_removed.cc"));
+  // Only the changes after the requested generation are folded.
+  EXPECT_THAT(Describe(ReadSince(1).changes),
+              ElementsAre("changed /w/added_changed.cc", "removed /w/added_removed.cc",
+                          "removed /w/changed_removed.cc", "added /w/removed_added.cc"));
+}
+
+TEST_F(ChangeLogTest, FutureGenerationIsIncomplete) {
+  Commit({{ChangeKind::kAdded, "/w/a.cc"}});
+  auto const changes = ReadSince(2);
+  EXPECT_EQ(changes.generation, 1);
+  EXPECT_FALSE(changes.complete);
+  EXPECT_THAT(changes.changes, IsEmpty());
+}
+
+TEST_F(ChangeLogTest, SkipsMalformedLines) {
+  Commit({{ChangeKind::kAdded, "/w/a.cc"}});
+  FD const fd{::open(log_path_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC)};
+  ASSERT_TRUE(fd);
+  ASSERT_TRUE(
+      comp_db_hook::WriteAll(fd, "1\tmoved\t/w/b.cc\nx\tadded\t/w/c.cc\n1\tadded\t\n1\tadd").ok());
+  EXPECT_THAT(Describe(ReadSince(0).changes), ElementsAre("added /w/a.cc"));
+}
+
+TEST_F(ChangeLogTest, ResetChanges) {
+  Commit({{ChangeKind::kAdded, "/w/a.cc"}});
+  auto const status_or_generation = ResetChanges(generation_path_, log_path_);
+  ASSERT_TRUE(status_or_generation.ok()) << status_or_generation.status();
+  EXPECT_EQ(status_or_generation.value(), 2);
+  auto const generation = ReadGeneration();
+  EXPECT_EQ(generation.generation, 2);
+  EXPECT_EQ(generation.base, 2);
+  EXPECT_EQ(ReadLog(), "");
+  EXPECT_FALSE(ReadSince(0).complete);
+  EXPECT_FALSE(ReadSince(1).complete);
+  EXPECT_TRUE(ReadSince(2).complete);
+  Commit({{ChangeKind::kChanged, "/w/a.cc"}});
+  EXPECT_THAT(Describe(ReadSince(2).changes), ElementsAre("changed /w/a.cc"));
+}
+
+TEST_F(ChangeLogTest, NewlineInPathCutsOffTheLog) {
+  Commit({{ChangeKind::kAdded, "/w/a.cc"}});
+  EXPECT_EQ(Commit({{ChangeKind::kAdded, "/w/b.cc"}, {ChangeKind::kAdded, "/w/c\nd.cc"}}), 2);
+  auto const generation = ReadGeneration();
+  EXPECT_EQ(generation.generation, 2);
+  EXPECT_EQ(generation.base, 2);
+  // Nothing of the generation is logged, not even the changes before the one with the newline.
+  EXPECT_EQ(ReadLog(), "1\tadded\t/w/a.cc\n");
+  EXPECT_FALSE(ReadSince(0).complete);
+  EXPECT_FALSE(ReadSince(1).complete);
+  auto const changes = ReadSince(2);
+  EXPECT_TRUE(changes.complete);
+  EXPECT_THAT(changes.changes, IsEmpty());
+  Commit({{ChangeKind::kRemoved, "/w/a.cc"}});
+  EXPECT_THAT(Describe(ReadSince(2).changes), ElementsAre("removed /w/a.cc"));
+}
+
+TEST_F(ChangeLogTest, Compaction) {
+  std::string const suffix(1000, 'x');
+  auto const get_path = [&](int64_t const generation) {
+    return absl::StrCat("/w/", generation, "/", suffix, ".cc");
+  };
+  DatabaseGeneration generation;
+  // Every generation takes about 1KB of log, so the log is compacted after about 1000 of them.
+  for (int64_t i = 1; generation.base == 0 && i < 2000; ++i) {
+    Commit({{ChangeKind::kAdded, get_path(i)}});
+    generation = ReadGeneration();
+  }
+  ASSERT_GT(generation.base, 0);
+  ASSERT_LT(generation.base, generation.generation);
+  auto const log = ReadLog();
+  EXPECT_LE(log.size(), kMaxChangeLogSize / 2);
+  // The base is the generation right before the oldest one left in the log.
+  int64_t first_generation = 0;
+  ASSERT_TRUE(absl::SimpleAtoi(std::string_view(log).substr(0, log.find('\t')), &first_generation));
+  EXPECT_EQ(first_generation, generation.base + 1);
+  EXPECT_FALSE(ReadSince(generation.base - 1).complete);
+  auto const changes = ReadSince(generation.base);
+  EXPECT_TRUE(changes.complete);
+  EXPECT_EQ(changes.changes.size(), static_cast<size_t>(generation.generation - generation.base));
+  std::vector<std::string> paths;
+  for (auto const& change : changes.changes) {
+    paths.push_back(change.path);
+  }
+  EXPECT_THAT(paths, Contains(get_path(generation.base + 1)));
+  EXPECT_THAT(paths, Not(Contains(get_path(generation.base))));
+}
+
+}  // namespace
@@ -0,0 +1,209 @@
+#include "src/command_database.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "common/env.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/bazel_execroot.h"
+#include "src/entry_scanner.h"
+#include "src/file_io.h"
+#include "src/path_canonicalizer.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+namespace json = ::tsdb2::json;
+
+std::string_view constexpr kWorkspaceDirEnvVar = "COMP_DB_HOOK_WORKSPACE_DIR";
+std::string_view constexpr kStagingDirEnvVar = "COMP_DB_HOOK_STAGING_DIR";
+
+std::string_view constexpr kCommandFileName = "compile_commands.json";
+
+bool IsBlank(std::string_view const text) {
+  return text.find_first_not_of(" \t\n\r") == std::string_view::npos;
+}
+
+}  // namespace
+
+std::string JoinPath(std::string_view const base_directory, std::string_view const file_name) {
+  if (base_directory.empty() || absl::StartsWith(file_name, "/")) {
+    return std::string(file_name);
+  } else if (absl::EndsWith(base_directory, "/")) {
+    return absl::StrCat(base_directory, file_name);
+  } else {
+    return absl::StrCat(base_directory, "/", file_name);
+  }
+}
+
+absl::StatusOr<std::string> GetCurrentDirectory() {
+  char buffer[PATH_MAX + 1];
+  if (::getcwd(buffer, PATH_MAX) != nullptr) {
+    return std::string(buffer);
+  } else {
+    return absl::ErrnoToStatus(errno, "getcwd");
+  }
+}
+
+absl::StatusOr<std::string> GetWorkspaceDirectory() {
+  auto maybe_directory = tsdb2::common::GetEnv(std::string(kWorkspaceDirEnvVar));
+  if (maybe_directory.has_value()) {
+    return std::move(maybe_directory).value();
+  }
+  DEFINE_VAR_OR_RETURN(cwd, GetCurrentDirectory());
+  // When running in a Bazel execution root the workspace can be found in the output base.
+  auto const maybe_bazel_paths = DetectBazelOutputPaths(cwd);
+  if (maybe_bazel_paths.has_value()) {
+    auto maybe_workspace = ReadBazelWorkspaceDirectory(maybe_bazel_paths.value());
+    if (maybe_workspace.has_value()) {
+      return std::move(maybe_workspace).value();
+    }
+  }
+  return cwd;
+}
+
+uint64_t FingerprintPath(std::string_view const path) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (char const ch : path) {
+    hash ^= static_cast<uint8_t>(ch);
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+bool IsStagingEnabled() {
+  auto const maybe_directory = tsdb2::common::GetEnv(std::string(kStagingDirEnvVar));
+  return maybe_directory.has_value() && !maybe_directory->empty();
+}
+
+std::optional<std::string> GetStagingDirectory(std::string_view const workspace_directory) {
+  auto const maybe_directory = tsdb2::common::GetEnv(std::string(kStagingDirEnvVar));
+  if (!maybe_directory.has_value() || maybe_directory->empty()) {
+    return std::nullopt;
+  }
+  auto const fingerprint = FingerprintPath(NormalizePath(workspace_directory));
+  return JoinPath(maybe_directory.value(),
+                  absl::StrCat("comp_db_hook.", absl::Hex(fingerprint, absl::kZeroPad16)));
+}
+
+absl::StatusOr<std::string> GetDatabaseDirectory() {
+  DEFINE_CONST_OR_RETURN(workspace_directory, GetWorkspaceDirectory());
+  return GetDatabaseDirectory(workspace_directory);
+}
+
+std::string GetDatabaseDirectory(std::string_view const directory) {
+  auto maybe_staging_directory = GetStagingDirectory(directory);
+  if (maybe_staging_directory.has_value()) {
+    struct stat stat {};
+    if (::stat(GetCommandFilePath(maybe_staging_directory.value()).c_str(), &stat) == 0) {
+      return std::move(maybe_staging_directory).value();
+    }
+  }
+  return std::string(directory);
+}
+
+absl::StatusOr<std::string> GetCommandFilePath() {
+  DEFINE_CONST_OR_RETURN(database_directory, GetDatabaseDirectory());
+  return GetCommandFilePath(database_directory);
+}
+
+std::string GetCommandFilePath(std::string_view const database_directory) {
+  return JoinPath(database_directory, kCommandFileName);
+}
+
+absl::StatusOr<std::string> GetSidecarFilePath(std::string_view const kind) {
+  DEFINE_CONST_OR_RETURN(database_directory, GetDatabaseDirectory());
+  return GetSidecarFilePath(database_directory, kind);
+}
+
+std::string GetSidecarFilePath(std::string_view const database_directory,
+                               std::string_view const kind) {
+  return JoinPath(database_directory, absl::StrCat(".", kCommandFileName, ".", kind));
+}
+
+absl::StatusOr<FD> OpenCommandFile() {
+  DEFINE_CONST_OR_RETURN(database_directory, GetDatabaseDirectory());
+  return OpenCommandFile(database_directory);
+}
+
+absl::StatusOr<FD> OpenCommandFile(std::string_view const database_directory) {
+  auto const file_path = GetCommandFilePath(database_directory);
+  FD fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      file_path.c_str(), /*flags=*/O_CREAT | O_CLOEXEC | O_RDWR, /*mode=*/0664)};
+  if (fd) {
+    return std::move(fd);
+  } else {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+}
+
+CommandEntries SalvageCommandEntries(std::string_view const text) {
+  CommandEntries entries;
+  EntryScanner scanner{text};
+  for (auto maybe_entry = scanner.Next(); maybe_entry.has_value(); maybe_entry = scanner.Next()) {
+    auto status_or_entry = json::Parse<CommandEntry>(maybe_entry.value());
+    if (status_or_entry.ok()) {
+      entries.emplace_back(std::move(status_or_entry).value());
+    } else {
+      LOG(WARNING) << "Dropping malformed entry at offset " << scanner.entry_offset() << ": "
+                   << status_or_entry.status();
+      scanner.Resync();
+    }
+  }
+  LOG(WARNING) << "Recovered " << entries.size() << " entries from compile_commands.json, dropped "
+               << scanner.num_dropped() << " malformed regions.";
+  return entries;
+}
+
+CommandEntries ParseCommandEntries(std::string_view const text) {
+  if (IsBlank(text)) {
+    return CommandEntries();
+  }
+  auto status_or_entries = json::Parse<CommandEntries>(text);
+  if (status_or_entries.ok()) {
+    return std::move(status_or_entries).value();
+  }
+  LOG(ERROR) << "Failed to parse compile_commands.json: " << status_or_entries.status()
+             << ". Salvaging well-formed entries.";
+  return SalvageCommandEntries(text);
+}
+
+absl::StatusOr<CommandEntries> ParseCommandFile(FD const& fd) {
+  DEFINE_CONST_OR_RETURN(contents, ReadFile(fd));
+  return ParseCommandEntries(contents);
+}
+
+std::optional<std::string> GetEntryPath(CommandEntry const& entry,
+                                        std::string_view const default_directory) {
+  auto const& maybe_file_path = entry.get<kFileField>();
+  if (!maybe_file_path.has_value()) {
+    return std::nullopt;
+  }
+  auto const& maybe_directory = entry.get<kDirectoryField>();
+  return NormalizePath(JoinPath(
+      maybe_directory.has_value() ? std::string_view(*maybe_directory) : default_directory,
+      maybe_file_path.value()));
+}
+
+}  // namespace comp_db_hook
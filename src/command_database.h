@@ -0,0 +1,109 @@
+#ifndef __COMP_DB_HOOK_COMMAND_DATABASE_H__
+#define __COMP_DB_HOOK_COMMAND_DATABASE_H__
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+#include "json/json.h"
+
+namespace comp_db_hook {
+
+inline char constexpr kDirectoryField[] = "directory";
+inline char constexpr kArgumentsField[] = "arguments";
+inline char constexpr kFileField[] = "file";
+
+// See https://clang.llvm.org/docs/JSONCompilationDatabase.html for the format specification.
+//
+// NOTE: none of these fields are actually optional in our format, but we don't want to fail the
+// entire run if for any reason we can't find one or more of them for one or more entries.
+using CommandEntry = tsdb2::json::Object<
+    tsdb2::json::Field<std::optional<std::string>, kDirectoryField>,
+    tsdb2::json::Field<std::optional<std::vector<std::string>>, kArgumentsField>,
+    tsdb2::json::Field<std::optional<std::string>, kFileField>>;
+
+using CommandEntries = std::vector<CommandEntry>;
+
+// Joins `file_name` to `base_directory` unless `file_name` is absolute.
+std::string JoinPath(std::string_view base_directory, std::string_view file_name);
+
+absl::StatusOr<std::string> GetCurrentDirectory();
+
+// Returns the directory where the compilation database is stored. That's the
+// `COMP_DB_HOOK_WORKSPACE_DIR` environment variable if set, otherwise the Bazel workspace if we're
+// running in a Bazel execution root, otherwise the current working directory.
+absl::StatusOr<std::string> GetWorkspaceDirectory();
+
+// Returns a 64-bit fingerprint of `path` (FNV-1a). Unlike `std::hash` and `absl::Hash` it's stable
+// across processes and builds of comp_db_hook, so it can be used to name files.
+uint64_t FingerprintPath(std::string_view path);
+
+// Tells whether the `COMP_DB_HOOK_STAGING_DIR` environment variable enables the staging of the
+// workspace database in memory during builds (see `StageDatabase`).
+bool IsStagingEnabled();
+
+// Returns the directory where the database of the workspace is staged, or an empty optional if
+// staging is disabled. That's a directory named after the fingerprint of the workspace path in the
+// one configured in `COMP_DB_HOOK_STAGING_DIR`, e.g. `/dev/shm`.
+std::optional<std::string> GetStagingDirectory(std::string_view workspace_directory);
+
+// Returns the directory of the live database of the workspace: the staging directory while the
+// database is staged, otherwise the workspace directory.
+absl::StatusOr<std::string> GetDatabaseDirectory();
+
+// Returns the directory of the live database of `directory`, which is the workspace directory or a
+// package root (see `PackageRoots`): its staging directory while the database is staged, otherwise
+// `directory` itself.
+std::string GetDatabaseDirectory(std::string_view directory);
+
+// Returns the path of the `compile_commands.json` file of the live database of the workspace (see
+// `GetDatabaseDirectory`).
+absl::StatusOr<std::string> GetCommandFilePath();
+
+// Returns the path of the `compile_commands.json` file in `database_directory`, which is the
+// workspace directory or a package root (see `PackageRoots`).
+std::string GetCommandFilePath(std::string_view database_directory);
+
+// Returns the path of a file storing auxiliary data of the live database of the workspace, e.g.
+// `.compile_commands.json.paths` for `kind` = `paths`.
+absl::StatusOr<std::string> GetSidecarFilePath(std::string_view kind);
+
+// Returns the path of a file storing auxiliary data of the compilation database in
+// `database_directory`.
+std::string GetSidecarFilePath(std::string_view database_directory, std::string_view kind);
+
+// Opens the live database of the workspace for reading and writing, creating it if it doesn't
+// exist. The caller is responsible for locking.
+absl::StatusOr<tsdb2::io::FD> OpenCommandFile();
+
+// Opens the compilation database in `database_directory` like `OpenCommandFile`.
+absl::StatusOr<tsdb2::io::FD> OpenCommandFile(std::string_view database_directory);
+
+// Parses the entries of a compilation database, skipping the malformed ones. An empty (or blank)
+// text is a valid, empty database.
+CommandEntries ParseCommandEntries(std::string_view text);
+
+// Parses the entries of a corrupt compilation database, e.g. one truncated by a crash or written
+// by a tool that didn't take the lock, resynchronizing at entry boundaries so that every
+// well-formed entry is kept. What was dropped is logged. `ParseCommandEntries` falls back to this
+// when the whole text can't be parsed.
+CommandEntries SalvageCommandEntries(std::string_view text);
+
+// Reads all entries of the compilation database from the current offset of `fd`, skipping the
+// malformed ones.
+absl::StatusOr<CommandEntries> ParseCommandFile(tsdb2::io::FD const& fd);
+
+// Returns the lexically normalized absolute path of the source file of `entry`, using
+// `default_directory` if the entry has no `directory` field. Returns an empty optional if the entry
+// has no `file` field.
+std::optional<std::string> GetEntryPath(CommandEntry const& entry,
+                                        std::string_view default_directory);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_COMMAND_DATABASE_H__
@@ -1,10 +1,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
-#include <linux/limits.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
+#include <map>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -17,6 +22,7 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/types/span.h"
 #include "common/env.h"
@@ -25,9 +31,60 @@
 #include "io/advisory_file_lock.h"
 #include "io/fd.h"
 #include "json/json.h"
+#include "src/argument_normalizer.h"
+#include "src/bazel_execroot.h"
+#include "src/change_log.h"
+#include "src/command_database.h"
+#include "src/config.h"
+#include "src/configuration_policy.h"
+#include "src/database_merger.h"
+#include "src/database_query.h"
+#include "src/entry_index.h"
+#include "src/entry_scanner.h"
+#include "src/entry_writer.h"
+#include "src/garbage_collector.h"
+#include "src/invocation.h"
+#include "src/last_seen.h"
+#include "src/mapped_file.h"
+#include "src/package_roots.h"
+#include "src/path_canonicalizer.h"
+#include "src/path_filter.h"
+#include "src/query_server.h"
+#include "src/response_file.h"
+#include "src/shards.h"
+#include "src/snapshot.h"
+#include "src/staging.h"
+#include "src/worker.h"
 
 namespace {
 
+using ::comp_db_hook::Change;
+using ::comp_db_hook::ChangeKind;
+using ::comp_db_hook::CommandEntry;
+using ::comp_db_hook::ConfigurationPolicy;
+using ::comp_db_hook::EntryIndex;
+using ::comp_db_hook::EntryIndexWriter;
+using ::comp_db_hook::EntryScanner;
+using ::comp_db_hook::EntrySpan;
+using ::comp_db_hook::EntryWriter;
+using ::comp_db_hook::ExecrootPathMapper;
+using ::comp_db_hook::GetSidecarFilePath;
+using ::comp_db_hook::GetSnapshotPath;
+using ::comp_db_hook::GetWorkspaceDirectory;
+using ::comp_db_hook::Invocation;
+using ::comp_db_hook::JoinPath;
+using ::comp_db_hook::MappedFile;
+using ::comp_db_hook::PackageRoots;
+using ::comp_db_hook::PathCanonicalizer;
+using ::comp_db_hook::PathFilter;
+using ::comp_db_hook::Snapshot;
+using ::comp_db_hook::SnapshotWriter;
+using ::comp_db_hook::kArgumentsField;
+using ::comp_db_hook::kExitCodeField;
+using ::comp_db_hook::kFileField;
+using ::comp_db_hook::kOutputField;
+using ::comp_db_hook::kRequestIdField;
+using ::comp_db_hook::kWorkArgumentsField;
 using ::tsdb2::io::FD;
 
 namespace json = ::tsdb2::json;
@@ -35,46 +92,50 @@ namespace json = ::tsdb2::json;
 std::string_view constexpr kCompilerNameEnvVar = "COMP_DB_HOOK_COMPILER";
 std::string_view constexpr kDefaultCompilerName = "clang++";
 
-std::string_view constexpr kWorkspaceDirEnvVar = "COMP_DB_HOOK_WORKSPACE_DIR";
+std::string_view constexpr kExpandResponseFilesEnvVar = "COMP_DB_HOOK_EXPAND_RESPONSE_FILES";
 
-auto constexpr kCompilerFlagsWithArgument = tsdb2::common::fixed_flat_set_of<std::string_view>(
-    {"-MF", "-include", "-iquote", "-isystem", "-o", "-target"});
+std::string_view constexpr kSortedEnvVar = "COMP_DB_HOOK_SORTED";
 
-char constexpr kDirectoryField[] = "directory";
-char constexpr kArgumentsField[] = "arguments";
-char constexpr kFileField[] = "file";
+std::string_view constexpr kWorkerFlushIntervalEnvVar = "COMP_DB_HOOK_WORKER_FLUSH_INTERVAL";
+int64_t constexpr kDefaultWorkerFlushInterval = 5;
 
-// See https://clang.llvm.org/docs/JSONCompilationDatabase.html for the format specification.
-//
-// NOTE: none of these fields are actually optional in our format, but we don't want to fail the
-// entire run if for any reason we can't find one or more of them for one or more entries.
-using CommandEntry =
-    json::Object<json::Field<std::optional<std::string>, kDirectoryField>,
-                 json::Field<std::optional<std::vector<std::string>>, kArgumentsField>,
-                 json::Field<std::optional<std::string>, kFileField>>;
-
-using CommandEntries = std::vector<CommandEntry>;
-
-std::string JoinPath(std::string_view const base_directory, std::string_view const file_name) {
-  if (base_directory.empty() || absl::StartsWith(file_name, "/")) {
-    return std::string(file_name);
-  } else if (absl::EndsWith(base_directory, "/")) {
-    return absl::StrCat(base_directory, file_name);
-  } else {
-    return absl::StrCat(base_directory, "/", file_name);
-  }
-}
+// How much of the database is processed before releasing the memory of its mapping.
+size_t constexpr kReleaseInterval = 1 << 20;
+
+// The recorded arguments of a compiler invocation, shared by all the source files it compiles.
+struct Compilation {
+  // The working directory of the compilation, canonicalized like the source file paths so that
+  // reading the entry back yields the same path (see `GetEntryPath`).
+  std::string directory;
+
+  std::vector<std::string> arguments;
+
+  // See `GetConfigurationFingerprint`.
+  std::string configuration;
+};
 
 struct SourceFile {
-  // Custom "less-than" functor to index source files by their absolute path.
+  // Custom "less-than" functor to index source files by their canonical absolute path. It's
+  // transparent so that files can be looked up by path without building a `SourceFile`.
   struct Less {
+    using is_transparent = void;
+
     bool operator()(SourceFile const& lhs, SourceFile const& rhs) const {
       return lhs.absolute_path() < rhs.absolute_path();
     }
+    bool operator()(SourceFile const& lhs, std::string_view const rhs) const {
+      return lhs.absolute_path() < rhs;
+    }
+    bool operator()(std::string_view const lhs, SourceFile const& rhs) const {
+      return lhs < rhs.absolute_path();
+    }
   };
 
-  explicit SourceFile(std::string_view const base_directory, std::string_view const relative_path)
-      : relative_path_(relative_path), absolute_path_(JoinPath(base_directory, relative_path)) {}
+  explicit SourceFile(std::string relative_path, std::string absolute_path,
+                      std::shared_ptr<Compilation const> compilation = nullptr)
+      : relative_path_(std::move(relative_path)),
+        absolute_path_(std::move(absolute_path)),
+        compilation_(std::move(compilation)) {}
 
   ~SourceFile() = default;
 
@@ -86,75 +147,27 @@ struct SourceFile {
   std::string_view relative_path() const { return relative_path_; }
   std::string_view absolute_path() const { return absolute_path_; }
 
+  // The compilation of the file, which is null if the file was read from an existing entry of the
+  // database.
+  std::shared_ptr<Compilation const> const& compilation() const { return compilation_; }
+
+  std::string_view directory() const { return compilation_->directory; }
+  absl::Span<std::string const> arguments() const { return compilation_->arguments; }
+  std::string_view configuration() const { return compilation_->configuration; }
+
  private:
   std::string relative_path_;
   std::string absolute_path_;
+  std::shared_ptr<Compilation const> compilation_;
 };
 
 using SourceFileSet = tsdb2::common::flat_set<SourceFile, SourceFile::Less>;
 
-absl::StatusOr<std::string> GetWorkspaceDirectory() {
-  auto maybe_directory = tsdb2::common::GetEnv(std::string(kWorkspaceDirEnvVar));
-  if (maybe_directory.has_value()) {
-    return std::move(maybe_directory).value();
-  }
-  char buffer[PATH_MAX + 1];
-  if (::getcwd(buffer, PATH_MAX) != nullptr) {
-    return std::string(buffer);
-  } else {
-    return absl::ErrnoToStatus(errno, "getcwd");
-  }
-}
-
-absl::StatusOr<std::string> GetCommandFilePath() {
-  DEFINE_VAR_OR_RETURN(workspace_directory, GetWorkspaceDirectory());
-  return JoinPath(std::move(workspace_directory), "compile_commands.json");
-}
-
 std::string GetCompilerName() {
   return tsdb2::common::GetEnv(std::string(kCompilerNameEnvVar))
       .value_or(std::string(kDefaultCompilerName));
 }
 
-absl::StatusOr<FD> OpenCommandFile() {
-  DEFINE_CONST_OR_RETURN(file_path, GetCommandFilePath());
-  FD fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
-      file_path.c_str(), /*flags=*/O_CREAT | O_CLOEXEC | O_RDWR, /*mode=*/0664)};
-  if (fd) {
-    return std::move(fd);
-  } else {
-    return absl::ErrnoToStatus(errno, "open");
-  }
-}
-
-template <typename Type>
-absl::StatusOr<Type> ParseJsonFile(FD const& fd) {
-  std::string json;
-  static size_t constexpr kBufferSize = 4096;
-  char buffer[kBufferSize];
-  ssize_t result = 0;
-  do {
-    result = ::read(fd.get(), buffer, kBufferSize);
-    if (result < 0) {
-      return absl::ErrnoToStatus(errno, "read");
-    } else if (result > 0) {
-      json += std::string_view(buffer, result);
-    }
-  } while (!(result < kBufferSize));
-  auto status_or_entries = json::Parse<Type>(json);
-  if (status_or_entries.ok()) {
-    return status_or_entries;
-  } else {
-    LOG(ERROR) << "Failed to parse compile_commands.json: " << status_or_entries.status()
-               << ". Will restart with a new file.";
-    return Type();
-  }
-}
-
-absl::StatusOr<CommandEntries> ParseCommandFile(FD const& fd) {
-  return ParseJsonFile<CommandEntries>(fd);
-}
-
 std::vector<std::string> MakeArguments(int const argc, char const* const argv[]) {
   std::vector<std::string> result;
   result.reserve(argc);
@@ -165,86 +178,1210 @@ std::vector<std::string> MakeArguments(int const argc, char const* const argv[])
   return result;
 }
 
-SourceFileSet GetCurrentFiles(std::string_view const cwd,
-                              absl::Span<std::string const> const args) {
+// Returns the path of `path` relative to `cwd`, or `path` itself if it's outside `cwd`. Both paths
+// must be canonical.
+std::string_view GetWorkspaceRelativePath(std::string_view const cwd, std::string_view path) {
+  if (cwd == "/") {
+    path.remove_prefix(1);
+  } else if (absl::StartsWith(path, cwd) && path.size() > cwd.size() && path[cwd.size()] == '/') {
+    path.remove_prefix(cwd.size() + 1);
+  }
+  return path;
+}
+
+// Returns the source files of `invocation` that pass `filter`, all compiled in `compilation`.
+SourceFileSet GetCurrentFiles(std::string_view const cwd, Invocation const& invocation,
+                              std::shared_ptr<Compilation const> const& compilation,
+                              PathFilter const& filter, PathCanonicalizer* const canonicalizer,
+                              ExecrootPathMapper* const mapper) {
+  std::string_view const canonical_cwd = compilation->directory;
+  // Under Bazel the input paths are relative to the execution root rather than the workspace.
+  std::string_view const input_directory = mapper->active() ? mapper->execroot() : cwd;
   SourceFileSet files;
-  for (size_t i = 1; i < args.size(); ++i) {
-    if (kCompilerFlagsWithArgument.contains(args[i])) {
-      ++i;
-    } else if (!absl::StartsWith(args[i], "-")) {
-      files.emplace(cwd, args[i]);
+  for (auto const& input : invocation.inputs) {
+    auto absolute_path = canonicalizer->Canonicalize(JoinPath(input_directory, input.path));
+    auto maybe_mapped_path = mapper->MapPath(absolute_path);
+    if (maybe_mapped_path.has_value()) {
+      absolute_path = std::move(maybe_mapped_path).value();
+    }
+    auto const relative_path = GetWorkspaceRelativePath(canonical_cwd, absolute_path);
+    if (filter.Accepts(relative_path)) {
+      files.emplace(std::string(relative_path), std::move(absolute_path), compilation);
     }
   }
   return files;
 }
 
-absl::Status UpdateEntries(absl::Span<std::string const> const arguments,
-                           CommandEntries* const entries) {
-  DEFINE_CONST_OR_RETURN(cwd, GetWorkspaceDirectory());
-  auto source_files = GetCurrentFiles(cwd, arguments);
-  for (auto& entry : *entries) {
-    auto const maybe_file_path = entry.get<kFileField>();
-    if (!maybe_file_path.has_value()) {
+// Outcome of matching an existing entry of the database against the current compilation.
+enum class EntryUpdate {
+  kUnchanged,
+  kReplaced,
+  kRemoved,
+};
+
+// Tells whether an entry recorded with `entry_arguments` must be updated to `arguments`.
+// Recompiling a file with the same arguments doesn't count as a change, so that the database can be
+// left alone, and neither does compiling it in a Bazel configuration that the configuration policy
+// ranks lower than the recorded one.
+bool ShouldUpdateArguments(std::optional<std::vector<std::string>> const& entry_arguments,
+                           absl::Span<std::string const> const arguments,
+                           ConfigurationPolicy const& policy,
+                           std::string_view const configuration) {
+  if (!entry_arguments.has_value()) {
+    return true;
+  }
+  if (std::equal(entry_arguments->begin(), entry_arguments->end(), arguments.begin(),
+                 arguments.end())) {
+    return false;
+  }
+  return policy.ShouldReplace(comp_db_hook::GetConfigurationFingerprint(entry_arguments.value()),
+                              configuration);
+}
+
+CommandEntry MakeEntry(SourceFile const& file) {
+  auto const arguments = file.arguments();
+  // NOLINTBEGIN(bugprone-argument-comment)
+  return CommandEntry{
+      json::kInitialize,
+      /*directory=*/std::string(file.directory()),
+      /*arguments=*/std::vector<std::string>(arguments.begin(), arguments.end()),
+      /*file=*/std::string(file.relative_path()),
+  };
+  // NOLINTEND(bugprone-argument-comment)
+}
+
+// Matches an existing entry of the source file at `path` against `source_files`. If it's one of
+// them, the matching source file is moved to `matched_files` and returned in `*file`, and the entry
+// may have to be replaced, which is only known by looking at its arguments (see
+// `ShouldUpdateArguments`). `*file` is only valid until `matched_files` changes again.
+//
+// New entries are recorded with canonical paths, directory included, so comparing them only
+// requires lexical normalization. Existing entries spelling the same file differently (e.g. written
+// by older versions) are merged into the first one by removing the others.
+EntryUpdate MatchEntry(std::string_view const path, SourceFileSet* const source_files,
+                       SourceFileSet* const matched_files, SourceFile const** const file) {
+  if (matched_files->contains(path)) {
+    return EntryUpdate::kRemoved;
+  }
+  auto const it = source_files->find(path);
+  if (it == source_files->end()) {
+    return EntryUpdate::kUnchanged;
+  }
+  *file = &*matched_files->insert(*it).first;
+  source_files->erase(it);
+  return EntryUpdate::kReplaced;
+}
+
+// Tells whether updating the database with `source_files` would leave it unchanged, i.e. whether
+// each of them already has exactly one entry in `snapshot` and its arguments don't have to be
+// updated (see `ShouldUpdateArguments`). This takes O(k log N) path comparisons for k source files
+// and N entries, and only materializes the entries of `source_files`.
+absl::StatusOr<bool> IsUpToDate(Snapshot const& snapshot, SourceFileSet const& source_files,
+                                ConfigurationPolicy const& policy) {
+  for (auto const& file : source_files) {
+    DEFINE_CONST_OR_RETURN(rank, snapshot.LowerBound(file.absolute_path()));
+    if (rank >= snapshot.size()) {
+      return false;
+    }
+    DEFINE_CONST_OR_RETURN(record, snapshot.GetSorted(rank));
+    if (record.path() != file.absolute_path()) {
+      return false;
+    }
+    if (rank + 1 < snapshot.size()) {
+      DEFINE_CONST_OR_RETURN(next_record, snapshot.GetSorted(rank + 1));
+      if (next_record.path() == file.absolute_path()) {
+        // A duplicate entry, which must be removed.
+        return false;
+      }
+    }
+    auto const entry = record.ToCommandEntry();
+    if (ShouldUpdateArguments(entry.get<kArgumentsField>(), file.arguments(), policy,
+                              file.configuration())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Updates the entries of `source_files` in the database at `fd`, mapped at `mapping`, and adds the
+// missing ones. Each source file is recorded with the arguments of its own compilation.
+//
+// The database is processed one entry at a time and rewritten through an `EntryWriter`, so memory
+// usage doesn't depend on its size: the pages of the mapping are released as soon as they're
+// processed. Nothing is written unless something changes, and the unchanged prefix before the first
+// change is copied verbatim rather than serialized again. Malformed parts of the database are
+// dropped (see `SalvageCommandEntries`).
+//
+// If `snapshot` is not null it must be the valid snapshot of the database, and the entries are read
+// from it rather than parsed: only the entries of `source_files` are materialized. Unless `sorted`
+// is requested, the entries of `source_files` are first looked up in the snapshot, and if none of
+// them changes the call returns in O(k log N) for k source files and N entries without walking the
+// database. If `snapshot` is null a new snapshot is built along the way, even if the database
+// doesn't change, unless `snapshot_path` is empty. Either way the snapshot is kept up to date with
+// the database. Fails with `DataLoss` if the snapshot turns out to be corrupt or not to match the
+// database, in which case nothing has been written.
+//
+// If `sorted` is not null new entries are inserted in path order rather than appended, and on
+// return `*sorted` tells whether the existing entries were sorted.
+//
+// The added and changed entries are appended to `changes`, which are only meaningful if the call
+// succeeds.
+//
+// `database_directory` is the directory of the database, i.e. the workspace directory or a package
+// root, while `cwd` is always the workspace directory.
+absl::Status UpdateEntries(FD const& fd, MappedFile const& mapping, Snapshot const* const snapshot,
+                           std::string const& snapshot_path,
+                           std::string_view const database_directory, std::string_view const cwd,
+                           SourceFileSet source_files, bool* const sorted,
+                           std::vector<Change>* const changes) {
+  auto const policy = ConfigurationPolicy::FromEnvironment();
+  if (snapshot != nullptr && sorted == nullptr) {
+    DEFINE_CONST_OR_RETURN(up_to_date, IsUpToDate(*snapshot, source_files, policy));
+    if (up_to_date) {
+      return absl::OkStatus();
+    }
+  }
+  auto const temp_path = GetSidecarFilePath(database_directory, "tmp");
+  std::optional<EntryWriter> writer;
+  std::optional<SnapshotWriter> snapshot_writer;
+  if (snapshot == nullptr && !snapshot_path.empty()) {
+    DEFINE_VAR_OR_RETURN(new_snapshot_writer, SnapshotWriter::Create(snapshot_path));
+    snapshot_writer.emplace(std::move(new_snapshot_writer));
+  }
+  // Number of entries and end of the last entry before the first change.
+  size_t prefix_size = 0;
+  size_t prefix_end = 0;
+  auto const start_writing = [&]() -> absl::Status {
+    DEFINE_VAR_OR_RETURN(new_writer, EntryWriter::Create(temp_path, prefix_end));
+    writer.emplace(std::move(new_writer));
+    if (snapshot != nullptr) {
+      // The records of the unchanged prefix are still valid as they are.
+      DEFINE_VAR_OR_RETURN(new_snapshot_writer, SnapshotWriter::Create(snapshot_path));
+      snapshot_writer.emplace(std::move(new_snapshot_writer));
+      for (size_t i = 0; i < prefix_size; ++i) {
+        DEFINE_CONST_OR_RETURN(record, snapshot->GetEntry(i));
+        RETURN_IF_ERROR(snapshot_writer->Add(record.span().offset, record));
+      }
+    }
+    return absl::OkStatus();
+  };
+  // Writes a new or replaced entry.
+  auto const write_entry = [&](CommandEntry const& entry, std::string_view const path,
+                               ChangeKind const kind) -> absl::Status {
+    changes->push_back(Change{.kind = kind, .path = std::string(path)});
+    auto const text = comp_db_hook::FormatEntry(entry);
+    RETURN_IF_ERROR(writer->WriteText(text));
+    if (!snapshot_writer.has_value()) {
+      return absl::OkStatus();
+    }
+    EntrySpan const span{.offset = writer->position() - text.size(), .size = text.size()};
+    return snapshot_writer->Add(span, path, entry);
+  };
+  SourceFileSet matched_files;
+  // Writes the entries of the new files that sort before `path`.
+  auto const insert_entries = [&](std::string_view const path) -> absl::Status {
+    while (!source_files.empty() && source_files.begin()->absolute_path() < path) {
+      if (!writer.has_value()) {
+        RETURN_IF_ERROR(start_writing());
+      }
+      auto file = *source_files.begin();
+      source_files.erase(source_files.begin());
+      RETURN_IF_ERROR(write_entry(MakeEntry(file), file.absolute_path(), ChangeKind::kAdded));
+      matched_files.insert(std::move(file));
+    }
+    return absl::OkStatus();
+  };
+  std::string last_path;
+  if (sorted != nullptr) {
+    *sorted = true;
+  }
+  // Processes an existing entry, given either `parsed` or as its snapshot `record`. Its text is
+  // `text`, at `offset`, and `path` is the path of its source file, empty if it has none.
+  auto const process_entry = [&](std::string_view const text, size_t const offset,
+                                 std::string_view const path, CommandEntry* parsed,
+                                 Snapshot::Entry const* const record) -> absl::Status {
+    std::optional<CommandEntry> materialized;
+    auto update = EntryUpdate::kUnchanged;
+    if (path.empty()) {
       LOG(ERROR) << "compile_commands.json contains an entry without a `file` field:\n"
-                 << json::Stringify(entry);
-      continue;
+                 << json::Stringify(parsed != nullptr ? *parsed : record->ToCommandEntry());
+    } else {
+      if (sorted != nullptr) {
+        RETURN_IF_ERROR(insert_entries(path));
+        if (path < last_path) {
+          *sorted = false;
+        }
+        last_path = path;
+      }
+      SourceFile const* file = nullptr;
+      update = MatchEntry(path, &source_files, &matched_files, &file);
+      if (update == EntryUpdate::kReplaced) {
+        if (parsed == nullptr) {
+          parsed = &materialized.emplace(record->ToCommandEntry());
+        }
+        auto& entry_arguments = parsed->get<kArgumentsField>();
+        auto const arguments = file->arguments();
+        if (ShouldUpdateArguments(entry_arguments, arguments, policy, file->configuration())) {
+          entry_arguments = std::vector<std::string>(arguments.begin(), arguments.end());
+        } else {
+          update = EntryUpdate::kUnchanged;
+        }
+      }
+    }
+    // Adds the unchanged entry to the snapshot, with its text at `new_offset`.
+    auto const add_unchanged = [&](uint64_t const new_offset) -> absl::Status {
+      if (!snapshot_writer.has_value()) {
+        return absl::OkStatus();
+      } else if (record != nullptr) {
+        return snapshot_writer->Add(new_offset, *record);
+      } else {
+        return snapshot_writer->Add(EntrySpan{.offset = new_offset, .size = text.size()}, path,
+                                    *parsed);
+      }
+    };
+    if (!writer.has_value()) {
+      if (update == EntryUpdate::kUnchanged) {
+        ++prefix_size;
+        prefix_end = offset + text.size();
+        return add_unchanged(offset);
+      }
+      RETURN_IF_ERROR(start_writing());
     }
-    auto const base_directory = entry.get<kDirectoryField>().value_or(cwd);
-    SourceFile file{base_directory, maybe_file_path.value()};
-    if (source_files.erase(file) > 0) {
-      entry.get<kArgumentsField>() = std::vector<std::string>(arguments.begin(), arguments.end());
+    if (update == EntryUpdate::kUnchanged) {
+      RETURN_IF_ERROR(writer->WriteText(text));
+      return add_unchanged(writer->position() - text.size());
+    } else if (update == EntryUpdate::kReplaced) {
+      return write_entry(*parsed, path, ChangeKind::kChanged);
+    } else {
+      return absl::OkStatus();
     }
+  };
+  size_t released = 0;
+  size_t num_dropped = 0;
+  if (snapshot != nullptr) {
+    for (size_t i = 0; i < snapshot->size(); ++i) {
+      DEFINE_CONST_OR_RETURN(record, snapshot->GetEntry(i));
+      auto const span = record.span();
+      if (span.end() > mapping.size()) {
+        return absl::DataLossError("the snapshot is stale");
+      }
+      if (span.offset - released >= kReleaseInterval) {
+        mapping.Release(released, span.offset);
+        released = span.offset;
+      }
+      RETURN_IF_ERROR(process_entry(mapping.contents().substr(span.offset, span.size),
+                                    span.offset, record.path(), /*parsed=*/nullptr, &record));
+    }
+  } else {
+    EntryScanner scanner{mapping.contents()};
+    for (auto maybe_text = scanner.Next(); maybe_text.has_value(); maybe_text = scanner.Next()) {
+      if (scanner.entry_offset() - released >= kReleaseInterval) {
+        mapping.Release(released, scanner.entry_offset());
+        released = scanner.entry_offset();
+      }
+      if (!writer.has_value() && scanner.num_dropped() > 0) {
+        RETURN_IF_ERROR(start_writing());
+      }
+      auto status_or_entry = json::Parse<CommandEntry>(maybe_text.value());
+      if (!status_or_entry.ok()) {
+        LOG(WARNING) << "Dropping malformed entry at offset " << scanner.entry_offset() << ": "
+                     << status_or_entry.status();
+        scanner.Resync();
+        continue;
+      }
+      auto& entry = status_or_entry.value();
+      auto const path = comp_db_hook::GetEntryPath(entry, cwd).value_or("");
+      RETURN_IF_ERROR(process_entry(maybe_text.value(), scanner.entry_offset(), path, &entry,
+                                    /*record=*/nullptr));
+    }
+    num_dropped = scanner.num_dropped();
+  }
+  if (!writer.has_value()) {
+    if (num_dropped == 0 && source_files.empty()) {
+      if (snapshot_writer.has_value()) {
+        return snapshot_writer->Commit(fd);
+      }
+      return absl::OkStatus();
+    }
+    RETURN_IF_ERROR(start_writing());
+  }
+  if (num_dropped > 0) {
+    LOG(WARNING) << "Dropped " << num_dropped << " malformed regions of compile_commands.json.";
   }
   for (auto const& file : source_files) {
-    // NOLINTBEGIN(bugprone-argument-comment)
-    entries->emplace_back(CommandEntry{
-        json::kInitialize,
-        /*directory=*/cwd,
-        /*arguments=*/std::vector<std::string>(arguments.begin(), arguments.end()),
-        /*file=*/file.relative_path(),
-    });
-    // NOLINTEND(bugprone-argument-comment)
+    RETURN_IF_ERROR(write_entry(MakeEntry(file), file.absolute_path(), ChangeKind::kAdded));
+  }
+  RETURN_IF_ERROR(writer->CopyTo(fd));
+  if (snapshot_writer.has_value()) {
+    return snapshot_writer->Commit(fd);
   }
   return absl::OkStatus();
 }
 
-absl::Status RewriteFile(FD const& fd, CommandEntries const& entries) {
-  if (::ftruncate(*fd, 0) < 0) {
-    return absl::ErrnoToStatus(errno, "ftruncate");
+// Updates the database through its snapshot if it has a valid one, or by parsing it otherwise (see
+// `UpdateEntries`).
+absl::Status UpdateEntriesWithSnapshot(FD const& fd, MappedFile const& mapping,
+                                       std::string_view const database_directory,
+                                       std::string_view const cwd, SourceFileSet source_files,
+                                       bool* const sorted, std::vector<Change>* const changes) {
+  auto const snapshot_path = GetSnapshotPath(database_directory);
+  if (!snapshot_path.empty()) {
+    DEFINE_CONST_OR_RETURN(maybe_snapshot, Snapshot::Load(snapshot_path, fd));
+    if (maybe_snapshot.has_value()) {
+      auto const status = UpdateEntries(fd, mapping, &*maybe_snapshot, snapshot_path,
+                                        database_directory, cwd, source_files, sorted, changes);
+      if (!absl::IsDataLoss(status)) {
+        return status;
+      }
+      LOG(WARNING) << "The snapshot of compile_commands.json is stale, rebuilding it: " << status;
+      changes->clear();
+    }
+  }
+  return UpdateEntries(fd, mapping, /*snapshot=*/nullptr, snapshot_path, database_directory, cwd,
+                       std::move(source_files), sorted, changes);
+}
+
+// A change to an indexed database: `entry`, whose text is `text` and whose source file is at
+// `path`, replaces the entry at `position` or is inserted before it.
+struct IndexedEdit {
+  size_t position;
+  bool replace;
+  std::string path;
+  CommandEntry entry;
+  std::string text;
+};
+
+// Looks up the entries of `source_files` in a sorted database using its index and returns the
+// edits needed to update them, in order (see `EntryIndex::MergeJoin`). An error means that the
+// index is unusable.
+absl::StatusOr<std::vector<IndexedEdit>> PlanIndexedUpdate(
+    std::string_view const contents, EntryIndex const& index, std::string_view const cwd,
+    SourceFileSet const& source_files) {
+  auto const policy = ConfigurationPolicy::FromEnvironment();
+  std::vector<std::string_view> paths;
+  paths.reserve(source_files.size());
+  for (auto const& file : source_files) {
+    paths.push_back(file.absolute_path());
   }
-  if (::lseek(*fd, 0, SEEK_SET) < 0) {
-    return absl::ErrnoToStatus(errno, "lseek");
+  DEFINE_VAR_OR_RETURN(matches, index.MergeJoin(contents, cwd, paths));
+  std::vector<IndexedEdit> edits;
+  size_t i = 0;
+  for (auto const& file : source_files) {
+    auto& match = matches[i++];
+    if (match.entry.has_value()) {
+      auto& entry = match.entry.value();
+      auto& entry_arguments = entry.get<kArgumentsField>();
+      auto const arguments = file.arguments();
+      if (ShouldUpdateArguments(entry_arguments, arguments, policy, file.configuration())) {
+        entry_arguments = std::vector<std::string>(arguments.begin(), arguments.end());
+        auto text = comp_db_hook::FormatEntry(entry);
+        edits.push_back(IndexedEdit{
+            .position = match.position,
+            .replace = true,
+            .path = std::string(file.absolute_path()),
+            .entry = std::move(entry),
+            .text = std::move(text),
+        });
+      }
+      continue;
+    }
+    auto entry = MakeEntry(file);
+    auto text = comp_db_hook::FormatEntry(entry);
+    edits.push_back(IndexedEdit{
+        .position = match.position,
+        .replace = false,
+        .path = std::string(file.absolute_path()),
+        .entry = std::move(entry),
+        .text = std::move(text),
+    });
   }
-  json::StringifyOptions const options{
-      .pretty = true,
-      .trailing_newline = true,
+  return edits;
+}
+
+// Applies `edits` to the indexed database at `fd`. The runs of entries between edits are copied
+// verbatim using their offsets, and the index is updated along the way. So is the snapshot if
+// `snapshot` is not null, in which case it must be the valid snapshot of the database.
+absl::Status ApplyIndexedEdits(FD const& fd, std::string_view const database_directory,
+                               EntryIndex const& index, std::string const& index_path,
+                               Snapshot const* const snapshot, std::string const& snapshot_path,
+                               absl::Span<IndexedEdit const> const edits) {
+  auto const temp_path = GetSidecarFilePath(database_directory, "tmp");
+  size_t next = edits.front().position;
+  DEFINE_VAR_OR_RETURN(writer,
+                       EntryWriter::Create(temp_path, next > 0 ? index[next - 1].end() : 0));
+  DEFINE_VAR_OR_RETURN(index_writer, EntryIndexWriter::Create(index_path));
+  std::optional<SnapshotWriter> snapshot_writer;
+  if (snapshot != nullptr) {
+    DEFINE_VAR_OR_RETURN(new_snapshot_writer, SnapshotWriter::Create(snapshot_path));
+    snapshot_writer.emplace(std::move(new_snapshot_writer));
+  }
+  for (size_t i = 0; i < next; ++i) {
+    RETURN_IF_ERROR(index_writer.Add(index[i]));
+    if (snapshot_writer.has_value()) {
+      DEFINE_CONST_OR_RETURN(record, snapshot->GetEntry(i));
+      RETURN_IF_ERROR(snapshot_writer->Add(record.span().offset, record));
+    }
+  }
+  // Copies the unchanged entries from `next` to `end`.
+  auto const copy_entries = [&](size_t const end) -> absl::Status {
+    if (next >= end) {
+      return absl::OkStatus();
+    }
+    uint64_t const begin_offset = index[next].offset;
+    uint64_t const end_offset = index[end - 1].end();
+    RETURN_IF_ERROR(writer.CopyEntries(fd, begin_offset, end_offset));
+    uint64_t const new_begin_offset = writer.position() - (end_offset - begin_offset);
+    for (; next < end; ++next) {
+      auto span = index[next];
+      span.offset = span.offset - begin_offset + new_begin_offset;
+      RETURN_IF_ERROR(index_writer.Add(span));
+      if (snapshot_writer.has_value()) {
+        DEFINE_CONST_OR_RETURN(record, snapshot->GetEntry(next));
+        RETURN_IF_ERROR(snapshot_writer->Add(span.offset, record));
+      }
+    }
+    return absl::OkStatus();
   };
-  auto const json = tsdb2::json::Stringify(entries, options);
-  size_t written = 0;
-  while (written < json.size()) {
-    auto const result = ::write(*fd, json.data() + written, json.size() - written);
-    if (result < 0) {
-      return absl::ErrnoToStatus(errno, "write");
+  for (auto const& edit : edits) {
+    RETURN_IF_ERROR(copy_entries(edit.position));
+    RETURN_IF_ERROR(writer.WriteText(edit.text));
+    EntrySpan const span{
+        .offset = writer.position() - edit.text.size(),
+        .size = edit.text.size(),
+    };
+    RETURN_IF_ERROR(index_writer.Add(span));
+    if (snapshot_writer.has_value()) {
+      RETURN_IF_ERROR(snapshot_writer->Add(span, edit.path, edit.entry));
+    }
+    if (edit.replace) {
+      next = edit.position + 1;
     }
-    written += result;
+  }
+  RETURN_IF_ERROR(copy_entries(index.size()));
+  RETURN_IF_ERROR(writer.CopyTo(fd));
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  RETURN_IF_ERROR(index_writer.Commit(stat));
+  if (snapshot_writer.has_value()) {
+    return snapshot_writer->Commit(fd);
   }
   return absl::OkStatus();
 }
 
-absl::Status UpdateCommandFile(int const argc, char const* const argv[]) {
-  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile());
+// Implements the sorted mode: the database is kept sorted by source file path and indexed, so that
+// the entries of the current compilation are looked up with a binary search and updated by copying
+// the runs of entries around them. If the index is missing or stale the database is updated by
+// scanning it and then indexed again, after sorting it if needed. The added and changed entries are
+// appended to `changes`.
+absl::Status UpdateSortedEntries(FD const& fd, struct stat const& stat, MappedFile const& mapping,
+                                 std::string_view const database_directory,
+                                 std::string_view const cwd, SourceFileSet source_files,
+                                 std::vector<Change>* const changes) {
+  auto const index_path = GetSidecarFilePath(database_directory, "index");
+  DEFINE_CONST_OR_RETURN(maybe_index, EntryIndex::Load(index_path, stat));
+  if (maybe_index.has_value()) {
+    auto const status_or_edits =
+        PlanIndexedUpdate(mapping.contents(), *maybe_index, cwd, source_files);
+    if (status_or_edits.ok()) {
+      if (status_or_edits->empty()) {
+        return absl::OkStatus();
+      }
+      // The snapshot is only maintained if it's in sync with the index, which is the case unless
+      // snapshots were disabled for a while.
+      auto const snapshot_path = GetSnapshotPath(database_directory);
+      std::optional<Snapshot> maybe_snapshot;
+      if (!snapshot_path.empty()) {
+        DEFINE_VAR_OR_RETURN(loaded_snapshot, Snapshot::Load(snapshot_path, fd));
+        maybe_snapshot = std::move(loaded_snapshot);
+      }
+      Snapshot const* const snapshot =
+          maybe_snapshot.has_value() && maybe_snapshot->size() == maybe_index->size()
+              ? &*maybe_snapshot
+              : nullptr;
+      auto status = ApplyIndexedEdits(fd, database_directory, *maybe_index, index_path, snapshot,
+                                      snapshot_path, status_or_edits.value());
+      if (snapshot != nullptr && absl::IsDataLoss(status)) {
+        // The snapshot is corrupt. Leaving it behind makes it stale, so it's rebuilt when needed.
+        LOG(WARNING) << "The snapshot of compile_commands.json is corrupt: " << status;
+        status = ApplyIndexedEdits(fd, database_directory, *maybe_index, index_path,
+                                   /*snapshot=*/nullptr, snapshot_path, status_or_edits.value());
+      }
+      RETURN_IF_ERROR(status);
+      for (auto const& edit : status_or_edits.value()) {
+        changes->push_back(Change{
+            .kind = edit.replace ? ChangeKind::kChanged : ChangeKind::kAdded,
+            .path = edit.path,
+        });
+      }
+      return absl::OkStatus();
+    }
+    LOG(WARNING) << "The index of compile_commands.json is stale, rebuilding it: "
+                 << status_or_edits.status();
+  }
+  bool sorted = true;
+  RETURN_IF_ERROR(UpdateEntriesWithSnapshot(fd, mapping, database_directory, cwd,
+                                            std::move(source_files), &sorted, changes));
+  if (!sorted) {
+    LOG(INFO) << "Sorting compile_commands.json.";
+    std::vector<std::string> const input_paths{
+        comp_db_hook::GetCommandFilePath(database_directory)};
+    auto const temp_path_prefix = GetSidecarFilePath(database_directory, "merge");
+    RETURN_IF_ERROR(comp_db_hook::MergeDatabases(cwd, input_paths, fd, temp_path_prefix,
+                                                 comp_db_hook::MergeOptions::FromEnvironment())
+                        .status());
+    auto const snapshot_path = GetSnapshotPath(database_directory);
+    if (!snapshot_path.empty()) {
+      RETURN_IF_ERROR(comp_db_hook::BuildSnapshot(snapshot_path, fd, cwd));
+    }
+  }
+  return comp_db_hook::BuildEntryIndex(index_path, fd);
+}
+
+// Tells whether builds must be tracked, i.e. whether the `EvictionPolicy` needs them. They're not
+// tracked by default so that the hook doesn't log every compilation for nothing.
+bool ShouldTrackBuilds() { return comp_db_hook::EvictionPolicy::FromEnvironment().enabled(); }
+
+// Records that `source_files` were compiled in the current build, for the `EvictionPolicy`, in the
+// build tracking files of `database_directory`. Must be called with the database lock held, or
+// with the build tracking lock if the database is sharded (see `OpenBuildTrackingFile`).
+absl::Status RecordLastSeen(std::string_view const database_directory,
+                            SourceFileSet const& source_files) {
+  auto const now = ::time(nullptr);
+  auto const build_path = GetSidecarFilePath(database_directory, "build");
+  DEFINE_CONST_OR_RETURN(generation, comp_db_hook::AdvanceBuildGeneration(
+                                         build_path, now, comp_db_hook::GetBuildIdleGap()));
+  std::vector<std::string> paths;
+  paths.reserve(source_files.size());
+  for (auto const& file : source_files) {
+    paths.emplace_back(file.absolute_path());
+  }
+  auto const last_seen_path = GetSidecarFilePath(database_directory, "seen");
+  return comp_db_hook::AppendLastSeen(
+      last_seen_path, comp_db_hook::LastSeen{.generation = generation, .time = now}, paths);
+}
+
+// Bumps the generation of the database and logs `changes` (see `DatabaseGeneration`). Must be
+// called with the database lock held.
+absl::Status CommitChanges(std::string_view const database_directory,
+                           absl::Span<Change const> const changes) {
+  auto const generation_path = GetSidecarFilePath(database_directory, "generation");
+  auto const log_path = GetSidecarFilePath(database_directory, "changes");
+  return comp_db_hook::CommitChanges(generation_path, log_path, changes).status();
+}
+
+// Updates the entries of `source_files` in the database in `database_directory`, which is either
+// the workspace directory `cwd`, its staging directory, a package root, or a shard. The build
+// generation used for eviction is only tracked if `track_builds` is true, i.e. in the database of
+// the workspace, staged or not, and if eviction is enabled. Returns true iff any entry changed.
+//
+// Fails with `Aborted` without changing anything if the database was unlinked while waiting for
+// the lock, which happens when a staged database is persisted (see `PersistDatabase`).
+absl::StatusOr<bool> UpdateDatabase(std::string_view const database_directory,
+                                    std::string_view const cwd, SourceFileSet source_files,
+                                    bool const track_builds) {
+  DEFINE_CONST_OR_RETURN(fd, comp_db_hook::OpenCommandFile(database_directory));
   DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(fd));
-  DEFINE_VAR_OR_RETURN(entries, ParseCommandFile(fd));
-  auto const arguments = MakeArguments(argc, argv);
-  RETURN_IF_ERROR(UpdateEntries(arguments, &entries));
-  return RewriteFile(fd, entries);
+  DEFINE_CONST_OR_RETURN(stat, comp_db_hook::StatLockedDatabase(fd));
+  if (track_builds && ShouldTrackBuilds()) {
+    if (auto const status = RecordLastSeen(database_directory, source_files); !status.ok()) {
+      LOG(WARNING) << "Failed to record the build generation: " << status;
+    }
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  std::vector<Change> changes;
+  if (comp_db_hook::GetBoolEnv(kSortedEnvVar, /*default_value=*/false)) {
+    RETURN_IF_ERROR(UpdateSortedEntries(fd, stat, mapping, database_directory, cwd,
+                                        std::move(source_files), &changes));
+  } else {
+    RETURN_IF_ERROR(UpdateEntriesWithSnapshot(fd, mapping, database_directory, cwd,
+                                              std::move(source_files), /*sorted=*/nullptr,
+                                              &changes));
+  }
+  if (changes.empty()) {
+    return false;
+  }
+  if (auto const status = CommitChanges(database_directory, changes); !status.ok()) {
+    LOG(WARNING) << "Failed to record the changes of compile_commands.json: " << status;
+  }
+  return true;
+}
+
+// Updates the entries of `source_files` in the shards of the workspace database (see
+// `GetNumShards`), locking one shard at a time, and schedules the concatenation of the shards if
+// anything changed.
+absl::Status UpdateShards(std::string_view const cwd, SourceFileSet const& source_files,
+                          size_t const num_shards) {
+  if (ShouldTrackBuilds()) {
+    // No shard lock covers the build generation and the last-seen log, they have their own.
+    DEFINE_CONST_OR_RETURN(tracking_fd, comp_db_hook::OpenBuildTrackingFile(cwd));
+    DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(tracking_fd));
+    if (auto const status = RecordLastSeen(cwd, source_files); !status.ok()) {
+      LOG(WARNING) << "Failed to record the build generation: " << status;
+    }
+  }
+  std::map<size_t, SourceFileSet> shard_files;
+  for (auto const& file : source_files) {
+    shard_files[comp_db_hook::GetShardIndex(file.absolute_path(), num_shards)].insert(file);
+  }
+  bool changed = false;
+  for (auto& [shard, files] : shard_files) {
+    DEFINE_CONST_OR_RETURN(shard_directory,
+                           comp_db_hook::GetShardDirectory(cwd, shard, num_shards));
+    DEFINE_CONST_OR_RETURN(
+        shard_changed,
+        UpdateDatabase(shard_directory, cwd, std::move(files), /*track_builds=*/false));
+    changed |= shard_changed;
+  }
+  if (changed) {
+    comp_db_hook::ScheduleConcatenation(cwd, num_shards);
+  }
+  return absl::OkStatus();
+}
+
+// Updates the entries of `source_files` in the copy of the database of `directory` (the workspace
+// directory `cwd` or a package root) staged in `staging_directory`, staging it first if needed, and
+// schedules its persistence if anything changed. If the staged database is persisted concurrently
+// it's staged again. `track_builds` is as in `UpdateDatabase`.
+absl::Status UpdateStagedDatabase(std::string_view const directory, std::string_view const cwd,
+                                  std::string const& staging_directory,
+                                  SourceFileSet const& source_files, bool const track_builds) {
+  DEFINE_CONST_OR_RETURN(
+      changed, comp_db_hook::RetryStagedUpdate(directory, staging_directory, [&] {
+        return UpdateDatabase(staging_directory, cwd, source_files, track_builds);
+      }));
+  if (changed) {
+    comp_db_hook::SchedulePersistence(directory, staging_directory);
+  }
+  return absl::OkStatus();
+}
+
+// Updates the entries of `source_files` in the workspace database, staged, sharded or neither.
+absl::Status UpdateWorkspaceDatabase(std::string_view const cwd, SourceFileSet source_files) {
+  auto const maybe_staging_directory = comp_db_hook::GetStagingDirectory(cwd);
+  if (maybe_staging_directory.has_value()) {
+    return UpdateStagedDatabase(cwd, cwd, maybe_staging_directory.value(), source_files,
+                                /*track_builds=*/true);
+  }
+  auto const num_shards = comp_db_hook::GetNumShards();
+  if (num_shards > 0) {
+    return UpdateShards(cwd, source_files, num_shards);
+  }
+  return UpdateDatabase(/*database_directory=*/cwd, cwd, std::move(source_files),
+                        /*track_builds=*/true)
+      .status();
+}
+
+// Updates the entries of `source_files` in the database of the package root `root` of
+// `package_roots`, seeding it first if it doesn't exist yet. Like the workspace database, it's
+// staged while staging is enabled.
+absl::Status UpdatePackageDatabase(std::string_view const cwd, PackageRoots const& package_roots,
+                                   std::string_view const root, SourceFileSet source_files) {
+  RETURN_IF_ERROR(comp_db_hook::SeedPackageDatabase(cwd, package_roots, root));
+  auto const maybe_staging_directory = comp_db_hook::GetStagingDirectory(root);
+  if (maybe_staging_directory.has_value()) {
+    return UpdateStagedDatabase(root, cwd, maybe_staging_directory.value(), source_files,
+                                /*track_builds=*/false);
+  }
+  return UpdateDatabase(root, cwd, std::move(source_files), /*track_builds=*/false).status();
+}
+
+// Returns the source files of `invocation` to record in the database, compiled with `arguments`.
+absl::StatusOr<SourceFileSet> GetSourceFiles(std::string_view const cwd,
+                                             absl::Span<std::string const> const arguments,
+                                             Invocation const& invocation) {
+  DEFINE_CONST_OR_RETURN(process_cwd, comp_db_hook::GetCurrentDirectory());
+  DEFINE_CONST_OR_RETURN(filter, PathFilter::FromWorkspace(cwd));
+  DEFINE_VAR_OR_RETURN(cache_path, GetSidecarFilePath("paths"));
+  PathCanonicalizer canonicalizer{
+      PathCanonicalizer::GetOptionsFromEnvironment(std::move(cache_path))};
+  auto mapper = ExecrootPathMapper::Create(process_cwd, comp_db_hook::NormalizePath(cwd));
+  auto mapped_arguments = mapper.MapArguments(arguments);
+  auto configuration = comp_db_hook::GetConfigurationFingerprint(mapped_arguments);
+  auto const compilation = std::make_shared<Compilation const>(Compilation{
+      .directory = canonicalizer.Canonicalize(cwd),
+      .arguments = std::move(mapped_arguments),
+      .configuration = std::move(configuration),
+  });
+  auto source_files =
+      GetCurrentFiles(cwd, invocation, compilation, filter, &canonicalizer, &mapper);
+  if (auto const status = canonicalizer.Flush(); !status.ok()) {
+    LOG(WARNING) << "Failed to update the path cache: " << status;
+  }
+  return source_files;
+}
+
+// Records `source_files`, each with the arguments of its own compilation, in the database of the
+// workspace and in the ones of their package roots.
+absl::Status UpdateSourceFiles(std::string_view const cwd, SourceFileSet source_files) {
+  if (source_files.empty()) {
+    // All inputs are filtered out, so there's no need to even open (and lock) the database.
+    return absl::OkStatus();
+  }
+  auto const package_roots = PackageRoots::FromEnvironment(cwd);
+  if (package_roots.empty()) {
+    return UpdateWorkspaceDatabase(cwd, std::move(source_files));
+  }
+  // Each package root only gets the files of its subtree, and its database is locked on its own.
+  bool const write_root_database = comp_db_hook::ShouldWriteRootDatabase();
+  std::map<std::string_view, SourceFileSet> package_files;
+  SourceFileSet root_files;
+  for (auto const& file : source_files) {
+    auto const maybe_root = package_roots.Find(file.absolute_path());
+    if (maybe_root.has_value()) {
+      package_files[maybe_root.value()].insert(file);
+    }
+    if (!maybe_root.has_value() || write_root_database) {
+      root_files.insert(file);
+    }
+  }
+  for (auto& [root, files] : package_files) {
+    RETURN_IF_ERROR(UpdatePackageDatabase(cwd, package_roots, root, std::move(files)));
+  }
+  if (root_files.empty()) {
+    return absl::OkStatus();
+  }
+  return UpdateWorkspaceDatabase(cwd, std::move(root_files));
+}
+
+// Returns the source files compiled by the compiler invocation with `arguments`, each with the
+// arguments to record for it, or an empty optional if the invocation doesn't compile any
+// translation unit. Response files are read through `expander`, which caches them.
+absl::StatusOr<std::optional<SourceFileSet>> GetCompiledFiles(
+    comp_db_hook::ResponseFileExpander* const expander,
+    absl::Span<std::string const> const arguments) {
+  // Response files are always expanded for classification purposes, but whether the expanded form
+  // is also what gets recorded in the database is configurable.
+  auto const expanded_arguments = expander->Expand(arguments);
+  auto const invocation = comp_db_hook::ClassifyInvocation(expanded_arguments);
+  // Link steps without source inputs, preprocessor runs and toolchain queries (including the probes
+  // Bazel runs while configuring the toolchain) don't touch the compilation database at all.
+  if (!invocation.compiles_translation_unit()) {
+    return std::nullopt;
+  }
+  bool const record_expanded =
+      comp_db_hook::GetBoolEnv(kExpandResponseFilesEnvVar, /*default_value=*/true);
+  comp_db_hook::ArgumentNormalizer const normalizer{
+      comp_db_hook::ArgumentNormalizer::GetOptionsFromEnvironment()};
+  auto const recorded_arguments =
+      normalizer.Normalize(record_expanded ? absl::MakeConstSpan(expanded_arguments) : arguments);
+  DEFINE_CONST_OR_RETURN(cwd, GetWorkspaceDirectory());
+  return GetSourceFiles(cwd, recorded_arguments, invocation);
+}
+
+absl::Status UpdateCommandFile(SourceFileSet source_files) {
+  DEFINE_CONST_OR_RETURN(cwd, GetWorkspaceDirectory());
+  return UpdateSourceFiles(cwd, std::move(source_files));
+}
+
+// Implements `comp_db_hook gc`.
+int RunGarbageCollection() {
+  auto const status_or_result =
+      comp_db_hook::CollectGarbage(comp_db_hook::GetGarbageCollectionThreads());
+  if (!status_or_result.ok()) {
+    LOG(ERROR) << status_or_result.status();
+    return 1;
+  }
+  std::printf("Removed %zu entries of missing files and evicted %zu unused entries.\n",
+              status_or_result->num_missing, status_or_result->num_evicted);
+  return 0;
+}
+
+// Implements `comp_db_hook merge [INPUT...]`.
+int RunMerge(absl::Span<char* const> const inputs) {
+  std::vector<std::string> const input_paths{inputs.begin(), inputs.end()};
+  auto const status_or_result = comp_db_hook::MergeIntoCommandFile(
+      input_paths, comp_db_hook::MergeOptions::FromEnvironment());
+  if (!status_or_result.ok()) {
+    LOG(ERROR) << status_or_result.status();
+    return 1;
+  }
+  std::printf("Merged %zu entries into %zu entries using %zu sorted runs.\n",
+              status_or_result->num_input_entries, status_or_result->num_output_entries,
+              status_or_result->num_runs);
+  return 0;
+}
+
+// Duplicates `fd` with the close-on-exec flag, so that the duplicate doesn't leak into the children
+// of the process. The duplicate is never one of the standard descriptors.
+absl::StatusOr<FD> DuplicateFD(int const fd) {
+  FD duplicate{::fcntl(fd, F_DUPFD_CLOEXEC, 3)};  // NOLINT(cppcoreguidelines-pro-type-vararg)
+  if (!duplicate) {
+    return absl::ErrnoToStatus(errno, "fcntl");
+  }
+  return std::move(duplicate);
+}
+
+// Returns the path to look up for the `path` argument of a query, spelled the way the hook records
+// it so that e.g. a symlinked path finds the entry of the file it points to if symlinks are
+// resolved.
+absl::StatusOr<std::string> GetQueryPath(std::string_view const path) {
+  DEFINE_CONST_OR_RETURN(cwd, comp_db_hook::GetCurrentDirectory());
+  DEFINE_VAR_OR_RETURN(cache_path, GetSidecarFilePath("paths"));
+  PathCanonicalizer canonicalizer{
+      PathCanonicalizer::GetOptionsFromEnvironment(std::move(cache_path))};
+  return canonicalizer.Canonicalize(JoinPath(cwd, path));
+}
+
+// Implements `comp_db_hook query [--prefix] PATH`. The matching entries are printed as a JSON
+// compilation database. Querying a file that has no entry fails, while querying a directory that
+// has none prints an empty database.
+int RunQuery(absl::Span<char* const> const arguments) {
+  comp_db_hook::Query query;
+  if (arguments.size() == 2 && std::string_view(arguments[0]) == "--prefix") {
+    query.prefix = true;
+  } else if (arguments.size() != 1) {
+    LOG(ERROR) << "Usage: comp_db_hook query [--prefix] PATH";
+    return 1;
+  }
+  auto status_or_path = GetQueryPath(arguments.back());
+  if (!status_or_path.ok()) {
+    LOG(ERROR) << status_or_path.status();
+    return 1;
+  }
+  query.path = std::move(status_or_path).value();
+  auto const status_or_texts = comp_db_hook::QueryCommandFile(query);
+  if (!status_or_texts.ok()) {
+    LOG(ERROR) << status_or_texts.status();
+    return 1;
+  }
+  auto const& texts = status_or_texts.value();
+  if (texts.empty() && !query.prefix) {
+    LOG(ERROR) << "No entry for " << query.path;
+    return 1;
+  }
+  std::string output = "[";
+  for (size_t i = 0; i < texts.size(); ++i) {
+    absl::StrAppend(&output, i > 0 ? ",\n  " : "\n  ", texts[i]);
+  }
+  absl::StrAppend(&output, texts.empty() ? "]\n" : "\n]\n");
+  std::fwrite(output.data(), 1, output.size(), stdout);
+  return 0;
+}
+
+// Exports the entries matching `query` to the file at `output_path`, which is replaced atomically.
+absl::StatusOr<size_t> ExportToFile(comp_db_hook::Query const& query,
+                                    std::string const& output_path) {
+  auto const temp_path = absl::StrCat(output_path, ".tmp");
+  size_t num_entries = 0;
+  {
+    FD const output{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+        temp_path.c_str(), /*flags=*/O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0664)};
+    if (!output) {
+      return absl::ErrnoToStatus(errno, "open");
+    }
+    DEFINE_CONST_OR_RETURN(num_exported, comp_db_hook::ExportCommandFile(query, output));
+    num_entries = num_exported;
+  }
+  if (::rename(temp_path.c_str(), output_path.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rename");
+  }
+  return num_entries;
+}
+
+// Exports the entries matching `query` to the standard output.
+absl::StatusOr<size_t> ExportToStandardOutput(comp_db_hook::Query const& query) {
+  DEFINE_CONST_OR_RETURN(output, DuplicateFD(STDOUT_FILENO));
+  return comp_db_hook::ExportCommandFile(query, output);
+}
+
+// Implements `comp_db_hook export [--prefix] PATH OUTPUT`. The matching entries are written to
+// OUTPUT as a standalone compilation database, or to the standard output if OUTPUT is `-`. Like
+// `query`, exporting a file that has no entry fails.
+int RunExport(absl::Span<char* const> const arguments) {
+  comp_db_hook::Query query;
+  if (arguments.size() == 3 && std::string_view(arguments[0]) == "--prefix") {
+    query.prefix = true;
+  } else if (arguments.size() != 2) {
+    LOG(ERROR) << "Usage: comp_db_hook export [--prefix] PATH OUTPUT";
+    return 1;
+  }
+  auto status_or_path = GetQueryPath(arguments[arguments.size() - 2]);
+  if (!status_or_path.ok()) {
+    LOG(ERROR) << status_or_path.status();
+    return 1;
+  }
+  query.path = std::move(status_or_path).value();
+  std::string const output_path = arguments.back();
+  absl::StatusOr<size_t> status_or_num_entries;
+  if (output_path == "-") {
+    status_or_num_entries = ExportToStandardOutput(query);
+  } else {
+    status_or_num_entries = ExportToFile(query, output_path);
+  }
+  if (!status_or_num_entries.ok()) {
+    LOG(ERROR) << status_or_num_entries.status();
+    return 1;
+  }
+  if (status_or_num_entries.value() == 0 && !query.prefix) {
+    LOG(ERROR) << "No entry for " << query.path;
+    return 1;
+  }
+  if (output_path != "-") {
+    std::printf("Exported %zu entries to %s.\n", status_or_num_entries.value(),
+                output_path.c_str());
+  }
+  return 0;
+}
+
+// Returns the changes of the database since generation `since` (see `ReadChangesSince`).
+absl::StatusOr<comp_db_hook::ChangesSince> ReadChanges(int64_t const since) {
+  DEFINE_CONST_OR_RETURN(generation_path, GetSidecarFilePath("generation"));
+  DEFINE_CONST_OR_RETURN(log_path, GetSidecarFilePath("changes"));
+  DEFINE_CONST_OR_RETURN(fd, comp_db_hook::OpenCommandFile());
+  DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(fd));
+  return comp_db_hook::ReadChangesSince(generation_path, log_path, since);
+}
+
+// Implements `comp_db_hook changes [SINCE]`. The first line of the output is the current generation
+// of the database. If SINCE is specified it's followed either by one line per changed source file,
+// with the kind of change and the path separated by a tab, or by `reset` if the changes since SINCE
+// are no longer known and the whole database must be read again.
+int RunChanges(absl::Span<char* const> const arguments) {
+  int64_t since = 0;
+  if (arguments.size() > 1 || (arguments.size() == 1 && !absl::SimpleAtoi(arguments[0], &since))) {
+    LOG(ERROR) << "Usage: comp_db_hook changes [SINCE]";
+    return 1;
+  }
+  auto const status_or_changes = ReadChanges(since);
+  if (!status_or_changes.ok()) {
+    LOG(ERROR) << status_or_changes.status();
+    return 1;
+  }
+  auto const& changes = status_or_changes.value();
+  std::string output = absl::StrCat("generation ", changes.generation, "\n");
+  if (!arguments.empty() && !changes.complete) {
+    output += "reset\n";
+  } else if (!arguments.empty()) {
+    for (auto const& change : changes.changes) {
+      absl::StrAppend(&output, comp_db_hook::GetChangeKindName(change.kind), "\t", change.path,
+                      "\n");
+    }
+  }
+  std::fwrite(output.data(), 1, output.size(), stdout);
+  return 0;
+}
+
+// Implements `comp_db_hook concat`.
+int RunConcatenation() {
+  auto const num_shards = comp_db_hook::GetNumShards();
+  if (num_shards == 0) {
+    LOG(ERROR) << "The database isn't sharded, set COMP_DB_HOOK_SHARDS.";
+    return 1;
+  }
+  auto const status_or_cwd = GetWorkspaceDirectory();
+  if (!status_or_cwd.ok()) {
+    LOG(ERROR) << status_or_cwd.status();
+    return 1;
+  }
+  auto const status_or_num_entries =
+      comp_db_hook::ConcatenateShards(status_or_cwd.value(), num_shards);
+  if (!status_or_num_entries.ok()) {
+    LOG(ERROR) << status_or_num_entries.status();
+    return 1;
+  }
+  std::printf("Concatenated %zu entries from %zu shards.\n", status_or_num_entries.value(),
+              num_shards);
+  return 0;
+}
+
+// Implements `comp_db_hook persist`.
+int RunPersist() {
+  auto const status_or_cwd = GetWorkspaceDirectory();
+  if (!status_or_cwd.ok()) {
+    LOG(ERROR) << status_or_cwd.status();
+    return 1;
+  }
+  auto const& cwd = status_or_cwd.value();
+  if (!comp_db_hook::IsStagingEnabled()) {
+    LOG(ERROR) << "The database isn't staged, set COMP_DB_HOOK_STAGING_DIR.";
+    return 1;
+  }
+  // The databases of the package roots are staged separately.
+  std::vector<std::string> directories{cwd};
+  auto const package_roots = PackageRoots::FromEnvironment(cwd);
+  directories.insert(directories.end(), package_roots.roots().begin(),
+                     package_roots.roots().end());
+  size_t num_persisted = 0;
+  for (auto const& directory : directories) {
+    auto const status_or_persisted = comp_db_hook::PersistDatabase(
+        directory, comp_db_hook::GetStagingDirectory(directory).value());
+    if (!status_or_persisted.ok()) {
+      LOG(ERROR) << status_or_persisted.status();
+      return 1;
+    }
+    num_persisted += status_or_persisted.value() ? 1 : 0;
+  }
+  if (num_persisted > 0) {
+    std::printf("Persisted %zu staged databases.\n", num_persisted);
+  } else {
+    std::printf("Nothing to persist.\n");
+  }
+  return 0;
+}
+
+// Handles a request of the persistent worker mode: the source files it compiles are added to
+// `pending_files`, replacing the pending entries of the same files, and the compiler is run with
+// its arguments. `expander` is shared by all the requests, so that the response files common to
+// many compilations are only read once.
+comp_db_hook::WorkResponse HandleWorkRequest(comp_db_hook::WorkRequest const& request,
+                                             comp_db_hook::ResponseFileExpander* const expander,
+                                             SourceFileSet* const pending_files) {
+  std::vector<std::string> arguments{GetCompilerName()};
+  auto const& maybe_arguments = request.get<kWorkArgumentsField>();
+  if (maybe_arguments.has_value()) {
+    arguments.insert(arguments.end(), maybe_arguments->begin(), maybe_arguments->end());
+  }
+  comp_db_hook::WorkResponse response;
+  response.get<kRequestIdField>() = request.get<kRequestIdField>().value_or(0);
+  auto status_or_files = GetCompiledFiles(expander, arguments);
+  if (!status_or_files.ok()) {
+    // Unlike the hook the worker doesn't crash, so that it keeps serving the other requests.
+    LOG(ERROR) << "Failed to record the compilation: " << status_or_files.status();
+  } else if (status_or_files->has_value()) {
+    for (auto& file : status_or_files->value()) {
+      pending_files->erase(file);
+      pending_files->insert(std::move(file));
+    }
+  }
+  auto& output = response.get<kOutputField>();
+  auto const status_or_exit_code = comp_db_hook::RunCompiler(arguments, &output);
+  if (status_or_exit_code.ok()) {
+    response.get<kExitCodeField>() = status_or_exit_code.value();
+  } else {
+    response.get<kExitCodeField>() = 1;
+    absl::StrAppend(&output, status_or_exit_code.status().ToString(), "\n");
+  }
+  return response;
+}
+
+// Implements the persistent worker mode (see `IsPersistentWorker`). The compiler runs as a child of
+// the worker, while the compiled source files are recorded in the database in batches, at most
+// `COMP_DB_HOOK_WORKER_FLUSH_INTERVAL` seconds (5 by default) after the first one of a batch and
+// when Bazel shuts the worker down, either by closing its input or with SIGTERM or SIGINT, so that
+// a single rewrite of the database covers all the compilations of the batch.
+int RunPersistentWorker() {
+  auto const flush_interval =
+      comp_db_hook::GetIntEnv(kWorkerFlushIntervalEnvVar, kDefaultWorkerFlushInterval);
+  auto status_or_input = DuplicateFD(STDIN_FILENO);
+  if (!status_or_input.ok()) {
+    LOG(ERROR) << status_or_input.status();
+    return 1;
+  }
+  comp_db_hook::WorkRequestReader reader{std::move(status_or_input).value()};
+  if (auto const status = reader.StopOnSignals(); !status.ok()) {
+    LOG(WARNING) << "Failed to install the signal handlers: " << status;
+  }
+  comp_db_hook::ResponseFileExpander expander;
+  auto status_or_output = DuplicateFD(STDOUT_FILENO);
+  if (!status_or_output.ok()) {
+    LOG(ERROR) << status_or_output.status();
+    return 1;
+  }
+  FD const output = std::move(status_or_output).value();
+  // The standard output carries the work responses, so nothing else may be written to it.
+  if (::dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+    LOG(ERROR) << absl::ErrnoToStatus(errno, "dup2");
+    return 1;
+  }
+  SourceFileSet pending_files;
+  time_t pending_since = 0;
+  auto const flush = [&] {
+    if (pending_files.empty()) {
+      return;
+    }
+    if (auto const status = UpdateCommandFile(std::move(pending_files)); !status.ok()) {
+      LOG(ERROR) << "Failed to update compile_commands.json: " << status;
+    }
+    pending_files = SourceFileSet();
+    comp_db_hook::MaybeCollectGarbageInBackground();
+  };
+  while (true) {
+    int timeout_ms = -1;
+    if (!pending_files.empty()) {
+      // Computed so that neither a huge flush interval nor its conversion to milliseconds overflow.
+      int64_t const elapsed = ::time(nullptr) - pending_since;
+      int64_t const remaining = flush_interval > elapsed ? flush_interval - elapsed : 0;
+      timeout_ms = static_cast<int>(std::min<int64_t>(remaining, INT_MAX / 1000) * 1000);
+    }
+    auto status_or_request = reader.Next(timeout_ms);
+    if (!status_or_request.ok()) {
+      flush();
+      if (absl::IsOutOfRange(status_or_request.status())) {
+        return 0;
+      }
+      if (absl::IsCancelled(status_or_request.status())) {
+        return 128 + reader.stop_signal();
+      }
+      LOG(ERROR) << status_or_request.status();
+      return 1;
+    }
+    if (status_or_request->has_value()) {
+      bool const was_empty = pending_files.empty();
+      auto const response =
+          HandleWorkRequest(status_or_request->value(), &expander, &pending_files);
+      if (was_empty) {
+        pending_since = ::time(nullptr);
+      }
+      if (auto const status = comp_db_hook::WriteWorkResponse(output, response); !status.ok()) {
+        LOG(ERROR) << status;
+        flush();
+        return 1;
+      }
+    }
+    if (!pending_files.empty() && ::time(nullptr) - pending_since >= flush_interval) {
+      flush();
+    }
+  }
+}
+
+// Implements `comp_db_hook serve`.
+int RunServer() {
+  LOG(ERROR) << comp_db_hook::RunQueryServer();
+  return 1;
 }
 
 }  // namespace
 
 int main(int const argc, char* const argv[]) {
   absl::InitializeLog();
-  CHECK_OK(UpdateCommandFile(argc, argv));
+  // Subcommands are recognized by the first argument, which is never a meaningful compiler argument
+  // on its own.
+  if (argc == 2 && std::string_view(argv[1]) == "gc") {
+    return RunGarbageCollection();
+  }
+  if (argc >= 2 && std::string_view(argv[1]) == "merge") {
+    return RunMerge(absl::MakeConstSpan(argv + 2, argc - 2));
+  }
+  if (argc >= 2 && std::string_view(argv[1]) == "query") {
+    return RunQuery(absl::MakeConstSpan(argv + 2, argc - 2));
+  }
+  if (argc >= 2 && std::string_view(argv[1]) == "export") {
+    return RunExport(absl::MakeConstSpan(argv + 2, argc - 2));
+  }
+  if (argc >= 2 && std::string_view(argv[1]) == "changes") {
+    return RunChanges(absl::MakeConstSpan(argv + 2, argc - 2));
+  }
+  if (argc == 2 && std::string_view(argv[1]) == "concat") {
+    return RunConcatenation();
+  }
+  if (argc == 2 && std::string_view(argv[1]) == "persist") {
+    return RunPersist();
+  }
+  if (argc == 2 && std::string_view(argv[1]) == "serve") {
+    return RunServer();
+  }
+  if (comp_db_hook::IsPersistentWorker(absl::MakeConstSpan(argv + 1, argc - 1))) {
+    return RunPersistentWorker();
+  }
+  comp_db_hook::ResponseFileExpander expander;
+  auto status_or_files = GetCompiledFiles(&expander, MakeArguments(argc, argv));
+  CHECK_OK(status_or_files.status());
+  if (status_or_files->has_value()) {
+    CHECK_OK(UpdateCommandFile(std::move(status_or_files->value())));
+    comp_db_hook::MaybeCollectGarbageInBackground();
+  }
   ::execvp(GetCompilerName().c_str(), argv);
   LOG(ERROR) << absl::ErrnoToStatus(errno, "execvp");
   return 1;
@@ -0,0 +1,65 @@
+#include "src/config.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "common/env.h"
+
+namespace comp_db_hook {
+
+bool GetBoolEnv(std::string_view const name, bool const default_value) {
+  auto const maybe_value = tsdb2::common::GetEnv(std::string(name));
+  if (!maybe_value.has_value()) {
+    return default_value;
+  }
+  std::string_view const value = maybe_value.value();
+  if (value == "1" || absl::EqualsIgnoreCase(value, "true") ||
+      absl::EqualsIgnoreCase(value, "yes") || absl::EqualsIgnoreCase(value, "on")) {
+    return true;
+  }
+  if (value == "0" || absl::EqualsIgnoreCase(value, "false") ||
+      absl::EqualsIgnoreCase(value, "no") || absl::EqualsIgnoreCase(value, "off")) {
+    return false;
+  }
+  LOG(WARNING) << "Invalid boolean value \"" << value << "\" in " << name << ", defaulting to "
+               << (default_value ? "true" : "false");
+  return default_value;
+}
+
+int64_t GetIntEnv(std::string_view const name, int64_t const default_value) {
+  auto const maybe_value = tsdb2::common::GetEnv(std::string(name));
+  if (!maybe_value.has_value()) {
+    return default_value;
+  }
+  int64_t value = 0;
+  if (absl::SimpleAtoi(maybe_value.value(), &value)) {
+    return value;
+  }
+  LOG(WARNING) << "Invalid integer value \"" << maybe_value.value() << "\" in " << name
+               << ", defaulting to " << default_value;
+  return default_value;
+}
+
+std::vector<std::string> GetListEnv(std::string_view const name) {
+  auto const maybe_value = tsdb2::common::GetEnv(std::string(name));
+  if (!maybe_value.has_value()) {
+    return {};
+  }
+  std::vector<std::string> result;
+  for (std::string_view element : absl::StrSplit(maybe_value.value(), ',')) {
+    element = absl::StripAsciiWhitespace(element);
+    if (!element.empty()) {
+      result.emplace_back(element);
+    }
+  }
+  return result;
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,26 @@
+#ifndef __COMP_DB_HOOK_CONFIG_H__
+#define __COMP_DB_HOOK_CONFIG_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace comp_db_hook {
+
+// Reads a boolean setting from the environment variable `name`. "1", "true", "yes" and "on" are
+// true, "0", "false", "no" and "off" are false (all case insensitive). Unset variables and other
+// values result in `default_value`.
+bool GetBoolEnv(std::string_view name, bool default_value);
+
+// Reads an integer setting from the environment variable `name`. Unset variables and values that
+// aren't valid integers result in `default_value`.
+int64_t GetIntEnv(std::string_view name, int64_t default_value);
+
+// Reads a comma-separated list from the environment variable `name`. Whitespace around the elements
+// is trimmed and empty elements are dropped. Returns an empty list if the variable is unset.
+std::vector<std::string> GetListEnv(std::string_view name);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_CONFIG_H__
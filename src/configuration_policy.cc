@@ -0,0 +1,120 @@
+#include "src/configuration_policy.h"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/types/span.h"
+#include "common/env.h"
+#include "src/config.h"
+#include "src/driver_options.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+std::string_view constexpr kConfigurationPolicyEnvVar = "COMP_DB_HOOK_CONFIGURATION_POLICY";
+std::string_view constexpr kPreferredConfigurationsEnvVar =
+    "COMP_DB_HOOK_PREFERRED_CONFIGURATIONS";
+
+std::string_view constexpr kBazelOut = "bazel-out/";
+
+// Matches `text` against `pattern`, where `*` matches any sequence of characters.
+bool MatchesWildcard(std::string_view pattern, std::string_view text) {
+  size_t star = std::string_view::npos;
+  size_t backtrack = 0;
+  size_t p = 0;
+  size_t t = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      backtrack = t;
+    } else if (p < pattern.size() && pattern[p] == text[t]) {
+      ++p;
+      ++t;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      t = ++backtrack;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+}  // namespace
+
+std::string GetConfigurationFingerprint(absl::Span<std::string const> const arguments) {
+  // The driver honors the last output option.
+  std::string_view output;
+  for (size_t i = 1; i < arguments.size(); ++i) {
+    auto const match = MatchDriverOption(arguments, i);
+    if (!match.has_value()) {
+      continue;
+    }
+    std::string_view const spelling = match->option->spelling;
+    if (spelling == "-o" || spelling == "--output" || spelling == "--output=") {
+      output = match->value;
+    }
+    i += match->num_args - 1;
+  }
+  auto offset = output.find(kBazelOut);
+  if (offset == std::string_view::npos) {
+    return "";
+  }
+  offset += kBazelOut.size();
+  auto const end = output.find('/', offset);
+  if (end == std::string_view::npos) {
+    return "";
+  }
+  return std::string(output.substr(offset, end - offset));
+}
+
+ConfigurationPolicy ConfigurationPolicy::FromEnvironment() {
+  auto const policy = tsdb2::common::GetEnv(std::string(kConfigurationPolicyEnvVar));
+  if (!policy.has_value() || policy.value() == "last") {
+    return ConfigurationPolicy(Kind::kLast);
+  } else if (policy.value() == "first") {
+    return ConfigurationPolicy(Kind::kFirst);
+  } else if (policy.value() == "prefer") {
+    return ConfigurationPolicy(Kind::kPrefer, GetListEnv(kPreferredConfigurationsEnvVar));
+  } else {
+    LOG(WARNING) << "Invalid configuration policy \"" << policy.value() << "\" in "
+                 << kConfigurationPolicyEnvVar << ", defaulting to \"last\".";
+    return ConfigurationPolicy(Kind::kLast);
+  }
+}
+
+bool ConfigurationPolicy::ShouldReplace(std::string_view const existing,
+                                        std::string_view const incoming) const {
+  // Entries in the same configuration are always replaced, and so are entries whose configuration
+  // is unknown on either side since there's nothing to rank.
+  if (existing == incoming || existing.empty() || incoming.empty()) {
+    return true;
+  }
+  switch (kind_) {
+    case Kind::kFirst:
+      return false;
+    case Kind::kPrefer:
+      return GetPriority(incoming) <= GetPriority(existing);
+    default:
+      return true;
+  }
+}
+
+size_t ConfigurationPolicy::GetPriority(std::string_view const configuration) const {
+  for (size_t i = 0; i < preferred_.size(); ++i) {
+    if (MatchesWildcard(preferred_[i], configuration)) {
+      return i;
+    }
+  }
+  return preferred_.size();
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,75 @@
+#ifndef __COMP_DB_HOOK_CONFIGURATION_POLICY_H__
+#define __COMP_DB_HOOK_CONFIGURATION_POLICY_H__
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// Derives a fingerprint of the Bazel configuration a command line was issued for, i.e. the
+// `bazel-out/<configuration>/` path component of its primary output (e.g. `k8-fastbuild`, `k8-opt`
+// or `k8-opt-exec-ST-1234` in `-o bazel-out/k8-opt/bin/foo.o`). Paths in other arguments, such as
+// include directories of generated headers built in the exec configuration, don't count, so that
+// they don't make the same configuration look different. The result is empty if the output isn't
+// under `bazel-out`.
+std::string GetConfigurationFingerprint(absl::Span<std::string const> arguments);
+
+// Decides which entry to keep when the same source file is compiled in different configurations,
+// e.g. `-c opt` and `-c fastbuild`, or host and target. By default the last writer wins; the other
+// policies keep the entry from flip-flopping, and the database from being rewritten at every build,
+// when both configurations are built regularly.
+//
+// Entries compiled in the same configuration, or in an unknown one, are always replaced, so that
+// changes to the flags are picked up.
+class ConfigurationPolicy {
+ public:
+  enum class Kind {
+    // Keep the configuration the file was last compiled with. This is the default.
+    kLast,
+
+    // Keep the configuration the file was first recorded with. Note that the entry then sticks to
+    // that configuration until it's evicted or removed, even if it stops being built.
+    kFirst,
+
+    // Keep the configuration matching the earliest pattern in a preference list. Configurations
+    // with the same priority (including the ones matching no pattern) behave like `kLast`.
+    kPrefer,
+  };
+
+  // Reads the policy from the `COMP_DB_HOOK_CONFIGURATION_POLICY` environment variable (`first`,
+  // `last` or `prefer`) and the preference list from `COMP_DB_HOOK_PREFERRED_CONFIGURATIONS`, a
+  // comma-separated list of patterns where `*` matches any sequence of characters.
+  static ConfigurationPolicy FromEnvironment();
+
+  explicit ConfigurationPolicy(Kind const kind, std::vector<std::string> preferred = {})
+      : kind_(kind), preferred_(std::move(preferred)) {}
+
+  ~ConfigurationPolicy() = default;
+
+  ConfigurationPolicy(ConfigurationPolicy&&) noexcept = default;
+  ConfigurationPolicy& operator=(ConfigurationPolicy&&) noexcept = default;
+  ConfigurationPolicy(ConfigurationPolicy const&) = default;
+  ConfigurationPolicy& operator=(ConfigurationPolicy const&) = default;
+
+  Kind kind() const { return kind_; }
+
+  // Returns true iff an entry recorded with the `existing` configuration fingerprint must be
+  // replaced by one with the `incoming` fingerprint.
+  bool ShouldReplace(std::string_view existing, std::string_view incoming) const;
+
+ private:
+  // Returns the index of the first preferred pattern matching `configuration`, or the number of
+  // patterns if none matches.
+  size_t GetPriority(std::string_view configuration) const;
+
+  Kind kind_;
+  std::vector<std::string> preferred_;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_CONFIGURATION_POLICY_H__
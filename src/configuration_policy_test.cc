@@ -0,0 +1,156 @@
+#include "src/configuration_policy.h"
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::ConfigurationPolicy;
+using ::comp_db_hook::GetConfigurationFingerprint;
+
+TEST(GetConfigurationFingerprintTest, NoBazelOut) {
+  std::vector<std::string> const arguments{"clang", "-c", "foo.cc", "-Iinclude", "-o", "foo.o"};
+  EXPECT_EQ(GetConfigurationFingerprint(arguments), "");
+}
+
+TEST(GetConfigurationFingerprintTest, NoOutput) {
+  std::vector<std::string> const arguments{"clang", "-c", "foo.cc",
+                                           "-Ibazel-out/k8-fastbuild/bin/include"};
+  EXPECT_EQ(GetConfigurationFingerprint(arguments), "");
+}
+
+TEST(GetConfigurationFingerprintTest, Output) {
+  std::vector<std::string> const arguments{"clang", "-c", "foo.cc",
+                                           "-Ibazel-out/k8-fastbuild/bin/include",
+                                           "-o", "bazel-out/k8-fastbuild/bin/foo.o"};
+  EXPECT_EQ(GetConfigurationFingerprint(arguments), "k8-fastbuild");
+}
+
+TEST(GetConfigurationFingerprintTest, OutputSpellings) {
+  EXPECT_EQ(GetConfigurationFingerprint(std::vector<std::string>{
+                "clang", "-c", "foo.cc", "-obazel-out/k8-opt/bin/foo.o"}),
+            "k8-opt");
+  EXPECT_EQ(GetConfigurationFingerprint(std::vector<std::string>{
+                "clang", "-c", "foo.cc", "--output", "bazel-out/k8-opt/bin/foo.o"}),
+            "k8-opt");
+  EXPECT_EQ(GetConfigurationFingerprint(std::vector<std::string>{
+                "clang", "-c", "foo.cc", "--output=/x/execroot/ws/bazel-out/k8-opt/bin/foo.o"}),
+            "k8-opt");
+}
+
+TEST(GetConfigurationFingerprintTest, LastOutputWins) {
+  std::vector<std::string> const arguments{"clang", "-c", "foo.cc",
+                                           "-o", "bazel-out/k8-fastbuild/bin/foo.o",
+                                           "-o", "bazel-out/k8-opt/bin/foo.o"};
+  EXPECT_EQ(GetConfigurationFingerprint(arguments), "k8-opt");
+}
+
+TEST(GetConfigurationFingerprintTest, IgnoresOtherPaths) {
+  // Include directories of generated headers are often in other configurations, e.g. the exec one.
+  std::vector<std::string> const arguments{
+      "clang",
+      "-Ibazel-out/k8-opt-exec-ST-1234/bin:bazel-out/k8-dbg/bin",
+      "-MF",
+      "bazel-out/k8-dbg/bin/foo.d",
+      "-o",
+      "bazel-out/k8-opt/bin/foo.o",
+      "-Ibazel-out/k8-opt/genfiles",
+  };
+  EXPECT_EQ(GetConfigurationFingerprint(arguments), "k8-opt");
+}
+
+TEST(GetConfigurationFingerprintTest, IgnoresIncompleteComponents) {
+  EXPECT_EQ(GetConfigurationFingerprint(std::vector<std::string>{"clang", "-o", "bazel-out/"}), "");
+  EXPECT_EQ(
+      GetConfigurationFingerprint(std::vector<std::string>{"clang", "-o", "bazel-out/k8-opt"}), "");
+  EXPECT_EQ(GetConfigurationFingerprint(std::vector<std::string>{"clang", "-o"}), "");
+}
+
+TEST(ConfigurationPolicyTest, FromEnvironment) {
+  ::unsetenv("COMP_DB_HOOK_CONFIGURATION_POLICY");
+  EXPECT_EQ(ConfigurationPolicy::FromEnvironment().kind(), ConfigurationPolicy::Kind::kLast);
+  ::setenv("COMP_DB_HOOK_CONFIGURATION_POLICY", "first", /*overwrite=*/1);
+  EXPECT_EQ(ConfigurationPolicy::FromEnvironment().kind(), ConfigurationPolicy::Kind::kFirst);
+  ::setenv("COMP_DB_HOOK_CONFIGURATION_POLICY", "prefer", /*overwrite=*/1);
+  EXPECT_EQ(ConfigurationPolicy::FromEnvironment().kind(), ConfigurationPolicy::Kind::kPrefer);
+  ::setenv("COMP_DB_HOOK_CONFIGURATION_POLICY", "bogus", /*overwrite=*/1);
+  EXPECT_EQ(ConfigurationPolicy::FromEnvironment().kind(), ConfigurationPolicy::Kind::kLast);
+  ::unsetenv("COMP_DB_HOOK_CONFIGURATION_POLICY");
+}
+
+TEST(ConfigurationPolicyTest, Last) {
+  ConfigurationPolicy const policy{ConfigurationPolicy::Kind::kLast};
+  EXPECT_TRUE(policy.ShouldReplace("k8-opt", "k8-opt"));
+  EXPECT_TRUE(policy.ShouldReplace("k8-opt", "k8-fastbuild"));
+  EXPECT_TRUE(policy.ShouldReplace("", "k8-fastbuild"));
+}
+
+TEST(ConfigurationPolicyTest, First) {
+  ConfigurationPolicy const policy{ConfigurationPolicy::Kind::kFirst};
+  EXPECT_TRUE(policy.ShouldReplace("k8-opt", "k8-opt"));
+  EXPECT_FALSE(policy.ShouldReplace("k8-opt", "k8-fastbuild"));
+  // Unknown configurations can't be ranked.
+  EXPECT_TRUE(policy.ShouldReplace("", "k8-fastbuild"));
+  EXPECT_TRUE(policy.ShouldReplace("k8-fastbuild", ""));
+}
+
+TEST(ConfigurationPolicyTest, Prefer) {
+  ConfigurationPolicy const policy{ConfigurationPolicy::Kind::kPrefer, {"*-fastbuild", "k8-opt"}};
+  EXPECT_TRUE(policy.ShouldReplace("k8-opt", "k8-opt"));
+  EXPECT_TRUE(policy.ShouldReplace("k8-opt", "k8-fastbuild"));
+  EXPECT_FALSE(policy.ShouldReplace("k8-fastbuild", "k8-opt"));
+  EXPECT_FALSE(policy.ShouldReplace("k8-opt", "k8-opt-exec-ST-1234"));
+  EXPECT_TRUE(policy.ShouldReplace("k8-opt-exec-ST-1234", "k8-opt"));
+  // Configurations with the same priority behave like `kLast`.
+  EXPECT_TRUE(policy.ShouldReplace("k8-dbg", "k8-opt-exec-ST-1234"));
+  EXPECT_TRUE(policy.ShouldReplace("arm-fastbuild", "k8-fastbuild"));
+}
+
+// Tells whether an entry compiled with `existing` is replaced by a compilation with `incoming`.
+bool ShouldReplace(ConfigurationPolicy const& policy, std::vector<std::string> const& existing,
+                   std::vector<std::string> const& incoming) {
+  return policy.ShouldReplace(GetConfigurationFingerprint(existing),
+                              GetConfigurationFingerprint(incoming));
+}
+
+TEST(ConfigurationPolicyTest, IncludeOfAnotherConfiguration) {
+  std::vector<std::string> const existing{"clang", "-c", "foo.cc", "-Ibazel-out/k8-fastbuild/bin",
+                                          "-o", "bazel-out/k8-fastbuild/bin/foo.o"};
+  // The file now includes a header generated in the exec configuration, but it's still compiled in
+  // the same configuration.
+  std::vector<std::string> const incoming{"clang",
+                                          "-c",
+                                          "foo.cc",
+                                          "-Ibazel-out/k8-fastbuild/bin",
+                                          "-Ibazel-out/k8-opt-exec-ST-1234/bin",
+                                          "-o",
+                                          "bazel-out/k8-fastbuild/bin/foo.o"};
+  for (auto const kind : {ConfigurationPolicy::Kind::kLast, ConfigurationPolicy::Kind::kFirst,
+                          ConfigurationPolicy::Kind::kPrefer}) {
+    ConfigurationPolicy const policy{kind, {"k8-opt*"}};
+    EXPECT_TRUE(ShouldReplace(policy, existing, incoming));
+    EXPECT_TRUE(ShouldReplace(policy, incoming, existing));
+  }
+}
+
+TEST(ConfigurationPolicyTest, CompilationModeSwitch) {
+  std::vector<std::string> const fastbuild{"clang", "-c", "foo.cc", "-o",
+                                           "bazel-out/k8-fastbuild/bin/foo.o"};
+  std::vector<std::string> const opt{"clang", "-c", "foo.cc", "-O2", "-o",
+                                     "bazel-out/k8-opt/bin/foo.o"};
+  ConfigurationPolicy const last{ConfigurationPolicy::Kind::kLast};
+  EXPECT_TRUE(ShouldReplace(last, fastbuild, opt));
+  EXPECT_TRUE(ShouldReplace(last, opt, fastbuild));
+  ConfigurationPolicy const first{ConfigurationPolicy::Kind::kFirst};
+  EXPECT_FALSE(ShouldReplace(first, fastbuild, opt));
+  EXPECT_FALSE(ShouldReplace(first, opt, fastbuild));
+  ConfigurationPolicy const prefer{ConfigurationPolicy::Kind::kPrefer, {"k8-fastbuild"}};
+  EXPECT_FALSE(ShouldReplace(prefer, fastbuild, opt));
+  EXPECT_TRUE(ShouldReplace(prefer, opt, fastbuild));
+}
+
+}  // namespace
@@ -0,0 +1,497 @@
+#include "src/database_merger.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "common/utilities.h"
+#include "io/advisory_file_lock.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/change_log.h"
+#include "src/command_database.h"
+#include "src/config.h"
+#include "src/entry_scanner.h"
+#include "src/entry_writer.h"
+#include "src/file_io.h"
+#include "src/mapped_file.h"
+#include "src/shards.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+namespace json = ::tsdb2::json;
+
+std::string_view constexpr kMemoryEnvVar = "COMP_DB_HOOK_MERGE_MEMORY_MB";
+std::string_view constexpr kThreadsEnvVar = "COMP_DB_HOOK_MERGE_THREADS";
+
+int64_t constexpr kDefaultMemoryMegabytes = 256;
+size_t constexpr kMaxDefaultThreads = 4;
+
+// Maximum number of runs merged at once, which bounds the number of open files and read buffers.
+// Runs in excess are merged in several passes.
+size_t constexpr kMaxFanIn = 64;
+
+// Size of the read and write buffers of the temporary files.
+size_t constexpr kBufferSize = 64 * 1024;
+
+// How much of an input is processed before releasing the memory of its mapping.
+size_t constexpr kReleaseInterval = 1 << 20;
+
+// An entry of a database together with its sort key, i.e. the absolute path of its source file,
+// and its position in the inputs, which decides which entry wins among those of the same file.
+struct Record {
+  std::string key;
+  uint64_t sequence_number;
+  std::string text;
+};
+
+// Records are encoded in the temporary files as this header followed by the key and the text.
+struct RecordHeader {
+  uint32_t key_size;
+  uint32_t text_size;
+  uint64_t sequence_number;
+};
+
+// Creates a temporary file at `path` and unlinks it right away, so that it goes away with the
+// returned file descriptor.
+absl::StatusOr<FD> CreateTempFile(std::string const& path) {
+  FD fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      path.c_str(), /*flags=*/O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0600)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  if (::unlink(path.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "unlink");
+  }
+  return std::move(fd);
+}
+
+absl::Status Rewind(FD const& fd) {
+  if (::lseek(fd.get(), 0, SEEK_SET) < 0) {
+    return absl::ErrnoToStatus(errno, "lseek");
+  }
+  return absl::OkStatus();
+}
+
+class RunWriter {
+ public:
+  explicit RunWriter(FD const& fd) : fd_(fd) {}
+
+  ~RunWriter() = default;
+
+  RunWriter(RunWriter const&) = delete;
+  RunWriter& operator=(RunWriter const&) = delete;
+  RunWriter(RunWriter&&) = delete;
+  RunWriter& operator=(RunWriter&&) = delete;
+
+  absl::Status Write(std::string_view const key, uint64_t const sequence_number,
+                     std::string_view const text) {
+    RecordHeader const header{
+        .key_size = static_cast<uint32_t>(key.size()),
+        .text_size = static_cast<uint32_t>(text.size()),
+        .sequence_number = sequence_number,
+    };
+    buffer_.append(reinterpret_cast<char const*>(&header), sizeof(header));
+    buffer_.append(key);
+    buffer_.append(text);
+    if (buffer_.size() < kBufferSize) {
+      return absl::OkStatus();
+    }
+    return Flush();
+  }
+
+  absl::Status Flush() {
+    RETURN_IF_ERROR(WriteAll(fd_, buffer_));
+    buffer_.clear();
+    return absl::OkStatus();
+  }
+
+ private:
+  FD const& fd_;
+  std::string buffer_;
+};
+
+class RunReader {
+ public:
+  explicit RunReader(FD fd) : fd_(std::move(fd)) {}
+
+  ~RunReader() = default;
+
+  RunReader(RunReader&&) noexcept = default;
+  RunReader& operator=(RunReader&&) noexcept = default;
+  RunReader(RunReader const&) = delete;
+  RunReader& operator=(RunReader const&) = delete;
+
+  // Reads the next record. Returns false at the end of the run.
+  absl::StatusOr<bool> Next() {
+    DEFINE_CONST_OR_RETURN(has_header, Fill(sizeof(RecordHeader)));
+    if (!has_header) {
+      return false;
+    }
+    RecordHeader header{};
+    std::memcpy(&header, buffer_.data() + offset_, sizeof(header));
+    offset_ += sizeof(header);
+    DEFINE_CONST_OR_RETURN(has_record, Fill(header.key_size + header.text_size));
+    if (!has_record) {
+      return absl::DataLossError("truncated temporary file");
+    }
+    key_.assign(buffer_, offset_, header.key_size);
+    offset_ += header.key_size;
+    text_.assign(buffer_, offset_, header.text_size);
+    offset_ += header.text_size;
+    sequence_number_ = header.sequence_number;
+    return true;
+  }
+
+  std::string const& key() const { return key_; }
+  uint64_t sequence_number() const { return sequence_number_; }
+  std::string const& text() const { return text_; }
+
+ private:
+  // Makes sure that at least `size` unread bytes are buffered. Returns false if the file ends
+  // before any more bytes could be read.
+  absl::StatusOr<bool> Fill(size_t const size) {
+    if (buffer_.size() - offset_ >= size) {
+      return true;
+    }
+    buffer_.erase(0, offset_);
+    offset_ = 0;
+    char chunk[kBufferSize];
+    while (buffer_.size() < size) {
+      auto const result = ::read(fd_.get(), chunk, sizeof(chunk));
+      if (result < 0) {
+        return absl::ErrnoToStatus(errno, "read");
+      } else if (result == 0) {
+        if (buffer_.empty()) {
+          return false;
+        }
+        return absl::DataLossError("truncated temporary file");
+      }
+      buffer_.append(chunk, result);
+    }
+    return true;
+  }
+
+  FD fd_;
+  std::string buffer_;
+  size_t offset_ = 0;
+  std::string key_;
+  uint64_t sequence_number_ = 0;
+  std::string text_;
+};
+
+// Merges the sorted `runs`, passing the winning record of every key to `sink` in key order.
+template <typename Sink>
+absl::Status MergeRuns(std::vector<FD> runs, Sink const& sink) {
+  std::vector<RunReader> readers;
+  readers.reserve(runs.size());
+  for (auto& run : runs) {
+    readers.emplace_back(std::move(run));
+  }
+  auto const greater = [&readers](size_t const lhs, size_t const rhs) {
+    auto const& lhs_reader = readers[lhs];
+    auto const& rhs_reader = readers[rhs];
+    if (lhs_reader.key() != rhs_reader.key()) {
+      return lhs_reader.key() > rhs_reader.key();
+    }
+    return lhs_reader.sequence_number() > rhs_reader.sequence_number();
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap{greater};
+  for (size_t i = 0; i < readers.size(); ++i) {
+    DEFINE_CONST_OR_RETURN(has_record, readers[i].Next());
+    if (has_record) {
+      heap.push(i);
+    }
+  }
+  std::string key;
+  uint64_t sequence_number = 0;
+  std::string text;
+  while (!heap.empty()) {
+    key = readers[heap.top()].key();
+    // The records of a key come out in order of sequence number, so the last one wins.
+    do {
+      size_t const i = heap.top();
+      heap.pop();
+      sequence_number = readers[i].sequence_number();
+      text = readers[i].text();
+      DEFINE_CONST_OR_RETURN(has_record, readers[i].Next());
+      if (has_record) {
+        heap.push(i);
+      }
+    } while (!heap.empty() && readers[heap.top()].key() == key);
+    RETURN_IF_ERROR(sink(key, sequence_number, text));
+  }
+  return absl::OkStatus();
+}
+
+// Splits a sequence of records into runs that fit in the memory budget, sorting and spilling up to
+// `num_threads` runs at the same time. Only the last record of every key is kept in each run.
+class RunGenerator {
+ public:
+  explicit RunGenerator(std::string_view const temp_path_prefix, MergeOptions const& options)
+      : temp_path_prefix_(temp_path_prefix),
+        max_batch_size_(options.memory_budget / std::max<size_t>(options.num_threads, 1)),
+        max_in_flight_(std::max<size_t>(options.num_threads, 1) - 1) {}
+
+  ~RunGenerator() { Join(); }
+
+  RunGenerator(RunGenerator const&) = delete;
+  RunGenerator& operator=(RunGenerator const&) = delete;
+  RunGenerator(RunGenerator&&) = delete;
+  RunGenerator& operator=(RunGenerator&&) = delete;
+
+  absl::Status Add(Record record) {
+    batch_size_ += sizeof(Record) + record.key.size() + record.text.size();
+    batch_.emplace_back(std::move(record));
+    if (batch_size_ < max_batch_size_) {
+      return absl::OkStatus();
+    }
+    return Spill();
+  }
+
+  // Spills the remaining records and returns the files of all runs.
+  absl::StatusOr<std::vector<FD>> Finish() {
+    if (!batch_.empty()) {
+      RETURN_IF_ERROR(Spill());
+    }
+    Join();
+    absl::MutexLock lock{&mutex_};
+    RETURN_IF_ERROR(status_);
+    return std::move(runs_);
+  }
+
+  size_t num_runs() const { return num_runs_; }
+
+ private:
+  absl::Status Spill() {
+    size_t const index = num_runs_++;
+    std::vector<Record> batch = std::move(batch_);
+    batch_.clear();
+    batch_size_ = 0;
+    if (max_in_flight_ == 0) {
+      WriteRun(index, std::move(batch));
+    } else {
+      if (in_flight_.size() >= max_in_flight_) {
+        in_flight_.front().join();
+        in_flight_.pop_front();
+      }
+      in_flight_.emplace_back([this, index, batch = std::move(batch)]() mutable {
+        WriteRun(index, std::move(batch));
+      });
+    }
+    absl::MutexLock lock{&mutex_};
+    return status_;
+  }
+
+  void WriteRun(size_t const index, std::vector<Record> batch) {
+    auto status_or_run = SortAndWrite(index, std::move(batch));
+    absl::MutexLock lock{&mutex_};
+    if (status_or_run.ok()) {
+      runs_.emplace_back(std::move(status_or_run).value());
+    } else if (status_.ok()) {
+      status_ = status_or_run.status();
+    }
+  }
+
+  absl::StatusOr<FD> SortAndWrite(size_t const index, std::vector<Record> batch) const {
+    std::sort(batch.begin(), batch.end(), [](Record const& lhs, Record const& rhs) {
+      if (lhs.key != rhs.key) {
+        return lhs.key < rhs.key;
+      }
+      return lhs.sequence_number < rhs.sequence_number;
+    });
+    DEFINE_VAR_OR_RETURN(fd, CreateTempFile(absl::StrCat(temp_path_prefix_, ".", index)));
+    RunWriter writer{fd};
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (i + 1 < batch.size() && batch[i + 1].key == batch[i].key) {
+        continue;
+      }
+      RETURN_IF_ERROR(writer.Write(batch[i].key, batch[i].sequence_number, batch[i].text));
+    }
+    RETURN_IF_ERROR(writer.Flush());
+    RETURN_IF_ERROR(Rewind(fd));
+    return std::move(fd);
+  }
+
+  void Join() {
+    for (auto& thread : in_flight_) {
+      thread.join();
+    }
+    in_flight_.clear();
+  }
+
+  std::string const temp_path_prefix_;
+  size_t const max_batch_size_;
+  size_t const max_in_flight_;
+
+  std::vector<Record> batch_;
+  size_t batch_size_ = 0;
+  size_t num_runs_ = 0;
+  std::deque<std::thread> in_flight_;
+
+  absl::Mutex mutex_;
+  std::vector<FD> runs_ ABSL_GUARDED_BY(mutex_);
+  absl::Status status_ ABSL_GUARDED_BY(mutex_);
+};
+
+// Reads the entries of the database at `path` one at a time and adds them to `generator`.
+// Malformed entries and entries without a `file` field are skipped.
+absl::Status ReadDatabase(std::string const& path, std::string_view const workspace_directory,
+                          uint64_t* const next_sequence_number, size_t* const num_entries,
+                          RunGenerator* const generator) {
+  FD const fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("open ", path));
+  }
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  size_t released = 0;
+  EntryScanner scanner{mapping.contents()};
+  for (auto maybe_text = scanner.Next(); maybe_text.has_value(); maybe_text = scanner.Next()) {
+    if (scanner.entry_offset() - released >= kReleaseInterval) {
+      mapping.Release(released, scanner.entry_offset());
+      released = scanner.entry_offset();
+    }
+    auto status_or_entry = json::Parse<CommandEntry>(maybe_text.value());
+    if (!status_or_entry.ok()) {
+      LOG(WARNING) << "Dropping malformed entry at offset " << scanner.entry_offset() << " of "
+                   << path << ": " << status_or_entry.status();
+      scanner.Resync();
+      continue;
+    }
+    auto const& entry = status_or_entry.value();
+    auto maybe_key = GetEntryPath(entry, workspace_directory);
+    if (!maybe_key.has_value()) {
+      LOG(WARNING) << "Dropping entry without a `file` field at offset " << scanner.entry_offset()
+                   << " of " << path;
+      continue;
+    }
+    RETURN_IF_ERROR(generator->Add(Record{
+        .key = std::move(maybe_key).value(),
+        .sequence_number = (*next_sequence_number)++,
+        .text = FormatEntry(entry),
+    }));
+    ++*num_entries;
+  }
+  if (scanner.num_dropped() > 0) {
+    LOG(WARNING) << "Dropped " << scanner.num_dropped() << " malformed regions of " << path;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+MergeOptions MergeOptions::FromEnvironment() {
+  size_t const num_cpus = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  auto const memory_megabytes = GetIntEnv(kMemoryEnvVar, kDefaultMemoryMegabytes);
+  auto const num_threads =
+      GetIntEnv(kThreadsEnvVar, std::min<int64_t>(num_cpus, kMaxDefaultThreads));
+  return MergeOptions{
+      .memory_budget = static_cast<size_t>(std::max<int64_t>(memory_megabytes, 1)) << 20,
+      .num_threads = static_cast<size_t>(std::max<int64_t>(num_threads, 1)),
+  };
+}
+
+absl::StatusOr<MergeResult> MergeDatabases(std::string_view const workspace_directory,
+                                           absl::Span<std::string const> const input_paths,
+                                           FD const& output_fd,
+                                           std::string_view const temp_path_prefix,
+                                           MergeOptions const& options) {
+  MergeResult result;
+  std::vector<FD> runs;
+  {
+    RunGenerator generator{temp_path_prefix, options};
+    uint64_t next_sequence_number = 0;
+    for (auto const& path : input_paths) {
+      RETURN_IF_ERROR(ReadDatabase(path, workspace_directory, &next_sequence_number,
+                                   &result.num_input_entries, &generator));
+    }
+    DEFINE_VAR_OR_RETURN(generated_runs, generator.Finish());
+    runs = std::move(generated_runs);
+    result.num_runs = generator.num_runs();
+  }
+  size_t next_index = result.num_runs;
+  while (runs.size() > kMaxFanIn) {
+    std::vector<FD> merged_runs;
+    for (size_t begin = 0; begin < runs.size(); begin += kMaxFanIn) {
+      size_t const end = std::min(begin + kMaxFanIn, runs.size());
+      std::vector<FD> group{std::make_move_iterator(runs.begin() + begin),
+                            std::make_move_iterator(runs.begin() + end)};
+      DEFINE_VAR_OR_RETURN(fd, CreateTempFile(absl::StrCat(temp_path_prefix, ".", next_index++)));
+      RunWriter writer{fd};
+      RETURN_IF_ERROR(MergeRuns(std::move(group), [&writer](std::string_view const key,
+                                                            uint64_t const sequence_number,
+                                                            std::string_view const text) {
+        return writer.Write(key, sequence_number, text);
+      }));
+      RETURN_IF_ERROR(writer.Flush());
+      RETURN_IF_ERROR(Rewind(fd));
+      merged_runs.emplace_back(std::move(fd));
+    }
+    runs = std::move(merged_runs);
+  }
+  DEFINE_VAR_OR_RETURN(writer, EntryWriter::Create(absl::StrCat(temp_path_prefix, ".out"),
+                                                   /*prefix_size=*/0));
+  RETURN_IF_ERROR(MergeRuns(std::move(runs),
+                            [&writer, &result](std::string_view, uint64_t,
+                                               std::string_view const text) {
+                              ++result.num_output_entries;
+                              return writer.WriteText(text);
+                            }));
+  RETURN_IF_ERROR(writer.CopyTo(output_fd));
+  return result;
+}
+
+absl::StatusOr<MergeResult> MergeIntoCommandFile(absl::Span<std::string const> const input_paths,
+                                                 MergeOptions const& options) {
+  if (GetNumShards() > 0) {
+    // The workspace database would be overwritten by the next concatenation of the shards.
+    return absl::FailedPreconditionError("merging into a sharded database is not supported");
+  }
+  DEFINE_CONST_OR_RETURN(workspace_directory, GetWorkspaceDirectory());
+  DEFINE_VAR_OR_RETURN(command_file_path, GetCommandFilePath());
+  DEFINE_CONST_OR_RETURN(temp_path_prefix, GetSidecarFilePath("merge"));
+  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile());
+  DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(fd));
+  std::vector<std::string> paths;
+  paths.reserve(input_paths.size() + 1);
+  paths.emplace_back(std::move(command_file_path));
+  paths.insert(paths.end(), input_paths.begin(), input_paths.end());
+  DEFINE_CONST_OR_RETURN(result,
+                         MergeDatabases(workspace_directory, paths, fd, temp_path_prefix, options));
+  // The changes made by a merge aren't tracked, so consumers have to start over.
+  DEFINE_CONST_OR_RETURN(generation_path, GetSidecarFilePath("generation"));
+  DEFINE_CONST_OR_RETURN(change_log_path, GetSidecarFilePath("changes"));
+  RETURN_IF_ERROR(ResetChanges(generation_path, change_log_path).status());
+  return result;
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,63 @@
+#ifndef __COMP_DB_HOOK_DATABASE_MERGER_H__
+#define __COMP_DB_HOOK_DATABASE_MERGER_H__
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "io/fd.h"
+
+namespace comp_db_hook {
+
+struct MergeOptions {
+  // Reads the options from the `COMP_DB_HOOK_MERGE_MEMORY_MB` and `COMP_DB_HOOK_MERGE_THREADS`
+  // environment variables.
+  static MergeOptions FromEnvironment();
+
+  // Approximate amount of memory used to buffer entries, split evenly among the threads.
+  size_t memory_budget = 256 << 20;
+
+  // Number of threads sorting runs concurrently.
+  size_t num_threads = 1;
+};
+
+struct MergeResult {
+  // Number of well-formed entries read from the inputs.
+  size_t num_input_entries = 0;
+
+  // Number of entries in the output, i.e. the input entries minus the duplicates.
+  size_t num_output_entries = 0;
+
+  // Number of sorted runs spilled to temporary files.
+  size_t num_runs = 0;
+};
+
+// Merges the compilation databases at `input_paths` into a single database sorted by the absolute
+// paths of the source files, with one entry per file, and writes it over `output_fd`. When a file
+// has more than one entry the last one wins, in the order of `input_paths` and then of the entries
+// within each input. Entries without a `directory` field are resolved against
+// `workspace_directory`.
+//
+// The merge runs in external memory: the inputs are read one entry at a time and split into runs
+// that fit in `options.memory_budget`, which are sorted in parallel and spilled to temporary files,
+// and then merged with a k-way merge. Temporary files are named after `temp_path_prefix` and
+// unlinked as soon as they're created.
+absl::StatusOr<MergeResult> MergeDatabases(std::string_view workspace_directory,
+                                           absl::Span<std::string const> input_paths,
+                                           tsdb2::io::FD const& output_fd,
+                                           std::string_view temp_path_prefix,
+                                           MergeOptions const& options);
+
+// Merges the databases at `input_paths` into the compilation database of the workspace, which
+// takes part in the merge as the first input. With no inputs this sorts and deduplicates the
+// compilation database. The database is locked for the whole operation. The changes of a merge
+// aren't logged, so the change log is reset (see `ResetChanges`). Fails if the database is sharded
+// (see `GetNumShards`).
+absl::StatusOr<MergeResult> MergeIntoCommandFile(absl::Span<std::string const> input_paths,
+                                                 MergeOptions const& options);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_DATABASE_MERGER_H__
@@ -0,0 +1,200 @@
+#include "src/database_merger.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+
+namespace {
+
+using ::comp_db_hook::kArgumentsField;
+using ::comp_db_hook::kFileField;
+using ::comp_db_hook::MergeDatabases;
+using ::comp_db_hook::MergeIntoCommandFile;
+using ::comp_db_hook::MergeOptions;
+using ::comp_db_hook::MergeResult;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::tsdb2::io::FD;
+
+// Returns the text of an entry for `file` whose last argument is `version`, so that tests can tell
+// which of several entries of the same file won.
+std::string MakeEntry(std::string_view const file, int const version) {
+  return absl::StrCat("{\"directory\": \"/w\", \"arguments\": [\"clang\", \"-DV=", version,
+                      "\"], \"file\": \"", file, "\"}");
+}
+
+class DatabaseMergerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/database_merger_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    output_path_ = absl::StrCat(directory_, "/compile_commands.json");
+    output_fd_ = FD(::open(output_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    ASSERT_TRUE(output_fd_);
+  }
+
+  void TearDown() override {
+    for (auto const& path : input_paths_) {
+      ::unlink(path.c_str());
+    }
+    ::unlink(output_path_.c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  // Writes a database with the given entries and returns its path.
+  std::string AddInput(std::vector<std::string> const& entries) {
+    auto path = absl::StrCat(directory_, "/input", input_paths_.size(), ".json");
+    FD const fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    EXPECT_TRUE(fd);
+    EXPECT_TRUE(
+        comp_db_hook::WriteAll(fd, absl::StrCat("[\n  ", absl::StrJoin(entries, ",\n  "), "\n]\n"))
+            .ok());
+    input_paths_.push_back(path);
+    return path;
+  }
+
+  MergeResult Merge(MergeOptions const& options) {
+    auto const status_or_result = MergeDatabases("/w", input_paths_, output_fd_,
+                                                 absl::StrCat(directory_, "/merge"), options);
+    EXPECT_TRUE(status_or_result.ok()) << status_or_result.status();
+    return status_or_result.value_or(MergeResult{});
+  }
+
+  // Returns the entries of the output as "<file> <last argument>" strings.
+  std::vector<std::string> ReadOutput() const {
+    auto status_or_contents = comp_db_hook::ReadFile(output_path_);
+    EXPECT_TRUE(status_or_contents.ok()) << status_or_contents.status();
+    auto const contents = std::move(status_or_contents).value_or(std::nullopt).value_or("");
+    std::vector<std::string> descriptions;
+    for (auto const& entry : comp_db_hook::SalvageCommandEntries(contents)) {
+      auto const& arguments = entry.get<kArgumentsField>();
+      descriptions.push_back(absl::StrCat(
+          entry.get<kFileField>().value_or(""), " ",
+          arguments.has_value() && !arguments->empty() ? arguments->back() : std::string()));
+    }
+    return descriptions;
+  }
+
+  std::string directory_;
+  std::string output_path_;
+  FD output_fd_;
+  std::vector<std::string> input_paths_;
+};
+
+TEST_F(DatabaseMergerTest, NoEntries) {
+  AddInput({});
+  auto const result = Merge(MergeOptions{});
+  EXPECT_EQ(result.num_input_entries, 0);
+  EXPECT_EQ(result.num_output_entries, 0);
+  EXPECT_THAT(ReadOutput(), IsEmpty());
+}
+
+TEST_F(DatabaseMergerTest, SortsByPath) {
+  AddInput({MakeEntry("c.cc", 1), MakeEntry("a.cc", 1), MakeEntry("/x/b.cc", 1)});
+  auto const result = Merge(MergeOptions{});
+  EXPECT_EQ(result.num_input_entries, 3);
+  EXPECT_EQ(result.num_output_entries, 3);
+  EXPECT_EQ(result.num_runs, 1);
+  EXPECT_THAT(ReadOutput(), ElementsAre("a.cc -DV=1", "c.cc -DV=1", "/x/b.cc -DV=1"));
+}
+
+TEST_F(DatabaseMergerTest, LastWriterWinsAcrossRuns) {
+  AddInput({MakeEntry("a.cc", 1), MakeEntry("b.cc", 1), MakeEntry("a.cc", 2)});
+  AddInput({MakeEntry("b.cc", 3), MakeEntry("c.cc", 3)});
+  AddInput({MakeEntry("./a.cc", 4)});
+  // Every entry goes in a run of its own, so all the duplicates are resolved by the k-way merge.
+  auto const result = Merge(MergeOptions{.memory_budget = 1, .num_threads = 1});
+  EXPECT_EQ(result.num_input_entries, 6);
+  EXPECT_EQ(result.num_output_entries, 3);
+  EXPECT_EQ(result.num_runs, 6);
+  EXPECT_THAT(ReadOutput(), ElementsAre("./a.cc -DV=4", "b.cc -DV=3", "c.cc -DV=3"));
+}
+
+TEST_F(DatabaseMergerTest, LastWriterWinsWithinRun) {
+  AddInput({MakeEntry("a.cc", 1), MakeEntry("b.cc", 1), MakeEntry("a.cc", 2)});
+  AddInput({MakeEntry("b.cc", 3)});
+  auto const result = Merge(MergeOptions{});
+  EXPECT_EQ(result.num_runs, 1);
+  EXPECT_THAT(ReadOutput(), ElementsAre("a.cc -DV=2", "b.cc -DV=3"));
+}
+
+TEST_F(DatabaseMergerTest, MultiPassMerge) {
+  std::vector<std::string> entries;
+  std::vector<std::string> expected;
+  // More runs than the maximum fan-in, with every file repeated in runs far apart so that the
+  // duplicates end up in different groups of the first pass.
+  for (int version = 0; version < 3; ++version) {
+    for (int i = 0; i < 100; ++i) {
+      entries.push_back(MakeEntry(absl::StrCat("f", 100 + i, ".cc"), version));
+    }
+  }
+  for (int i = 0; i < 100; ++i) {
+    expected.push_back(absl::StrCat("f", 100 + i, ".cc -DV=2"));
+  }
+  AddInput(entries);
+  for (size_t const num_threads : {1, 4}) {
+    auto const result = Merge(MergeOptions{.memory_budget = 1, .num_threads = num_threads});
+    EXPECT_EQ(result.num_input_entries, 300) << num_threads;
+    EXPECT_EQ(result.num_output_entries, 100) << num_threads;
+    EXPECT_EQ(result.num_runs, 300) << num_threads;
+    EXPECT_EQ(ReadOutput(), expected) << num_threads;
+  }
+}
+
+TEST_F(DatabaseMergerTest, BudgetSmallerThanOneEntry) {
+  std::string const file = absl::StrCat(std::string(10000, 'a'), ".cc");
+  AddInput({MakeEntry(file, 1), MakeEntry("b.cc", 1), MakeEntry(file, 2)});
+  // With more threads than bytes each thread gets an empty budget.
+  for (size_t const memory_budget : {0, 1, 100}) {
+    auto const result = Merge(MergeOptions{.memory_budget = memory_budget, .num_threads = 4});
+    EXPECT_EQ(result.num_output_entries, 2) << memory_budget;
+    EXPECT_EQ(result.num_runs, 3) << memory_budget;
+    EXPECT_THAT(ReadOutput(), ElementsAre(absl::StrCat(file, " -DV=2"), "b.cc -DV=1"))
+        << memory_budget;
+  }
+}
+
+TEST_F(DatabaseMergerTest, SkipsEntriesWithoutFile) {
+  AddInput({MakeEntry("a.cc", 1), "{\"directory\": \"/w\"}", "{\"file\": 42}"});
+  auto const result = Merge(MergeOptions{});
+  EXPECT_EQ(result.num_input_entries, 1);
+  EXPECT_THAT(ReadOutput(), ElementsAre("a.cc -DV=1"));
+}
+
+TEST_F(DatabaseMergerTest, MissingInput) {
+  input_paths_.push_back(absl::StrCat(directory_, "/missing.json"));
+  auto const status_or_result = MergeDatabases("/w", input_paths_, output_fd_,
+                                               absl::StrCat(directory_, "/merge"), MergeOptions{});
+  EXPECT_EQ(status_or_result.status().code(), absl::StatusCode::kNotFound);
+}
+
+TEST_F(DatabaseMergerTest, RejectsShardedDatabase) {
+  ::unsetenv("COMP_DB_HOOK_STAGING_DIR");
+  ::setenv("COMP_DB_HOOK_WORKSPACE_DIR", directory_.c_str(), /*overwrite=*/1);
+  ::setenv("COMP_DB_HOOK_SHARDS", "4", /*overwrite=*/1);
+  auto const status_or_result = MergeIntoCommandFile({}, MergeOptions{});
+  ::unsetenv("COMP_DB_HOOK_SHARDS");
+  ::unsetenv("COMP_DB_HOOK_WORKSPACE_DIR");
+  EXPECT_EQ(status_or_result.status().code(), absl::StatusCode::kFailedPrecondition);
+  // The database was left alone.
+  EXPECT_THAT(ReadOutput(), IsEmpty());
+  EXPECT_FALSE(comp_db_hook::Exists(absl::StrCat(directory_, "/.compile_commands.json.shards")));
+}
+
+}  // namespace
@@ -0,0 +1,255 @@
+#include "src/database_query.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "common/utilities.h"
+#include "io/advisory_file_lock.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/entry_writer.h"
+#include "src/file_io.h"
+#include "src/mapped_file.h"
+#include "src/snapshot.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+// What `EntryWriter` writes between two entries.
+std::string_view constexpr kEntrySeparator = ",\n  ";
+
+// Exported entries are buffered up to this size. Longer texts, e.g. large runs of adjacent entries,
+// are written directly.
+size_t constexpr kBufferSize = 64 * 1024;
+
+// Writes a compilation database made of the given entry texts to a file descriptor.
+class ExportWriter {
+ public:
+  explicit ExportWriter(FD const& fd) : fd_(fd), buffer_("[") {}
+
+  ~ExportWriter() = default;
+
+  ExportWriter(ExportWriter const&) = delete;
+  ExportWriter& operator=(ExportWriter const&) = delete;
+  ExportWriter(ExportWriter&&) = delete;
+  ExportWriter& operator=(ExportWriter&&) = delete;
+
+  // Appends the text of one or more entries. Several entries must be separated like in the database
+  // written by `EntryWriter`.
+  absl::Status WriteText(std::string_view const text) {
+    RETURN_IF_ERROR(Append(has_entries_ ? kEntrySeparator : "\n  "));
+    has_entries_ = true;
+    return Append(text);
+  }
+
+  // Ends the array and flushes the buffer.
+  absl::Status Finish() {
+    RETURN_IF_ERROR(Append(has_entries_ ? "\n]\n" : "]\n"));
+    RETURN_IF_ERROR(WriteAll(fd_, buffer_));
+    buffer_.clear();
+    return absl::OkStatus();
+  }
+
+ private:
+  absl::Status Append(std::string_view const text) {
+    if (buffer_.size() + text.size() < kBufferSize) {
+      buffer_.append(text);
+      return absl::OkStatus();
+    }
+    RETURN_IF_ERROR(WriteAll(fd_, buffer_));
+    buffer_.clear();
+    return WriteAll(fd_, text);
+  }
+
+  FD const& fd_;
+  std::string buffer_;
+  bool has_entries_ = false;
+};
+
+// Returns the smallest source file path matched by `query`. For prefix queries the trailing slash
+// keeps siblings like `dir-foo/a.cc`, which sort between `dir` and `dir/`, out of the range.
+std::string GetLowerBound(Query const& query) {
+  if (!query.prefix || absl::EndsWith(query.path, "/")) {
+    return query.path;
+  }
+  return absl::StrCat(query.path, "/");
+}
+
+// Tells whether `path` is matched by `query`, given the `lower_bound` of the query. The matching
+// paths are contiguous in path order, starting at the lower bound.
+bool Matches(Query const& query, std::string_view const lower_bound, std::string_view const path) {
+  if (query.prefix) {
+    return absl::StartsWith(path, lower_bound);
+  } else {
+    return path == lower_bound;
+  }
+}
+
+absl::StatusOr<std::vector<std::string>> LookUpEntries(FD const& fd, Snapshot const& snapshot,
+                                                       Query const& query) {
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  DEFINE_CONST_OR_RETURN(entries, FindEntries(snapshot, query));
+  std::vector<std::string> texts;
+  for (auto const& entry : entries) {
+    auto const span = entry.span();
+    if (span.end() > mapping.size()) {
+      return absl::DataLossError("the snapshot is stale");
+    }
+    texts.emplace_back(mapping.contents().substr(span.offset, span.size));
+  }
+  return texts;
+}
+
+// Writes the entries of `snapshot` matching `query` to `writer`, copying their text from the
+// database at `fd`. Runs of entries that are adjacent in the database are written at once, along
+// with the separators between them. All matching records are read before anything is written, so a
+// corrupt snapshot fails without writing anything.
+absl::StatusOr<size_t> ExportEntries(FD const& fd, Snapshot const& snapshot, Query const& query,
+                                     ExportWriter* const writer) {
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  auto const contents = mapping.contents();
+  DEFINE_CONST_OR_RETURN(entries, FindEntries(snapshot, query));
+  size_t i = 0;
+  while (i < entries.size()) {
+    size_t const begin = entries[i].span().offset;
+    size_t end = entries[i].span().end();
+    for (++i; i < entries.size() && entries[i].span().offset == end + kEntrySeparator.size() &&
+              contents.substr(end, kEntrySeparator.size()) == kEntrySeparator;
+         ++i) {
+      end = entries[i].span().end();
+    }
+    if (end > contents.size()) {
+      return absl::DataLossError("the snapshot is stale");
+    }
+    RETURN_IF_ERROR(writer->WriteText(contents.substr(begin, end - begin)));
+  }
+  return entries.size();
+}
+
+// Runs `lookup` on the snapshot of the database at `fd`, whose path is `snapshot_path`, holding
+// only a shared lock on the database so that concurrent queries don't serialize. Loading the
+// snapshot takes O(1), and its records are only checked as `lookup` reads them. If the snapshot is
+// missing, stale or corrupt, it's rebuilt under the exclusive lock and `lookup` runs again, so
+// `lookup` must not have any effect before failing with `DataLoss`.
+template <typename Result>
+absl::StatusOr<Result> WithSnapshot(
+    FD const& fd, std::string const& snapshot_path, std::string_view const workspace_directory,
+    absl::FunctionRef<absl::StatusOr<Result>(Snapshot const&)> const lookup) {
+  {
+    DEFINE_OR_RETURN(lock, tsdb2::io::SharedFileLock::Acquire(fd));
+    DEFINE_CONST_OR_RETURN(maybe_snapshot, Snapshot::Load(snapshot_path, fd));
+    if (maybe_snapshot.has_value()) {
+      auto status_or_result = lookup(maybe_snapshot.value());
+      if (!absl::IsDataLoss(status_or_result.status())) {
+        return status_or_result;
+      }
+    }
+  }
+  DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(fd));
+  DEFINE_CONST_OR_RETURN(snapshot, LoadOrBuildSnapshot(snapshot_path, fd, workspace_directory,
+                                                       /*validate=*/true));
+  return lookup(snapshot);
+}
+
+absl::StatusOr<std::vector<std::string>> ScanEntries(FD const& fd,
+                                                     std::string_view const workspace_directory,
+                                                     Query const& query) {
+  DEFINE_CONST_OR_RETURN(entries, ParseCommandFile(fd));
+  auto const lower_bound = GetLowerBound(query);
+  std::vector<std::pair<std::string, CommandEntry const*>> matches;
+  for (auto const& entry : entries) {
+    auto maybe_path = GetEntryPath(entry, workspace_directory);
+    if (maybe_path.has_value() && Matches(query, lower_bound, maybe_path.value())) {
+      matches.emplace_back(std::move(maybe_path).value(), &entry);
+    }
+  }
+  std::stable_sort(matches.begin(), matches.end(),
+                   [](auto const& lhs, auto const& rhs) { return lhs.first < rhs.first; });
+  std::vector<std::string> texts;
+  texts.reserve(matches.size());
+  for (auto const& [path, entry] : matches) {
+    texts.emplace_back(FormatEntry(*entry));
+  }
+  return texts;
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<Snapshot::Entry>> FindEntries(Snapshot const& snapshot,
+                                                         Query const& query) {
+  auto const lower_bound = GetLowerBound(query);
+  std::vector<Snapshot::Entry> entries;
+  DEFINE_CONST_OR_RETURN(first_rank, snapshot.LowerBound(lower_bound));
+  for (size_t rank = first_rank; rank < snapshot.size(); ++rank) {
+    DEFINE_VAR_OR_RETURN(entry, snapshot.GetSorted(rank));
+    if (!Matches(query, lower_bound, entry.path())) {
+      break;
+    }
+    entries.emplace_back(std::move(entry));
+  }
+  return entries;
+}
+
+absl::StatusOr<std::vector<std::string>> QueryCommandFile(Query const& query) {
+  DEFINE_CONST_OR_RETURN(workspace_directory, GetWorkspaceDirectory());
+  DEFINE_CONST_OR_RETURN(snapshot_path, GetSnapshotPath());
+  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile());
+  if (snapshot_path.empty()) {
+    DEFINE_OR_RETURN(lock, tsdb2::io::SharedFileLock::Acquire(fd));
+    return ScanEntries(fd, workspace_directory, query);
+  }
+  return WithSnapshot<std::vector<std::string>>(
+      fd, snapshot_path, workspace_directory,
+      [&](Snapshot const& snapshot) { return LookUpEntries(fd, snapshot, query); });
+}
+
+absl::StatusOr<size_t> ExportCommandFile(Query const& query, FD const& output) {
+  DEFINE_CONST_OR_RETURN(workspace_directory, GetWorkspaceDirectory());
+  DEFINE_CONST_OR_RETURN(snapshot_path, GetSnapshotPath());
+  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile());
+  ExportWriter writer{output};
+  size_t num_entries = 0;
+  if (snapshot_path.empty()) {
+    DEFINE_OR_RETURN(lock, tsdb2::io::SharedFileLock::Acquire(fd));
+    DEFINE_CONST_OR_RETURN(texts, ScanEntries(fd, workspace_directory, query));
+    for (auto const& text : texts) {
+      RETURN_IF_ERROR(writer.WriteText(text));
+    }
+    num_entries = texts.size();
+  } else {
+    DEFINE_CONST_OR_RETURN(
+        num_exported,
+        WithSnapshot<size_t>(fd, snapshot_path, workspace_directory, [&](Snapshot const& snapshot) {
+          return ExportEntries(fd, snapshot, query, &writer);
+        }));
+    num_entries = num_exported;
+  }
+  RETURN_IF_ERROR(writer.Finish());
+  return num_entries;
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,51 @@
+#ifndef __COMP_DB_HOOK_DATABASE_QUERY_H__
+#define __COMP_DB_HOOK_DATABASE_QUERY_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+#include "src/snapshot.h"
+
+namespace comp_db_hook {
+
+struct Query {
+  // Lexically normalized absolute path of a source file, or of a directory if `prefix` is true.
+  std::string path;
+
+  // Whether the query is for all the source files under the directory `path`, at any depth, rather
+  // than for the file `path`.
+  bool prefix = false;
+};
+
+// Returns the entries of `snapshot` matching `query`, in source file path order. Takes O(log N)
+// path comparisons plus the number of matches. Fails with `DataLoss` if the snapshot is corrupt.
+absl::StatusOr<std::vector<Snapshot::Entry>> FindEntries(Snapshot const& snapshot,
+                                                         Query const& query);
+
+// Returns the texts of the entries of the compilation database matching `query` as they're written
+// in the database, in source file path order.
+//
+// The entries are looked up in the snapshot of the database (see `Snapshot`) with a binary search,
+// and only their text is read from the database. Loading the snapshot takes O(1) and only the
+// records it visits are checked, so a lookup takes O(log N) path comparisons plus the size of the
+// matches. Lookups only take a shared lock on the database. The exclusive lock is only taken to
+// rebuild a missing, stale or corrupt snapshot. If snapshots are disabled the whole database is
+// parsed instead.
+absl::StatusOr<std::vector<std::string>> QueryCommandFile(Query const& query);
+
+// Writes the entries of the compilation database matching `query` to `output` as a standalone
+// compilation database, in source file path order, and returns their number.
+//
+// The entries are looked up like in `QueryCommandFile`, and their text is streamed from the mapped
+// database without being parsed, so exporting a subtree takes time proportional to the size of its
+// entries rather than of the database. Entries that are adjacent in the database (all of them if
+// it's sorted, see `COMP_DB_HOOK_SORTED`) are written with a single copy. The database is
+// share-locked until the export is complete.
+absl::StatusOr<size_t> ExportCommandFile(Query const& query, tsdb2::io::FD const& output);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_DATABASE_QUERY_H__
@@ -0,0 +1,231 @@
+#include "src/database_query.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+#include "src/snapshot.h"
+
+namespace {
+
+using ::comp_db_hook::ExportCommandFile;
+using ::comp_db_hook::FindEntries;
+using ::comp_db_hook::kFileField;
+using ::comp_db_hook::Query;
+using ::comp_db_hook::QueryCommandFile;
+using ::comp_db_hook::Snapshot;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kSiblingEntries =
+    "[\n"
+    "  {\"directory\": \"/w\", \"file\": \"dir/a.cc\"},\n"
+    "  {\"directory\": \"/w\", \"file\": \"dir-foo/b.cc\"},\n"
+    "  {\"directory\": \"/w\", \"file\": \"dir.cc\"},\n"
+    "  {\"directory\": \"/w\", \"file\": \"dir/sub/c.cc\"},\n"
+    "  {\"directory\": \"/w\", \"file\": \"dirx/d.cc\"}\n"
+    "]\n";
+
+class DatabaseQueryTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/database_query_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    database_path_ = absl::StrCat(directory_, "/compile_commands.json");
+    snapshot_path_ = absl::StrCat(directory_, "/.compile_commands.json.snapshot");
+    output_path_ = absl::StrCat(directory_, "/export.json");
+    ::unsetenv("COMP_DB_HOOK_STAGING_DIR");
+    ::unsetenv("COMP_DB_HOOK_SNAPSHOT");
+    ::setenv("COMP_DB_HOOK_WORKSPACE_DIR", directory_.c_str(), /*overwrite=*/1);
+  }
+
+  void TearDown() override {
+    ::unsetenv("COMP_DB_HOOK_WORKSPACE_DIR");
+    ::unsetenv("COMP_DB_HOOK_SNAPSHOT");
+    ::unlink(database_path_.c_str());
+    ::unlink(snapshot_path_.c_str());
+    ::unlink(output_path_.c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  void WriteDatabase(std::string_view const contents) {
+    fd_ = FD(::open(database_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    ASSERT_TRUE(fd_);
+    ASSERT_TRUE(comp_db_hook::WriteAll(fd_, contents).ok());
+  }
+
+  Snapshot BuildSnapshot() const {
+    auto const status = comp_db_hook::BuildSnapshot(snapshot_path_, fd_, directory_);
+    EXPECT_TRUE(status.ok()) << status;
+    auto status_or_snapshot = Snapshot::Load(snapshot_path_, fd_);
+    EXPECT_TRUE(status_or_snapshot.ok()) << status_or_snapshot.status();
+    return std::move(status_or_snapshot).value_or(std::nullopt).value_or(Snapshot());
+  }
+
+  // Returns the source file paths of the entries matching `query` in `snapshot`.
+  static std::vector<std::string> Find(Snapshot const& snapshot, Query const& query) {
+    auto const status_or_entries = FindEntries(snapshot, query);
+    EXPECT_TRUE(status_or_entries.ok()) << status_or_entries.status();
+    std::vector<std::string> paths;
+    for (auto const& entry : status_or_entries.value_or(std::vector<Snapshot::Entry>())) {
+      paths.emplace_back(entry.path());
+    }
+    return paths;
+  }
+
+  // Returns the `file` fields of the entries matching `query` in the workspace database.
+  static std::vector<std::string> QueryFiles(Query const& query) {
+    auto const status_or_texts = QueryCommandFile(query);
+    EXPECT_TRUE(status_or_texts.ok()) << status_or_texts.status();
+    std::vector<std::string> files;
+    for (auto const& text : status_or_texts.value_or(std::vector<std::string>())) {
+      for (auto const& entry : comp_db_hook::SalvageCommandEntries(absl::StrCat("[", text, "]"))) {
+        files.push_back(entry.get<kFileField>().value_or(""));
+      }
+    }
+    return files;
+  }
+
+  // Exports the entries matching `query` from the workspace database and returns the exported
+  // database.
+  std::string Export(Query const& query, size_t const expected_num_entries) const {
+    FD const output{::open(output_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    EXPECT_TRUE(output);
+    auto const status_or_num_entries = ExportCommandFile(query, output);
+    EXPECT_TRUE(status_or_num_entries.ok()) << status_or_num_entries.status();
+    EXPECT_EQ(status_or_num_entries.value_or(-1), expected_num_entries);
+    auto status_or_contents = comp_db_hook::ReadFile(output_path_);
+    EXPECT_TRUE(status_or_contents.ok()) << status_or_contents.status();
+    return std::move(status_or_contents).value_or(std::nullopt).value_or("<missing>");
+  }
+
+  std::string directory_;
+  std::string database_path_;
+  std::string snapshot_path_;
+  std::string output_path_;
+  FD fd_;
+};
+
+TEST_F(DatabaseQueryTest, PrefixExcludesSiblings) {
+  WriteDatabase(kSiblingEntries);
+  auto const snapshot = BuildSnapshot();
+  ASSERT_EQ(snapshot.size(), 5);
+  // `dir-foo/` and `dir.cc` sort between `dir` and `dir/`.
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w/dir", .prefix = true}),
+              ElementsAre("/w/dir/a.cc", "/w/dir/sub/c.cc"));
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w/dir/", .prefix = true}),
+              ElementsAre("/w/dir/a.cc", "/w/dir/sub/c.cc"));
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w/dir/sub", .prefix = true}),
+              ElementsAre("/w/dir/sub/c.cc"));
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w", .prefix = true}),
+              ElementsAre("/w/dir-foo/b.cc", "/w/dir.cc", "/w/dir/a.cc", "/w/dir/sub/c.cc",
+                          "/w/dirx/d.cc"));
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w/di", .prefix = true}), IsEmpty());
+  EXPECT_THAT(Find(snapshot, Query{.path = "/v", .prefix = true}), IsEmpty());
+}
+
+TEST_F(DatabaseQueryTest, ExactFile) {
+  WriteDatabase(kSiblingEntries);
+  auto const snapshot = BuildSnapshot();
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w/dir/a.cc"}), ElementsAre("/w/dir/a.cc"));
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w/dir.cc"}), ElementsAre("/w/dir.cc"));
+  // A directory or a prefix of a path doesn't match as a file.
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w/dir"}), IsEmpty());
+  EXPECT_THAT(Find(snapshot, Query{.path = "/w/dir/a"}), IsEmpty());
+}
+
+TEST_F(DatabaseQueryTest, QueryCommandFile) {
+  WriteDatabase(kSiblingEntries);
+  EXPECT_THAT(QueryFiles(Query{.path = absl::StrCat(directory_, "/dir"), .prefix = true}),
+              IsEmpty());
+  // The entries have their own directory.
+  EXPECT_THAT(QueryFiles(Query{.path = "/w/dir", .prefix = true}),
+              ElementsAre("dir/a.cc", "dir/sub/c.cc"));
+  EXPECT_THAT(QueryFiles(Query{.path = "/w/dir-foo/b.cc"}), ElementsAre("dir-foo/b.cc"));
+  // The snapshot was built by the first query.
+  EXPECT_TRUE(comp_db_hook::Exists(snapshot_path_));
+}
+
+TEST_F(DatabaseQueryTest, QueryCommandFileWithoutSnapshot) {
+  ::setenv("COMP_DB_HOOK_SNAPSHOT", "0", /*overwrite=*/1);
+  WriteDatabase(kSiblingEntries);
+  EXPECT_THAT(QueryFiles(Query{.path = "/w/dir", .prefix = true}),
+              ElementsAre("dir/a.cc", "dir/sub/c.cc"));
+  EXPECT_THAT(QueryFiles(Query{.path = "/w/dir-foo/b.cc"}), ElementsAre("dir-foo/b.cc"));
+  EXPECT_THAT(QueryFiles(Query{.path = "/w/dir"}), IsEmpty());
+  EXPECT_FALSE(comp_db_hook::Exists(snapshot_path_));
+}
+
+TEST_F(DatabaseQueryTest, ExportNothing) {
+  WriteDatabase(kSiblingEntries);
+  EXPECT_EQ(Export(Query{.path = "/v", .prefix = true}, 0), "[]\n");
+}
+
+TEST_F(DatabaseQueryTest, ExportAdjacentEntries) {
+  WriteDatabase(kSiblingEntries);
+  EXPECT_EQ(Export(Query{.path = "/w/dir", .prefix = true}, 2),
+            "[\n"
+            "  {\"directory\": \"/w\", \"file\": \"dir/a.cc\"},\n"
+            "  {\"directory\": \"/w\", \"file\": \"dir/sub/c.cc\"}\n"
+            "]\n");
+  EXPECT_EQ(Export(Query{.path = "/w/dir-foo", .prefix = true}, 1),
+            "[\n"
+            "  {\"directory\": \"/w\", \"file\": \"dir-foo/b.cc\"}\n"
+            "]\n");
+  EXPECT_EQ(Export(Query{.path = "/w", .prefix = true}, 5),
+            "[\n"
+            "  {\"directory\": \"/w\", \"file\": \"dir-foo/b.cc\"},\n"
+            "  {\"directory\": \"/w\", \"file\": \"dir.cc\"},\n"
+            "  {\"directory\": \"/w\", \"file\": \"dir/a.cc\"},\n"
+            "  {\"directory\": \"/w\", \"file\": \"dir/sub/c.cc\"},\n"
+            "  {\"directory\": \"/w\", \"file\": \"dirx/d.cc\"}\n"
+            "]\n");
+}
+
+TEST_F(DatabaseQueryTest, ExportMergesOnlyMatchingSeparators) {
+  // The first two entries are as far apart as with the usual separator but separated by other
+  // bytes, and the last two are separated by more than the usual separator. None of them must be
+  // copied as a run.
+  WriteDatabase(
+      "[\n"
+      "  {\"directory\": \"/w\", \"file\": \"a.cc\"},\n\t "
+      "{\"directory\": \"/w\", \"file\": \"b.cc\"},\n\n  "
+      "{\"directory\": \"/w\", \"file\": \"c.cc\"},\n"
+      "  {\"directory\": \"/w\", \"file\": \"d.cc\"}\n"
+      "]\n");
+  EXPECT_EQ(Export(Query{.path = "/w", .prefix = true}, 4),
+            "[\n"
+            "  {\"directory\": \"/w\", \"file\": \"a.cc\"},\n"
+            "  {\"directory\": \"/w\", \"file\": \"b.cc\"},\n"
+            "  {\"directory\": \"/w\", \"file\": \"c.cc\"},\n"
+            "  {\"directory\": \"/w\", \"file\": \"d.cc\"}\n"
+            "]\n");
+}
+
+TEST_F(DatabaseQueryTest, ExportWithoutSnapshot) {
+  ::setenv("COMP_DB_HOOK_SNAPSHOT", "0", /*overwrite=*/1);
+  WriteDatabase(kSiblingEntries);
+  auto const exported = Export(Query{.path = "/w/dir", .prefix = true}, 2);
+  std::vector<std::string> files;
+  for (auto const& entry : comp_db_hook::SalvageCommandEntries(exported)) {
+    files.push_back(entry.get<kFileField>().value_or(""));
+  }
+  EXPECT_THAT(files, ElementsAre("dir/a.cc", "dir/sub/c.cc"));
+}
+
+}  // namespace
@@ -0,0 +1,397 @@
+#include "src/driver_options.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "absl/numeric/bits.h"
+#include "absl/types/span.h"
+#include "src/perfect_hash.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+OptionKind constexpr kFlag = OptionKind::kFlag;
+OptionKind constexpr kJoined = OptionKind::kJoined;
+OptionKind constexpr kSeparate = OptionKind::kSeparate;
+OptionKind constexpr kJoinedOrSeparate = OptionKind::kJoinedOrSeparate;
+OptionKind constexpr kJoinedAndSeparate = OptionKind::kJoinedAndSeparate;
+
+DriverAction constexpr kCompileOnly = DriverAction::kCompileOnly;
+DriverAction constexpr kPreprocessOnly = DriverAction::kPreprocessOnly;
+DriverAction constexpr kQuery = DriverAction::kQuery;
+
+// Union of the Clang and GCC driver options that are relevant to the classification of the command
+// line. All options consuming the next argument must be listed here, otherwise their values would
+// be mistaken for input files; options that never take a value only need to be listed if some
+// other component refers to them.
+DriverOption constexpr kOptionTable[] = {
+    // Driver modes and actions.
+    {"-c", kFlag, kCompileOnly},
+    {"-S", kFlag, kCompileOnly},
+    {"-E", kFlag, kPreprocessOnly},
+    {"-M", kFlag, kPreprocessOnly},
+    {"-MM", kFlag, kPreprocessOnly},
+    {"-fsyntax-only", kFlag, kCompileOnly},
+    {"-emit-llvm", kFlag},
+    {"-shared", kFlag},
+    {"-static", kFlag},
+    {"-r", kFlag},
+    {"-v", kFlag},
+    {"-###", kFlag, kQuery},
+    {"--version", kFlag, kQuery},
+    {"--help", kFlag, kQuery},
+    {"-help", kFlag, kQuery},
+    {"--help-hidden", kFlag, kQuery},
+    {"--target-help", kFlag, kQuery},
+    {"-dumpversion", kFlag, kQuery},
+    {"-dumpfullversion", kFlag, kQuery},
+    {"-dumpmachine", kFlag, kQuery},
+    {"-dumpspecs", kFlag, kQuery},
+    {"-print-diagnostic-options", kFlag, kQuery},
+    {"-print-effective-triple", kFlag, kQuery},
+    {"-print-file-name=", kJoined, kQuery},
+    {"-print-libgcc-file-name", kFlag, kQuery},
+    {"-print-multi-directory", kFlag, kQuery},
+    {"-print-multi-lib", kFlag, kQuery},
+    {"-print-multi-os-directory", kFlag, kQuery},
+    {"-print-multiarch", kFlag, kQuery},
+    {"-print-prog-name=", kJoined, kQuery},
+    {"-print-resource-dir", kFlag, kQuery},
+    {"-print-rocm-search-dirs", kFlag, kQuery},
+    {"-print-runtime-dir", kFlag, kQuery},
+    {"-print-search-dirs", kFlag, kQuery},
+    {"-print-supported-cpus", kFlag, kQuery},
+    {"-print-sysroot", kFlag, kQuery},
+    {"-print-sysroot-headers-suffix", kFlag, kQuery},
+    {"-print-target-triple", kFlag, kQuery},
+    {"-print-targets", kFlag, kQuery},
+    {"--print-file-name", kSeparate, kQuery},
+    {"--print-prog-name", kSeparate, kQuery},
+    {"--print-supported-extensions", kFlag, kQuery},
+
+    // Output and dependency files.
+    {"-o", kJoinedOrSeparate},
+    {"--output", kSeparate},
+    {"--output=", kJoined},
+    {"-MD", kFlag},
+    {"-MMD", kFlag},
+    {"-MG", kFlag},
+    {"-MP", kFlag},
+    {"-MV", kFlag},
+    {"-MF", kJoinedOrSeparate},
+    {"-MJ", kJoinedOrSeparate},
+    {"-MQ", kJoinedOrSeparate},
+    {"-MT", kJoinedOrSeparate},
+    {"--write-dependencies", kFlag},
+    {"--write-user-dependencies", kFlag},
+    {"-dependency-dot", kSeparate},
+    {"-dependency-file", kSeparate},
+    {"-serialize-diagnostics", kSeparate},
+    {"--serialize-diagnostics", kSeparate},
+    {"-index-store-path", kSeparate},
+    {"-aux-info", kSeparate},
+    {"-dumpbase", kSeparate},
+    {"-dumpbase-ext", kSeparate},
+    {"-dumpdir", kSeparate},
+    {"-save-temps", kFlag},
+    {"-save-temps=", kJoined},
+
+    // Language and target selection.
+    {"-x", kJoinedOrSeparate},
+    {"--language", kSeparate},
+    {"--language=", kJoined},
+    {"-std=", kJoined},
+    {"--std", kSeparate},
+    {"--std=", kJoined},
+    {"-stdlib=", kJoined},
+    {"--stdlib", kSeparate},
+    {"--stdlib=", kJoined},
+    {"-target", kSeparate},
+    {"--target=", kJoined},
+    {"-arch", kSeparate},
+    {"-arch_only", kSeparate},
+    {"-march=", kJoined},
+    {"-mcpu=", kJoined},
+    {"-mtune=", kJoined},
+    {"-mabi=", kJoined},
+    {"-mfpu=", kJoined},
+    {"-mfloat-abi=", kJoined},
+    {"--offload-arch=", kJoined},
+    {"--cuda-gpu-arch=", kJoined},
+    {"--cuda-path=", kJoined},
+    {"-O", kJoined},
+    {"-W", kJoined},
+
+    // Preprocessor.
+    {"-D", kJoinedOrSeparate},
+    {"--define-macro", kSeparate},
+    {"--define-macro=", kJoined},
+    {"-U", kJoinedOrSeparate},
+    {"--undefine-macro", kSeparate},
+    {"--undefine-macro=", kJoined},
+    {"-A", kJoinedOrSeparate},
+    {"--assert", kSeparate},
+    {"--assert=", kJoined},
+    {"-I", kJoinedOrSeparate},
+    {"--include-directory", kSeparate},
+    {"--include-directory=", kJoined},
+    {"--include-directory-after", kSeparate},
+    {"--include-directory-after=", kJoined},
+    {"-I-", kFlag},
+    {"-iquote", kJoinedOrSeparate},
+    {"-isystem", kJoinedOrSeparate},
+    {"-isystem-after", kJoinedOrSeparate},
+    {"-idirafter", kJoinedOrSeparate},
+    {"-cxx-isystem", kJoinedOrSeparate},
+    {"-iframework", kJoinedOrSeparate},
+    {"-iframeworkwithsysroot", kJoinedOrSeparate},
+    {"-imultiarch", kSeparate},
+    {"-imultilib", kSeparate},
+    {"-iprefix", kJoinedOrSeparate},
+    {"--include-prefix", kSeparate},
+    {"--include-prefix=", kJoined},
+    {"-iwithprefix", kJoinedOrSeparate},
+    {"--include-with-prefix", kSeparate},
+    {"--include-with-prefix=", kJoined},
+    {"--include-with-prefix-after", kSeparate},
+    {"--include-with-prefix-after=", kJoined},
+    {"-iwithprefixbefore", kJoinedOrSeparate},
+    {"--include-with-prefix-before", kSeparate},
+    {"--include-with-prefix-before=", kJoined},
+    {"-iwithsysroot", kJoinedOrSeparate},
+    {"-isysroot", kJoinedOrSeparate},
+    {"--sysroot", kSeparate},
+    {"--sysroot=", kJoined},
+    {"-ivfsoverlay", kJoinedOrSeparate},
+    {"-include", kJoinedOrSeparate},
+    {"--include", kSeparate},
+    {"--include=", kJoined},
+    {"-imacros", kJoinedOrSeparate},
+    {"--imacros", kSeparate},
+    {"--imacros=", kJoined},
+    {"-include-pch", kSeparate},
+    {"--embed-dir=", kJoined},
+    {"-nostdinc", kFlag},
+    {"-nostdinc++", kFlag},
+    {"-nostdlibinc", kFlag},
+
+    // Pass-through to the underlying tools.
+    {"-Xclang", kSeparate},
+    {"-Xlinker", kSeparate},
+    {"-Xassembler", kSeparate},
+    {"-Xpreprocessor", kSeparate},
+    {"-Xanalyzer", kSeparate},
+    {"-Xflang", kSeparate},
+    {"-Xarch_device", kSeparate},
+    {"-Xarch_host", kSeparate},
+    {"-Xcuda-fatbinary", kSeparate},
+    {"-Xcuda-ptxas", kSeparate},
+    {"-Xopenmp-target", kSeparate},
+    {"-Xoffload-linker", kJoinedOrSeparate},
+    {"-Xarch_", kJoinedAndSeparate},
+    {"-mllvm", kSeparate},
+    {"-mmlir", kSeparate},
+    {"--param", kSeparate},
+    {"--param=", kJoined},
+    {"-Wl,", kJoined},
+    {"-Wa,", kJoined},
+    {"-Wp,", kJoined},
+
+    // Toolchain selection.
+    {"-B", kJoinedOrSeparate},
+    {"--prefix", kSeparate},
+    {"--prefix=", kJoined},
+    {"-gcc-toolchain", kSeparate},
+    {"--gcc-toolchain=", kJoined},
+    {"--gcc-install-dir=", kJoined},
+    {"-ccc-gcc-name", kSeparate},
+    {"-ccc-install-dir", kSeparate},
+    {"-resource-dir", kSeparate},
+    {"-resource-dir=", kJoined},
+    {"--config", kSeparate},
+    {"--config=", kJoined},
+    {"-specs", kSeparate},
+    {"-specs=", kJoined},
+    {"--specs", kSeparate},
+    {"--specs=", kJoined},
+    {"-wrapper", kSeparate},
+    {"-working-directory", kSeparate},
+    {"-working-directory=", kJoined},
+    {"-fuse-ld=", kJoined},
+    {"-rtlib=", kJoined},
+    {"--rtlib", kSeparate},
+    {"--rtlib=", kJoined},
+    {"-unwindlib=", kJoined},
+
+    // Code generation options whose values are paths that vary between builds.
+    {"-frandom-seed=", kJoined},
+    {"-fdebug-prefix-map=", kJoined},
+    {"-ffile-prefix-map=", kJoined},
+    {"-fmacro-prefix-map=", kJoined},
+    {"-fcoverage-prefix-map=", kJoined},
+    {"-fprofile-prefix-map=", kJoined},
+    {"-fdebug-compilation-dir", kSeparate},
+    {"-fdebug-compilation-dir=", kJoined},
+    {"-ffile-compilation-dir=", kJoined},
+    {"-fcoverage-compilation-dir=", kJoined},
+    {"-fcrash-diagnostics-dir=", kJoined},
+    {"-fmodules-cache-path=", kJoined},
+    {"-fmodule-file=", kJoined},
+    {"-fmodule-map-file=", kJoined},
+    {"-fprebuilt-module-path=", kJoined},
+    {"-fprofile-instr-use=", kJoined},
+    {"-fprofile-use=", kJoined},
+    {"-fsanitize-ignorelist=", kJoined},
+    {"-fsanitize-blacklist=", kJoined},
+
+    // Linker inputs and options.
+    {"-L", kJoinedOrSeparate},
+    {"--library-directory", kSeparate},
+    {"--library-directory=", kJoined},
+    {"-l", kJoinedOrSeparate},
+    {"-F", kJoinedOrSeparate},
+    {"-T", kJoinedOrSeparate},
+    {"-u", kJoinedOrSeparate},
+    {"-e", kJoinedOrSeparate},
+    {"--entry", kSeparate},
+    {"-G", kJoinedOrSeparate},
+    {"-z", kSeparate},
+    {"-rpath", kSeparate},
+    {"-framework", kSeparate},
+    {"-weak_framework", kSeparate},
+    {"-weak_library", kSeparate},
+    {"-weak_reference_mismatches", kSeparate},
+    {"-filelist", kSeparate},
+    {"-install_name", kSeparate},
+    {"-compatibility_version", kSeparate},
+    {"-current_version", kSeparate},
+    {"-exported_symbols_list", kSeparate},
+    {"-unexported_symbols_list", kSeparate},
+    {"-bundle_loader", kSeparate},
+    {"-allowable_client", kSeparate},
+    {"-client_name", kSeparate},
+    {"-dylib_file", kSeparate},
+    {"-image_base", kSeparate},
+    {"-init", kSeparate},
+    {"-multiply_defined", kSeparate},
+    {"-read_only_relocs", kSeparate},
+    {"-seg_addr_table", kSeparate},
+    {"-segs_read_only_addr", kSeparate},
+    {"-segs_read_write_addr", kSeparate},
+    {"-umbrella", kSeparate},
+    {"-pie", kFlag},
+    {"-no-pie", kFlag},
+    {"-rdynamic", kFlag},
+    {"-pthread", kFlag},
+    {"-nostdlib", kFlag},
+    {"-nostdlib++", kFlag},
+    {"-nodefaultlibs", kFlag},
+    {"-nostartfiles", kFlag},
+};
+
+template <size_t kNumOptions>
+constexpr auto IndexOptions(DriverOption const (&options)[kNumOptions]) {
+  std::array<PerfectHashEntry<DriverOption>, kNumOptions> entries{};
+  for (size_t i = 0; i < kNumOptions; ++i) {
+    entries[i].key = options[i].spelling;
+    entries[i].value = options[i];
+  }
+  return PerfectHashMap<DriverOption, kNumOptions>(entries);
+}
+
+auto constexpr kOptionIndex = IndexOptions(kOptionTable);
+
+// Options that can be joined to their value are spelled with at most this many characters, so that
+// the lengths fit in the bits of a `uint64_t`.
+size_t constexpr kMaxSpellingLength = 63;
+
+// Returns, for each character, a mask with bit `length` set iff there's an option that can be
+// joined to its value whose spelling has `length` characters and starts with `-` followed by that
+// character. When the exact spelling and the `=` form both miss, `MatchDriverOption` probes one
+// prefix of the argument for each bit of the mask of its second character.
+constexpr std::array<uint64_t, 256> GetJoinedPrefixMasks() {
+  std::array<uint64_t, 256> masks{};
+  for (auto const& option : kOptionTable) {
+    if (option.kind != kJoined && option.kind != kJoinedOrSeparate &&
+        option.kind != kJoinedAndSeparate) {
+      continue;
+    }
+    if (option.spelling.size() < 2 || option.spelling.size() > kMaxSpellingLength) {
+      internal::PerfectHashConstructionFailed();
+    }
+    masks[static_cast<uint8_t>(option.spelling[1])] |= uint64_t{1} << option.spelling.size();
+  }
+  return masks;
+}
+
+auto constexpr kJoinedPrefixMasks = GetJoinedPrefixMasks();
+
+}  // namespace
+
+DriverOption const* FindDriverOption(std::string_view const arg) { return kOptionIndex.Find(arg); }
+
+std::optional<OptionMatch> MatchDriverOption(absl::Span<std::string const> const args,
+                                             size_t const index) {
+  std::string_view const arg = args[index];
+  if (arg.size() < 2 || arg.front() != '-') {
+    return std::nullopt;
+  }
+  auto const* const exact = kOptionIndex.Find(arg);
+  if (exact != nullptr) {
+    if (exact->consumes_next_argument() && index + 1 < args.size()) {
+      return OptionMatch{exact, args[index + 1], 2};
+    } else {
+      return OptionMatch{exact, std::string_view(), 1};
+    }
+  }
+  auto const equals = arg.find('=');
+  if (equals != std::string_view::npos) {
+    auto const* const joined = kOptionIndex.Find(arg.substr(0, equals + 1));
+    if (joined != nullptr && joined->kind == kJoined) {
+      return OptionMatch{joined, arg.substr(equals + 1), 1};
+    }
+  }
+  // Only prefixes shorter than the argument are considered, a joined option needs a value.
+  size_t const max_length = std::min(arg.size() - 1, kMaxSpellingLength);
+  uint64_t lengths = kJoinedPrefixMasks[static_cast<uint8_t>(arg[1])] &
+                     ((uint64_t{2} << max_length) - 1);
+  if (lengths == 0) {
+    return std::nullopt;
+  }
+  // Fingerprint all the candidate prefixes in a single pass.
+  size_t const longest = 63 - absl::countl_zero(lengths);
+  std::array<uint64_t, kMaxSpellingLength + 1> fingerprints{};
+  uint64_t fingerprint = kPerfectHashFingerprintBasis;
+  for (size_t i = 0; i < longest; ++i) {
+    fingerprint = ExtendPerfectHashFingerprint(fingerprint, arg[i]);
+    fingerprints[i + 1] = fingerprint;
+  }
+  // Try the longest prefixes first, so `-isystemfoo` matches `-isystem` rather than `-i`.
+  while (lengths != 0) {
+    size_t const length = 63 - absl::countl_zero(lengths);
+    lengths &= ~(uint64_t{1} << length);
+    auto const* const prefix = kOptionIndex.Find(arg.substr(0, length), fingerprints[length]);
+    if (prefix == nullptr) {
+      continue;
+    }
+    if (prefix->kind == kJoined || prefix->kind == kJoinedOrSeparate) {
+      return OptionMatch{prefix, arg.substr(length), 1};
+    }
+    if (prefix->kind == kJoinedAndSeparate) {
+      if (index + 1 < args.size()) {
+        return OptionMatch{prefix, args[index + 1], 2};
+      } else {
+        return OptionMatch{prefix, std::string_view(), 1};
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,93 @@
+#ifndef __COMP_DB_HOOK_DRIVER_OPTIONS_H__
+#define __COMP_DB_HOOK_DRIVER_OPTIONS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// Describes how a compiler driver option takes its value, using the same terminology as Clang's
+// `Options.td`.
+enum class OptionKind : uint8_t {
+  // The option has no value, e.g. `-c`.
+  kFlag,
+
+  // The value is attached to the spelling, e.g. `-std=c++17` or `-Wl,--gc-sections`.
+  kJoined,
+
+  // The value is the next argument, e.g. `-Xclang -ast-dump`.
+  kSeparate,
+
+  // The value is either attached or the next argument, e.g. `-Iinclude` or `-I include`.
+  kJoinedOrSeparate,
+
+  // The spelling is followed by an attached qualifier and the value is the next argument, e.g.
+  // `-Xarch_arm64 -O2`.
+  kJoinedAndSeparate,
+};
+
+// What an option says about the driver's job, used to classify invocations.
+enum class DriverAction : uint8_t {
+  // No effect on the driver's job.
+  kNone,
+
+  // Stop after compiling, i.e. don't link (`-c`, `-S`, `-fsyntax-only`).
+  kCompileOnly,
+
+  // Stop after preprocessing (`-E`, `-M`, `-MM`).
+  kPreprocessOnly,
+
+  // Print some information about the toolchain and exit without processing any input
+  // (`--version`, `-print-*`, `-dump*`, etc.)
+  kQuery,
+};
+
+struct DriverOption {
+  // Returns true iff the option consumes the next argument when it's spelled as a whole argument.
+  constexpr bool consumes_next_argument() const {
+    return kind == OptionKind::kSeparate || kind == OptionKind::kJoinedOrSeparate ||
+           kind == OptionKind::kJoinedAndSeparate;
+  }
+
+  std::string_view spelling;
+  OptionKind kind = OptionKind::kFlag;
+  DriverAction action = DriverAction::kNone;
+};
+
+// Looks up an option by its exact spelling, with a single perfect hash probe. Since all options
+// taking a separate value are spelled as a whole argument this is enough to know whether an
+// argument consumes the next one, but not to recognize joined forms (see `MatchDriverOption`).
+DriverOption const* FindDriverOption(std::string_view arg);
+
+// The result of `MatchDriverOption`.
+struct OptionMatch {
+  // The matched option.
+  DriverOption const* option;
+
+  // The value of the option, if any. For joined options this is the part of the argument following
+  // the spelling, for separate options it's the next argument. Joined-and-separate options keep
+  // their qualifier in `args[index]` and their value is the next argument.
+  std::string_view value;
+
+  // The number of arguments spanned by the option and its value (1 or 2).
+  size_t num_args;
+};
+
+// Matches `args[index]` against the option table, taking joined forms into account (e.g. `-Ifoo`,
+// `-MFfoo.d`, `--sysroot=/foo`). Returns an empty optional if the argument is not a known option.
+//
+// The exact spelling is tried first, then the `=` form, and finally the known prefixes of joined
+// options from the longest to the shortest, so `-isystemfoo` matches `-isystem` rather than `-i`.
+// Only the prefix lengths of the joined options sharing the first character after the `-` are
+// probed, and their fingerprints are computed in a single pass over the argument, so an unknown
+// argument costs at most three hashing passes plus one slot lookup per candidate length.
+std::optional<OptionMatch> MatchDriverOption(absl::Span<std::string const> args, size_t index);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_DRIVER_OPTIONS_H__
@@ -0,0 +1,108 @@
+#include "src/driver_options.h"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::DriverAction;
+using ::comp_db_hook::FindDriverOption;
+using ::comp_db_hook::MatchDriverOption;
+using ::comp_db_hook::OptionKind;
+using ::testing::IsNull;
+using ::testing::NotNull;
+
+TEST(FindDriverOptionTest, ExactSpellings) {
+  auto const* const compile = FindDriverOption("-c");
+  ASSERT_THAT(compile, NotNull());
+  EXPECT_EQ(compile->kind, OptionKind::kFlag);
+  EXPECT_EQ(compile->action, DriverAction::kCompileOnly);
+  auto const* const preprocess = FindDriverOption("-E");
+  ASSERT_THAT(preprocess, NotNull());
+  EXPECT_EQ(preprocess->action, DriverAction::kPreprocessOnly);
+  auto const* const version = FindDriverOption("--version");
+  ASSERT_THAT(version, NotNull());
+  EXPECT_EQ(version->action, DriverAction::kQuery);
+}
+
+TEST(FindDriverOptionTest, OptionsConsumingTheNextArgument) {
+  for (std::string_view const spelling :
+       {"-o", "-x", "-Xclang", "-MF", "-MT", "-MQ", "-I", "-D", "-include", "-isystem", "--param",
+        "-arch", "-Xlinker"}) {
+    auto const* const option = FindDriverOption(spelling);
+    ASSERT_THAT(option, NotNull()) << spelling;
+    EXPECT_TRUE(option->consumes_next_argument()) << spelling;
+  }
+}
+
+TEST(FindDriverOptionTest, FlagsDontConsumeTheNextArgument) {
+  for (std::string_view const spelling : {"-c", "-S", "-MD", "-MMD", "-pthread", "-shared"}) {
+    auto const* const option = FindDriverOption(spelling);
+    ASSERT_THAT(option, NotNull()) << spelling;
+    EXPECT_FALSE(option->consumes_next_argument()) << spelling;
+  }
+}
+
+TEST(FindDriverOptionTest, UnknownSpellings) {
+  EXPECT_THAT(FindDriverOption(""), IsNull());
+  EXPECT_THAT(FindDriverOption("-"), IsNull());
+  EXPECT_THAT(FindDriverOption("foo.cc"), IsNull());
+  EXPECT_THAT(FindDriverOption("-Ifoo"), IsNull());
+  EXPECT_THAT(FindDriverOption("-not-an-option"), IsNull());
+}
+
+struct MatchTestCase {
+  std::vector<std::string> args;
+  std::string_view spelling;
+  std::string_view value;
+  size_t num_args;
+};
+
+TEST(MatchDriverOptionTest, Match) {
+  MatchTestCase const test_cases[] = {
+      {{"-c", "foo.cc"}, "-c", "", 1},
+      {{"-o", "foo.o"}, "-o", "foo.o", 2},
+      {{"-ofoo.o"}, "-o", "foo.o", 1},
+      {{"-o"}, "-o", "", 1},
+      {{"-I", "include"}, "-I", "include", 2},
+      {{"-Iinclude"}, "-I", "include", 1},
+      {{"-isystemfoo"}, "-isystem", "foo", 1},
+      {{"-MFfoo.d"}, "-MF", "foo.d", 1},
+      {{"-std=c++17"}, "-std=", "c++17", 1},
+      {{"--sysroot=/foo"}, "--sysroot=", "/foo", 1},
+      {{"-Xclang", "-ast-dump"}, "-Xclang", "-ast-dump", 2},
+      {{"-Xarch_arm64", "-O2"}, "-Xarch_", "-O2", 2},
+      {{"-Xarch_arm64"}, "-Xarch_", "", 1},
+      {{"-index-store-path", "foo/index"}, "-index-store-path", "foo/index", 2},
+  };
+  for (auto const& test_case : test_cases) {
+    auto const match = MatchDriverOption(test_case.args, 0);
+    ASSERT_TRUE(match.has_value()) << test_case.args[0];
+    EXPECT_EQ(match->option->spelling, test_case.spelling) << test_case.args[0];
+    EXPECT_EQ(match->value, test_case.value) << test_case.args[0];
+    EXPECT_EQ(match->num_args, test_case.num_args) << test_case.args[0];
+  }
+}
+
+TEST(MatchDriverOptionTest, NoMatch) {
+  std::vector<std::string> const args{"foo.cc", "-", "-not-an-option", ""};
+  for (size_t i = 0; i < args.size(); ++i) {
+    EXPECT_FALSE(MatchDriverOption(args, i).has_value()) << args[i];
+  }
+}
+
+TEST(MatchDriverOptionTest, MatchesAtIndex) {
+  std::vector<std::string> const args{"clang++", "-c", "-MF", "foo.d", "foo.cc"};
+  auto const match = MatchDriverOption(args, 2);
+  ASSERT_TRUE(match.has_value());
+  EXPECT_EQ(match->option->spelling, "-MF");
+  EXPECT_EQ(match->value, "foo.d");
+  EXPECT_EQ(match->num_args, 2);
+}
+
+}  // namespace
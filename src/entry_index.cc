@@ -0,0 +1,224 @@
+#include "src/entry_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/command_database.h"
+#include "src/entry_scanner.h"
+#include "src/file_io.h"
+#include "src/mapped_file.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+namespace json = ::tsdb2::json;
+
+char constexpr kMagic[8] = {'C', 'D', 'B', 'I', 'D', 'X', '1', '\0'};
+
+// The index file starts with this header and continues with one `EntrySpan` per entry.
+struct IndexHeader {
+  char magic[8];
+  uint64_t inode;
+  uint64_t database_size;
+  int64_t mtime_seconds;
+  int64_t mtime_nanoseconds;
+  uint64_t num_entries;
+};
+
+// Index writes are flushed to the file whenever the buffer exceeds this size.
+size_t constexpr kBufferSize = 64 * 1024;
+
+// How much of the database is scanned before releasing the memory of its mapping.
+size_t constexpr kReleaseInterval = 1 << 20;
+
+IndexHeader MakeHeader(struct stat const& database_stat, uint64_t const num_entries) {
+  IndexHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.inode = database_stat.st_ino;
+  header.database_size = database_stat.st_size;
+  header.mtime_seconds = database_stat.st_mtim.tv_sec;
+  header.mtime_nanoseconds = database_stat.st_mtim.tv_nsec;
+  header.num_entries = num_entries;
+  return header;
+}
+
+}  // namespace
+
+absl::StatusOr<std::optional<EntryIndex>> EntryIndex::Load(std::string const& path,
+                                                           struct stat const& database_stat) {
+  FD const fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!fd) {
+    if (errno == ENOENT) {
+      return std::nullopt;
+    } else {
+      return absl::ErrnoToStatus(errno, "open");
+    }
+  }
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  if (stat.st_size < sizeof(IndexHeader)) {
+    return std::nullopt;
+  }
+  DEFINE_VAR_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  IndexHeader header{};
+  std::memcpy(&header, mapping.contents().data(), sizeof(header));
+  auto const expected = MakeHeader(database_stat, header.num_entries);
+  if (std::memcmp(&header, &expected, sizeof(header)) != 0 ||
+      stat.st_size != sizeof(IndexHeader) + header.num_entries * sizeof(EntrySpan)) {
+    return std::nullopt;
+  }
+  return EntryIndex(std::move(mapping), header.num_entries);
+}
+
+EntrySpan EntryIndex::operator[](size_t const index) const {
+  EntrySpan span{};
+  std::memcpy(&span, mapping_.contents().data() + sizeof(IndexHeader) + index * sizeof(EntrySpan),
+              sizeof(span));
+  return span;
+}
+
+absl::StatusOr<CommandEntry> EntryIndex::ParseEntry(std::string_view const contents,
+                                                    size_t const index) const {
+  auto const span = (*this)[index];
+  if (span.end() > contents.size()) {
+    return absl::DataLossError("the index is stale");
+  }
+  auto const text = contents.substr(span.offset, span.size);
+  if (!absl::StartsWith(text, "{") || !absl::EndsWith(text, "}")) {
+    return absl::DataLossError("the index is stale");
+  }
+  return json::Parse<CommandEntry>(text);
+}
+
+absl::StatusOr<size_t> EntryIndex::LowerBound(std::string_view const contents,
+                                              std::string_view const default_directory,
+                                              std::string_view const path,
+                                              size_t const begin) const {
+  size_t low = begin;
+  size_t high = size_;
+  while (low < high) {
+    size_t const middle = low + (high - low) / 2;
+    DEFINE_CONST_OR_RETURN(entry, ParseEntry(contents, middle));
+    auto const maybe_path = GetEntryPath(entry, default_directory);
+    if (!maybe_path.has_value()) {
+      return absl::DataLossError("the indexed database contains an entry without a `file` field");
+    }
+    if (maybe_path.value() < path) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+absl::StatusOr<std::vector<IndexMatch>> EntryIndex::MergeJoin(
+    std::string_view const contents, std::string_view const default_directory,
+    absl::Span<std::string_view const> const paths) const {
+  std::vector<IndexMatch> matches;
+  matches.reserve(paths.size());
+  size_t position = 0;
+  for (auto const path : paths) {
+    DEFINE_CONST_OR_RETURN(lower_bound, LowerBound(contents, default_directory, path, position));
+    position = lower_bound;
+    IndexMatch match{.position = position, .entry = std::nullopt};
+    if (position < size_) {
+      DEFINE_VAR_OR_RETURN(entry, ParseEntry(contents, position));
+      auto const maybe_path = GetEntryPath(entry, default_directory);
+      if (maybe_path.has_value() && maybe_path.value() == path) {
+        match.entry = std::move(entry);
+      }
+    }
+    matches.emplace_back(std::move(match));
+  }
+  return matches;
+}
+
+absl::StatusOr<EntryIndexWriter> EntryIndexWriter::Create(std::string path) {
+  auto temp_path = absl::StrCat(path, ".tmp");
+  FD fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      temp_path.c_str(), /*flags=*/O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0664)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  EntryIndexWriter writer{std::move(path), std::move(temp_path), std::move(fd)};
+  // The header is written last, when the database has been written.
+  writer.buffer_.assign(sizeof(IndexHeader), '\0');
+  return std::move(writer);
+}
+
+absl::Status EntryIndexWriter::Add(EntrySpan const span) {
+  buffer_.append(reinterpret_cast<char const*>(&span), sizeof(span));
+  ++num_entries_;
+  if (buffer_.size() < kBufferSize) {
+    return absl::OkStatus();
+  }
+  return Flush();
+}
+
+absl::Status EntryIndexWriter::Commit(struct stat const& database_stat) {
+  RETURN_IF_ERROR(Flush());
+  auto const header = MakeHeader(database_stat, num_entries_);
+  if (::pwrite(fd_.get(), &header, sizeof(header), 0) != sizeof(header)) {
+    return absl::ErrnoToStatus(errno, "pwrite");
+  }
+  if (::rename(temp_path_.c_str(), path_.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rename");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status EntryIndexWriter::Flush() {
+  RETURN_IF_ERROR(WriteAll(fd_, buffer_));
+  buffer_.clear();
+  return absl::OkStatus();
+}
+
+absl::Status BuildEntryIndex(std::string const& path, FD const& fd) {
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  DEFINE_VAR_OR_RETURN(writer, EntryIndexWriter::Create(path));
+  size_t released = 0;
+  EntryScanner scanner{mapping.contents()};
+  for (auto maybe_text = scanner.Next(); maybe_text.has_value(); maybe_text = scanner.Next()) {
+    if (scanner.entry_offset() - released >= kReleaseInterval) {
+      mapping.Release(released, scanner.entry_offset());
+      released = scanner.entry_offset();
+    }
+    RETURN_IF_ERROR(writer.Add(EntrySpan{
+        .offset = scanner.entry_offset(),
+        .size = maybe_text->size(),
+    }));
+  }
+  return writer.Commit(stat);
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,129 @@
+#ifndef __COMP_DB_HOOK_ENTRY_INDEX_H__
+#define __COMP_DB_HOOK_ENTRY_INDEX_H__
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/mapped_file.h"
+
+namespace comp_db_hook {
+
+// Position of the text of an entry in the compilation database.
+struct EntrySpan {
+  uint64_t offset;
+  uint64_t size;
+
+  uint64_t end() const { return offset + size; }
+};
+
+// Result of looking up a source file path in an `EntryIndex` (see `EntryIndex::MergeJoin`).
+struct IndexMatch {
+  // Position of the first entry whose path isn't less than the looked up one, which is where a new
+  // entry for the path goes.
+  size_t position;
+
+  // The entry at `position` if it's the entry of the looked up path.
+  std::optional<CommandEntry> entry;
+};
+
+// Offset index of a compilation database sorted by source file path, stored in the
+// `.compile_commands.json.index` sidecar file. It allows looking up entries with a binary search
+// rather than a linear scan, and copying runs of unchanged entries without scanning them.
+//
+// The index is only valid for the exact version of the database it was built from, which is checked
+// by comparing the inode, size and modification time of the database with the ones recorded in the
+// index. Writers that don't maintain the index (e.g. garbage collection) thus invalidate it.
+class EntryIndex {
+ public:
+  // Loads the index at `path`. Returns an empty optional if there's no index or it doesn't match
+  // the database described by `database_stat`.
+  static absl::StatusOr<std::optional<EntryIndex>> Load(std::string const& path,
+                                                        struct stat const& database_stat);
+
+  EntryIndex() = default;
+  ~EntryIndex() = default;
+
+  EntryIndex(EntryIndex&&) noexcept = default;
+  EntryIndex& operator=(EntryIndex&&) noexcept = default;
+  EntryIndex(EntryIndex const&) = delete;
+  EntryIndex& operator=(EntryIndex const&) = delete;
+
+  size_t size() const { return size_; }
+
+  EntrySpan operator[](size_t index) const;
+
+  // Parses the entry at position `index` of `contents`, the text of the database. Fails if the text
+  // at that position isn't an entry, which means that the index is stale.
+  absl::StatusOr<CommandEntry> ParseEntry(std::string_view contents, size_t index) const;
+
+  // Returns the position of the first entry at or after `begin` whose source file path (as
+  // returned by `GetEntryPath`) isn't less than `path`. Each step of the search parses an entry.
+  absl::StatusOr<size_t> LowerBound(std::string_view contents, std::string_view default_directory,
+                                    std::string_view path, size_t begin) const;
+
+  // Looks up the sorted `paths` with a merge join, each search starting at the position found for
+  // the previous path. This takes O(k log N) entry parses for k paths and N entries.
+  absl::StatusOr<std::vector<IndexMatch>> MergeJoin(std::string_view contents,
+                                                    std::string_view default_directory,
+                                                    absl::Span<std::string_view const> paths) const;
+
+ private:
+  explicit EntryIndex(MappedFile mapping, size_t const size)
+      : mapping_(std::move(mapping)), size_(size) {}
+
+  MappedFile mapping_;
+  size_t size_ = 0;
+};
+
+// Writes an index one span at a time. The index is written to a temporary file and renamed over the
+// old one on `Commit`.
+class EntryIndexWriter {
+ public:
+  static absl::StatusOr<EntryIndexWriter> Create(std::string path);
+
+  ~EntryIndexWriter() = default;
+
+  EntryIndexWriter(EntryIndexWriter&&) noexcept = default;
+  EntryIndexWriter& operator=(EntryIndexWriter&&) noexcept = default;
+  EntryIndexWriter(EntryIndexWriter const&) = delete;
+  EntryIndexWriter& operator=(EntryIndexWriter const&) = delete;
+
+  // Appends the span of the next entry. Spans must be added in order.
+  absl::Status Add(EntrySpan span);
+
+  // Finishes the index, binding it to the database described by `database_stat`, which must be
+  // taken after the database has been written.
+  absl::Status Commit(struct stat const& database_stat);
+
+ private:
+  explicit EntryIndexWriter(std::string path, std::string temp_path, tsdb2::io::FD fd)
+      : path_(std::move(path)), temp_path_(std::move(temp_path)), fd_(std::move(fd)) {}
+
+  absl::Status Flush();
+
+  std::string path_;
+  std::string temp_path_;
+  tsdb2::io::FD fd_;
+  std::string buffer_;
+  uint64_t num_entries_ = 0;
+};
+
+// Builds the index of the database at `fd` from scratch and writes it to `path`. The entries are
+// only scanned, not parsed.
+absl::Status BuildEntryIndex(std::string const& path, tsdb2::io::FD const& fd);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_ENTRY_INDEX_H__
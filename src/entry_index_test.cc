@@ -0,0 +1,282 @@
+#include "src/entry_index.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+
+namespace {
+
+using ::comp_db_hook::BuildEntryIndex;
+using ::comp_db_hook::EntryIndex;
+using ::comp_db_hook::EntryIndexWriter;
+using ::comp_db_hook::EntrySpan;
+using ::comp_db_hook::IndexMatch;
+using ::comp_db_hook::kArgumentsField;
+using ::comp_db_hook::kFileField;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Optional;
+using ::tsdb2::io::FD;
+
+class EntryIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/entry_index_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    database_path_ = absl::StrCat(directory_, "/compile_commands.json");
+    index_path_ = absl::StrCat(directory_, "/.compile_commands.json.index");
+  }
+
+  void TearDown() override {
+    ::unlink(database_path_.c_str());
+    ::unlink(index_path_.c_str());
+    ::unlink(absl::StrCat(index_path_, ".tmp").c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  // Writes a database with the given entries, indexes it, and returns its stat.
+  struct stat WriteDatabase(std::vector<std::string_view> const& entries) {
+    contents_ = absl::StrCat("[\n  ", absl::StrJoin(entries, ",\n  "), "\n]\n");
+    FD const fd{::open(database_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    EXPECT_TRUE(fd);
+    EXPECT_TRUE(comp_db_hook::WriteAll(fd, contents_).ok());
+    auto const status = BuildEntryIndex(index_path_, fd);
+    EXPECT_TRUE(status.ok()) << status;
+    return Stat();
+  }
+
+  struct stat Stat() const {
+    struct stat stat {};
+    EXPECT_EQ(::stat(database_path_.c_str(), &stat), 0);
+    return stat;
+  }
+
+  std::optional<EntryIndex> Load(struct stat const& stat) const {
+    auto status_or_index = EntryIndex::Load(index_path_, stat);
+    EXPECT_TRUE(status_or_index.ok()) << status_or_index.status();
+    return std::move(status_or_index).value_or(std::nullopt);
+  }
+
+  size_t LowerBound(EntryIndex const& index, std::string_view const path,
+                    size_t const begin = 0) const {
+    auto const status_or_position = index.LowerBound(contents_, "/w", path, begin);
+    EXPECT_TRUE(status_or_position.ok()) << status_or_position.status();
+    return status_or_position.value_or(-1);
+  }
+
+  // Returns the matches of `paths` as "<position>" for the paths to insert and "=<position>" for
+  // the ones found in the index.
+  std::vector<std::string> MergeJoin(EntryIndex const& index,
+                                     std::vector<std::string_view> const& paths) const {
+    auto const status_or_matches = index.MergeJoin(contents_, "/w", paths);
+    EXPECT_TRUE(status_or_matches.ok()) << status_or_matches.status();
+    std::vector<std::string> descriptions;
+    for (auto const& match : status_or_matches.value_or(std::vector<IndexMatch>())) {
+      descriptions.push_back(absl::StrCat(match.entry.has_value() ? "=" : "", match.position));
+    }
+    return descriptions;
+  }
+
+  std::string directory_;
+  std::string database_path_;
+  std::string index_path_;
+  std::string contents_;
+};
+
+TEST_F(EntryIndexTest, Missing) {
+  struct stat const stat {};
+  EXPECT_FALSE(Load(stat).has_value());
+}
+
+TEST_F(EntryIndexTest, Empty) {
+  auto const maybe_index = Load(WriteDatabase({}));
+  ASSERT_TRUE(maybe_index.has_value());
+  EXPECT_EQ(maybe_index->size(), 0);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/a.cc"), 0);
+}
+
+TEST_F(EntryIndexTest, Spans) {
+  auto const maybe_index =
+      Load(WriteDatabase({R"({"file": "/w/a.cc"})", R"({"file": "/w/b.cc", "x": {}})"}));
+  ASSERT_TRUE(maybe_index.has_value());
+  ASSERT_EQ(maybe_index->size(), 2);
+  EXPECT_EQ((*maybe_index)[0].offset, 4);
+  EXPECT_EQ((*maybe_index)[0].size, 19);
+  EXPECT_EQ((*maybe_index)[1].offset, 27);
+  EXPECT_EQ((*maybe_index)[1].size, 28);
+  auto const status_or_entry = maybe_index->ParseEntry(contents_, 1);
+  ASSERT_TRUE(status_or_entry.ok()) << status_or_entry.status();
+  EXPECT_THAT(status_or_entry->get<kFileField>(), Optional(std::string("/w/b.cc")));
+}
+
+TEST_F(EntryIndexTest, RejectsOtherInode) {
+  auto stat = WriteDatabase({R"({"file": "/w/a.cc"})"});
+  ASSERT_TRUE(Load(stat).has_value());
+  ++stat.st_ino;
+  EXPECT_FALSE(Load(stat).has_value());
+}
+
+TEST_F(EntryIndexTest, RejectsOtherSize) {
+  auto stat = WriteDatabase({R"({"file": "/w/a.cc"})"});
+  ++stat.st_size;
+  EXPECT_FALSE(Load(stat).has_value());
+}
+
+TEST_F(EntryIndexTest, RejectsOtherModificationTime) {
+  auto stat = WriteDatabase({R"({"file": "/w/a.cc"})"});
+  auto other_stat = stat;
+  ++other_stat.st_mtim.tv_sec;
+  EXPECT_FALSE(Load(other_stat).has_value());
+  other_stat = stat;
+  other_stat.st_mtim.tv_nsec = (other_stat.st_mtim.tv_nsec + 1) % 1000000000;
+  EXPECT_FALSE(Load(other_stat).has_value());
+}
+
+TEST_F(EntryIndexTest, RejectsRewrittenDatabase) {
+  WriteDatabase({R"({"file": "/w/a.cc"})"});
+  // Replace the database with a new file of the same size and modification time, as a writer that
+  // doesn't maintain the index would.
+  auto const stat = Stat();
+  std::string const new_path = absl::StrCat(directory_, "/new.json");
+  FD const fd{::open(new_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+  ASSERT_TRUE(fd);
+  ASSERT_TRUE(comp_db_hook::WriteAll(fd, contents_).ok());
+  struct timespec const times[2] = {stat.st_atim, stat.st_mtim};
+  ASSERT_EQ(::futimens(fd.get(), times), 0);
+  ASSERT_EQ(::rename(new_path.c_str(), database_path_.c_str()), 0);
+  auto const new_stat = Stat();
+  ASSERT_NE(new_stat.st_ino, stat.st_ino);
+  EXPECT_FALSE(Load(new_stat).has_value());
+}
+
+TEST_F(EntryIndexTest, RejectsTruncatedIndex) {
+  auto const stat = WriteDatabase({R"({"file": "/w/a.cc"})", R"({"file": "/w/b.cc"})"});
+  struct stat index_stat {};
+  ASSERT_EQ(::stat(index_path_.c_str(), &index_stat), 0);
+  // One span short of the number of entries in the header.
+  ASSERT_EQ(::truncate(index_path_.c_str(), index_stat.st_size - sizeof(EntrySpan)), 0);
+  EXPECT_FALSE(Load(stat).has_value());
+  // Not even a whole header.
+  ASSERT_EQ(::truncate(index_path_.c_str(), sizeof(EntrySpan)), 0);
+  EXPECT_FALSE(Load(stat).has_value());
+}
+
+TEST_F(EntryIndexTest, LowerBound) {
+  auto const maybe_index = Load(WriteDatabase({
+      R"({"directory": "/w", "file": "a.cc"})",
+      R"({"file": "c.cc"})",
+      R"({"directory": "/w/x/..", "file": "e.cc"})",
+      R"({"directory": "/v", "file": "/w/g.cc"})",
+  }));
+  ASSERT_TRUE(maybe_index.has_value());
+  EXPECT_EQ(LowerBound(*maybe_index, "/v/z.cc"), 0);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/a.cc"), 0);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/b.cc"), 1);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/c.cc"), 1);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/d.cc"), 2);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/e.cc"), 2);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/g.cc"), 3);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/h.cc"), 4);
+  // The search starts at `begin`.
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/a.cc", /*begin=*/2), 2);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/g.cc", /*begin=*/2), 3);
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/h.cc", /*begin=*/4), 4);
+}
+
+TEST_F(EntryIndexTest, LowerBoundOverEntryWithoutFile) {
+  auto const maybe_index = Load(WriteDatabase({
+      R"({"file": "a.cc"})",
+      R"({"directory": "/w"})",
+      R"({"file": "c.cc"})",
+  }));
+  ASSERT_TRUE(maybe_index.has_value());
+  // The first step of the search lands on the entry without a file, which can't be ordered.
+  auto const status_or_position = maybe_index->LowerBound(contents_, "/w", "/w/b.cc", 0);
+  EXPECT_EQ(status_or_position.status().code(), absl::StatusCode::kDataLoss);
+  // Searches that don't look at it succeed.
+  EXPECT_EQ(LowerBound(*maybe_index, "/w/c.cc", /*begin=*/2), 2);
+}
+
+TEST_F(EntryIndexTest, StaleIndex) {
+  auto const stat = WriteDatabase({R"({"file": "a.cc"})", R"({"file": "b.cc"})"});
+  auto const maybe_index = Load(stat);
+  ASSERT_TRUE(maybe_index.has_value());
+  // The spans don't point at entries anymore.
+  contents_ = absl::StrCat("  ", contents_);
+  EXPECT_EQ(maybe_index->ParseEntry(contents_, 0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(maybe_index->LowerBound(contents_, "/w", "/w/a.cc", 0).status().code(),
+            absl::StatusCode::kDataLoss);
+  contents_.resize(10);
+  EXPECT_EQ(maybe_index->ParseEntry(contents_, 1).status().code(), absl::StatusCode::kDataLoss);
+}
+
+TEST_F(EntryIndexTest, MergeJoin) {
+  auto const maybe_index = Load(WriteDatabase({
+      R"({"file": "b.cc"})",
+      R"({"file": "d.cc"})",
+      R"({"file": "f.cc"})",
+  }));
+  ASSERT_TRUE(maybe_index.has_value());
+  // New files are inserted before the first entry greater than them, in order when several go in
+  // the same place, and existing ones are matched in place.
+  EXPECT_THAT(MergeJoin(*maybe_index, {"/w/a.cc", "/w/b.cc", "/w/c1.cc", "/w/c2.cc", "/w/d.cc",
+                                       "/w/g.cc", "/w/h.cc"}),
+              ElementsAre("0", "=0", "1", "1", "=1", "3", "3"));
+  EXPECT_THAT(MergeJoin(*maybe_index, {"/w/b.cc", "/w/d.cc", "/w/f.cc"}),
+              ElementsAre("=0", "=1", "=2"));
+  EXPECT_THAT(MergeJoin(*maybe_index, {"/w/e.cc"}), ElementsAre("2"));
+  EXPECT_THAT(MergeJoin(*maybe_index, {}), IsEmpty());
+}
+
+TEST_F(EntryIndexTest, MergeJoinReturnsMatchedEntries) {
+  auto const maybe_index = Load(WriteDatabase({
+      R"({"directory": "/w", "arguments": ["clang", "-c", "a.cc"], "file": "a.cc"})",
+      R"({"file": "b.cc"})",
+  }));
+  ASSERT_TRUE(maybe_index.has_value());
+  std::vector<std::string_view> const paths{"/w/a.cc", "/w/a2.cc"};
+  auto const status_or_matches = maybe_index->MergeJoin(contents_, "/w", paths);
+  ASSERT_TRUE(status_or_matches.ok()) << status_or_matches.status();
+  ASSERT_EQ(status_or_matches->size(), 2);
+  auto const& entry = (*status_or_matches)[0].entry;
+  ASSERT_TRUE(entry.has_value());
+  EXPECT_THAT(entry->get<kArgumentsField>(), Optional(ElementsAre("clang", "-c", "a.cc")));
+  EXPECT_FALSE((*status_or_matches)[1].entry.has_value());
+}
+
+TEST_F(EntryIndexTest, Writer) {
+  auto const stat = WriteDatabase({R"({"file": "a.cc"})"});
+  {
+    auto status_or_writer = EntryIndexWriter::Create(index_path_);
+    ASSERT_TRUE(status_or_writer.ok()) << status_or_writer.status();
+    auto& writer = status_or_writer.value();
+    ASSERT_TRUE(writer.Add(EntrySpan{.offset = 4, .size = 17}).ok());
+    ASSERT_TRUE(writer.Add(EntrySpan{.offset = 25, .size = 17}).ok());
+    ASSERT_TRUE(writer.Commit(stat).ok());
+  }
+  EXPECT_FALSE(comp_db_hook::Exists(absl::StrCat(index_path_, ".tmp")));
+  auto const maybe_index = Load(stat);
+  ASSERT_TRUE(maybe_index.has_value());
+  ASSERT_EQ(maybe_index->size(), 2);
+  EXPECT_EQ((*maybe_index)[1].offset, 25);
+  EXPECT_EQ((*maybe_index)[1].end(), 42);
+}
+
+}  // namespace
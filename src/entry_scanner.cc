@@ -0,0 +1,92 @@
+#include "src/entry_scanner.h"
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace comp_db_hook {
+
+namespace {
+
+bool IsWhitespace(char const ch) { return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r'; }
+
+}  // namespace
+
+std::optional<std::string_view> EntryScanner::Next() {
+  size_t const size = text_.size();
+  while (offset_ < size) {
+    char const ch = text_[offset_];
+    if (IsWhitespace(ch) || ch == ',' || ch == '[') {
+      ++offset_;
+    } else if (ch == ']') {
+      // End of the array. Anything other than whitespace after it is garbage.
+      for (size_t i = offset_ + 1; i < size; ++i) {
+        if (!IsWhitespace(text_[i])) {
+          ++num_dropped_;
+          break;
+        }
+      }
+      offset_ = size;
+    } else if (ch == '{') {
+      size_t const end = FindObjectEnd(offset_);
+      if (end != std::string_view::npos) {
+        entry_offset_ = offset_;
+        offset_ = end;
+        return text_.substr(entry_offset_, end - entry_offset_);
+      }
+      ++num_dropped_;
+      offset_ = FindEntryStart(offset_ + 1);
+    } else {
+      ++num_dropped_;
+      offset_ = FindEntryStart(offset_);
+    }
+  }
+  return std::nullopt;
+}
+
+void EntryScanner::Resync() {
+  ++num_dropped_;
+  offset_ = FindEntryStart(entry_offset_ + 1);
+}
+
+size_t EntryScanner::FindObjectEnd(size_t const start) const {
+  size_t depth = 0;
+  bool in_string = false;
+  for (size_t i = start; i < text_.size(); ++i) {
+    char const ch = text_[i];
+    if (in_string) {
+      if (ch == '\\') {
+        ++i;
+      } else if (ch == '"') {
+        in_string = false;
+      }
+    } else if (ch == '"') {
+      in_string = true;
+    } else if (ch == '{') {
+      ++depth;
+    } else if (ch == '}') {
+      if (--depth == 0) {
+        return i + 1;
+      }
+    }
+  }
+  return std::string_view::npos;
+}
+
+size_t EntryScanner::FindEntryStart(size_t const start) const {
+  for (size_t i = start; i < text_.size(); ++i) {
+    if (text_[i] != '{') {
+      continue;
+    }
+    size_t j = i;
+    while (j > 0 && IsWhitespace(text_[j - 1])) {
+      --j;
+    }
+    if (j > 0 && (text_[j - 1] == ',' || text_[j - 1] == '[')) {
+      return i;
+    }
+  }
+  return text_.size();
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,61 @@
+#ifndef __COMP_DB_HOOK_ENTRY_SCANNER_H__
+#define __COMP_DB_HOOK_ENTRY_SCANNER_H__
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace comp_db_hook {
+
+// Splits the text of a JSON compilation database into the texts of its entries without parsing
+// them, so that entries can be processed one at a time and malformed ones can be skipped.
+//
+// The scanner only tracks strings and brace nesting, so it doesn't validate the entries: callers
+// are expected to parse each of them and call `Resync` on failure. Resynchronization looks for the
+// next `{` that follows a `,` or a `[` (ignoring whitespace), which is how every entry but the
+// first starts in any formatting of the array and is very unlikely to occur inside strings of a
+// command line.
+class EntryScanner {
+ public:
+  explicit EntryScanner(std::string_view const text) : text_(text) {}
+
+  ~EntryScanner() = default;
+
+  EntryScanner(EntryScanner&&) noexcept = default;
+  EntryScanner& operator=(EntryScanner&&) noexcept = default;
+  EntryScanner(EntryScanner const&) = default;
+  EntryScanner& operator=(EntryScanner const&) = default;
+
+  // Returns the text of the next entry, i.e. the next balanced `{...}` block at the top level of
+  // the array, or an empty optional at the end of the text. Unbalanced blocks (e.g. the last entry
+  // of a truncated file) and stray characters between entries are skipped and counted as dropped.
+  std::optional<std::string_view> Next();
+
+  // Declares that the entry last returned by `Next` is malformed. It's counted as dropped and
+  // scanning resumes at the next position that looks like the start of an entry, which may be
+  // inside the dropped text if its braces were unbalanced by the corruption.
+  void Resync();
+
+  // The offset of the entry last returned by `Next`.
+  size_t entry_offset() const { return entry_offset_; }
+
+  // Number of malformed regions skipped so far.
+  size_t num_dropped() const { return num_dropped_; }
+
+ private:
+  // Returns the offset following the `}` matching the `{` at `start`, or `npos`.
+  size_t FindObjectEnd(size_t start) const;
+
+  // Returns the offset of the first `{` at or after `start` that follows a `,` or a `[`, or the
+  // size of the text if there's none.
+  size_t FindEntryStart(size_t start) const;
+
+  std::string_view text_;
+  size_t offset_ = 0;
+  size_t entry_offset_ = 0;
+  size_t num_dropped_ = 0;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_ENTRY_SCANNER_H__
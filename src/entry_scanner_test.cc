@@ -0,0 +1,167 @@
+#include "src/entry_scanner.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "src/command_database.h"
+
+namespace {
+
+using ::comp_db_hook::CommandEntries;
+using ::comp_db_hook::EntryScanner;
+using ::comp_db_hook::kFileField;
+using ::comp_db_hook::SalvageCommandEntries;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+struct ScanResult {
+  std::vector<std::string_view> entries;
+  size_t num_dropped;
+};
+
+// Scans `text` like `SalvageCommandEntries`, with the entries containing `BAD` standing for the ones
+// that fail to parse.
+ScanResult Scan(std::string_view const text) {
+  ScanResult result;
+  EntryScanner scanner{text};
+  for (auto maybe_entry = scanner.Next(); maybe_entry.has_value(); maybe_entry = scanner.Next()) {
+    if (absl::StrContains(maybe_entry.value(), "BAD")) {
+      scanner.Resync();
+    } else {
+      result.entries.push_back(maybe_entry.value());
+    }
+  }
+  result.num_dropped = scanner.num_dropped();
+  return result;
+}
+
+std::vector<std::string> GetFiles(CommandEntries const& entries) {
+  std::vector<std::string> files;
+  for (auto const& entry : entries) {
+    files.push_back(entry.get<kFileField>().value_or(""));
+  }
+  return files;
+}
+
+TEST(EntryScannerTest, Empty) {
+  auto const result = Scan("");
+  EXPECT_THAT(result.entries, IsEmpty());
+  EXPECT_EQ(result.num_dropped, 0);
+}
+
+TEST(EntryScannerTest, EmptyArray) {
+  auto const result = Scan("[]\n");
+  EXPECT_THAT(result.entries, IsEmpty());
+  EXPECT_EQ(result.num_dropped, 0);
+}
+
+TEST(EntryScannerTest, WellFormed) {
+  std::string_view const text = "[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\"}\n]\n";
+  EntryScanner scanner{text};
+  EXPECT_EQ(scanner.Next(), "{\"file\": \"a.cc\"}");
+  EXPECT_EQ(scanner.entry_offset(), 4);
+  EXPECT_EQ(scanner.Next(), "{\"file\": \"b.cc\"}");
+  EXPECT_EQ(scanner.entry_offset(), 24);
+  EXPECT_EQ(scanner.Next(), std::nullopt);
+  EXPECT_EQ(scanner.num_dropped(), 0);
+}
+
+TEST(EntryScannerTest, NestedObjects) {
+  auto const result = Scan("[{\"file\": \"a.cc\", \"x\": {\"y\": {}}}, {\"file\": \"b.cc\"}]");
+  EXPECT_THAT(result.entries,
+              ElementsAre("{\"file\": \"a.cc\", \"x\": {\"y\": {}}}", "{\"file\": \"b.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 0);
+}
+
+TEST(EntryScannerTest, TruncatedMidEntry) {
+  auto const result = Scan("[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.c");
+  EXPECT_THAT(result.entries, ElementsAre("{\"file\": \"a.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 1);
+}
+
+TEST(EntryScannerTest, TruncatedInsideString) {
+  auto const result = Scan("[{\"file\": \"a.cc\"}, {\"file\": \"b.cc\", \"arguments\": [\"-D{");
+  EXPECT_THAT(result.entries, ElementsAre("{\"file\": \"a.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 1);
+}
+
+TEST(EntryScannerTest, MissingClosingBrace) {
+  auto const result = Scan(
+      "[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\",\n  {\"file\": \"c.cc\"}\n]\n");
+  EXPECT_THAT(result.entries, ElementsAre("{\"file\": \"a.cc\"}", "{\"file\": \"c.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 1);
+}
+
+TEST(EntryScannerTest, ExtraClosingBrace) {
+  auto const result =
+      Scan("[\n  {\"file\": \"a.cc\"}},\n  {\"file\": \"b.cc\"},\n  {\"file\": \"c.cc\"}\n]\n");
+  EXPECT_THAT(result.entries,
+              ElementsAre("{\"file\": \"a.cc\"}", "{\"file\": \"b.cc\"}", "{\"file\": \"c.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 1);
+}
+
+TEST(EntryScannerTest, StaleBytesAfterArray) {
+  // What an interrupted rewrite leaves when the new database is shorter than the old one and the
+  // file wasn't truncated yet.
+  auto const result = Scan("[\n  {\"file\": \"a.cc\"}\n]\n  {\"file\": \"old.cc\"}\n]\n");
+  EXPECT_THAT(result.entries, ElementsAre("{\"file\": \"a.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 1);
+}
+
+TEST(EntryScannerTest, WhitespaceAfterArray) {
+  auto const result = Scan("[{\"file\": \"a.cc\"}]\n \t\r\n");
+  EXPECT_THAT(result.entries, ElementsAre("{\"file\": \"a.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 0);
+}
+
+TEST(EntryScannerTest, BracesInsideStrings) {
+  std::string_view const entry =
+      R"({"file": "a.cc", "arguments": ["-D{=}", "-DX=\"}\"", ",{", "\\"]})";
+  std::string const text = absl::StrCat("[", entry, ", {\"file\": \"b.cc\"}]");
+  auto const result = Scan(text);
+  EXPECT_THAT(result.entries, ElementsAre(entry, "{\"file\": \"b.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 0);
+}
+
+TEST(EntryScannerTest, ResyncAfterMalformedEntry) {
+  auto const result =
+      Scan("[{\"file\": \"a.cc\"}, {\"file\": BAD}, {\"file\": \"c.cc\"}, {\"BAD\": 1}]");
+  EXPECT_THAT(result.entries, ElementsAre("{\"file\": \"a.cc\"}", "{\"file\": \"c.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 2);
+}
+
+TEST(EntryScannerTest, ResyncInsideMalformedEntry) {
+  // The braces of the corrupt entry are balanced by swallowing the next one, which is found again
+  // by resynchronizing inside the dropped text.
+  auto const result = Scan("[{\"file\": \"BAD\", {\"file\": \"b.cc\"}}, {\"file\": \"c.cc\"}]");
+  EXPECT_THAT(result.entries, ElementsAre("{\"file\": \"b.cc\"}", "{\"file\": \"c.cc\"}"));
+  EXPECT_EQ(result.num_dropped, 2);
+}
+
+TEST(SalvageCommandEntriesTest, KeepsWellFormedEntries) {
+  auto const entries = SalvageCommandEntries(
+      "[\n"
+      "  {\"directory\": \"/w\", \"file\": \"a.cc\", \"arguments\": [\"clang\", \"-D{\"]},\n"
+      "  {\"directory\": \"/w\", \"file\": 42},\n"
+      "  {\"directory\": \"/w\", \"file\": \"c.cc\",\n"
+      "  {\"directory\": \"/w\", \"file\": \"d.cc\"}}\n"
+      "]\n"
+      "  {\"directory\": \"/w\", \"file\": \"stale.cc\"}\n"
+      "]\n");
+  EXPECT_THAT(GetFiles(entries), ElementsAre("a.cc", "d.cc"));
+}
+
+TEST(SalvageCommandEntriesTest, Truncated) {
+  auto const entries = SalvageCommandEntries(
+      "[\n  {\"directory\": \"/w\", \"file\": \"a.cc\"},\n  {\"directory\": \"/w\", \"fi");
+  EXPECT_THAT(GetFiles(entries), ElementsAre("a.cc"));
+}
+
+}  // namespace
@@ -0,0 +1,207 @@
+#include "src/entry_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_replace.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+namespace json = ::tsdb2::json;
+
+// Output is flushed to the temporary file whenever the buffer exceeds this size.
+size_t constexpr kBufferSize = 64 * 1024;
+
+// Assumed block size of filesystems that don't report one, for the alignment of cloned ranges.
+off_t constexpr kDefaultBlockSize = 4096;
+
+// Writes all of `contents` at `offset` of `fd`, retrying short and interrupted writes.
+absl::Status PwriteAll(FD const& fd, std::string_view const contents, off_t const offset) {
+  size_t written = 0;
+  while (written < contents.size()) {
+    auto const result = ::pwrite(fd.get(), contents.data() + written, contents.size() - written,
+                                 offset + written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::ErrnoToStatus(errno, "pwrite");
+    }
+    written += result;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+std::string FormatEntry(CommandEntry const& entry) {
+  json::StringifyOptions const options{.pretty = true};
+  // Entries are nested in the array, so all their lines but the first need one more level of
+  // indentation. JSON strings can't contain raw newlines, so this doesn't alter any values.
+  return absl::StrReplaceAll(json::Stringify(entry, options), {{"\n", "\n  "}});
+}
+
+absl::StatusOr<EntryWriter> EntryWriter::Create(std::string const& temp_path,
+                                                size_t const prefix_size) {
+  FD temp_fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      temp_path.c_str(), /*flags=*/O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0600)};
+  if (!temp_fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  if (::unlink(temp_path.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "unlink");
+  }
+  EntryWriter writer{std::move(temp_fd), prefix_size};
+  if (prefix_size > 0) {
+    // The temporary file has the same layout as the database, with a hole in place of the prefix.
+    if (::lseek(writer.fd_.get(), prefix_size, SEEK_SET) < 0) {
+      return absl::ErrnoToStatus(errno, "lseek");
+    }
+    writer.written_ = prefix_size;
+  } else {
+    RETURN_IF_ERROR(writer.Append("["));
+  }
+  return std::move(writer);
+}
+
+absl::Status EntryWriter::WriteText(std::string_view const text) {
+  RETURN_IF_ERROR(Append(has_entries_ ? ",\n  " : "\n  "));
+  has_entries_ = true;
+  return Append(text);
+}
+
+absl::Status EntryWriter::Write(CommandEntry const& entry) {
+  return WriteText(FormatEntry(entry));
+}
+
+absl::Status EntryWriter::CopyEntries(FD const& fd, size_t const begin, size_t const end) {
+  RETURN_IF_ERROR(Append(has_entries_ ? ",\n  " : "\n  "));
+  has_entries_ = true;
+  RETURN_IF_ERROR(Flush());
+  RETURN_IF_ERROR(CopyFile(fd, begin, end - begin, fd_, /*destination_offset=*/nullptr));
+  written_ += end - begin;
+  return absl::OkStatus();
+}
+
+absl::Status EntryWriter::CopyTo(FD const& fd) {
+  RETURN_IF_ERROR(Append(has_entries_ ? "\n]\n" : "]\n"));
+  RETURN_IF_ERROR(Flush());
+  // Overwrite first and truncate later, so that a crash in between leaves at worst some trailing
+  // garbage that the parser can skip, rather than an empty database. The prefix is already there.
+  RETURN_IF_ERROR(CloneOrCopyRange(fd_, prefix_size_, written_ - prefix_size_, fd));
+  if (::ftruncate(fd.get(), written_) < 0) {
+    return absl::ErrnoToStatus(errno, "ftruncate");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status EntryWriter::Append(std::string_view const text) {
+  if (buffer_.size() + text.size() < kBufferSize) {
+    buffer_.append(text);
+    return absl::OkStatus();
+  }
+  // Large texts (e.g. an unchanged prefix of the database) are written directly rather than copied
+  // into the buffer.
+  RETURN_IF_ERROR(Flush());
+  RETURN_IF_ERROR(WriteAll(fd_, text));
+  written_ += text.size();
+  return absl::OkStatus();
+}
+
+absl::Status EntryWriter::CopyFile(FD const& source, off_t const offset, off_t const size,
+                                   FD const& destination, loff_t* const destination_offset) {
+  // `copy_file_range` copies in the kernel, without going through user space.
+  loff_t source_offset = offset;
+  off_t copied = 0;
+  while (copied < size) {
+    auto const result = ::copy_file_range(source.get(), &source_offset, destination.get(),
+                                          destination_offset, size - copied, /*flags=*/0);
+    if (result < 0) {
+      if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+        // Not supported by the kernel or between these files, copy the rest by hand.
+        break;
+      }
+      return absl::ErrnoToStatus(errno, "copy_file_range");
+    } else if (result == 0) {
+      return absl::DataLossError("unexpected end of file");
+    }
+    copied += result;
+  }
+  char buffer[kBufferSize];
+  while (copied < size) {
+    auto const result = ::pread(source.get(), buffer,
+                                std::min<off_t>(sizeof(buffer), size - copied), offset + copied);
+    if (result < 0) {
+      return absl::ErrnoToStatus(errno, "pread");
+    } else if (result == 0) {
+      return absl::DataLossError("unexpected end of file");
+    }
+    if (destination_offset != nullptr) {
+      RETURN_IF_ERROR(
+          PwriteAll(destination, std::string_view(buffer, result), *destination_offset));
+      *destination_offset += result;
+    } else {
+      RETURN_IF_ERROR(WriteAll(destination, std::string_view(buffer, result)));
+    }
+    copied += result;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status EntryWriter::CloneOrCopyRange(FD const& source, off_t const offset, off_t const size,
+                                           FD const& destination) {
+  struct stat stat {};
+  if (::fstat(destination.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  off_t const block_size = stat.st_blksize > 0 ? stat.st_blksize : kDefaultBlockSize;
+  off_t const clone_begin = (offset + block_size - 1) / block_size * block_size;
+  off_t const clone_end = (offset + size) / block_size * block_size;
+  // The offsets are the same in both files, so all of them are block-aligned modulo each other.
+  loff_t position = offset;
+  if (clone_begin < clone_end) {
+    RETURN_IF_ERROR(CopyFile(source, position, clone_begin - position, destination, &position));
+    struct file_clone_range range {};
+    range.src_fd = source.get();
+    range.src_offset = clone_begin;
+    range.src_length = clone_end - clone_begin;
+    range.dest_offset = clone_begin;
+    if (::ioctl(destination.get(), FICLONERANGE, &range) == 0) {
+      position = clone_end;
+    } else if (errno != EOPNOTSUPP && errno != EXDEV && errno != EINVAL && errno != ENOTTY) {
+      return absl::ErrnoToStatus(errno, "ioctl(FICLONERANGE)");
+    }
+  }
+  return CopyFile(source, position, offset + size - position, destination, &position);
+}
+
+absl::Status EntryWriter::Flush() {
+  RETURN_IF_ERROR(WriteAll(fd_, buffer_));
+  written_ += buffer_.size();
+  buffer_.clear();
+  return absl::OkStatus();
+}
+
+}  // namespace comp_db_hook
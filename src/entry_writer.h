@@ -0,0 +1,96 @@
+#ifndef __COMP_DB_HOOK_ENTRY_WRITER_H__
+#define __COMP_DB_HOOK_ENTRY_WRITER_H__
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+
+namespace comp_db_hook {
+
+// Returns the text of `entry` as it's written in the database by `EntryWriter`, i.e. pretty-printed
+// and indented as an element of the array.
+std::string FormatEntry(CommandEntry const& entry);
+
+// Writes a compilation database one entry at a time to a temporary file and then copies it over the
+// real one, so that rewriting the database takes memory bounded by the size of the largest entry
+// rather than by the size of the database. The output has the same format as
+// `tsdb2::json::Stringify` with pretty-printing and a trailing newline.
+//
+// The temporary file is unlinked as soon as it's created, so it never outlives the process. The
+// caller must hold the database lock, which also protects the temporary file path.
+class EntryWriter {
+ public:
+  // Creates the temporary file at `temp_path`. A nonzero `prefix_size` keeps the first
+  // `prefix_size` bytes of the database as they are, which allows skipping the serialization and
+  // the rewrite of an unchanged prefix: the output starts right after it and `CopyTo` only writes
+  // what follows. The prefix must be either empty or a well-formed part of the database spanning
+  // from the opening bracket to the end of an entry, and `CopyTo` must be given that database.
+  static absl::StatusOr<EntryWriter> Create(std::string const& temp_path, size_t prefix_size);
+
+  ~EntryWriter() = default;
+
+  EntryWriter(EntryWriter&&) noexcept = default;
+  EntryWriter& operator=(EntryWriter&&) noexcept = default;
+  EntryWriter(EntryWriter const&) = delete;
+  EntryWriter& operator=(EntryWriter const&) = delete;
+
+  // Appends an entry given its JSON text, e.g. as returned by `EntryScanner`.
+  absl::Status WriteText(std::string_view text);
+
+  // Appends an entry.
+  absl::Status Write(CommandEntry const& entry);
+
+  // Appends the entries spanning the bytes [begin, end) of the database at `fd` verbatim, e.g. a
+  // run of unchanged entries. The range must start at the beginning of an entry and end at the end
+  // of one.
+  absl::Status CopyEntries(tsdb2::io::FD const& fd, size_t begin, size_t end);
+
+  // Offset in the output of the next byte to be written. After appending an entry its text ends
+  // here.
+  size_t position() const { return written_ + buffer_.size(); }
+
+  // Ends the array and replaces the content of the database at `fd` following the prefix with the
+  // written one. The database file is overwritten in place (rather than renamed over) so that
+  // processes waiting for the lock on it keep referring to the right file. The block-aligned part
+  // of the output is cloned with `FICLONERANGE` where the filesystem supports it, so it shares the
+  // extents of the temporary file instead of being written again.
+  absl::Status CopyTo(tsdb2::io::FD const& fd);
+
+ private:
+  explicit EntryWriter(tsdb2::io::FD fd, size_t const prefix_size)
+      : fd_(std::move(fd)), prefix_size_(prefix_size), has_entries_(prefix_size > 0) {}
+
+  absl::Status Append(std::string_view text);
+  absl::Status Flush();
+
+  // Copies `size` bytes starting at `offset` of `source` to `destination`, at `*destination_offset`
+  // (which is advanced) or at its current offset if `destination_offset` is null. Uses
+  // `copy_file_range`, which copies in the kernel, and falls back to reading and writing where it's
+  // not supported.
+  static absl::Status CopyFile(tsdb2::io::FD const& source, off_t offset, off_t size,
+                               tsdb2::io::FD const& destination, loff_t* destination_offset);
+
+  // Copies `size` bytes starting at `offset` of `source` to the same offset of `destination`. The
+  // blocks fully inside the range are cloned with `FICLONERANGE`, and the rest (or everything, if
+  // cloning isn't supported) is copied with `CopyFile`.
+  static absl::Status CloneOrCopyRange(tsdb2::io::FD const& source, off_t offset, off_t size,
+                                       tsdb2::io::FD const& destination);
+
+  tsdb2::io::FD fd_;
+  size_t prefix_size_;
+  std::string buffer_;
+  size_t written_ = 0;
+  bool has_entries_;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_ENTRY_WRITER_H__
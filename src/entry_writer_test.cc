@@ -0,0 +1,202 @@
+#include "src/entry_writer.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+
+namespace {
+
+using ::comp_db_hook::CommandEntry;
+using ::comp_db_hook::EntryWriter;
+using ::comp_db_hook::FormatEntry;
+using ::comp_db_hook::kArgumentsField;
+using ::comp_db_hook::kDirectoryField;
+using ::comp_db_hook::kFileField;
+using ::testing::ElementsAre;
+using ::testing::Optional;
+using ::tsdb2::io::FD;
+
+CommandEntry MakeEntry(std::vector<std::string> arguments) {
+  return CommandEntry{
+      tsdb2::json::kInitialize,
+      /*directory=*/std::make_optional<std::string>("/workspace"),
+      /*arguments=*/std::make_optional(std::move(arguments)),
+      /*file=*/std::make_optional<std::string>("foo.cc"),
+  };
+}
+
+TEST(FormatEntryTest, IndentsNestedLines) {
+  auto const entry = MakeEntry({"clang", "-c", "foo.cc"});
+  tsdb2::json::StringifyOptions const options{.pretty = true};
+  std::vector<std::string> const lines = absl::StrSplit(FormatEntry(entry), '\n');
+  std::vector<std::string> const pretty_lines =
+      absl::StrSplit(tsdb2::json::Stringify(entry, options), '\n');
+  ASSERT_EQ(lines.size(), pretty_lines.size());
+  ASSERT_GT(lines.size(), 1);
+  EXPECT_EQ(lines.front(), pretty_lines.front());
+  for (size_t i = 1; i < lines.size(); ++i) {
+    EXPECT_EQ(lines[i], absl::StrCat("  ", pretty_lines[i])) << i;
+  }
+}
+
+TEST(FormatEntryTest, KeepsEscapedNewlines) {
+  auto const entry = MakeEntry({"clang", "-DX=\"a\nb\"", "foo.cc"});
+  auto const text = FormatEntry(entry);
+  auto const status_or_entry = tsdb2::json::Parse<CommandEntry>(text);
+  ASSERT_TRUE(status_or_entry.ok()) << status_or_entry.status();
+  EXPECT_THAT(status_or_entry->get<kDirectoryField>(), Optional(std::string("/workspace")));
+  EXPECT_THAT(status_or_entry->get<kArgumentsField>(),
+              Optional(ElementsAre("clang", "-DX=\"a\nb\"", "foo.cc")));
+  EXPECT_THAT(status_or_entry->get<kFileField>(), Optional(std::string("foo.cc")));
+}
+
+class EntryWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/entry_writer_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    database_path_ = absl::StrCat(directory_, "/compile_commands.json");
+    temp_path_ = absl::StrCat(directory_, "/compile_commands.json.tmp");
+    fd_ = FD(::open(database_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    ASSERT_TRUE(fd_);
+  }
+
+  void TearDown() override {
+    ::unlink(database_path_.c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  void WriteDatabase(std::string_view const contents) {
+    ASSERT_EQ(::pwrite(fd_.get(), contents.data(), contents.size(), 0), contents.size());
+  }
+
+  std::string ReadDatabase() const {
+    auto status_or_contents = comp_db_hook::ReadFile(database_path_);
+    EXPECT_TRUE(status_or_contents.ok()) << status_or_contents.status();
+    return std::move(status_or_contents).value_or(std::nullopt).value_or("<missing>");
+  }
+
+  EntryWriter CreateWriter(size_t const prefix_size) const {
+    auto status_or_writer = EntryWriter::Create(temp_path_, prefix_size);
+    EXPECT_TRUE(status_or_writer.ok()) << status_or_writer.status();
+    return std::move(status_or_writer).value();
+  }
+
+  std::string directory_;
+  std::string database_path_;
+  std::string temp_path_;
+  FD fd_;
+};
+
+TEST_F(EntryWriterTest, Empty) {
+  auto writer = CreateWriter(/*prefix_size=*/0);
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  EXPECT_EQ(ReadDatabase(), "[]\n");
+  EXPECT_FALSE(comp_db_hook::Exists(temp_path_));
+}
+
+TEST_F(EntryWriterTest, WriteText) {
+  auto writer = CreateWriter(/*prefix_size=*/0);
+  EXPECT_EQ(writer.position(), 1);
+  ASSERT_TRUE(writer.WriteText("{\"file\": \"a.cc\"}").ok());
+  EXPECT_EQ(writer.position(), 20);
+  ASSERT_TRUE(writer.WriteText("{\"file\": \"b.cc\"}").ok());
+  EXPECT_EQ(writer.position(), 40);
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  EXPECT_EQ(ReadDatabase(), "[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\"}\n]\n");
+}
+
+TEST_F(EntryWriterTest, Write) {
+  auto const entry = MakeEntry({"clang", "-c", "foo.cc"});
+  auto writer = CreateWriter(/*prefix_size=*/0);
+  ASSERT_TRUE(writer.Write(entry).ok());
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  EXPECT_EQ(ReadDatabase(), absl::StrCat("[\n  ", FormatEntry(entry), "\n]\n"));
+}
+
+TEST_F(EntryWriterTest, CopyEntriesWithoutPrefix) {
+  WriteDatabase("[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\"}\n]\n");
+  auto writer = CreateWriter(/*prefix_size=*/0);
+  ASSERT_TRUE(writer.CopyEntries(fd_, 4, 40).ok());
+  EXPECT_EQ(writer.position(), 40);
+  ASSERT_TRUE(writer.WriteText("{\"file\": \"c.cc\"}").ok());
+  ASSERT_TRUE(writer.CopyEntries(fd_, 4, 20).ok());
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  EXPECT_EQ(ReadDatabase(),
+            "[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\"},\n  {\"file\": \"c.cc\"},\n"
+            "  {\"file\": \"a.cc\"}\n]\n");
+}
+
+TEST_F(EntryWriterTest, CopyEntriesWithPrefix) {
+  WriteDatabase("[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\"}\n]\n");
+  auto writer = CreateWriter(/*prefix_size=*/20);
+  EXPECT_EQ(writer.position(), 20);
+  ASSERT_TRUE(writer.CopyEntries(fd_, 24, 40).ok());
+  ASSERT_TRUE(writer.WriteText("{\"file\": \"c.cc\"}").ok());
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  EXPECT_EQ(ReadDatabase(),
+            "[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\"},\n  {\"file\": \"c.cc\"}\n]\n");
+}
+
+TEST_F(EntryWriterTest, WriteTextWithPrefix) {
+  WriteDatabase("[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\"}\n]\n");
+  auto writer = CreateWriter(/*prefix_size=*/20);
+  ASSERT_TRUE(writer.WriteText("{\"file\": \"c.cc\"}").ok());
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  EXPECT_EQ(ReadDatabase(), "[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"c.cc\"}\n]\n");
+}
+
+TEST_F(EntryWriterTest, PrefixOnly) {
+  WriteDatabase("[\n  {\"file\": \"a.cc\"},\n  {\"file\": \"b.cc\"}\n]\n");
+  auto writer = CreateWriter(/*prefix_size=*/20);
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  EXPECT_EQ(ReadDatabase(), "[\n  {\"file\": \"a.cc\"}\n]\n");
+}
+
+TEST_F(EntryWriterTest, CopyToShrinks) {
+  WriteDatabase(
+      absl::StrCat("[\n  {\"file\": \"", std::string(10000, 'a'), ".cc\"},\n  {\"file\": \"",
+                   std::string(10000, 'b'), ".cc\"}\n]\n"));
+  auto writer = CreateWriter(/*prefix_size=*/0);
+  ASSERT_TRUE(writer.WriteText("{\"file\": \"c.cc\"}").ok());
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  std::string_view constexpr kExpected = "[\n  {\"file\": \"c.cc\"}\n]\n";
+  EXPECT_EQ(ReadDatabase(), kExpected);
+  struct stat stat {};
+  ASSERT_EQ(::fstat(fd_.get(), &stat), 0);
+  EXPECT_EQ(stat.st_size, kExpected.size());
+}
+
+TEST_F(EntryWriterTest, LargeSuffixAfterUnalignedPrefix) {
+  // Large enough to span several blocks on either side of an unaligned prefix, so that both the
+  // copied head and tail and the cloned middle (where supported) are exercised.
+  std::string const first = absl::StrCat("{\"file\": \"", std::string(5000, 'a'), ".cc\"}");
+  std::string const second = absl::StrCat("{\"file\": \"", std::string(30000, 'b'), ".cc\"}");
+  std::string const third = absl::StrCat("{\"file\": \"", std::string(20000, 'c'), ".cc\"}");
+  WriteDatabase(absl::StrCat("[\n  ", first, ",\n  ", second, "\n]\n"));
+  size_t const prefix_size = 4 + first.size();
+  auto writer = CreateWriter(prefix_size);
+  ASSERT_TRUE(writer.WriteText(third).ok());
+  ASSERT_TRUE(writer.CopyEntries(fd_, prefix_size + 4, prefix_size + 4 + second.size()).ok());
+  ASSERT_TRUE(writer.CopyTo(fd_).ok());
+  EXPECT_EQ(ReadDatabase(), absl::StrCat("[\n  ", first, ",\n  ", third, ",\n  ", second, "\n]\n"));
+}
+
+}  // namespace
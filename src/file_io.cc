@@ -0,0 +1,84 @@
+#include "src/file_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "src/mapped_file.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+// How much `ReadFile` reads at a time from a file descriptor.
+size_t constexpr kReadSize = 64 * 1024;
+
+}  // namespace
+
+bool Exists(std::string const& path) {
+  struct stat stat {};
+  return ::stat(path.c_str(), &stat) == 0;
+}
+
+absl::StatusOr<std::optional<std::string>> ReadFile(std::string const& path) {
+  FD const fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!fd) {
+    if (errno == ENOENT) {
+      return std::nullopt;
+    } else {
+      return absl::ErrnoToStatus(errno, "open");
+    }
+  }
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  return std::string(mapping.contents());
+}
+
+absl::StatusOr<std::string> ReadFile(FD const& fd) {
+  std::string contents;
+  char buffer[kReadSize];
+  while (true) {
+    auto const result = ::read(fd.get(), buffer, sizeof(buffer));
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::ErrnoToStatus(errno, "read");
+    } else if (result == 0) {
+      return contents;
+    }
+    contents.append(buffer, result);
+  }
+}
+
+absl::Status WriteAll(FD const& fd, std::string_view const contents) {
+  size_t written = 0;
+  while (written < contents.size()) {
+    auto const result = ::write(fd.get(), contents.data() + written, contents.size() - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::ErrnoToStatus(errno, "write");
+    }
+    written += result;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,29 @@
+#ifndef __COMP_DB_HOOK_FILE_IO_H__
+#define __COMP_DB_HOOK_FILE_IO_H__
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+
+namespace comp_db_hook {
+
+// Tells whether anything exists at `path`.
+bool Exists(std::string const& path);
+
+// Reads the whole file at `path` through a memory mapping. Returns an empty optional if it doesn't
+// exist.
+absl::StatusOr<std::optional<std::string>> ReadFile(std::string const& path);
+
+// Reads `fd` from its current position to the end.
+absl::StatusOr<std::string> ReadFile(tsdb2::io::FD const& fd);
+
+// Writes all of `contents` to `fd`, retrying short and interrupted writes.
+absl::Status WriteAll(tsdb2::io::FD const& fd, std::string_view contents);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_FILE_IO_H__
@@ -0,0 +1,375 @@
+#include "src/garbage_collector.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "common/utilities.h"
+#include "io/advisory_file_lock.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/background_task.h"
+#include "src/change_log.h"
+#include "src/command_database.h"
+#include "src/config.h"
+#include "src/entry_scanner.h"
+#include "src/entry_writer.h"
+#include "src/file_io.h"
+#include "src/last_seen.h"
+#include "src/mapped_file.h"
+#include "src/package_roots.h"
+#include "src/shards.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+namespace json = ::tsdb2::json;
+
+std::string_view constexpr kThreadsEnvVar = "COMP_DB_HOOK_GC_THREADS";
+std::string_view constexpr kIntervalEnvVar = "COMP_DB_HOOK_GC_INTERVAL";
+
+size_t constexpr kMaxDefaultThreads = 16;
+
+// Number of paths a worker claims at a time.
+size_t constexpr kBatchSize = 256;
+
+// Number of consecutive entries of the database whose source files are checked together.
+size_t constexpr kScanBatchSize = 16 * 1024;
+
+bool IsMissing(std::string const& path) {
+  struct statx statx {};
+  if (::statx(AT_FDCWD, path.c_str(), AT_STATX_DONT_SYNC, STATX_TYPE, &statx) == 0) {
+    return false;
+  }
+  return errno == ENOENT || errno == ENOTDIR;
+}
+
+// Updates the modification time of the garbage collection timestamp file, creating it if needed.
+absl::Status TouchTimestamp(std::string const& path) {
+  FD const fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      path.c_str(), /*flags=*/O_WRONLY | O_CREAT | O_CLOEXEC, /*mode=*/0664)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  if (::futimens(fd.get(), nullptr) < 0) {
+    return absl::ErrnoToStatus(errno, "futimens");
+  }
+  return absl::OkStatus();
+}
+
+// Removes the stale and evicted entries of the database at `fd`, which is in `database_directory`
+// and must be locked by the caller. The records of the removed entries are erased from `last_seen`,
+// and the remaining entries that had none get one (see `EvictEntry`). `last_seen` is null if
+// eviction is disabled, in which case only the stale entries are removed.
+absl::StatusOr<GarbageCollectionResult> CollectDatabaseGarbage(
+    FD const& fd, std::string_view const workspace_directory,
+    std::string_view const database_directory, size_t const num_threads, int64_t const generation,
+    LastSeenMap* const last_seen) {
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  auto const policy = EvictionPolicy::FromEnvironment();
+  auto const now = ::time(nullptr);
+  GarbageCollectionResult result;
+  std::vector<Change> removals;
+  std::optional<EntryWriter> writer;
+  // End of the last entry before the first removal.
+  size_t prefix_end = 0;
+  auto const start_writing = [&]() -> absl::Status {
+    DEFINE_VAR_OR_RETURN(
+        new_writer,
+        EntryWriter::Create(GetSidecarFilePath(database_directory, "tmp"), prefix_end));
+    writer.emplace(std::move(new_writer));
+    return absl::OkStatus();
+  };
+  // The texts of a batch of consecutive entries, at `offsets`, and the paths of their source files.
+  // Entries without a `file` field get an empty path, which is always reported missing.
+  std::vector<std::string_view> texts;
+  std::vector<size_t> offsets;
+  std::vector<std::string> paths;
+  size_t released = 0;
+  auto const process_batch = [&]() -> absl::Status {
+    auto const missing = FindMissingPaths(paths, num_threads);
+    size_t next_missing = 0;
+    for (size_t i = 0; i < texts.size(); ++i) {
+      bool removed = false;
+      if (next_missing < missing.size() && missing[next_missing] == i) {
+        ++next_missing;
+        ++result.num_missing;
+        removed = true;
+        if (last_seen != nullptr) {
+          last_seen->erase(paths[i]);
+        }
+      } else if (last_seen != nullptr && EvictEntry(policy, generation, now, paths[i], last_seen)) {
+        ++result.num_evicted;
+        removed = true;
+      }
+      if (removed) {
+        if (!paths[i].empty()) {
+          removals.push_back(Change{.kind = ChangeKind::kRemoved, .path = std::move(paths[i])});
+        }
+        if (!writer.has_value()) {
+          RETURN_IF_ERROR(start_writing());
+        }
+      } else if (writer.has_value()) {
+        RETURN_IF_ERROR(writer->WriteText(texts[i]));
+      } else {
+        prefix_end = offsets[i] + texts[i].size();
+      }
+    }
+    if (!texts.empty()) {
+      size_t const end = offsets.back() + texts.back().size();
+      mapping.Release(released, end);
+      released = end;
+    }
+    texts.clear();
+    offsets.clear();
+    paths.clear();
+    return absl::OkStatus();
+  };
+  EntryScanner scanner{mapping.contents()};
+  size_t num_dropped = 0;
+  for (auto maybe_text = scanner.Next(); maybe_text.has_value(); maybe_text = scanner.Next()) {
+    if (scanner.num_dropped() > num_dropped) {
+      // Malformed regions are dropped by rewriting the database without them, starting before the
+      // first one.
+      num_dropped = scanner.num_dropped();
+      RETURN_IF_ERROR(process_batch());
+      if (!writer.has_value()) {
+        RETURN_IF_ERROR(start_writing());
+      }
+    }
+    auto const status_or_entry = json::Parse<CommandEntry>(maybe_text.value());
+    if (!status_or_entry.ok()) {
+      LOG(WARNING) << "Dropping malformed entry at offset " << scanner.entry_offset() << ": "
+                   << status_or_entry.status();
+      scanner.Resync();
+      continue;
+    }
+    texts.push_back(maybe_text.value());
+    offsets.push_back(scanner.entry_offset());
+    paths.push_back(
+        GetEntryPath(status_or_entry.value(), workspace_directory).value_or(std::string()));
+    if (texts.size() >= kScanBatchSize) {
+      RETURN_IF_ERROR(process_batch());
+    }
+  }
+  RETURN_IF_ERROR(process_batch());
+  if (!writer.has_value() && scanner.num_dropped() > 0) {
+    RETURN_IF_ERROR(start_writing());
+  }
+  if (!writer.has_value()) {
+    return result;
+  }
+  if (scanner.num_dropped() > 0) {
+    LOG(WARNING) << "Dropped " << scanner.num_dropped()
+                 << " malformed regions of compile_commands.json.";
+  }
+  RETURN_IF_ERROR(writer->CopyTo(fd));
+  RETURN_IF_ERROR(CommitChanges(GetSidecarFilePath(database_directory, "generation"),
+                                GetSidecarFilePath(database_directory, "changes"), removals)
+                      .status());
+  return result;
+}
+
+// Garbage collection of a sharded database (see `GetNumShards`). The shards are collected one at a
+// time, each under its own lock, and then concatenated into the workspace database. The build
+// tracking lock is only held while reading and writing the last-seen log, so the hook isn't blocked
+// for the whole collection.
+absl::StatusOr<GarbageCollectionResult> CollectShardGarbage(
+    std::string_view const workspace_directory, size_t const num_shards,
+    size_t const num_threads) {
+  // Builds are only tracked if eviction is enabled (see `EvictionPolicy`).
+  bool const evict = EvictionPolicy::FromEnvironment().enabled();
+  auto const build_path = GetSidecarFilePath(workspace_directory, "build");
+  auto const last_seen_path = GetSidecarFilePath(workspace_directory, "seen");
+  auto const start_time = ::time(nullptr);
+  DEFINE_CONST_OR_RETURN(tracking_fd, OpenBuildTrackingFile(workspace_directory));
+  int64_t generation = 0;
+  LastSeenMap last_seen;
+  if (evict) {
+    DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(tracking_fd));
+    DEFINE_VAR_OR_RETURN(current_generation, ReadBuildGeneration(build_path));
+    DEFINE_VAR_OR_RETURN(current_last_seen, ReadLastSeen(last_seen_path));
+    generation = current_generation;
+    last_seen = std::move(current_last_seen);
+  }
+  GarbageCollectionResult result;
+  for (auto const& directory : GetShardDirectories(workspace_directory, num_shards)) {
+    DEFINE_CONST_OR_RETURN(fd, OpenCommandFile(directory));
+    DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(fd));
+    DEFINE_CONST_OR_RETURN(shard_result,
+                           CollectDatabaseGarbage(fd, workspace_directory, directory, num_threads,
+                                                  generation, evict ? &last_seen : nullptr));
+    result.num_missing += shard_result.num_missing;
+    result.num_evicted += shard_result.num_evicted;
+  }
+  if (evict) {
+    DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(tracking_fd));
+    // Keep the records appended by hooks while the shards were being collected.
+    DEFINE_CONST_OR_RETURN(current_last_seen, ReadLastSeen(last_seen_path));
+    for (auto const& [path, record] : current_last_seen) {
+      if (record.time >= start_time) {
+        last_seen[path] = record;
+      }
+    }
+    RETURN_IF_ERROR(WriteLastSeen(last_seen_path, last_seen));
+  }
+  if (result.num_missing > 0 || result.num_evicted > 0) {
+    RETURN_IF_ERROR(ConcatenateShards(workspace_directory, num_shards).status());
+  }
+  return result;
+}
+
+// Garbage collection of the database of the workspace, sharded, staged or neither.
+absl::StatusOr<GarbageCollectionResult> CollectWorkspaceGarbage(
+    std::string_view const workspace_directory, size_t const num_threads) {
+  auto const num_shards = GetNumShards();
+  if (num_shards > 0) {
+    return CollectShardGarbage(workspace_directory, num_shards, num_threads);
+  }
+  // While the database is staged (see `StageDatabase`) the staged copy is collected.
+  auto const database_directory = GetDatabaseDirectory(workspace_directory);
+  auto const build_path = GetSidecarFilePath(database_directory, "build");
+  auto const last_seen_path = GetSidecarFilePath(database_directory, "seen");
+  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile(database_directory));
+  DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(fd));
+  if (!EvictionPolicy::FromEnvironment().enabled()) {
+    // Builds aren't tracked (see `EvictionPolicy`), so there's nothing to read or compact.
+    return CollectDatabaseGarbage(fd, workspace_directory, database_directory, num_threads,
+                                  /*generation=*/0, /*last_seen=*/nullptr);
+  }
+  DEFINE_CONST_OR_RETURN(generation, ReadBuildGeneration(build_path));
+  DEFINE_VAR_OR_RETURN(last_seen, ReadLastSeen(last_seen_path));
+  DEFINE_CONST_OR_RETURN(result,
+                         CollectDatabaseGarbage(fd, workspace_directory, database_directory,
+                                                num_threads, generation, &last_seen));
+  RETURN_IF_ERROR(WriteLastSeen(last_seen_path, last_seen));
+  return result;
+}
+
+// Garbage collection of the databases of the package roots (see `PackageRoots`), staged or not, one
+// at a time under their own locks. Builds aren't tracked there, so only the entries of missing
+// files are removed. The results are added to `result`.
+absl::Status CollectPackageGarbage(std::string_view const workspace_directory,
+                                   size_t const num_threads,
+                                   GarbageCollectionResult* const result) {
+  auto const package_roots = PackageRoots::FromEnvironment(workspace_directory);
+  for (auto const& root : package_roots.roots()) {
+    auto const database_directory = GetDatabaseDirectory(root);
+    if (!Exists(GetCommandFilePath(database_directory))) {
+      // Nothing was recorded in this package yet, don't create its database.
+      continue;
+    }
+    DEFINE_CONST_OR_RETURN(fd, OpenCommandFile(database_directory));
+    DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(fd));
+    DEFINE_CONST_OR_RETURN(package_result,
+                           CollectDatabaseGarbage(fd, workspace_directory, database_directory,
+                                                  num_threads, /*generation=*/0,
+                                                  /*last_seen=*/nullptr));
+    result->num_missing += package_result.num_missing;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+size_t GetGarbageCollectionThreads() {
+  size_t const num_cpus = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  auto const num_threads =
+      GetIntEnv(kThreadsEnvVar, std::min<int64_t>(num_cpus, kMaxDefaultThreads));
+  return std::max<int64_t>(num_threads, 1);
+}
+
+std::vector<size_t> FindMissingPaths(absl::Span<std::string const> const paths,
+                                     size_t const num_threads) {
+  std::atomic<size_t> next_batch{0};
+  absl::Mutex mutex;
+  std::vector<size_t> missing;
+  auto const worker = [&] {
+    std::vector<size_t> local_missing;
+    while (true) {
+      size_t const begin = next_batch.fetch_add(kBatchSize, std::memory_order_relaxed);
+      if (begin >= paths.size()) {
+        break;
+      }
+      size_t const end = std::min(begin + kBatchSize, paths.size());
+      for (size_t i = begin; i < end; ++i) {
+        if (IsMissing(paths[i])) {
+          local_missing.push_back(i);
+        }
+      }
+    }
+    absl::MutexLock lock{&mutex};
+    missing.insert(missing.end(), local_missing.begin(), local_missing.end());
+  };
+  // No point in spawning more threads than batches, and the calling thread works too.
+  size_t const num_batches = (paths.size() + kBatchSize - 1) / kBatchSize;
+  size_t const num_workers = std::min(num_threads, num_batches);
+  std::vector<std::thread> threads;
+  threads.reserve(num_workers > 0 ? num_workers - 1 : 0);
+  for (size_t i = 1; i < num_workers; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::sort(missing.begin(), missing.end());
+  return missing;
+}
+
+absl::StatusOr<GarbageCollectionResult> CollectGarbage(size_t const num_threads) {
+  DEFINE_CONST_OR_RETURN(workspace_directory, GetWorkspaceDirectory());
+  DEFINE_VAR_OR_RETURN(result, CollectWorkspaceGarbage(workspace_directory, num_threads));
+  RETURN_IF_ERROR(CollectPackageGarbage(workspace_directory, num_threads, &result));
+  RETURN_IF_ERROR(TouchTimestamp(GetSidecarFilePath(workspace_directory, "gc")));
+  return result;
+}
+
+void MaybeCollectGarbageInBackground() {
+  auto const interval = GetIntEnv(kIntervalEnvVar, /*default_value=*/0);
+  if (interval <= 0) {
+    return;
+  }
+  auto const status_or_workspace_directory = GetWorkspaceDirectory();
+  if (!status_or_workspace_directory.ok()) {
+    return;
+  }
+  auto const timestamp_path = GetSidecarFilePath(status_or_workspace_directory.value(), "gc");
+  struct stat stat {};
+  if (::stat(timestamp_path.c_str(), &stat) == 0 && ::time(nullptr) - stat.st_mtime < interval) {
+    return;
+  }
+  // Claim this collection right away so that concurrent hooks don't start one too. Two hooks may
+  // still race here, but that's harmless because collections are serialized by the database lock.
+  if (!TouchTimestamp(timestamp_path).ok()) {
+    return;
+  }
+  RunDetached([] { return CollectGarbage(GetGarbageCollectionThreads()).ok() ? 0 : 1; });
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,52 @@
+#ifndef __COMP_DB_HOOK_GARBAGE_COLLECTOR_H__
+#define __COMP_DB_HOOK_GARBAGE_COLLECTOR_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// Returns the number of threads to use for garbage collection, read from the
+// `COMP_DB_HOOK_GC_THREADS` environment variable. Defaults to the number of CPUs, capped at 16
+// because the work is bound by filesystem metadata lookups rather than CPU.
+size_t GetGarbageCollectionThreads();
+
+// Returns the (sorted) indices of the paths that don't exist. The paths are checked with `statx`
+// requesting no attributes other than the file type, in batches distributed over a pool of
+// `num_threads` threads. Errors other than `ENOENT` and `ENOTDIR` are not considered evidence that
+// a file is gone.
+std::vector<size_t> FindMissingPaths(absl::Span<std::string const> paths, size_t num_threads);
+
+struct GarbageCollectionResult {
+  // Number of entries removed because their source file doesn't exist.
+  size_t num_missing = 0;
+
+  // Number of entries evicted by the `EvictionPolicy`.
+  size_t num_evicted = 0;
+};
+
+// Removes the entries whose source file doesn't exist anymore (as well as the ones without a `file`
+// field) from the compilation database, and the ones that the `EvictionPolicy` configured in the
+// environment says must be evicted. The last-seen log is compacted in the process. The databases of
+// the package roots (see `PackageRoots`) are collected too, one at a time after the one of the
+// workspace; only the entries of missing files are removed from them, since their builds aren't
+// tracked.
+//
+// The database is streamed through an `EntryWriter` like the updates of the hook, so memory usage
+// doesn't depend on its size, and it's only rewritten if some entry is removed. The source files
+// are checked in batches of consecutive entries.
+absl::StatusOr<GarbageCollectionResult> CollectGarbage(size_t num_threads);
+
+// Amortized garbage collection: if the `COMP_DB_HOOK_GC_INTERVAL` environment variable is set to a
+// positive number of seconds and at least that much time has elapsed since the last collection,
+// starts a detached background process running `CollectGarbage`. The time of the last collection is
+// the modification time of the `.compile_commands.json.gc` file, so the check costs one `stat`.
+void MaybeCollectGarbageInBackground();
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_GARBAGE_COLLECTOR_H__
@@ -0,0 +1,70 @@
+#include "src/garbage_collector.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::FindMissingPaths;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+class FindMissingPathsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/garbage_collector_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    file_ = absl::StrCat(directory_, "/foo.cc");
+    int const fd = ::open(file_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+  }
+
+  void TearDown() override {
+    ::unlink(file_.c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  std::string directory_;
+  std::string file_;
+};
+
+TEST_F(FindMissingPathsTest, NoPaths) { EXPECT_THAT(FindMissingPaths({}, 4), IsEmpty()); }
+
+TEST_F(FindMissingPathsTest, FindsMissingPaths) {
+  std::vector<std::string> const paths{
+      file_,
+      absl::StrCat(directory_, "/bar.cc"),
+      directory_,
+      absl::StrCat(file_, "/baz.cc"),
+      "",
+  };
+  EXPECT_THAT(FindMissingPaths(paths, 1), ElementsAre(1, 3, 4));
+}
+
+TEST_F(FindMissingPathsTest, ManyBatches) {
+  std::vector<std::string> paths;
+  std::vector<size_t> expected;
+  for (size_t i = 0; i < 3000; ++i) {
+    if (i % 7 == 3) {
+      paths.push_back(absl::StrCat(directory_, "/missing", i, ".cc"));
+      expected.push_back(i);
+    } else {
+      paths.push_back(file_);
+    }
+  }
+  for (size_t const num_threads : {1, 4, 64}) {
+    EXPECT_EQ(FindMissingPaths(paths, num_threads), expected) << num_threads;
+  }
+}
+
+}  // namespace
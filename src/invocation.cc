@@ -0,0 +1,77 @@
+#include "src/invocation.h"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "absl/strings/match.h"
+#include "absl/types/span.h"
+#include "src/driver_options.h"
+#include "src/source_language.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+bool IsLanguageOption(DriverOption const& option) {
+  return option.spelling == "-x" || option.spelling == "--language" ||
+         option.spelling == "--language=";
+}
+
+}  // namespace
+
+Invocation ClassifyInvocation(absl::Span<std::string const> const args) {
+  Invocation invocation;
+  bool compile_only = false;
+  bool preprocess_only = false;
+  bool query = false;
+  bool has_inputs = false;
+  std::optional<SourceLanguage> language;
+  for (size_t i = 1; i < args.size(); ++i) {
+    std::string_view const arg = args[i];
+    if (arg == "-") {
+      has_inputs = true;
+    } else if (absl::StartsWith(arg, "-")) {
+      auto const match = MatchDriverOption(args, i);
+      if (!match.has_value()) {
+        continue;
+      }
+      if (IsLanguageOption(*(match->option))) {
+        language = GetLanguageFromName(match->value);
+      }
+      switch (match->option->action) {
+        case DriverAction::kCompileOnly:
+          compile_only = true;
+          break;
+        case DriverAction::kPreprocessOnly:
+          preprocess_only = true;
+          break;
+        case DriverAction::kQuery:
+          query = true;
+          break;
+        default:
+          break;
+      }
+      i += match->num_args - 1;
+    } else {
+      has_inputs = true;
+      auto const input_language = language.value_or(GetLanguageFromPath(arg));
+      if (input_language != SourceLanguage::kUnknown) {
+        invocation.inputs.push_back(InputFile{arg, input_language});
+      }
+    }
+  }
+  if (query || !has_inputs) {
+    invocation.mode = DriverMode::kQuery;
+  } else if (preprocess_only) {
+    invocation.mode = DriverMode::kPreprocess;
+  } else if (compile_only) {
+    invocation.mode = DriverMode::kCompile;
+  } else {
+    invocation.mode = DriverMode::kLink;
+  }
+  return invocation;
+}
+
+}  // namespace comp_db_hook
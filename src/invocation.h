@@ -0,0 +1,58 @@
+#ifndef __COMP_DB_HOOK_INVOCATION_H__
+#define __COMP_DB_HOOK_INVOCATION_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "src/source_language.h"
+
+namespace comp_db_hook {
+
+// The job a compiler driver invocation performs.
+enum class DriverMode {
+  // Source files are compiled but not linked (`-c`, `-S`, `-fsyntax-only`).
+  kCompile,
+
+  // Only the preprocessor runs (`-E`, `-M`, `-MM`).
+  kPreprocess,
+
+  // No option stops the pipeline early: source inputs are compiled, then everything is linked.
+  kLink,
+
+  // The driver prints some information about the toolchain and exits (`--version`, `-print-*`,
+  // `-dump*`, `--help`, or no inputs at all).
+  kQuery,
+};
+
+struct InputFile {
+  // The path of the file, as spelled in the command line.
+  std::string_view path;
+
+  // The language of the file, either inferred from its extension or set by `-x`. Never `kUnknown`.
+  SourceLanguage language;
+};
+
+struct Invocation {
+  // Returns true iff the invocation compiles at least one translation unit, which is the only case
+  // in which the compilation database needs to be updated.
+  bool compiles_translation_unit() const {
+    return (mode == DriverMode::kCompile || mode == DriverMode::kLink) && !inputs.empty();
+  }
+
+  DriverMode mode = DriverMode::kLink;
+
+  // The source files compiled by the invocation. Inputs whose language is unknown (object files,
+  // libraries, linker scripts, etc.) and stdin (`-`) are excluded.
+  //
+  // NOTE: the paths refer to the classified arguments, which must outlive the `Invocation`.
+  std::vector<InputFile> inputs;
+};
+
+// Classifies a compiler invocation. `args[0]` is the compiler name and is ignored.
+Invocation ClassifyInvocation(absl::Span<std::string const> args);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_INVOCATION_H__
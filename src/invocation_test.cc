@@ -0,0 +1,70 @@
+#include "src/invocation.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "src/source_language.h"
+
+namespace {
+
+using ::comp_db_hook::ClassifyInvocation;
+using ::comp_db_hook::DriverMode;
+using ::comp_db_hook::SourceLanguage;
+
+struct ClassifyTestCase {
+  std::vector<std::string> args;
+  DriverMode mode;
+  bool compiles_translation_unit;
+};
+
+TEST(ClassifyInvocationTest, Mode) {
+  ClassifyTestCase const test_cases[] = {
+      {{"clang", "-c", "foo.cc", "-o", "foo.o"}, DriverMode::kCompile, true},
+      {{"clang", "-S", "foo.c"}, DriverMode::kCompile, true},
+      {{"clang", "-fsyntax-only", "foo.cc"}, DriverMode::kCompile, true},
+      {{"clang", "foo.cc", "-o", "foo"}, DriverMode::kLink, true},
+      {{"clang", "foo.o", "bar.o", "-o", "foo"}, DriverMode::kLink, false},
+      {{"clang", "-E", "foo.cc"}, DriverMode::kPreprocess, false},
+      {{"clang", "-c", "-M", "foo.cc"}, DriverMode::kPreprocess, false},
+      {{"clang", "--version"}, DriverMode::kQuery, false},
+      {{"clang", "-c", "foo.cc", "-print-resource-dir"}, DriverMode::kQuery, false},
+      {{"clang"}, DriverMode::kQuery, false},
+      {{"clang", "-c", "-o", "foo.o"}, DriverMode::kQuery, false},
+  };
+  for (auto const& test_case : test_cases) {
+    auto const invocation = ClassifyInvocation(test_case.args);
+    EXPECT_EQ(invocation.mode, test_case.mode) << test_case.args.back();
+    EXPECT_EQ(invocation.compiles_translation_unit(), test_case.compiles_translation_unit)
+        << test_case.args.back();
+  }
+}
+
+TEST(ClassifyInvocationTest, Inputs) {
+  std::vector<std::string> const args{"clang", "-c", "foo.cc", "bar.c", "baz.o", "-"};
+  auto const invocation = ClassifyInvocation(args);
+  ASSERT_EQ(invocation.inputs.size(), 2);
+  EXPECT_EQ(invocation.inputs[0].path, "foo.cc");
+  EXPECT_EQ(invocation.inputs[0].language, SourceLanguage::kCxx);
+  EXPECT_EQ(invocation.inputs[1].path, "bar.c");
+  EXPECT_EQ(invocation.inputs[1].language, SourceLanguage::kC);
+}
+
+TEST(ClassifyInvocationTest, OptionValuesAreNotInputs) {
+  std::vector<std::string> const args{"clang", "-c", "-include", "prefix.h", "-o", "foo.cc.o",
+                                      "foo.cc"};
+  auto const invocation = ClassifyInvocation(args);
+  ASSERT_EQ(invocation.inputs.size(), 1);
+  EXPECT_EQ(invocation.inputs[0].path, "foo.cc");
+}
+
+TEST(ClassifyInvocationTest, LanguageOption) {
+  std::vector<std::string> const args{"clang", "-c", "-x", "c++", "foo.c", "-x", "none", "bar.c"};
+  auto const invocation = ClassifyInvocation(args);
+  ASSERT_EQ(invocation.inputs.size(), 2);
+  EXPECT_EQ(invocation.inputs[0].language, SourceLanguage::kCxx);
+  EXPECT_EQ(invocation.inputs[1].language, SourceLanguage::kC);
+}
+
+}  // namespace
@@ -0,0 +1,200 @@
+#include "src/last_seen.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/types/span.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "src/config.h"
+#include "src/file_io.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kBuildIdleGapEnvVar = "COMP_DB_HOOK_BUILD_IDLE_GAP";
+std::string_view constexpr kEvictAfterBuildsEnvVar = "COMP_DB_HOOK_EVICT_AFTER_BUILDS";
+std::string_view constexpr kEvictAfterSecondsEnvVar = "COMP_DB_HOOK_EVICT_AFTER_SECONDS";
+
+int64_t constexpr kDefaultBuildIdleGap = 300;
+
+// The build generation file contains the generation and the time of the last compilation,
+// separated by a space.
+bool ParseBuildGeneration(std::string_view const contents, int64_t* const generation,
+                          int64_t* const last_activity) {
+  std::vector<std::string_view> const fields =
+      absl::StrSplit(contents, absl::ByAnyChar(" \n"), absl::SkipEmpty());
+  return fields.size() == 2 && absl::SimpleAtoi(fields[0], generation) &&
+         absl::SimpleAtoi(fields[1], last_activity);
+}
+
+// Rewrites the log at `path` with one record per file. Records are never dropped here, however
+// large the log: only garbage collection knows which entries are gone (see `EvictEntry`).
+absl::Status CompactLastSeen(std::string const& path) {
+  DEFINE_CONST_OR_RETURN(last_seen, ReadLastSeen(path));
+  return WriteLastSeen(path, last_seen);
+}
+
+}  // namespace
+
+int64_t GetBuildIdleGap() { return GetIntEnv(kBuildIdleGapEnvVar, kDefaultBuildIdleGap); }
+
+absl::StatusOr<int64_t> AdvanceBuildGeneration(std::string const& path, int64_t const now,
+                                               int64_t const idle_gap) {
+  DEFINE_CONST_OR_RETURN(maybe_contents, ReadFile(path));
+  int64_t generation = 0;
+  int64_t last_activity = 0;
+  if (!maybe_contents.has_value() ||
+      !ParseBuildGeneration(maybe_contents.value(), &generation, &last_activity)) {
+    generation = 0;
+    last_activity = now;
+  }
+  if (now - last_activity > idle_gap) {
+    ++generation;
+  }
+  FD const fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      path.c_str(), /*flags=*/O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0664)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  RETURN_IF_ERROR(WriteAll(fd, absl::StrCat(generation, " ", now, "\n")));
+  return generation;
+}
+
+absl::StatusOr<int64_t> ReadBuildGeneration(std::string const& path) {
+  DEFINE_CONST_OR_RETURN(maybe_contents, ReadFile(path));
+  int64_t generation = 0;
+  int64_t last_activity = 0;
+  if (maybe_contents.has_value() &&
+      ParseBuildGeneration(maybe_contents.value(), &generation, &last_activity)) {
+    return generation;
+  } else {
+    return 0;
+  }
+}
+
+absl::Status AppendLastSeen(std::string const& path, LastSeen const& last_seen,
+                            absl::Span<std::string const> const paths) {
+  std::string records;
+  for (auto const& file_path : paths) {
+    // Paths that would break the format of the log aren't tracked.
+    if (file_path.find_first_of("\t\n") == std::string::npos) {
+      absl::StrAppend(&records, last_seen.generation, "\t", last_seen.time, "\t", file_path, "\n");
+    }
+  }
+  if (records.empty()) {
+    return absl::OkStatus();
+  }
+  FD const fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      path.c_str(), /*flags=*/O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, /*mode=*/0664)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  RETURN_IF_ERROR(WriteAll(fd, records));
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  // Compact only when this append crosses a multiple of `kMaxLastSeenLogSize`, so that a log whose
+  // compacted size still exceeds the limit isn't rewritten on every append.
+  size_t const size = stat.st_size;
+  size_t const previous_size = size - std::min(size, records.size());
+  if (size > kMaxLastSeenLogSize &&
+      size / kMaxLastSeenLogSize != previous_size / kMaxLastSeenLogSize) {
+    return CompactLastSeen(path);
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<LastSeenMap> ReadLastSeen(std::string const& path) {
+  DEFINE_CONST_OR_RETURN(maybe_contents, ReadFile(path));
+  LastSeenMap last_seen;
+  if (!maybe_contents.has_value()) {
+    return last_seen;
+  }
+  std::string_view contents = maybe_contents.value();
+  // A crash in the middle of an append may leave the last line torn, and a torn path would still
+  // look valid, so everything after the last newline is ignored.
+  contents = contents.substr(0, contents.rfind('\n') + 1);
+  for (std::string_view const line : absl::StrSplit(contents, '\n')) {
+    std::vector<std::string_view> const fields = absl::StrSplit(line, absl::MaxSplits('\t', 2));
+    LastSeen record;
+    if (fields.size() != 3 || !absl::SimpleAtoi(fields[0], &record.generation) ||
+        !absl::SimpleAtoi(fields[1], &record.time) || fields[2].empty() ||
+        fields[2].find('\t') != std::string_view::npos) {
+      // Skip malformed lines, e.g. a torn line that later appends were glued to.
+      continue;
+    }
+    last_seen.insert_or_assign(std::string(fields[2]), record);
+  }
+  return last_seen;
+}
+
+absl::Status WriteLastSeen(std::string const& path, LastSeenMap const& last_seen) {
+  std::string records;
+  for (auto const& [file_path, record] : last_seen) {
+    absl::StrAppend(&records, record.generation, "\t", record.time, "\t", file_path, "\n");
+  }
+  // Write a temporary file and rename it, so that a crash doesn't lose the whole log.
+  auto const temp_path = absl::StrCat(path, ".tmp");
+  {
+    FD const fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+        temp_path.c_str(), /*flags=*/O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0664)};
+    if (!fd) {
+      return absl::ErrnoToStatus(errno, "open");
+    }
+    RETURN_IF_ERROR(WriteAll(fd, records));
+  }
+  if (::rename(temp_path.c_str(), path.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rename");
+  }
+  return absl::OkStatus();
+}
+
+EvictionPolicy EvictionPolicy::FromEnvironment() {
+  return EvictionPolicy(GetIntEnv(kEvictAfterBuildsEnvVar, /*default_value=*/0),
+                        GetIntEnv(kEvictAfterSecondsEnvVar, /*default_value=*/0));
+}
+
+bool EvictionPolicy::ShouldEvict(LastSeen const& last_seen, int64_t const generation,
+                                 int64_t const now) const {
+  if (max_builds_ > 0 && generation - last_seen.generation > max_builds_) {
+    return true;
+  }
+  if (max_age_ > 0 && now - last_seen.time > max_age_) {
+    return true;
+  }
+  return false;
+}
+
+bool EvictEntry(EvictionPolicy const& policy, int64_t const generation, int64_t const now,
+                std::string const& path, LastSeenMap* const last_seen) {
+  auto const it =
+      last_seen->try_emplace(path, LastSeen{.generation = generation, .time = now}).first;
+  if (!policy.enabled() || !policy.ShouldEvict(it->second, generation, now)) {
+    return false;
+  }
+  last_seen->erase(it);
+  return true;
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,102 @@
+#ifndef __COMP_DB_HOOK_LAST_SEEN_H__
+#define __COMP_DB_HOOK_LAST_SEEN_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// When a source file was last compiled.
+struct LastSeen {
+  // The build generation, see `AdvanceBuildGeneration`.
+  int64_t generation = 0;
+
+  // Seconds since the epoch.
+  int64_t time = 0;
+};
+
+// Last-seen records keyed by the normalized absolute path of the source file (see `GetEntryPath`).
+using LastSeenMap = absl::flat_hash_map<std::string, LastSeen>;
+
+// The last-seen log is compacted to one record per file when it grows larger than this, and again
+// every time it grows by as much.
+inline size_t constexpr kMaxLastSeenLogSize = 16 << 20;
+
+// Returns the minimum time without any compilation after which the next compilation is considered
+// part of a new build, read from `COMP_DB_HOOK_BUILD_IDLE_GAP` (in seconds, 300 by default).
+int64_t GetBuildIdleGap();
+
+// Returns the current build generation, stored in the file at `path` along with the time of the
+// last compilation. Build tools don't tell compilers when a build starts, so we consider the
+// generation to advance whenever more than `idle_gap` seconds elapsed since the last compilation.
+//
+// The caller must serialize calls, e.g. by holding the database lock.
+absl::StatusOr<int64_t> AdvanceBuildGeneration(std::string const& path, int64_t now,
+                                               int64_t idle_gap);
+
+// Reads the current build generation without advancing it. Returns 0 if the file doesn't exist.
+absl::StatusOr<int64_t> ReadBuildGeneration(std::string const& path);
+
+// Records that the files in `paths` were seen at `last_seen`. The records are appended to the log
+// at `path` with a single `write` so that this remains cheap for large databases, and later
+// records override earlier ones. Paths containing tabs or newlines aren't recorded. The log is
+// compacted if it exceeds `kMaxLastSeenLogSize`.
+absl::Status AppendLastSeen(std::string const& path, LastSeen const& last_seen,
+                            absl::Span<std::string const> paths);
+
+// Reads the log at `path`, skipping malformed records and a torn last line. Returns an empty map if
+// the file doesn't exist.
+absl::StatusOr<LastSeenMap> ReadLastSeen(std::string const& path);
+
+// Replaces the log at `path` with one record per element of `last_seen`, compacting it.
+absl::Status WriteLastSeen(std::string const& path, LastSeenMap const& last_seen);
+
+// Decides which entries haven't been compiled recently enough to be kept.
+class EvictionPolicy {
+ public:
+  // Reads the policy from the `COMP_DB_HOOK_EVICT_AFTER_BUILDS` and
+  // `COMP_DB_HOOK_EVICT_AFTER_SECONDS` environment variables. Both are disabled by default.
+  static EvictionPolicy FromEnvironment();
+
+  explicit EvictionPolicy(int64_t const max_builds, int64_t const max_age)
+      : max_builds_(max_builds), max_age_(max_age) {}
+
+  ~EvictionPolicy() = default;
+
+  EvictionPolicy(EvictionPolicy&&) noexcept = default;
+  EvictionPolicy& operator=(EvictionPolicy&&) noexcept = default;
+  EvictionPolicy(EvictionPolicy const&) = default;
+  EvictionPolicy& operator=(EvictionPolicy const&) = default;
+
+  bool enabled() const { return max_builds_ > 0 || max_age_ > 0; }
+
+  // Returns true iff an entry last seen at `last_seen` must be evicted. `generation` is the current
+  // build generation, which may still be in progress, so an entry is evicted only when it hasn't
+  // been compiled in the last `max_builds` completed builds.
+  bool ShouldEvict(LastSeen const& last_seen, int64_t generation, int64_t now) const;
+
+ private:
+  // Maximum number of builds an entry can go without being compiled, 0 for no limit.
+  int64_t max_builds_;
+
+  // Maximum number of seconds an entry can go without being compiled, 0 for no limit.
+  int64_t max_age_;
+};
+
+// Tells whether the entry of the source file at `path` must be evicted according to `policy` and
+// the records of `last_seen`, and if so removes its record. Entries that have no record (e.g.
+// because they were recorded before tracking started) get one for `generation` and `now`, so
+// they're not evicted before having had a chance to be compiled but do age from then on.
+bool EvictEntry(EvictionPolicy const& policy, int64_t generation, int64_t now,
+                std::string const& path, LastSeenMap* last_seen);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_LAST_SEEN_H__
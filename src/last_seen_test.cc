@@ -0,0 +1,271 @@
+#include "src/last_seen.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/file_io.h"
+
+namespace {
+
+using ::comp_db_hook::AdvanceBuildGeneration;
+using ::comp_db_hook::AppendLastSeen;
+using ::comp_db_hook::EvictEntry;
+using ::comp_db_hook::EvictionPolicy;
+using ::comp_db_hook::kMaxLastSeenLogSize;
+using ::comp_db_hook::LastSeen;
+using ::comp_db_hook::LastSeenMap;
+using ::comp_db_hook::ReadBuildGeneration;
+using ::comp_db_hook::ReadLastSeen;
+using ::comp_db_hook::WriteLastSeen;
+using ::testing::Field;
+using ::testing::IsEmpty;
+using ::testing::Pair;
+using ::testing::UnorderedElementsAre;
+using ::tsdb2::io::FD;
+
+auto LastSeenIs(int64_t const generation, int64_t const time) {
+  return ::testing::AllOf(Field(&LastSeen::generation, generation), Field(&LastSeen::time, time));
+}
+
+class LastSeenTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/last_seen_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    build_path_ = absl::StrCat(directory_, "/build");
+    log_path_ = absl::StrCat(directory_, "/seen");
+  }
+
+  void TearDown() override {
+    ::unlink(build_path_.c_str());
+    ::unlink(log_path_.c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  static void WriteFile(std::string const& path, std::string_view const contents) {
+    FD const fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    ASSERT_TRUE(fd);
+    ASSERT_TRUE(comp_db_hook::WriteAll(fd, contents).ok());
+  }
+
+  static std::string ReadFile(std::string const& path) {
+    auto status_or_contents = comp_db_hook::ReadFile(path);
+    EXPECT_TRUE(status_or_contents.ok()) << status_or_contents.status();
+    return std::move(status_or_contents).value_or(std::nullopt).value_or("<missing>");
+  }
+
+  int64_t Advance(int64_t const now, int64_t const idle_gap = 300) const {
+    auto const status_or_generation = AdvanceBuildGeneration(build_path_, now, idle_gap);
+    EXPECT_TRUE(status_or_generation.ok()) << status_or_generation.status();
+    return status_or_generation.value_or(-1);
+  }
+
+  void Append(LastSeen const& last_seen, std::vector<std::string> const& paths) const {
+    auto const status = AppendLastSeen(log_path_, last_seen, paths);
+    EXPECT_TRUE(status.ok()) << status;
+  }
+
+  LastSeenMap Read() const {
+    auto status_or_last_seen = ReadLastSeen(log_path_);
+    EXPECT_TRUE(status_or_last_seen.ok()) << status_or_last_seen.status();
+    return std::move(status_or_last_seen).value_or(LastSeenMap());
+  }
+
+  size_t GetLogSize() const {
+    struct stat stat {};
+    EXPECT_EQ(::stat(log_path_.c_str(), &stat), 0);
+    return stat.st_size;
+  }
+
+  std::string directory_;
+  std::string build_path_;
+  std::string log_path_;
+};
+
+TEST_F(LastSeenTest, BuildGeneration) {
+  auto const status_or_generation = ReadBuildGeneration(build_path_);
+  ASSERT_TRUE(status_or_generation.ok()) << status_or_generation.status();
+  EXPECT_EQ(status_or_generation.value(), 0);
+  EXPECT_EQ(Advance(1000), 0);
+  // Compilations no more than the idle gap apart belong to the same build.
+  EXPECT_EQ(Advance(1300), 0);
+  EXPECT_EQ(Advance(1600), 0);
+  EXPECT_EQ(Advance(1901), 1);
+  EXPECT_EQ(Advance(1901), 1);
+  EXPECT_EQ(Advance(5000), 2);
+  EXPECT_EQ(ReadFile(build_path_), "2 5000\n");
+  EXPECT_EQ(ReadBuildGeneration(build_path_).value_or(-1), 2);
+  EXPECT_EQ(Advance(5010, /*idle_gap=*/5), 3);
+}
+
+TEST_F(LastSeenTest, MalformedBuildGenerationIsReset) {
+  for (std::string_view const contents : {"", "garbage\n", "7\n", "7 1000 1\n", "x 1000\n"}) {
+    WriteFile(build_path_, contents);
+    EXPECT_EQ(ReadBuildGeneration(build_path_).value_or(-1), 0) << contents;
+    // The reset doesn't count as an idle gap either.
+    EXPECT_EQ(Advance(5000), 0) << contents;
+    EXPECT_EQ(ReadFile(build_path_), "0 5000\n") << contents;
+  }
+}
+
+TEST_F(LastSeenTest, MissingLog) { EXPECT_THAT(Read(), IsEmpty()); }
+
+TEST_F(LastSeenTest, AppendAndRead) {
+  Append(LastSeen{.generation = 1, .time = 100}, {"/w/a.cc", "/w/b.cc"});
+  Append(LastSeen{.generation = 2, .time = 200}, {"/w/b.cc", "/w/with space.cc"});
+  Append(LastSeen{.generation = 3, .time = 300}, {});
+  EXPECT_THAT(Read(), UnorderedElementsAre(Pair("/w/a.cc", LastSeenIs(1, 100)),
+                                           Pair("/w/b.cc", LastSeenIs(2, 200)),
+                                           Pair("/w/with space.cc", LastSeenIs(2, 200))));
+}
+
+TEST_F(LastSeenTest, SkipsUnrepresentablePaths) {
+  Append(LastSeen{.generation = 1, .time = 100}, {"/w/a\n.cc", "/w/b\t.cc", "/w/c.cc"});
+  EXPECT_EQ(ReadFile(log_path_), "1\t100\t/w/c.cc\n");
+}
+
+TEST_F(LastSeenTest, SkipsTornLastLine) {
+  WriteFile(log_path_, "1\t100\t/w/a.cc\n2\t200\t/w/b");
+  EXPECT_THAT(Read(), UnorderedElementsAre(Pair("/w/a.cc", LastSeenIs(1, 100))));
+  // Records appended after the torn line are glued to it, so that line is skipped but the next ones
+  // aren't.
+  Append(LastSeen{.generation = 3, .time = 300}, {"/w/c.cc", "/w/d.cc"});
+  EXPECT_THAT(Read(), UnorderedElementsAre(Pair("/w/a.cc", LastSeenIs(1, 100)),
+                                           Pair("/w/d.cc", LastSeenIs(3, 300))));
+}
+
+TEST_F(LastSeenTest, SkipsMalformedLines) {
+  WriteFile(log_path_,
+            "1\t100\t/w/a.cc\n"
+            "\n"
+            "x\t100\t/w/b.cc\n"
+            "1\tx\t/w/c.cc\n"
+            "1\t100\t\n"
+            "1\t100\n"
+            "2\t200\t/w/d.cc\n");
+  EXPECT_THAT(Read(), UnorderedElementsAre(Pair("/w/a.cc", LastSeenIs(1, 100)),
+                                           Pair("/w/d.cc", LastSeenIs(2, 200))));
+}
+
+TEST_F(LastSeenTest, WriteCompacts) {
+  Append(LastSeen{.generation = 1, .time = 100}, {"/w/a.cc", "/w/b.cc"});
+  Append(LastSeen{.generation = 2, .time = 200}, {"/w/a.cc"});
+  ASSERT_TRUE(WriteLastSeen(log_path_, Read()).ok());
+  EXPECT_EQ(GetLogSize(), std::string_view("2\t200\t/w/a.cc\n1\t100\t/w/b.cc\n").size());
+  EXPECT_THAT(Read(), UnorderedElementsAre(Pair("/w/a.cc", LastSeenIs(2, 200)),
+                                           Pair("/w/b.cc", LastSeenIs(1, 100))));
+}
+
+TEST_F(LastSeenTest, CompactsWhenCrossingTheLimit) {
+  // Each record of this path takes a bit more than 1 MiB.
+  std::string const path = absl::StrCat("/w/", std::string(1 << 20, 'a'));
+  size_t const record_size = absl::StrCat("1\t100\t", path, "\n").size();
+  size_t expected_size = 0;
+  while (expected_size + record_size <= kMaxLastSeenLogSize) {
+    Append(LastSeen{.generation = 1, .time = 100}, {path});
+    expected_size += record_size;
+    ASSERT_EQ(GetLogSize(), expected_size);
+  }
+  Append(LastSeen{.generation = 1, .time = 100}, {path});
+  EXPECT_EQ(GetLogSize(), record_size);
+  EXPECT_THAT(Read(), UnorderedElementsAre(Pair(path, LastSeenIs(1, 100))));
+}
+
+TEST_F(LastSeenTest, DoesNotCompactOnEveryAppendAboveTheLimit) {
+  // Distinct paths, so that the compacted log still exceeds the limit.
+  std::vector<std::string> paths;
+  size_t size = 0;
+  for (int i = 0; size <= kMaxLastSeenLogSize; ++i) {
+    paths.push_back(absl::StrCat("/w/", i, std::string(1 << 20, 'a')));
+    size += absl::StrCat("1\t100\t", paths.back(), "\n").size();
+  }
+  for (auto const& path : paths) {
+    Append(LastSeen{.generation = 1, .time = 100}, {path});
+  }
+  auto const compacted_size = GetLogSize();
+  EXPECT_GT(compacted_size, kMaxLastSeenLogSize);
+  Append(LastSeen{.generation = 2, .time = 200}, {"/w/x.cc"});
+  Append(LastSeen{.generation = 3, .time = 300}, {"/w/x.cc"});
+  // Both records are still there.
+  EXPECT_EQ(GetLogSize(), compacted_size + 2 * std::string_view("2\t200\t/w/x.cc\n").size());
+  EXPECT_EQ(Read().size(), paths.size() + 1);
+}
+
+TEST(EvictionPolicyTest, FromEnvironment) {
+  ::unsetenv("COMP_DB_HOOK_EVICT_AFTER_BUILDS");
+  ::unsetenv("COMP_DB_HOOK_EVICT_AFTER_SECONDS");
+  EXPECT_FALSE(EvictionPolicy::FromEnvironment().enabled());
+  ::setenv("COMP_DB_HOOK_EVICT_AFTER_BUILDS", "3", /*overwrite=*/1);
+  EXPECT_TRUE(EvictionPolicy::FromEnvironment().enabled());
+  ::unsetenv("COMP_DB_HOOK_EVICT_AFTER_BUILDS");
+  ::setenv("COMP_DB_HOOK_EVICT_AFTER_SECONDS", "3600", /*overwrite=*/1);
+  EXPECT_TRUE(EvictionPolicy::FromEnvironment().enabled());
+  ::unsetenv("COMP_DB_HOOK_EVICT_AFTER_SECONDS");
+}
+
+TEST(EvictionPolicyTest, MaxBuilds) {
+  EvictionPolicy const policy{/*max_builds=*/2, /*max_age=*/0};
+  // Generation 10 is in progress, so the last 2 completed builds are generations 8 and 9.
+  EXPECT_FALSE(policy.ShouldEvict(LastSeen{.generation = 10, .time = 0}, 10, 1000000));
+  EXPECT_FALSE(policy.ShouldEvict(LastSeen{.generation = 9, .time = 0}, 10, 1000000));
+  EXPECT_FALSE(policy.ShouldEvict(LastSeen{.generation = 8, .time = 0}, 10, 1000000));
+  EXPECT_TRUE(policy.ShouldEvict(LastSeen{.generation = 7, .time = 0}, 10, 1000000));
+}
+
+TEST(EvictionPolicyTest, MaxAge) {
+  EvictionPolicy const policy{/*max_builds=*/0, /*max_age=*/100};
+  EXPECT_FALSE(policy.ShouldEvict(LastSeen{.generation = 0, .time = 950}, 10, 1000));
+  EXPECT_FALSE(policy.ShouldEvict(LastSeen{.generation = 0, .time = 900}, 10, 1000));
+  EXPECT_TRUE(policy.ShouldEvict(LastSeen{.generation = 0, .time = 899}, 10, 1000));
+}
+
+TEST(EvictionPolicyTest, EitherLimit) {
+  EvictionPolicy const policy{/*max_builds=*/2, /*max_age=*/100};
+  EXPECT_FALSE(policy.ShouldEvict(LastSeen{.generation = 9, .time = 950}, 10, 1000));
+  EXPECT_TRUE(policy.ShouldEvict(LastSeen{.generation = 7, .time = 950}, 10, 1000));
+  EXPECT_TRUE(policy.ShouldEvict(LastSeen{.generation = 9, .time = 850}, 10, 1000));
+}
+
+TEST(EvictEntryTest, Evicts) {
+  EvictionPolicy const policy{/*max_builds=*/2, /*max_age=*/0};
+  LastSeenMap last_seen{{"/w/a.cc", LastSeen{.generation = 7, .time = 100}},
+                        {"/w/b.cc", LastSeen{.generation = 9, .time = 100}}};
+  EXPECT_TRUE(EvictEntry(policy, 10, 1000, "/w/a.cc", &last_seen));
+  EXPECT_FALSE(EvictEntry(policy, 10, 1000, "/w/b.cc", &last_seen));
+  // The record of the evicted entry is gone, the other one is untouched.
+  EXPECT_THAT(last_seen, UnorderedElementsAre(Pair("/w/b.cc", LastSeenIs(9, 100))));
+}
+
+TEST(EvictEntryTest, SeedsUntrackedEntries) {
+  EvictionPolicy const policy{/*max_builds=*/2, /*max_age=*/0};
+  LastSeenMap last_seen;
+  EXPECT_FALSE(EvictEntry(policy, 10, 1000, "/w/a.cc", &last_seen));
+  EXPECT_THAT(last_seen, UnorderedElementsAre(Pair("/w/a.cc", LastSeenIs(10, 1000))));
+  // The entry ages from the seeded record on.
+  EXPECT_FALSE(EvictEntry(policy, 12, 2000, "/w/a.cc", &last_seen));
+  EXPECT_TRUE(EvictEntry(policy, 13, 3000, "/w/a.cc", &last_seen));
+  EXPECT_THAT(last_seen, IsEmpty());
+}
+
+TEST(EvictEntryTest, Disabled) {
+  EvictionPolicy const policy{/*max_builds=*/0, /*max_age=*/0};
+  LastSeenMap last_seen{{"/w/a.cc", LastSeen{.generation = 0, .time = 0}}};
+  EXPECT_FALSE(EvictEntry(policy, 100, 1000000, "/w/a.cc", &last_seen));
+  EXPECT_EQ(last_seen.size(), 1);
+}
+
+}  // namespace
@@ -0,0 +1,57 @@
+#include "src/mapped_file.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+
+namespace comp_db_hook {
+
+absl::StatusOr<MappedFile> MappedFile::Map(tsdb2::io::FD const& fd, size_t const size) {
+  if (size == 0) {
+    return MappedFile();
+  }
+  void* const data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  if (data == MAP_FAILED) {  // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+    return absl::ErrnoToStatus(errno, "mmap");
+  }
+  return MappedFile(static_cast<char const*>(data), size);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Unmap();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+void MappedFile::Release(size_t const begin, size_t const end) const {
+  auto const page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  size_t const first = (begin + page_size - 1) / page_size * page_size;
+  size_t const last = std::min(end, size_) / page_size * page_size;
+  if (first < last) {
+    ::madvise(const_cast<char*>(data_) + first, last - first, MADV_DONTNEED);
+  }
+}
+
+void MappedFile::Unmap() {
+  if (data_ != nullptr) {
+    ::munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+}
+
+}  // namespace comp_db_hook
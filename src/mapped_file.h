@@ -0,0 +1,48 @@
+#ifndef __COMP_DB_HOOK_MAPPED_FILE_H__
+#define __COMP_DB_HOOK_MAPPED_FILE_H__
+
+#include <cstddef>
+#include <string_view>
+
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+
+namespace comp_db_hook {
+
+// Read-only memory mapping of (a prefix of) a file, unmapped on destruction. The mapping remains
+// valid after the file descriptor is closed.
+class MappedFile {
+ public:
+  // Maps the first `size` bytes of the file. `size` is usually taken from `fstat`. An empty file
+  // results in an empty mapping rather than an error.
+  static absl::StatusOr<MappedFile> Map(tsdb2::io::FD const& fd, size_t size);
+
+  MappedFile() = default;
+  ~MappedFile() { Unmap(); }
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+
+  std::string_view contents() const { return {data_, size_}; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Drops the pages that lie entirely within [begin, end) from the resident memory of the process,
+  // e.g. after processing them sequentially. They remain accessible and are faulted back in from
+  // the file if accessed again.
+  void Release(size_t begin, size_t end) const;
+
+ private:
+  explicit MappedFile(char const* const data, size_t const size) : data_(data), size_(size) {}
+
+  void Unmap();
+
+  char const* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_MAPPED_FILE_H__
@@ -0,0 +1,117 @@
+#include "src/package_roots.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "common/utilities.h"
+#include "io/advisory_file_lock.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/config.h"
+#include "src/entry_writer.h"
+#include "src/file_io.h"
+#include "src/path_canonicalizer.h"
+#include "src/snapshot.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::ExclusiveFileLock;
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kPackageRootsEnvVar = "COMP_DB_HOOK_PACKAGE_ROOTS";
+std::string_view constexpr kRootDatabaseEnvVar = "COMP_DB_HOOK_ROOT_DATABASE";
+
+}  // namespace
+
+PackageRoots PackageRoots::FromEnvironment(std::string_view const workspace_directory) {
+  auto const workspace_root = NormalizePath(workspace_directory);
+  std::vector<std::string> roots;
+  for (auto const& root : GetListEnv(kPackageRootsEnvVar)) {
+    auto path = NormalizePath(JoinPath(workspace_root, root));
+    // The workspace itself isn't a package root, it already has its database.
+    if (path != workspace_root) {
+      roots.emplace_back(std::move(path));
+    }
+  }
+  return PackageRoots(std::move(roots));
+}
+
+PackageRoots::PackageRoots(std::vector<std::string> roots) : roots_(std::move(roots)) {
+  // Longer roots first, so that the first match is the innermost one.
+  std::sort(roots_.begin(), roots_.end(), [](std::string const& lhs, std::string const& rhs) {
+    return lhs.size() > rhs.size() || (lhs.size() == rhs.size() && lhs < rhs);
+  });
+  roots_.erase(std::unique(roots_.begin(), roots_.end()), roots_.end());
+}
+
+std::optional<std::string_view> PackageRoots::Find(std::string_view const path) const {
+  for (auto const& root : roots_) {
+    if (path.size() > root.size() && absl::StartsWith(path, root) &&
+        (root.back() == '/' || path[root.size()] == '/')) {
+      return root;
+    }
+  }
+  return std::nullopt;
+}
+
+bool ShouldWriteRootDatabase() { return GetBoolEnv(kRootDatabaseEnvVar, /*default_value=*/true); }
+
+absl::Status SeedPackageDatabase(std::string_view const workspace_directory,
+                                 PackageRoots const& package_roots, std::string_view const root) {
+  auto const path = GetCommandFilePath(root);
+  if (Exists(path)) {
+    return absl::OkStatus();
+  }
+  auto const database_directory = GetDatabaseDirectory(workspace_directory);
+  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile(database_directory));
+  DEFINE_OR_RETURN(lock, ExclusiveFileLock::Acquire(fd));
+  // Check again, another process may have seeded the database while we waited for the lock.
+  if (Exists(path)) {
+    return absl::OkStatus();
+  }
+  DEFINE_CONST_OR_RETURN(snapshot,
+                         LoadOrBuildSnapshot(GetSidecarFilePath(database_directory, "snapshot"),
+                                             fd, workspace_directory, /*validate=*/true));
+  auto const temp_path = GetSidecarFilePath(root, "seed");
+  FD const temp_fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      temp_path.c_str(), /*flags=*/O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0664)};
+  if (!temp_fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  DEFINE_VAR_OR_RETURN(writer,
+                       EntryWriter::Create(GetSidecarFilePath(root, "tmp"), /*prefix_size=*/0));
+  size_t num_entries = 0;
+  for (size_t i = 0; i < snapshot.size(); ++i) {
+    DEFINE_CONST_OR_RETURN(entry, snapshot.GetEntry(i));
+    auto const entry_path = entry.path();
+    if (entry_path.empty() || package_roots.Find(entry_path) != root) {
+      continue;
+    }
+    auto const span = entry.span();
+    RETURN_IF_ERROR(writer.CopyEntries(fd, span.offset, span.end()));
+    ++num_entries;
+  }
+  RETURN_IF_ERROR(writer.CopyTo(temp_fd));
+  if (::rename(temp_path.c_str(), path.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rename");
+  }
+  LOG(INFO) << "Seeded the compile_commands.json of " << root << " with " << num_entries
+            << " entries.";
+  return absl::OkStatus();
+}
+
+}  // namespace comp_db_hook
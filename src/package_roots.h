@@ -0,0 +1,65 @@
+#ifndef __COMP_DB_HOOK_PACKAGE_ROOTS_H__
+#define __COMP_DB_HOOK_PACKAGE_ROOTS_H__
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+
+namespace comp_db_hook {
+
+// The package roots of a workspace, i.e. the directories that get a compilation database of their
+// own with only the entries of the source files in their subtree. This allows tools (e.g. clangd
+// opened on a package of a large monorepo) to load a small database, and hook processes compiling
+// files of different packages to update different databases without contending on the same lock.
+//
+// The roots are read from the comma-separated `COMP_DB_HOOK_PACKAGE_ROOTS` environment variable,
+// relative to the workspace directory. Roots may be nested, in which case a file belongs to the
+// innermost one.
+class PackageRoots {
+ public:
+  static PackageRoots FromEnvironment(std::string_view workspace_directory);
+
+  // `roots` must be lexically normalized absolute paths.
+  explicit PackageRoots(std::vector<std::string> roots);
+
+  ~PackageRoots() = default;
+
+  PackageRoots(PackageRoots&&) noexcept = default;
+  PackageRoots& operator=(PackageRoots&&) noexcept = default;
+  PackageRoots(PackageRoots const&) = default;
+  PackageRoots& operator=(PackageRoots const&) = default;
+
+  bool empty() const { return roots_.empty(); }
+
+  // The roots, innermost first.
+  std::vector<std::string> const& roots() const { return roots_; }
+
+  // Returns the innermost root containing the source file at `path`, a lexically normalized
+  // absolute path, or an empty optional if there's none.
+  std::optional<std::string_view> Find(std::string_view path) const;
+
+ private:
+  std::vector<std::string> roots_;
+};
+
+// Tells whether the entries of the source files in a package root are also recorded in the
+// database of the workspace, read from the `COMP_DB_HOOK_ROOT_DATABASE` environment variable (true
+// by default). Files outside of all package roots are always recorded there.
+bool ShouldWriteRootDatabase();
+
+// Creates the database of the package root `root` of `package_roots` if it doesn't exist yet,
+// seeding it with the entries of the files in its subtree found in the live database of the
+// workspace (see `GetDatabaseDirectory`), so that a package database doesn't start out empty when
+// package roots are configured on an existing workspace. The entries are copied verbatim, without
+// parsing anything. The database is written under a temporary name and renamed into place while
+// holding the lock of the workspace database, so hooks never see it partially seeded.
+absl::Status SeedPackageDatabase(std::string_view workspace_directory,
+                                 PackageRoots const& package_roots, std::string_view root);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_PACKAGE_ROOTS_H__
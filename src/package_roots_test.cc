@@ -0,0 +1,191 @@
+#include "src/package_roots.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+#include "src/path_canonicalizer.h"
+
+namespace {
+
+using ::comp_db_hook::GetCommandFilePath;
+using ::comp_db_hook::JoinPath;
+using ::comp_db_hook::PackageRoots;
+using ::comp_db_hook::SeedPackageDatabase;
+using ::comp_db_hook::ShouldWriteRootDatabase;
+using ::testing::ElementsAre;
+using ::testing::Optional;
+using ::tsdb2::io::FD;
+
+TEST(PackageRootsTest, Empty) {
+  PackageRoots const roots{std::vector<std::string>()};
+  EXPECT_TRUE(roots.empty());
+  EXPECT_EQ(roots.Find("/w/a/x.cc"), std::nullopt);
+}
+
+TEST(PackageRootsTest, InnermostFirst) {
+  PackageRoots const roots{std::vector<std::string>{"/w/a", "/w/c", "/w/a/b", "/w/a", "/w/b"}};
+  EXPECT_FALSE(roots.empty());
+  EXPECT_THAT(roots.roots(), ElementsAre("/w/a/b", "/w/a", "/w/b", "/w/c"));
+}
+
+TEST(PackageRootsTest, FindInnermostRoot) {
+  PackageRoots const roots{std::vector<std::string>{"/w/a", "/w/a/b/c", "/w/a/b"}};
+  EXPECT_THAT(roots.Find("/w/a/x.cc"), Optional(std::string_view("/w/a")));
+  EXPECT_THAT(roots.Find("/w/a/b/x.cc"), Optional(std::string_view("/w/a/b")));
+  EXPECT_THAT(roots.Find("/w/a/b/c/x.cc"), Optional(std::string_view("/w/a/b/c")));
+  EXPECT_THAT(roots.Find("/w/a/b/c/d/x.cc"), Optional(std::string_view("/w/a/b/c")));
+  EXPECT_THAT(roots.Find("/w/a/bc/x.cc"), Optional(std::string_view("/w/a")));
+  EXPECT_EQ(roots.Find("/w/x.cc"), std::nullopt);
+}
+
+TEST(PackageRootsTest, RejectsSiblingPrefixes) {
+  PackageRoots const roots{std::vector<std::string>{"/w/a/b"}};
+  EXPECT_EQ(roots.Find("/w/a/bc/x.cc"), std::nullopt);
+  EXPECT_EQ(roots.Find("/w/a/bc"), std::nullopt);
+  EXPECT_EQ(roots.Find("/w/a/b.cc"), std::nullopt);
+  EXPECT_EQ(roots.Find("/w/a/b-c/x.cc"), std::nullopt);
+  // A root doesn't contain itself.
+  EXPECT_EQ(roots.Find("/w/a/b"), std::nullopt);
+  EXPECT_THAT(roots.Find("/w/a/b/x.cc"), Optional(std::string_view("/w/a/b")));
+}
+
+TEST(PackageRootsTest, FromEnvironment) {
+  ::setenv("COMP_DB_HOOK_PACKAGE_ROOTS", "a, ./a,a/b/,.,,b/..,c/../a/b,/abs/pkg",
+           /*overwrite=*/1);
+  auto const roots = PackageRoots::FromEnvironment("/w/");
+  ::unsetenv("COMP_DB_HOOK_PACKAGE_ROOTS");
+  // The workspace root and the duplicates are dropped.
+  EXPECT_THAT(roots.roots(), ElementsAre("/abs/pkg", "/w/a/b", "/w/a"));
+}
+
+TEST(PackageRootsTest, FromEmptyEnvironment) {
+  ::unsetenv("COMP_DB_HOOK_PACKAGE_ROOTS");
+  EXPECT_TRUE(PackageRoots::FromEnvironment("/w").empty());
+  ::setenv("COMP_DB_HOOK_PACKAGE_ROOTS", ".", /*overwrite=*/1);
+  EXPECT_TRUE(PackageRoots::FromEnvironment("/w").empty());
+  ::unsetenv("COMP_DB_HOOK_PACKAGE_ROOTS");
+}
+
+TEST(PackageRootsTest, ShouldWriteRootDatabase) {
+  ::unsetenv("COMP_DB_HOOK_ROOT_DATABASE");
+  EXPECT_TRUE(ShouldWriteRootDatabase());
+  ::setenv("COMP_DB_HOOK_ROOT_DATABASE", "0", /*overwrite=*/1);
+  EXPECT_FALSE(ShouldWriteRootDatabase());
+  ::unsetenv("COMP_DB_HOOK_ROOT_DATABASE");
+}
+
+int RemoveFile(char const* const path, struct stat const* /*stat*/, int /*type*/,
+               struct FTW* /*ftw*/) {
+  return ::remove(path);
+}
+
+class SeedPackageDatabaseTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ::unsetenv("COMP_DB_HOOK_STAGING_DIR");
+    ::unsetenv("COMP_DB_HOOK_SNAPSHOT");
+    std::string directory = absl::StrCat(::testing::TempDir(), "/package_roots_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory.data()), nullptr);
+    workspace_directory_ = comp_db_hook::NormalizePath(directory);
+    for (std::string_view const root : {"a", "a/b"}) {
+      ASSERT_EQ(::mkdir(JoinPath(workspace_directory_, root).c_str(), 0775), 0);
+    }
+  }
+
+  void TearDown() override {
+    ::nftw(workspace_directory_.c_str(), RemoveFile, /*nopenfd=*/16, FTW_DEPTH | FTW_PHYS);
+  }
+
+  std::string MakeEntry(std::string_view const file) const {
+    return absl::StrCat("{\"directory\": \"", workspace_directory_, "\", \"file\": \"", file,
+                        "\"}");
+  }
+
+  static std::string MakeDatabase(std::vector<std::string> const& entries) {
+    if (entries.empty()) {
+      return "[]\n";
+    }
+    return absl::StrCat("[\n  ", absl::StrJoin(entries, ",\n  "), "\n]\n");
+  }
+
+  static void WriteFile(std::string const& path, std::string_view const contents) {
+    FD const fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    ASSERT_TRUE(fd);
+    ASSERT_TRUE(comp_db_hook::WriteAll(fd, contents).ok());
+  }
+
+  static std::string ReadFile(std::string const& path) {
+    auto status_or_contents = comp_db_hook::ReadFile(path);
+    EXPECT_TRUE(status_or_contents.ok()) << status_or_contents.status();
+    return std::move(status_or_contents).value_or(std::nullopt).value_or("<missing>");
+  }
+
+  PackageRoots GetPackageRoots() const {
+    return PackageRoots(std::vector<std::string>{JoinPath(workspace_directory_, "a"),
+                                                 JoinPath(workspace_directory_, "a/b")});
+  }
+
+  // Seeds the database of the package root at `root`, relative to the workspace, and returns it.
+  std::string Seed(std::string_view const root) const {
+    auto const root_directory = JoinPath(workspace_directory_, root);
+    auto const status =
+        SeedPackageDatabase(workspace_directory_, GetPackageRoots(), root_directory);
+    EXPECT_TRUE(status.ok()) << status;
+    return ReadFile(GetCommandFilePath(root_directory));
+  }
+
+  std::string workspace_directory_;
+};
+
+TEST_F(SeedPackageDatabaseTest, SeedsEntriesOfTheSubtree) {
+  WriteFile(GetCommandFilePath(workspace_directory_),
+            MakeDatabase({MakeEntry("a/x.cc"), MakeEntry("c.cc"), MakeEntry("a/b/y.cc"),
+                          MakeEntry("ab/z.cc"), "{\"directory\": \"/w\"}", MakeEntry("a/w.cc")}));
+  // The entries of nested roots go to the innermost one only.
+  EXPECT_EQ(Seed("a"), MakeDatabase({MakeEntry("a/x.cc"), MakeEntry("a/w.cc")}));
+  EXPECT_EQ(Seed("a/b"), MakeDatabase({MakeEntry("a/b/y.cc")}));
+  // The temporary files are gone.
+  EXPECT_FALSE(comp_db_hook::Exists(
+      comp_db_hook::GetSidecarFilePath(JoinPath(workspace_directory_, "a"), "seed")));
+}
+
+TEST_F(SeedPackageDatabaseTest, NoEntries) {
+  WriteFile(GetCommandFilePath(workspace_directory_), MakeDatabase({MakeEntry("c.cc")}));
+  EXPECT_EQ(Seed("a"), "[]\n");
+}
+
+TEST_F(SeedPackageDatabaseTest, MissingWorkspaceDatabase) { EXPECT_EQ(Seed("a"), "[]\n"); }
+
+TEST_F(SeedPackageDatabaseTest, SeedsOnlyOnce) {
+  WriteFile(GetCommandFilePath(workspace_directory_), MakeDatabase({MakeEntry("a/x.cc")}));
+  EXPECT_EQ(Seed("a"), MakeDatabase({MakeEntry("a/x.cc")}));
+  WriteFile(GetCommandFilePath(workspace_directory_),
+            MakeDatabase({MakeEntry("a/x.cc"), MakeEntry("a/y.cc")}));
+  EXPECT_EQ(Seed("a"), MakeDatabase({MakeEntry("a/x.cc")}));
+}
+
+TEST_F(SeedPackageDatabaseTest, KeepsExistingDatabase) {
+  WriteFile(GetCommandFilePath(workspace_directory_), MakeDatabase({MakeEntry("a/x.cc")}));
+  WriteFile(GetCommandFilePath(JoinPath(workspace_directory_, "a")), "[]\n");
+  EXPECT_EQ(Seed("a"), "[]\n");
+}
+
+}  // namespace
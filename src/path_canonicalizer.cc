@@ -0,0 +1,202 @@
+#include "src/path_canonicalizer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "io/fd.h"
+#include "src/config.h"
+#include "src/mapped_file.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kResolveSymlinksEnvVar = "COMP_DB_HOOK_RESOLVE_SYMLINKS";
+
+std::optional<std::string> RealPath(std::string const& path) {
+  char buffer[PATH_MAX + 1];
+  if (::realpath(path.c_str(), buffer) != nullptr) {
+    return std::string(buffer);
+  } else {
+    return std::nullopt;
+  }
+}
+
+}  // namespace
+
+std::string NormalizePath(std::string_view const path) {
+  bool const absolute = !path.empty() && path.front() == '/';
+  std::vector<std::string_view> components;
+  for (std::string_view const component : absl::StrSplit(path, '/')) {
+    if (component.empty() || component == ".") {
+      continue;
+    }
+    if (component == "..") {
+      if (!components.empty() && components.back() != "..") {
+        components.pop_back();
+        continue;
+      } else if (absolute) {
+        continue;
+      }
+    }
+    components.push_back(component);
+  }
+  if (absolute) {
+    return absl::StrCat("/", absl::StrJoin(components, "/"));
+  } else if (components.empty()) {
+    return ".";
+  } else {
+    return absl::StrJoin(components, "/");
+  }
+}
+
+PathCanonicalizer::Options PathCanonicalizer::GetOptionsFromEnvironment(std::string cache_path) {
+  return Options{
+      .resolve_symlinks = GetBoolEnv(kResolveSymlinksEnvVar, /*default_value=*/false),
+      .cache_path = std::move(cache_path),
+  };
+}
+
+std::string PathCanonicalizer::Canonicalize(std::string_view const path) {
+  auto normalized = NormalizePath(path);
+  if (!options_.resolve_symlinks || normalized == "/") {
+    return normalized;
+  }
+  auto const separator = normalized.rfind('/');
+  std::string directory;
+  std::string_view base_name = normalized;
+  if (separator == std::string::npos) {
+    directory = ".";
+  } else {
+    directory = separator > 0 ? normalized.substr(0, separator) : "/";
+    base_name.remove_prefix(separator + 1);
+  }
+  auto const maybe_resolved_directory = ResolveDirectory(directory);
+  if (!maybe_resolved_directory.has_value()) {
+    return normalized;
+  }
+  auto const& resolved_directory = maybe_resolved_directory.value();
+  auto resolved = resolved_directory == "/" ? absl::StrCat("/", base_name)
+                                            : absl::StrCat(resolved_directory, "/", base_name);
+  // The last component can be a symlink too. That's rare enough that it's not worth caching, so we
+  // only pay one `readlink` in the common case.
+  char buffer[1];
+  if (::readlink(resolved.c_str(), buffer, sizeof(buffer)) >= 0) {
+    return RealPath(resolved).value_or(std::move(resolved));
+  }
+  return resolved;
+}
+
+absl::Status PathCanonicalizer::Flush() {
+  if (pending_lines_.empty() || options_.cache_path.empty()) {
+    return absl::OkStatus();
+  }
+  FD const fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      options_.cache_path.c_str(), /*flags=*/O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+      /*mode=*/0664)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  // A single `write` in append mode, so that concurrent hook processes don't interleave lines.
+  auto const contents = absl::StrJoin(pending_lines_, "");
+  pending_lines_.clear();
+  if (::write(fd.get(), contents.data(), contents.size()) < 0) {
+    return absl::ErrnoToStatus(errno, "write");
+  }
+  return absl::OkStatus();
+}
+
+void PathCanonicalizer::LoadCache() {
+  cache_loaded_ = true;
+  if (options_.cache_path.empty()) {
+    return;
+  }
+  FD const fd{::open(options_.cache_path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!fd) {
+    return;
+  }
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return;
+  }
+  if (stat.st_size > kMaxCacheFileSize) {
+    ::unlink(options_.cache_path.c_str());
+    return;
+  }
+  auto status_or_mapping = MappedFile::Map(fd, stat.st_size);
+  if (!status_or_mapping.ok()) {
+    LOG(WARNING) << "Failed to read " << options_.cache_path << ": "
+                 << status_or_mapping.status();
+    return;
+  }
+  // Each line is `<device>\t<inode>\t<directory>\t<resolved directory>`. Malformed lines (e.g.
+  // truncated by a crash) are skipped, and later lines override earlier ones.
+  for (std::string_view const line : absl::StrSplit(status_or_mapping->contents(), '\n')) {
+    std::vector<std::string_view> const fields = absl::StrSplit(line, '\t');
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    if (fields.size() != 4 || !absl::SimpleAtoi(fields[0], &device) ||
+        !absl::SimpleAtoi(fields[1], &inode) || fields[2].empty() || fields[3].empty()) {
+      continue;
+    }
+    cache_.insert_or_assign(std::string(fields[2]), CachedDirectory{
+                                                        .device = static_cast<dev_t>(device),
+                                                        .inode = static_cast<ino_t>(inode),
+                                                        .resolved_path = std::string(fields[3]),
+                                                    });
+  }
+}
+
+std::optional<std::string> PathCanonicalizer::ResolveDirectory(std::string const& directory) {
+  auto const it = memo_.find(directory);
+  if (it != memo_.end()) {
+    return it->second;
+  }
+  if (!cache_loaded_) {
+    LoadCache();
+  }
+  struct stat stat {};
+  if (::stat(directory.c_str(), &stat) < 0) {
+    return std::nullopt;
+  }
+  auto const cached = cache_.find(directory);
+  if (cached != cache_.end() && cached->second.device == stat.st_dev &&
+      cached->second.inode == stat.st_ino) {
+    auto const [memoized, unused] = memo_.try_emplace(directory, cached->second.resolved_path);
+    return memoized->second;
+  }
+  auto maybe_resolved = RealPath(directory);
+  if (!maybe_resolved.has_value()) {
+    return std::nullopt;
+  }
+  auto const& resolved = maybe_resolved.value();
+  if (directory.find_first_of("\t\n") == std::string::npos &&
+      resolved.find_first_of("\t\n") == std::string::npos) {
+    pending_lines_.emplace_back(
+        absl::StrCat(stat.st_dev, "\t", stat.st_ino, "\t", directory, "\t", resolved, "\n"));
+  }
+  memo_.try_emplace(directory, resolved);
+  return maybe_resolved;
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,93 @@
+#ifndef __COMP_DB_HOOK_PATH_CANONICALIZER_H__
+#define __COMP_DB_HOOK_PATH_CANONICALIZER_H__
+
+#include <sys/types.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+
+namespace comp_db_hook {
+
+// Lexically normalizes a path: duplicate slashes and `.` components are removed and `..`
+// components are collapsed with the preceding component. No filesystem access is performed, so
+// `..` following a symlink is resolved the same way clangd resolves it. `..` components can't climb
+// above the root of an absolute path and are kept at the beginning of a relative one. The result is
+// never empty (the empty relative path is `.`).
+std::string NormalizePath(std::string_view path);
+
+// Computes the canonical form of the source file paths, which is what the compilation database
+// entries are keyed by, so that the same file is never recorded twice under different spellings.
+//
+// Paths are always normalized lexically. Symlinks are also resolved if so configured, in which case
+// the resolved directories are memoized for the lifetime of the canonicalizer and also persisted in
+// a per-workspace cache file shared by all hook processes. A persisted entry is validated with a
+// single `stat` of the unresolved directory (its device and inode must match the resolved one),
+// which is considerably cheaper than the `lstat` per path component performed by `realpath`.
+class PathCanonicalizer {
+ public:
+  // The persistent cache is discarded when it grows larger than this.
+  static size_t constexpr kMaxCacheFileSize = 1 << 20;
+
+  struct Options {
+    // Whether to resolve symlinks. When false only lexical normalization is performed.
+    bool resolve_symlinks = false;
+
+    // Path of the persistent cache file. Empty means no persistent cache.
+    std::string cache_path;
+  };
+
+  // Reads the options from the `COMP_DB_HOOK_RESOLVE_SYMLINKS` environment variable.
+  static Options GetOptionsFromEnvironment(std::string cache_path);
+
+  explicit PathCanonicalizer(Options options) : options_(std::move(options)) {}
+
+  ~PathCanonicalizer() = default;
+
+  PathCanonicalizer(PathCanonicalizer&&) noexcept = default;
+  PathCanonicalizer& operator=(PathCanonicalizer&&) noexcept = default;
+  PathCanonicalizer(PathCanonicalizer const&) = delete;
+  PathCanonicalizer& operator=(PathCanonicalizer const&) = delete;
+
+  Options const& options() const { return options_; }
+
+  // Returns the canonical form of `path`. Paths that can't be resolved (e.g. because they don't
+  // exist) are only normalized lexically.
+  std::string Canonicalize(std::string_view path);
+
+  // Appends the directories resolved since the last call to the persistent cache.
+  absl::Status Flush();
+
+ private:
+  struct CachedDirectory {
+    dev_t device;
+    ino_t inode;
+    std::string resolved_path;
+  };
+
+  void LoadCache();
+
+  std::optional<std::string> ResolveDirectory(std::string const& directory);
+
+  Options options_;
+
+  bool cache_loaded_ = false;
+
+  // Directories resolved by this process.
+  absl::flat_hash_map<std::string, std::string> memo_;
+
+  // Directories read from the persistent cache, still to be validated.
+  absl::flat_hash_map<std::string, CachedDirectory> cache_;
+
+  // Lines to append to the persistent cache.
+  std::vector<std::string> pending_lines_;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_PATH_CANONICALIZER_H__
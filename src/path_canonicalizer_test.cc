@@ -0,0 +1,208 @@
+#include "src/path_canonicalizer.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::NormalizePath;
+using ::comp_db_hook::PathCanonicalizer;
+
+struct NormalizePathTestCase {
+  std::string_view path;
+  std::string_view normalized;
+};
+
+TEST(NormalizePathTest, Normalize) {
+  NormalizePathTestCase const test_cases[] = {
+      {"", "."},
+      {".", "."},
+      {"./", "."},
+      {"/", "/"},
+      {"//", "/"},
+      {"/.", "/"},
+      {"/..", "/"},
+      {"/../..", "/"},
+      {"foo", "foo"},
+      {"foo/", "foo"},
+      {"./foo", "foo"},
+      {"foo//bar", "foo/bar"},
+      {"foo/./bar", "foo/bar"},
+      {"foo/../bar", "bar"},
+      {"foo/..", "."},
+      {"foo/bar/../../..", ".."},
+      {"..", ".."},
+      {"../foo", "../foo"},
+      {"../../foo/..", "../.."},
+      {"/foo/bar", "/foo/bar"},
+      {"/foo/../bar", "/bar"},
+      {"/foo/../../bar", "/bar"},
+      {"//foo///bar//", "/foo/bar"},
+      {"/foo/./bar/./baz.cc", "/foo/bar/baz.cc"},
+      {"/foo/..bar/.baz", "/foo/..bar/.baz"},
+  };
+  for (auto const& test_case : test_cases) {
+    EXPECT_EQ(NormalizePath(test_case.path), test_case.normalized) << test_case.path;
+  }
+}
+
+class PathCanonicalizerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/path_canonicalizer_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    // The temporary directory may itself be behind a symlink.
+    char buffer[PATH_MAX + 1];
+    ASSERT_NE(::realpath(directory_.c_str(), buffer), nullptr);
+    directory_ = buffer;
+  }
+
+  void TearDown() override {
+    for (auto it = paths_.rbegin(); it != paths_.rend(); ++it) {
+      if (::unlink(it->c_str()) < 0) {
+        ::rmdir(it->c_str());
+      }
+    }
+    ::rmdir(directory_.c_str());
+  }
+
+  std::string GetPath(std::string_view const name) const {
+    return absl::StrCat(directory_, "/", name);
+  }
+
+  std::string MakeDirectory(std::string_view const name) {
+    auto path = GetPath(name);
+    EXPECT_EQ(::mkdir(path.c_str(), 0755), 0);
+    paths_.push_back(path);
+    return path;
+  }
+
+  std::string WriteFile(std::string_view const name, std::string_view const contents) {
+    auto path = GetPath(name);
+    int const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(::write(fd, contents.data(), contents.size()), contents.size());
+    ::close(fd);
+    paths_.push_back(path);
+    return path;
+  }
+
+  std::string MakeSymlink(std::string_view const name, std::string const& target) {
+    auto path = GetPath(name);
+    EXPECT_EQ(::symlink(target.c_str(), path.c_str()), 0);
+    paths_.push_back(path);
+    return path;
+  }
+
+  // Returns the line of the persistent cache that maps `directory` to `resolved_path`, as if
+  // `directory` had the device and inode of `inode_path`.
+  static std::string MakeCacheLine(std::string_view const directory,
+                                   std::string const& inode_path,
+                                   std::string_view const resolved_path) {
+    struct stat stat {};
+    EXPECT_EQ(::stat(inode_path.c_str(), &stat), 0);
+    return absl::StrCat(stat.st_dev, "\t", stat.st_ino, "\t", directory, "\t", resolved_path,
+                        "\n");
+  }
+
+  std::string directory_;
+  std::vector<std::string> paths_;
+};
+
+TEST_F(PathCanonicalizerTest, OnlyNormalizesByDefault) {
+  MakeDirectory("real");
+  auto const link = MakeSymlink("link", GetPath("real"));
+  PathCanonicalizer canonicalizer{PathCanonicalizer::Options{}};
+  EXPECT_EQ(canonicalizer.Canonicalize(absl::StrCat(link, "/./foo.cc")),
+            absl::StrCat(link, "/foo.cc"));
+}
+
+TEST_F(PathCanonicalizerTest, ResolvesSymlinkedDirectory) {
+  auto const real = MakeDirectory("real");
+  auto const link = MakeSymlink("link", real);
+  PathCanonicalizer canonicalizer{PathCanonicalizer::Options{.resolve_symlinks = true}};
+  EXPECT_EQ(canonicalizer.Canonicalize(absl::StrCat(link, "/foo.cc")),
+            absl::StrCat(real, "/foo.cc"));
+  // Memoized.
+  EXPECT_EQ(canonicalizer.Canonicalize(absl::StrCat(link, "/bar.cc")),
+            absl::StrCat(real, "/bar.cc"));
+}
+
+TEST_F(PathCanonicalizerTest, ResolvesSymlinkedFile) {
+  auto const real = WriteFile("real.cc", "");
+  auto const link = MakeSymlink("link.cc", real);
+  PathCanonicalizer canonicalizer{PathCanonicalizer::Options{.resolve_symlinks = true}};
+  EXPECT_EQ(canonicalizer.Canonicalize(link), real);
+}
+
+TEST_F(PathCanonicalizerTest, DotDotIsLexical) {
+  MakeDirectory("real");
+  MakeDirectory("real/sub");
+  MakeDirectory("other");
+  auto const link = MakeSymlink("other/link", GetPath("real/sub"));
+  PathCanonicalizer canonicalizer{PathCanonicalizer::Options{.resolve_symlinks = true}};
+  // Like clangd, `link/..` is `other` rather than `real`.
+  EXPECT_EQ(canonicalizer.Canonicalize(absl::StrCat(link, "/../foo.cc")),
+            GetPath("other/foo.cc"));
+}
+
+TEST_F(PathCanonicalizerTest, MissingDirectoryIsOnlyNormalized) {
+  PathCanonicalizer canonicalizer{PathCanonicalizer::Options{.resolve_symlinks = true}};
+  EXPECT_EQ(canonicalizer.Canonicalize(GetPath("missing/./foo.cc")), GetPath("missing/foo.cc"));
+}
+
+TEST_F(PathCanonicalizerTest, RootIsKept) {
+  PathCanonicalizer canonicalizer{PathCanonicalizer::Options{.resolve_symlinks = true}};
+  EXPECT_EQ(canonicalizer.Canonicalize("/"), "/");
+  EXPECT_EQ(canonicalizer.Canonicalize("/.."), "/");
+}
+
+TEST_F(PathCanonicalizerTest, FlushPersistsResolvedDirectories) {
+  auto const real = MakeDirectory("real");
+  auto const link = MakeSymlink("link", real);
+  auto const cache_path = GetPath("cache");
+  paths_.push_back(cache_path);
+  {
+    PathCanonicalizer canonicalizer{
+        PathCanonicalizer::Options{.resolve_symlinks = true, .cache_path = cache_path}};
+    canonicalizer.Canonicalize(absl::StrCat(link, "/foo.cc"));
+    ASSERT_TRUE(canonicalizer.Flush().ok());
+  }
+  struct stat stat {};
+  ASSERT_EQ(::stat(cache_path.c_str(), &stat), 0);
+  EXPECT_EQ(stat.st_size, MakeCacheLine(link, real, real).size());
+}
+
+TEST_F(PathCanonicalizerTest, UsesPersistedDirectories) {
+  auto const real = MakeDirectory("real");
+  auto const link = MakeSymlink("link", real);
+  // A cached resolution is trusted as long as the device and inode match, so a bogus one shows
+  // that it was used instead of resolving the directory again.
+  auto const cache_path = WriteFile("cache", MakeCacheLine(link, real, "/cached"));
+  PathCanonicalizer canonicalizer{
+      PathCanonicalizer::Options{.resolve_symlinks = true, .cache_path = cache_path}};
+  EXPECT_EQ(canonicalizer.Canonicalize(absl::StrCat(link, "/foo.cc")), "/cached/foo.cc");
+}
+
+TEST_F(PathCanonicalizerTest, IgnoresStalePersistedDirectories) {
+  auto const real = MakeDirectory("real");
+  auto const link = MakeSymlink("link", real);
+  auto const cache_path = WriteFile(
+      "cache", absl::StrCat(MakeCacheLine(link, directory_, "/stale"), "garbage\n1\t2\t3\n"));
+  PathCanonicalizer canonicalizer{
+      PathCanonicalizer::Options{.resolve_symlinks = true, .cache_path = cache_path}};
+  EXPECT_EQ(canonicalizer.Canonicalize(absl::StrCat(link, "/foo.cc")),
+            absl::StrCat(real, "/foo.cc"));
+}
+
+}  // namespace
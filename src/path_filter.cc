@@ -0,0 +1,395 @@
+#include "src/path_filter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/types/span.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "src/config.h"
+#include "src/mapped_file.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kPathFiltersEnvVar = "COMP_DB_HOOK_PATH_FILTERS";
+std::string_view constexpr kPathFiltersFileName = ".comp_db_hook_filters";
+
+using ByteSet = std::bitset<256>;
+
+ByteSet AllBytes() { return ByteSet().set(); }
+
+ByteSet AllBytesButSlash() { return ByteSet().set().reset('/'); }
+
+ByteSet SingleByte(char const ch) { return ByteSet().set(static_cast<uint8_t>(ch)); }
+
+struct GlobToken {
+  enum class Kind {
+    // Matches one byte of `bytes`.
+    kByte,
+
+    // `*`: any sequence of bytes except `/`.
+    kStar,
+
+    // `**`: any sequence of bytes.
+    kDoubleStar,
+
+    // `**/`: zero or more directories.
+    kDirectories,
+  };
+
+  Kind kind;
+  ByteSet bytes;
+};
+
+// Parses a bracket expression starting at `pattern[*index]`, which must be `[`. Returns false if
+// the expression is unterminated, in which case the `[` must be taken literally.
+bool ParseBracketExpression(std::string_view const pattern, size_t* const index,
+                            ByteSet* const bytes) {
+  size_t i = *index + 1;
+  bool negated = false;
+  if (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^')) {
+    negated = true;
+    ++i;
+  }
+  ByteSet set;
+  bool first = true;
+  for (; i < pattern.size() && (first || pattern[i] != ']'); first = false) {
+    uint8_t low = pattern[i++];
+    if (low == '\\' && i < pattern.size()) {
+      low = pattern[i++];
+    }
+    uint8_t high = low;
+    if (i + 1 < pattern.size() && pattern[i] == '-' && pattern[i + 1] != ']') {
+      high = pattern[i + 1];
+      i += 2;
+    }
+    for (unsigned int ch = low; ch <= high; ++ch) {
+      set.set(ch);
+    }
+  }
+  if (i >= pattern.size()) {
+    return false;
+  }
+  *index = i;  // points to the closing bracket
+  if (negated) {
+    set.flip();
+  }
+  // Like all other wildcards, character classes never match directory separators.
+  set.reset('/');
+  *bytes = set;
+  return true;
+}
+
+std::vector<GlobToken> ParseGlob(std::string_view pattern) {
+  while (pattern.size() > 1 && pattern.back() == '/') {
+    pattern.remove_suffix(1);
+  }
+  std::vector<GlobToken> tokens;
+  if (pattern.find('/') == std::string_view::npos) {
+    tokens.push_back(GlobToken{GlobToken::Kind::kDirectories});
+  }
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    char const ch = pattern[i];
+    if (ch == '*') {
+      if (i + 1 < pattern.size() && pattern[i + 1] == '*') {
+        ++i;
+        if (i + 1 < pattern.size() && pattern[i + 1] == '/') {
+          ++i;
+          tokens.push_back(GlobToken{GlobToken::Kind::kDirectories});
+        } else {
+          tokens.push_back(GlobToken{GlobToken::Kind::kDoubleStar});
+        }
+      } else {
+        tokens.push_back(GlobToken{GlobToken::Kind::kStar});
+      }
+    } else if (ch == '?') {
+      tokens.push_back(GlobToken{GlobToken::Kind::kByte, AllBytesButSlash()});
+    } else if (ch == '[') {
+      ByteSet bytes;
+      if (ParseBracketExpression(pattern, &i, &bytes)) {
+        tokens.push_back(GlobToken{GlobToken::Kind::kByte, bytes});
+      } else {
+        tokens.push_back(GlobToken{GlobToken::Kind::kByte, SingleByte(ch)});
+      }
+    } else if (ch == '\\' && i + 1 < pattern.size()) {
+      tokens.push_back(GlobToken{GlobToken::Kind::kByte, SingleByte(pattern[++i])});
+    } else {
+      tokens.push_back(GlobToken{GlobToken::Kind::kByte, SingleByte(ch)});
+    }
+  }
+  return tokens;
+}
+
+// Nondeterministic automaton built from the globs, then converted to a DFA by subset construction.
+class Nfa {
+ public:
+  explicit Nfa() { AddState(); }
+
+  // Adds the pattern to the automaton. Its final states are marked with `accept`.
+  void AddPattern(std::string_view const pattern, uint8_t const accept) {
+    int state = AddState();
+    AddEpsilon(0, state);
+    for (auto const& token : ParseGlob(pattern)) {
+      int const next = AddState();
+      switch (token.kind) {
+        case GlobToken::Kind::kByte:
+          AddEdge(state, token.bytes, next);
+          break;
+        case GlobToken::Kind::kStar:
+          AddEdge(state, AllBytesButSlash(), state);
+          AddEpsilon(state, next);
+          break;
+        case GlobToken::Kind::kDoubleStar:
+          AddEdge(state, AllBytes(), state);
+          AddEpsilon(state, next);
+          break;
+        case GlobToken::Kind::kDirectories: {
+          // Either nothing, or anything ending with a `/`.
+          int const directories = AddState();
+          AddEpsilon(state, next);
+          AddEdge(state, AllBytes(), directories);
+          AddEdge(directories, AllBytes(), directories);
+          AddEdge(directories, SingleByte('/'), next);
+          break;
+        }
+      }
+      state = next;
+    }
+    states_[state].accept |= accept;
+    // Everything under a matched directory matches too.
+    int const subtree = AddState();
+    AddEdge(state, SingleByte('/'), subtree);
+    AddEdge(subtree, AllBytes(), subtree);
+    states_[subtree].accept |= accept;
+  }
+
+  size_t num_states() const { return states_.size(); }
+
+  uint8_t accept(int const state) const { return states_[state].accept; }
+
+  std::vector<ByteSet> const& labels() const { return labels_; }
+
+  // Adds the epsilon closure of `states` to `states`, which is then sorted.
+  void Close(std::vector<int>* const states) const {
+    std::vector<bool> visited(states_.size(), false);
+    std::vector<int> stack;
+    for (int const state : *states) {
+      visited[state] = true;
+      stack.push_back(state);
+    }
+    states->clear();
+    while (!stack.empty()) {
+      int const state = stack.back();
+      stack.pop_back();
+      states->push_back(state);
+      for (int const next : states_[state].epsilon) {
+        if (!visited[next]) {
+          visited[next] = true;
+          stack.push_back(next);
+        }
+      }
+    }
+    std::sort(states->begin(), states->end());
+  }
+
+  // Returns the (unclosed) set of states reachable from `states` by consuming `byte`.
+  std::vector<int> Step(std::vector<int> const& states, uint8_t const byte) const {
+    std::vector<int> result;
+    for (int const state : states) {
+      for (auto const& [label, next] : states_[state].edges) {
+        if (labels_[label].test(byte)) {
+          result.push_back(next);
+        }
+      }
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+  }
+
+ private:
+  struct State {
+    std::vector<std::pair<size_t, int>> edges;
+    std::vector<int> epsilon;
+    uint8_t accept = 0;
+  };
+
+  int AddState() {
+    states_.emplace_back();
+    return static_cast<int>(states_.size() - 1);
+  }
+
+  void AddEdge(int const from, ByteSet const& bytes, int const to) {
+    labels_.push_back(bytes);
+    states_[from].edges.emplace_back(labels_.size() - 1, to);
+  }
+
+  void AddEpsilon(int const from, int const to) { states_[from].epsilon.push_back(to); }
+
+  std::vector<State> states_;
+  std::vector<ByteSet> labels_;
+};
+
+// Partitions the bytes in equivalence classes, two bytes being equivalent iff they belong to
+// exactly the same edge labels. Returns the number of classes.
+size_t ComputeByteClasses(std::vector<ByteSet> const& labels,
+                          std::vector<uint8_t>* const byte_classes) {
+  std::map<std::vector<bool>, uint8_t> signatures;
+  byte_classes->resize(256);
+  for (unsigned int byte = 0; byte < 256; ++byte) {
+    std::vector<bool> signature;
+    signature.reserve(labels.size());
+    for (auto const& label : labels) {
+      signature.push_back(label.test(byte));
+    }
+    auto const [it, unused] = signatures.try_emplace(std::move(signature), signatures.size());
+    (*byte_classes)[byte] = it->second;
+  }
+  return signatures.size();
+}
+
+absl::StatusOr<std::vector<std::string>> ReadRulesFile(std::string const& path) {
+  FD const fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!fd) {
+    if (errno == ENOENT) {
+      return std::vector<std::string>();
+    } else {
+      return absl::ErrnoToStatus(errno, absl::StrCat("open(\"", path, "\")"));
+    }
+  }
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  std::vector<std::string> rules;
+  for (std::string_view line : absl::StrSplit(mapping.contents(), '\n')) {
+    line = absl::StripAsciiWhitespace(line);
+    if (!line.empty() && line.front() != '#') {
+      rules.emplace_back(line);
+    }
+  }
+  return rules;
+}
+
+}  // namespace
+
+absl::StatusOr<PathFilter> PathFilter::Create(absl::Span<std::string const> const rules) {
+  if (rules.empty()) {
+    return PathFilter();
+  }
+  Nfa nfa;
+  bool has_includes = false;
+  for (std::string_view rule : rules) {
+    uint8_t accept = kExcludeMatch;
+    if (!rule.empty() && rule.front() == '+') {
+      accept = kIncludeMatch;
+      has_includes = true;
+      rule.remove_prefix(1);
+    } else if (!rule.empty() && rule.front() == '-') {
+      rule.remove_prefix(1);
+    }
+    if (rule.empty()) {
+      return absl::InvalidArgumentError("empty path filter pattern");
+    }
+    nfa.AddPattern(rule, accept);
+  }
+
+  std::vector<uint8_t> byte_classes;
+  size_t const num_classes = ComputeByteClasses(nfa.labels(), &byte_classes);
+  std::vector<uint8_t> representatives(num_classes);
+  for (unsigned int byte = 256; byte > 0; --byte) {
+    representatives[byte_classes[byte - 1]] = byte - 1;
+  }
+
+  std::map<std::vector<int>, int32_t> dfa_states;
+  std::vector<std::vector<int>> queue;
+  std::vector<int32_t> transitions;
+  std::vector<uint8_t> accept;
+  auto const get_state = [&](std::vector<int> nfa_states) -> absl::StatusOr<int32_t> {
+    nfa.Close(&nfa_states);
+    auto const it = dfa_states.find(nfa_states);
+    if (it != dfa_states.end()) {
+      return it->second;
+    }
+    if (dfa_states.size() >= kMaxStates) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("path filter patterns require more than ", kMaxStates, " DFA states"));
+    }
+    int32_t const state = dfa_states.size();
+    uint8_t flags = 0;
+    for (int const nfa_state : nfa_states) {
+      flags |= nfa.accept(nfa_state);
+    }
+    accept.push_back(flags);
+    transitions.resize(transitions.size() + num_classes, kDeadState);
+    dfa_states.emplace(nfa_states, state);
+    queue.emplace_back(std::move(nfa_states));
+    return state;
+  };
+
+  RETURN_IF_ERROR(get_state({0}).status());
+  for (size_t state = 0; state < queue.size(); ++state) {
+    for (size_t byte_class = 0; byte_class < num_classes; ++byte_class) {
+      auto next = nfa.Step(queue[state], representatives[byte_class]);
+      if (next.empty()) {
+        continue;
+      }
+      DEFINE_CONST_OR_RETURN(next_state, get_state(std::move(next)));
+      transitions[state * num_classes + byte_class] = next_state;
+    }
+  }
+
+  size_t const num_states = queue.size();
+  return PathFilter(has_includes, std::move(byte_classes), num_classes, std::move(transitions),
+                    std::move(accept), num_states);
+}
+
+absl::StatusOr<PathFilter> PathFilter::FromWorkspace(std::string_view const workspace_directory) {
+  auto rules = GetListEnv(kPathFiltersEnvVar);
+  auto const file_path = workspace_directory.empty()
+                             ? std::string(kPathFiltersFileName)
+                             : absl::StrCat(workspace_directory, "/", kPathFiltersFileName);
+  DEFINE_VAR_OR_RETURN(file_rules, ReadRulesFile(file_path));
+  for (auto& rule : file_rules) {
+    rules.emplace_back(std::move(rule));
+  }
+  return Create(rules);
+}
+
+bool PathFilter::Accepts(std::string_view const path) const {
+  if (empty()) {
+    return true;
+  }
+  int32_t state = 0;
+  for (char const ch : path) {
+    state = transitions_[state * num_classes_ + byte_classes_[static_cast<uint8_t>(ch)]];
+    if (state == kDeadState) {
+      return !has_includes_;
+    }
+  }
+  uint8_t const flags = accept_[state];
+  return (!has_includes_ || (flags & kIncludeMatch) != 0) && (flags & kExcludeMatch) == 0;
+}
+
+}  // namespace comp_db_hook
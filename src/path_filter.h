@@ -0,0 +1,103 @@
+#ifndef __COMP_DB_HOOK_PATH_FILTER_H__
+#define __COMP_DB_HOOK_PATH_FILTER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// Decides which source files are recorded in the compilation database based on a list of include
+// and exclude glob patterns. A path is accepted iff it matches at least one include pattern (or
+// there are no include patterns at all) and it matches no exclude pattern.
+//
+// Each rule is a glob pattern prefixed by `+` (include) or `-` (exclude); rules without a prefix
+// are exclude rules. The patterns are matched against workspace-relative paths and support the
+// following syntax:
+//
+//   * `*` matches any sequence of characters except `/`;
+//   * `?` matches any single character except `/`;
+//   * `**` matches any sequence of characters, including `/`;
+//   * `**/` matches zero or more directories;
+//   * `[abc]`, `[a-z]`, `[!a-z]` and `[^a-z]` match a character class;
+//   * `\` escapes the next character.
+//
+// As in `.gitignore` files, a pattern matching a directory also matches everything under it, and a
+// pattern without any `/` other than a trailing one is matched against every component of the path
+// (so `*.pb.cc` is equivalent to `**/*.pb.cc`, and `external` and `external/` are both equivalent
+// to `**/external/**`).
+//
+// All patterns are compiled into a single DFA over byte equivalence classes, so that matching a
+// path costs one table lookup per character regardless of the number of rules.
+class PathFilter {
+ public:
+  // Maximum number of DFA states. Pathological pattern sets exceeding this limit are rejected.
+  static size_t constexpr kMaxStates = 4096;
+
+  // Compiles the rules.
+  static absl::StatusOr<PathFilter> Create(absl::Span<std::string const> rules);
+
+  // Compiles the rules read from the `COMP_DB_HOOK_PATH_FILTERS` environment variable
+  // (comma-separated) and from the `.comp_db_hook_filters` file in the workspace directory (one
+  // rule per line, `#` starts a comment line). A missing file is not an error.
+  static absl::StatusOr<PathFilter> FromWorkspace(std::string_view workspace_directory);
+
+  // Constructs a filter that accepts everything.
+  explicit PathFilter() = default;
+
+  ~PathFilter() = default;
+
+  PathFilter(PathFilter&&) noexcept = default;
+  PathFilter& operator=(PathFilter&&) noexcept = default;
+  PathFilter(PathFilter const&) = default;
+  PathFilter& operator=(PathFilter const&) = default;
+
+  // Returns true iff the filter has no rules, i.e. it accepts everything.
+  bool empty() const { return num_states_ == 0; }
+
+  // Returns the number of states of the compiled DFA.
+  size_t num_states() const { return num_states_; }
+
+  // Checks a workspace-relative path against the rules.
+  bool Accepts(std::string_view path) const;
+
+ private:
+  static uint8_t constexpr kIncludeMatch = 1;
+  static uint8_t constexpr kExcludeMatch = 2;
+
+  static int32_t constexpr kDeadState = -1;
+
+  explicit PathFilter(bool const has_includes, std::vector<uint8_t> byte_classes,
+                      size_t const num_classes, std::vector<int32_t> transitions,
+                      std::vector<uint8_t> accept, size_t const num_states)
+      : has_includes_(has_includes),
+        byte_classes_(std::move(byte_classes)),
+        num_classes_(num_classes),
+        transitions_(std::move(transitions)),
+        accept_(std::move(accept)),
+        num_states_(num_states) {}
+
+  bool has_includes_ = false;
+
+  // Maps each byte to its equivalence class.
+  std::vector<uint8_t> byte_classes_;
+  size_t num_classes_ = 0;
+
+  // Transition table, `num_states_ * num_classes_` entries. The initial state is 0.
+  std::vector<int32_t> transitions_;
+
+  // Bitmask of `kIncludeMatch` and `kExcludeMatch` for each state.
+  std::vector<uint8_t> accept_;
+
+  size_t num_states_ = 0;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_PATH_FILTER_H__
@@ -0,0 +1,132 @@
+#include "src/path_filter.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::PathFilter;
+
+struct FilterTestCase {
+  std::vector<std::string> rules;
+  std::string_view path;
+  bool accepted;
+};
+
+std::string DescribeTestCase(FilterTestCase const& test_case) {
+  std::string description = "rules:";
+  for (auto const& rule : test_case.rules) {
+    description += " ";
+    description += rule;
+  }
+  description += ", path: ";
+  description += test_case.path;
+  return description;
+}
+
+TEST(PathFilterTest, EmptyFilter) {
+  PathFilter const filter;
+  EXPECT_TRUE(filter.empty());
+  EXPECT_TRUE(filter.Accepts("foo.cc"));
+  EXPECT_TRUE(filter.Accepts("external/foo.cc"));
+}
+
+TEST(PathFilterTest, NoRules) {
+  auto const status_or_filter = PathFilter::Create({});
+  ASSERT_TRUE(status_or_filter.ok()) << status_or_filter.status();
+  EXPECT_TRUE(status_or_filter->empty());
+  EXPECT_TRUE(status_or_filter->Accepts("foo.cc"));
+}
+
+TEST(PathFilterTest, EmptyPattern) {
+  EXPECT_EQ(PathFilter::Create({"+"}).status().code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(PathFilter::Create({"-"}).status().code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(PathFilter::Create({""}).status().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(PathFilterTest, Rules) {
+  FilterTestCase const test_cases[] = {
+      // Plain names match whole components at any depth, and everything under them.
+      {{"external"}, "external", false},
+      {{"external"}, "external/a.cc", false},
+      {{"external"}, "src/external/a.cc", false},
+      {{"external"}, "src/external", false},
+      {{"external"}, "myexternal/a.cc", true},
+      {{"external"}, "src/my_external/a.cc", true},
+      {{"external"}, "externals/a.cc", true},
+      {{"external"}, "src/externals", true},
+      {{"external/"}, "external/a.cc", false},
+      {{"external/"}, "src/external/a.cc", false},
+      {{"external/"}, "myexternal/a.cc", true},
+      {{"foo.cc"}, "foo.cc", false},
+      {{"foo.cc"}, "src/foo.cc", false},
+      {{"foo.cc"}, "src/barfoo.cc", true},
+      {{"foo.cc"}, "barfoo.cc", true},
+      {{"foo.cc"}, "src/foo.cc.bak", true},
+
+      // Wildcards.
+      {{"*.pb.cc"}, "foo.pb.cc", false},
+      {{"*.pb.cc"}, "src/proto/foo.pb.cc", false},
+      {{"*.pb.cc"}, "src/proto/foo.pb.h", true},
+      {{"src/*.cc"}, "src/foo.cc", false},
+      {{"src/*.cc"}, "src/a/foo.cc", true},
+      {{"src/*.cc"}, "lib/src/foo.cc", true},
+      {{"src/**.cc"}, "src/a/foo.cc", false},
+      {{"src/?.cc"}, "src/a.cc", false},
+      {{"src/?.cc"}, "src/ab.cc", true},
+      {{"src/?.cc"}, "src//.cc", true},
+      {{"src/[ab].cc"}, "src/a.cc", false},
+      {{"src/[ab].cc"}, "src/c.cc", true},
+      {{"src/[a-c].cc"}, "src/b.cc", false},
+      {{"src/[!a-c].cc"}, "src/b.cc", true},
+      {{"src/[^a-c].cc"}, "src/d.cc", false},
+      {{"src/[ab.cc"}, "src/[ab.cc", false},
+      {{"src/\\*.cc"}, "src/*.cc", false},
+      {{"src/\\*.cc"}, "src/a.cc", true},
+
+      // `**/` matches zero or more whole directories.
+      {{"src/**/test"}, "src/test/a.cc", false},
+      {{"src/**/test"}, "src/a/test/a.cc", false},
+      {{"src/**/test"}, "src/a/b/test/a.cc", false},
+      {{"src/**/test"}, "src/atest/a.cc", true},
+      {{"src/**/test"}, "src/a/btest/a.cc", true},
+      {{"**/gen/*.cc"}, "gen/a.cc", false},
+      {{"**/gen/*.cc"}, "a/b/gen/a.cc", false},
+      {{"**/gen/*.cc"}, "a/bgen/a.cc", true},
+
+      // Patterns with a `/` are anchored to the workspace directory.
+      {{"src/gen"}, "src/gen/a.cc", false},
+      {{"src/gen"}, "lib/src/gen/a.cc", true},
+      {{"/src"}, "src/a.cc", true},
+
+      // Include rules.
+      {{"+src"}, "src/a.cc", true},
+      {{"+src"}, "lib/src/a.cc", true},
+      {{"+src"}, "lib/a.cc", false},
+      {{"+src"}, "mysrc/a.cc", false},
+      {{"+src/**", "src/gen"}, "src/a.cc", true},
+      {{"+src/**", "src/gen"}, "src/gen/a.cc", false},
+      {{"+src/**", "-src/gen"}, "src/gen/a.cc", false},
+      {{"+*.cc", "+*.h"}, "src/a.h", true},
+      {{"+*.cc", "+*.h"}, "src/a.py", false},
+
+      // Several exclude rules.
+      {{"external", "*.pb.cc", "third_party"}, "src/a.cc", true},
+      {{"external", "*.pb.cc", "third_party"}, "third_party/a.cc", false},
+      {{"external", "*.pb.cc", "third_party"}, "src/a.pb.cc", false},
+      {{"external", "*.pb.cc", "third_party"}, "src/third_party_a.cc", true},
+  };
+  for (auto const& test_case : test_cases) {
+    auto const status_or_filter = PathFilter::Create(test_case.rules);
+    ASSERT_TRUE(status_or_filter.ok()) << status_or_filter.status();
+    EXPECT_EQ(status_or_filter->Accepts(test_case.path), test_case.accepted)
+        << DescribeTestCase(test_case);
+  }
+}
+
+}  // namespace
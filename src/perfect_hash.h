@@ -0,0 +1,207 @@
+#ifndef __COMP_DB_HOOK_PERFECT_HASH_H__
+#define __COMP_DB_HOOK_PERFECT_HASH_H__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace comp_db_hook {
+
+// A key-value pair provided to `MakePerfectHashMap`.
+template <typename Value>
+struct PerfectHashEntry {
+  std::string_view key;
+  Value value;
+};
+
+namespace internal {
+
+// Invoked when the perfect hash construction fails. It's deliberately not `constexpr` so that a
+// failure during constant evaluation turns into a compilation error. The two known causes are
+// duplicate keys and an exhausted displacement search.
+inline void PerfectHashConstructionFailed() {}
+
+constexpr size_t PerfectHashNumSlots(size_t const num_keys) {
+  size_t num_slots = 1;
+  while (num_slots < num_keys * 2) {
+    num_slots <<= 1;
+  }
+  return num_slots;
+}
+
+}  // namespace internal
+
+// 64-bit FNV-1a. The fingerprint of a string can be computed one character at a time, starting from
+// `kPerfectHashFingerprintBasis` and calling `ExtendPerfectHashFingerprint` for each character, so
+// the fingerprints of all the prefixes of a string take a single pass.
+inline uint64_t constexpr kPerfectHashFingerprintBasis = 0xCBF29CE484222325ULL;
+
+constexpr uint64_t ExtendPerfectHashFingerprint(uint64_t const hash, char const ch) {
+  return (hash ^ static_cast<uint8_t>(ch)) * 0x100000001B3ULL;
+}
+
+constexpr uint64_t PerfectHashFingerprint(std::string_view const key) {
+  uint64_t hash = kPerfectHashFingerprintBasis;
+  for (char const ch : key) {
+    hash = ExtendPerfectHashFingerprint(hash, ch);
+  }
+  return hash;
+}
+
+// Static string-keyed hash map that is built entirely at compile time using the "hash, displace,
+// and compress" scheme: keys are first distributed in buckets by one half of their fingerprint,
+// then each bucket is assigned a displacement that makes the other half of the fingerprint map all
+// of its keys to unused slots. A lookup is therefore exactly one hash computation and one key
+// comparison, with no probing.
+//
+// Instances must be created by `MakePerfectHashMap` in a `constexpr` context, e.g.:
+//
+//   auto constexpr kColors = MakePerfectHashMap<int>({
+//       {"red", 1},
+//       {"green", 2},
+//       {"blue", 3},
+//   });
+//
+//   int const* const value = kColors.Find("green");
+//
+// Duplicate keys result in a compilation error.
+template <typename Value, size_t kNumKeys>
+class PerfectHashMap {
+ public:
+  using Entry = PerfectHashEntry<Value>;
+
+  static size_t constexpr kNumSlots = internal::PerfectHashNumSlots(kNumKeys);
+  static size_t constexpr kNumBuckets = kNumKeys / 2 + 1;
+
+  explicit constexpr PerfectHashMap(std::array<Entry, kNumKeys> const& entries)
+      : entries_(entries) {
+    Build();
+  }
+
+  constexpr size_t size() const { return kNumKeys; }
+
+  constexpr auto begin() const { return entries_.begin(); }
+  constexpr auto end() const { return entries_.end(); }
+
+  // Returns a pointer to the value associated to `key`, or nullptr if `key` is not in the map.
+  constexpr Value const* Find(std::string_view const key) const {
+    return Find(key, PerfectHashFingerprint(key));
+  }
+
+  // Like `Find`, with the `PerfectHashFingerprint` of `key` already computed.
+  constexpr Value const* Find(std::string_view const key, uint64_t const fingerprint) const {
+    auto const index = slots_[GetSlot(fingerprint, displacements_[GetBucket(fingerprint)])];
+    if (index != kEmptySlot && entries_[index].key == key) {
+      return &entries_[index].value;
+    } else {
+      return nullptr;
+    }
+  }
+
+  constexpr bool Contains(std::string_view const key) const { return Find(key) != nullptr; }
+
+ private:
+  static uint32_t constexpr kEmptySlot = UINT32_MAX;
+  static uint32_t constexpr kMaxDisplacement = kNumSlots * 4;
+
+  static constexpr size_t GetBucket(uint64_t const fingerprint) {
+    return (fingerprint >> 32) % kNumBuckets;
+  }
+
+  static constexpr size_t GetSlot(uint64_t const fingerprint, uint32_t const displacement) {
+    uint64_t const step = ((fingerprint >> 32) * 0x9E3779B97F4A7C15ULL) | 1;
+    return (fingerprint + displacement * step) & (kNumSlots - 1);
+  }
+
+  constexpr void Build() {
+    for (auto& slot : slots_) {
+      slot = kEmptySlot;
+    }
+
+    // Distribute the keys in buckets (counting sort).
+    std::array<uint64_t, kNumKeys> fingerprints{};
+    std::array<size_t, kNumBuckets + 1> bucket_offsets{};
+    for (size_t i = 0; i < kNumKeys; ++i) {
+      fingerprints[i] = PerfectHashFingerprint(entries_[i].key);
+      ++bucket_offsets[GetBucket(fingerprints[i]) + 1];
+    }
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+      bucket_offsets[i + 1] += bucket_offsets[i];
+    }
+    std::array<size_t, kNumKeys> members{};
+    std::array<size_t, kNumBuckets> fill{};
+    for (size_t i = 0; i < kNumKeys; ++i) {
+      auto const bucket = GetBucket(fingerprints[i]);
+      members[bucket_offsets[bucket] + fill[bucket]++] = i;
+    }
+
+    // Place the largest buckets first, they are the hardest to fit.
+    std::array<size_t, kNumBuckets> order{};
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+      size_t j = i;
+      while (j > 0 && fill[order[j - 1]] < fill[i]) {
+        order[j] = order[j - 1];
+        --j;
+      }
+      order[j] = i;
+    }
+
+    std::array<size_t, kNumKeys> candidates{};
+    for (size_t const bucket : order) {
+      size_t const begin = bucket_offsets[bucket];
+      size_t const end = bucket_offsets[bucket + 1];
+      if (begin == end) {
+        break;
+      }
+      uint32_t displacement = 0;
+      while (!TryDisplacement(fingerprints, members, begin, end, displacement, &candidates)) {
+        if (++displacement > kMaxDisplacement) {
+          internal::PerfectHashConstructionFailed();
+          return;
+        }
+      }
+      displacements_[bucket] = displacement;
+      for (size_t i = begin; i < end; ++i) {
+        slots_[candidates[i - begin]] = members[i];
+      }
+    }
+  }
+
+  constexpr bool TryDisplacement(std::array<uint64_t, kNumKeys> const& fingerprints,
+                                 std::array<size_t, kNumKeys> const& members, size_t const begin,
+                                 size_t const end, uint32_t const displacement,
+                                 std::array<size_t, kNumKeys>* const candidates) const {
+    for (size_t i = begin; i < end; ++i) {
+      auto const slot = GetSlot(fingerprints[members[i]], displacement);
+      if (slots_[slot] != kEmptySlot) {
+        return false;
+      }
+      for (size_t j = begin; j < i; ++j) {
+        if ((*candidates)[j - begin] == slot) {
+          return false;
+        }
+      }
+      (*candidates)[i - begin] = slot;
+    }
+    return true;
+  }
+
+  std::array<Entry, kNumKeys> entries_;
+  std::array<uint32_t, kNumBuckets> displacements_{};
+  std::array<uint32_t, kNumSlots> slots_{};
+};
+
+template <typename Value, size_t kNumKeys>
+constexpr PerfectHashMap<Value, kNumKeys> MakePerfectHashMap(
+    PerfectHashEntry<Value> const (&entries)[kNumKeys]) {
+  std::array<PerfectHashEntry<Value>, kNumKeys> array{};
+  for (size_t i = 0; i < kNumKeys; ++i) {
+    array[i] = entries[i];
+  }
+  return PerfectHashMap<Value, kNumKeys>(array);
+}
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_PERFECT_HASH_H__
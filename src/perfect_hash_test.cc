@@ -0,0 +1,67 @@
+#include "src/perfect_hash.h"
+
+#include <string>
+#include <string_view>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::MakePerfectHashMap;
+using ::testing::IsNull;
+using ::testing::Pointee;
+
+auto constexpr kColors = MakePerfectHashMap<int>({
+    {"red", 1},
+    {"green", 2},
+    {"blue", 3},
+    {"cyan", 4},
+    {"magenta", 5},
+    {"yellow", 6},
+    {"black", 7},
+    {"white", 8},
+    {"", 9},
+});
+
+TEST(PerfectHashMapTest, Size) { EXPECT_EQ(kColors.size(), 9); }
+
+TEST(PerfectHashMapTest, FindAllKeys) {
+  for (auto const& entry : kColors) {
+    EXPECT_THAT(kColors.Find(entry.key), Pointee(entry.value)) << entry.key;
+    EXPECT_TRUE(kColors.Contains(entry.key)) << entry.key;
+  }
+}
+
+TEST(PerfectHashMapTest, MissingKeys) {
+  EXPECT_THAT(kColors.Find("purple"), IsNull());
+  EXPECT_THAT(kColors.Find("Red"), IsNull());
+  EXPECT_THAT(kColors.Find("re"), IsNull());
+  EXPECT_THAT(kColors.Find("redd"), IsNull());
+  EXPECT_FALSE(kColors.Contains("gray"));
+}
+
+TEST(PerfectHashMapTest, KeysWithEmbeddedNul) {
+  auto constexpr kMap = MakePerfectHashMap<int>({
+      {std::string_view("a\0b", 3), 1},
+      {std::string_view("a\0c", 3), 2},
+      {"a", 3},
+  });
+  EXPECT_THAT(kMap.Find(std::string_view("a\0b", 3)), Pointee(1));
+  EXPECT_THAT(kMap.Find(std::string_view("a\0c", 3)), Pointee(2));
+  EXPECT_THAT(kMap.Find("a"), Pointee(3));
+  EXPECT_THAT(kMap.Find(std::string_view("a\0", 2)), IsNull());
+}
+
+TEST(PerfectHashMapTest, ConstantLookup) {
+  static_assert(*kColors.Find("green") == 2);
+  static_assert(kColors.Find("purple") == nullptr);
+}
+
+TEST(PerfectHashMapTest, SingleKey) {
+  auto constexpr kMap = MakePerfectHashMap<int>({{"only", 42}});
+  EXPECT_THAT(kMap.Find("only"), Pointee(42));
+  EXPECT_THAT(kMap.Find("other"), IsNull());
+}
+
+}  // namespace
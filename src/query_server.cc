@@ -0,0 +1,299 @@
+#include "src/query_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+#include "common/utilities.h"
+#include "io/advisory_file_lock.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/command_database.h"
+#include "src/database_query.h"
+#include "src/path_canonicalizer.h"
+#include "src/snapshot.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+namespace json = ::tsdb2::json;
+
+std::string_view constexpr kFileRequest = "file ";
+std::string_view constexpr kPrefixRequest = "prefix ";
+
+// Requests longer than this are rejected and their connection is closed.
+size_t constexpr kMaxRequestSize = 64 * 1024;
+
+int constexpr kListenBacklog = 64;
+
+// inotify events that may signal a new version of the database. The database is overwritten in
+// place and closed by its writer once done, while the snapshot is renamed over. `IN_MODIFY` is left
+// out because it fires on every write of an update, long before the update is complete.
+uint32_t constexpr kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+absl::Status SendAll(FD const& fd, std::string_view const contents) {
+  size_t sent = 0;
+  while (sent < contents.size()) {
+    auto const result =
+        ::send(fd.get(), contents.data() + sent, contents.size() - sent, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::ErrnoToStatus(errno, "send");
+    }
+    sent += result;
+  }
+  return absl::OkStatus();
+}
+
+// Serves the requests of a client until it disconnects.
+void ServeConnection(std::shared_ptr<QueryServer const> const server, FD const connection) {
+  std::string buffer;
+  char chunk[4096];
+  while (true) {
+    auto const result = ::recv(connection.get(), chunk, sizeof(chunk), 0);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    } else if (result <= 0) {
+      return;
+    }
+    buffer.append(chunk, result);
+    size_t begin = 0;
+    for (auto end = buffer.find('\n'); end != std::string::npos; end = buffer.find('\n', begin)) {
+      auto const answer = server->Answer(std::string_view(buffer).substr(begin, end - begin));
+      if (auto const status = SendAll(connection, absl::StrCat(answer, "\n")); !status.ok()) {
+        return;
+      }
+      begin = end + 1;
+    }
+    buffer.erase(0, begin);
+    if (buffer.size() > kMaxRequestSize) {
+      LOG(WARNING) << "Closing a connection sending an overlong request.";
+      return;
+    }
+  }
+}
+
+absl::StatusOr<sockaddr_un> MakeSocketAddress(std::string const& path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("the socket path \"", absl::CEscape(path), "\" is too long"));
+  }
+  std::memcpy(address.sun_path, path.data(), path.size());
+  return address;
+}
+
+// Creates the listening socket at `path`, replacing a stale one left by a server that's gone. Fails
+// if another server is listening there.
+absl::StatusOr<FD> Listen(std::string const& path) {
+  DEFINE_CONST_OR_RETURN(address, MakeSocketAddress(path));
+  auto const* const socket_address = reinterpret_cast<sockaddr const*>(&address);
+  FD fd{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "socket");
+  }
+  if (::connect(fd.get(), socket_address, sizeof(address)) == 0) {
+    return absl::AlreadyExistsError(absl::StrCat("a query server is already listening on \"",
+                                                 absl::CEscape(path), "\""));
+  }
+  fd = FD{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "socket");
+  }
+  if (::unlink(path.c_str()) < 0 && errno != ENOENT) {
+    return absl::ErrnoToStatus(errno, "unlink");
+  }
+  if (::bind(fd.get(), socket_address, sizeof(address)) < 0) {
+    return absl::ErrnoToStatus(errno, "bind");
+  }
+  if (::listen(fd.get(), kListenBacklog) < 0) {
+    return absl::ErrnoToStatus(errno, "listen");
+  }
+  return std::move(fd);
+}
+
+// Returns the name of the file at `path`.
+std::string_view GetBaseName(std::string_view const path) {
+  auto const slash = path.rfind('/');
+  return slash != std::string_view::npos ? path.substr(slash + 1) : path;
+}
+
+// Opens the database in `workspace_directory` read-only, so that closing it doesn't trigger
+// `IN_CLOSE_WRITE` and thus another reload. Creates it if it doesn't exist yet.
+absl::StatusOr<FD> OpenDatabase(std::string_view const workspace_directory) {
+  auto const path = GetCommandFilePath(workspace_directory);
+  FD fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT(cppcoreguidelines-pro-type-vararg)
+  if (fd) {
+    return std::move(fd);
+  } else if (errno != ENOENT) {
+    return absl::ErrnoToStatus(errno, "open");
+  } else {
+    return OpenCommandFile(workspace_directory);
+  }
+}
+
+// Reloads `server` whenever the database or its snapshot change. Events are coalesced: a batch of
+// them results in a single reload. Only returns if reading `inotify_fd` fails, in which case the
+// server keeps serving the last snapshot it loaded.
+void WatchDatabase(std::shared_ptr<QueryServer> const server, FD const inotify_fd,
+                   std::string const command_file_name, std::string const snapshot_file_name) {
+  alignas(inotify_event) char buffer[16 * 1024];
+  while (true) {
+    auto const result = ::read(inotify_fd.get(), buffer, sizeof(buffer));
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG(ERROR) << "Stopped watching compile_commands.json: "
+                 << absl::ErrnoToStatus(errno, "read");
+      return;
+    }
+    bool changed = false;
+    for (char const* next = buffer; next < buffer + result;) {
+      auto const* const event = reinterpret_cast<inotify_event const*>(next);
+      std::string_view const name{event->len > 0 ? event->name : ""};
+      changed = changed || (event->mask & IN_Q_OVERFLOW) != 0 || name == command_file_name ||
+                name == snapshot_file_name;
+      next += sizeof(inotify_event) + event->len;
+    }
+    if (!changed) {
+      continue;
+    }
+    // Rebuilding a stale snapshot triggers one more reload, which finds the database unchanged.
+    if (auto const status = server->Reload(); !status.ok()) {
+      LOG(ERROR) << "Failed to reload compile_commands.json: " << status;
+    }
+  }
+}
+
+}  // namespace
+
+absl::Status QueryServer::Reload() {
+  DEFINE_CONST_OR_RETURN(fd, OpenDatabase(workspace_directory_));
+  {
+    DEFINE_OR_RETURN(lock, tsdb2::io::SharedFileLock::Acquire(fd));
+    DEFINE_CONST_OR_RETURN(version, GetDatabaseVersion(fd));
+    if (snapshot() != nullptr && version == version_) {
+      // E.g. a hook that had nothing to update closed the database.
+      return absl::OkStatus();
+    }
+    DEFINE_VAR_OR_RETURN(maybe_snapshot, Snapshot::Load(snapshot_path_, fd));
+    // The snapshot is validated once here so that lookups don't run into a corrupt one.
+    if (maybe_snapshot.has_value() && maybe_snapshot->Validate().ok()) {
+      version_ = version;
+      std::atomic_store(&snapshot_,
+                        std::make_shared<Snapshot const>(std::move(maybe_snapshot).value()));
+      return absl::OkStatus();
+    }
+  }
+  DEFINE_OR_RETURN(lock, tsdb2::io::ExclusiveFileLock::Acquire(fd));
+  DEFINE_CONST_OR_RETURN(version, GetDatabaseVersion(fd));
+  DEFINE_VAR_OR_RETURN(snapshot, LoadOrBuildSnapshot(snapshot_path_, fd, workspace_directory_,
+                                                     /*validate=*/true));
+  version_ = version;
+  std::atomic_store(&snapshot_, std::make_shared<Snapshot const>(std::move(snapshot)));
+  return absl::OkStatus();
+}
+
+absl::StatusOr<QueryServer::DatabaseVersion> QueryServer::GetDatabaseVersion(FD const& fd) {
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  return DatabaseVersion{.inode = stat.st_ino, .size = stat.st_size, .mtime = stat.st_mtim};
+}
+
+std::string QueryServer::Answer(std::string_view request) const {
+  request = absl::StripAsciiWhitespace(request);
+  Query query;
+  if (absl::ConsumePrefix(&request, kFileRequest)) {
+    query.prefix = false;
+  } else if (absl::ConsumePrefix(&request, kPrefixRequest)) {
+    query.prefix = true;
+  } else {
+    return "error: unknown request";
+  }
+  if (request.empty()) {
+    return "error: missing path";
+  }
+  query.path = NormalizePath(JoinPath(workspace_directory_, request));
+  auto const snapshot = this->snapshot();
+  auto const status_or_entries = FindEntries(*snapshot, query);
+  if (!status_or_entries.ok()) {
+    return absl::StrCat("error: ", status_or_entries.status().message());
+  }
+  std::string answer = "[";
+  bool first = true;
+  for (auto const& entry : status_or_entries.value()) {
+    absl::StrAppend(&answer, first ? "" : ",", json::Stringify(entry.ToCommandEntry()));
+    first = false;
+  }
+  answer += "]";
+  return answer;
+}
+
+absl::Status RunQueryServer() {
+  DEFINE_VAR_OR_RETURN(workspace_directory, GetWorkspaceDirectory());
+  // The server always serves the database in the workspace directory, even while it's staged (see
+  // `StageDatabase`), so that it can be watched in a fixed place.
+  auto snapshot_path = GetSnapshotPath(workspace_directory);
+  if (snapshot_path.empty()) {
+    return absl::FailedPreconditionError("the query server requires snapshots to be enabled");
+  }
+  auto const command_file_path = GetCommandFilePath(workspace_directory);
+  auto const socket_path = GetSidecarFilePath(workspace_directory, "socket");
+  std::string const command_file_name{GetBaseName(command_file_path)};
+  std::string const snapshot_file_name{GetBaseName(snapshot_path)};
+  // Start watching before the first load so that no change goes unnoticed.
+  FD inotify_fd{::inotify_init1(IN_CLOEXEC)};
+  if (!inotify_fd) {
+    return absl::ErrnoToStatus(errno, "inotify_init1");
+  }
+  if (::inotify_add_watch(inotify_fd.get(), workspace_directory.c_str(), kWatchMask) < 0) {
+    return absl::ErrnoToStatus(errno, "inotify_add_watch");
+  }
+  // Shared with the threads, which outlive this function if it fails.
+  auto const server =
+      std::make_shared<QueryServer>(std::move(workspace_directory), std::move(snapshot_path));
+  RETURN_IF_ERROR(server->Reload());
+  DEFINE_CONST_OR_RETURN(listen_fd, Listen(socket_path));
+  LOG(INFO) << "Serving queries on " << socket_path;
+  std::thread{WatchDatabase, server, std::move(inotify_fd), command_file_name, snapshot_file_name}
+      .detach();
+  while (true) {
+    FD connection{::accept4(listen_fd.get(), nullptr, nullptr, SOCK_CLOEXEC)};
+    if (!connection) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        return absl::ErrnoToStatus(errno, "accept4");
+      }
+      continue;
+    }
+    std::thread{ServeConnection, server, std::move(connection)}.detach();
+  }
+}
+
+}  // namespace comp_db_hook
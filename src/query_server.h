@@ -0,0 +1,85 @@
+#ifndef __COMP_DB_HOOK_QUERY_SERVER_H__
+#define __COMP_DB_HOOK_QUERY_SERVER_H__
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+#include "src/snapshot.h"
+
+namespace comp_db_hook {
+
+// Answers queries of the compilation database from its snapshot, which is reloaded when the
+// database changes.
+//
+// The served snapshot is immutable and published through an atomically swapped `shared_ptr`, in a
+// read-copy-update fashion: readers grab the current one without taking any locks and keep using it
+// for the whole query, while a reload builds the new one on the side and swaps it in. The old
+// snapshot is released when its last reader is done, so queries never wait for a reload. Snapshots
+// are renamed over rather than overwritten, so the mapping of an old one remains valid.
+class QueryServer {
+ public:
+  explicit QueryServer(std::string workspace_directory, std::string snapshot_path)
+      : workspace_directory_(std::move(workspace_directory)),
+        snapshot_path_(std::move(snapshot_path)) {}
+
+  ~QueryServer() = default;
+
+  QueryServer(QueryServer const&) = delete;
+  QueryServer& operator=(QueryServer const&) = delete;
+  QueryServer(QueryServer&&) = delete;
+  QueryServer& operator=(QueryServer&&) = delete;
+
+  // Loads the snapshot of the current version of the database and publishes it. Does nothing if the
+  // database hasn't changed since the last reload. The snapshot is loaded and validated under a
+  // shared lock of the database, and only rebuilt under an exclusive one if it's stale or corrupt.
+  // Never waits for readers. Must not be called concurrently.
+  absl::Status Reload();
+
+  // Answers a request, which is a line of the form `file PATH` or `prefix DIR` (see `Query`).
+  // Relative paths are resolved against the workspace directory. The answer is a single line with
+  // the matching entries as a compact JSON array, or starting with `error: ` if the request is
+  // malformed.
+  std::string Answer(std::string_view request) const;
+
+ private:
+  // Identifies a version of the database file, see `Reload`.
+  struct DatabaseVersion {
+    ino_t inode = 0;
+    off_t size = 0;
+    timespec mtime{};
+
+    bool operator==(DatabaseVersion const& other) const {
+      return inode == other.inode && size == other.size && mtime.tv_sec == other.mtime.tv_sec &&
+             mtime.tv_nsec == other.mtime.tv_nsec;
+    }
+  };
+
+  static absl::StatusOr<DatabaseVersion> GetDatabaseVersion(tsdb2::io::FD const& fd);
+
+  std::shared_ptr<Snapshot const> snapshot() const { return std::atomic_load(&snapshot_); }
+
+  std::string const workspace_directory_;
+  std::string const snapshot_path_;
+
+  // The version of the database that `snapshot_` was loaded for. Only accessed by `Reload`.
+  DatabaseVersion version_;
+
+  // Only accessed through `std::atomic_load` and `std::atomic_store`.
+  std::shared_ptr<Snapshot const> snapshot_;
+};
+
+// Implements `comp_db_hook serve`: serves queries on the `.compile_commands.json.socket` Unix
+// socket in the workspace directory, one request per line (see `QueryServer::Answer`), watching the
+// database with inotify to reload it when it changes. Only returns on error.
+absl::Status RunQueryServer();
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_QUERY_SERVER_H__
@@ -0,0 +1,164 @@
+#include "src/query_server.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+
+namespace {
+
+using ::comp_db_hook::kArgumentsField;
+using ::comp_db_hook::kFileField;
+using ::comp_db_hook::QueryServer;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Optional;
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kDatabase =
+    "[\n"
+    "  {\"arguments\": [\"clang\", \"-c\", \"a.cc\"], \"file\": \"a.cc\"},\n"
+    "  {\"file\": \"dir/b.cc\"},\n"
+    "  {\"file\": \"dir-x/c.cc\"},\n"
+    "  {\"directory\": \"/abs\", \"file\": \"d.cc\"}\n"
+    "]\n";
+
+// Returns the `file` fields of the entries of an answer, which must be a JSON array.
+std::vector<std::string> GetFiles(std::string_view const answer) {
+  EXPECT_TRUE(absl::StartsWith(answer, "[")) << answer;
+  std::vector<std::string> files;
+  for (auto const& entry : comp_db_hook::SalvageCommandEntries(answer)) {
+    files.push_back(entry.get<kFileField>().value_or(""));
+  }
+  return files;
+}
+
+class QueryServerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/query_server_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    database_path_ = absl::StrCat(directory_, "/compile_commands.json");
+    snapshot_path_ = absl::StrCat(directory_, "/.compile_commands.json.snapshot");
+    WriteDatabase(kDatabase);
+  }
+
+  void TearDown() override {
+    ::unlink(database_path_.c_str());
+    ::unlink(snapshot_path_.c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  void WriteDatabase(std::string_view const contents) const {
+    FD const fd{::open(database_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    ASSERT_TRUE(fd);
+    ASSERT_TRUE(comp_db_hook::WriteAll(fd, contents).ok());
+  }
+
+  std::string directory_;
+  std::string database_path_;
+  std::string snapshot_path_;
+};
+
+TEST_F(QueryServerTest, FileRequest) {
+  QueryServer server{directory_, snapshot_path_};
+  ASSERT_TRUE(server.Reload().ok());
+  EXPECT_THAT(GetFiles(server.Answer("file a.cc")), ElementsAre("a.cc"));
+  EXPECT_THAT(GetFiles(server.Answer(absl::StrCat("file ", directory_, "/a.cc"))),
+              ElementsAre("a.cc"));
+  EXPECT_THAT(GetFiles(server.Answer("file dir/../a.cc")), ElementsAre("a.cc"));
+  EXPECT_THAT(GetFiles(server.Answer("file /abs/d.cc")), ElementsAre("d.cc"));
+  EXPECT_THAT(GetFiles(server.Answer("  file dir/b.cc \r")), ElementsAre("dir/b.cc"));
+  EXPECT_THAT(GetFiles(server.Answer("file dir")), IsEmpty());
+  EXPECT_THAT(GetFiles(server.Answer("file missing.cc")), IsEmpty());
+}
+
+TEST_F(QueryServerTest, PrefixRequest) {
+  QueryServer server{directory_, snapshot_path_};
+  ASSERT_TRUE(server.Reload().ok());
+  EXPECT_THAT(GetFiles(server.Answer("prefix dir")), ElementsAre("dir/b.cc"));
+  EXPECT_THAT(GetFiles(server.Answer("prefix dir/")), ElementsAre("dir/b.cc"));
+  EXPECT_THAT(GetFiles(server.Answer("prefix .")), ElementsAre("a.cc", "dir-x/c.cc", "dir/b.cc"));
+  EXPECT_THAT(GetFiles(server.Answer("prefix /abs")), ElementsAre("d.cc"));
+  EXPECT_THAT(GetFiles(server.Answer("prefix /nowhere")), IsEmpty());
+}
+
+TEST_F(QueryServerTest, AnswerHasArguments) {
+  QueryServer server{directory_, snapshot_path_};
+  ASSERT_TRUE(server.Reload().ok());
+  auto const answer = server.Answer("file a.cc");
+  EXPECT_EQ(answer.find('\n'), std::string::npos) << answer;
+  auto const entries = comp_db_hook::SalvageCommandEntries(answer);
+  ASSERT_EQ(entries.size(), 1);
+  EXPECT_THAT(entries[0].get<kArgumentsField>(), Optional(ElementsAre("clang", "-c", "a.cc")));
+}
+
+TEST_F(QueryServerTest, MalformedRequests) {
+  QueryServer server{directory_, snapshot_path_};
+  ASSERT_TRUE(server.Reload().ok());
+  EXPECT_EQ(server.Answer(""), "error: unknown request");
+  EXPECT_EQ(server.Answer("a.cc"), "error: unknown request");
+  EXPECT_EQ(server.Answer("files a.cc"), "error: unknown request");
+  EXPECT_EQ(server.Answer("FILE a.cc"), "error: unknown request");
+  EXPECT_EQ(server.Answer("file\ta.cc"), "error: unknown request");
+  // The trailing space of a request without a path is stripped along with the rest of the
+  // whitespace, so there's no request left to recognize.
+  EXPECT_EQ(server.Answer("file "), "error: unknown request");
+  EXPECT_EQ(server.Answer("prefix  "), "error: unknown request");
+}
+
+TEST_F(QueryServerTest, ReloadBuildsMissingSnapshot) {
+  ASSERT_FALSE(comp_db_hook::Exists(snapshot_path_));
+  QueryServer server{directory_, snapshot_path_};
+  ASSERT_TRUE(server.Reload().ok());
+  EXPECT_TRUE(comp_db_hook::Exists(snapshot_path_));
+}
+
+TEST_F(QueryServerTest, ReloadSkipsUnchangedDatabase) {
+  QueryServer server{directory_, snapshot_path_};
+  ASSERT_TRUE(server.Reload().ok());
+  // Nothing is loaded, let alone rebuilt, while the database stays the same, and the snapshot that
+  // was loaded keeps being served.
+  ASSERT_EQ(::unlink(snapshot_path_.c_str()), 0);
+  ASSERT_TRUE(server.Reload().ok());
+  EXPECT_FALSE(comp_db_hook::Exists(snapshot_path_));
+  EXPECT_THAT(GetFiles(server.Answer("file a.cc")), ElementsAre("a.cc"));
+}
+
+TEST_F(QueryServerTest, ReloadAfterDatabaseChange) {
+  QueryServer server{directory_, snapshot_path_};
+  ASSERT_TRUE(server.Reload().ok());
+  WriteDatabase("[\n  {\"file\": \"e.cc\"}\n]\n");
+  ASSERT_TRUE(server.Reload().ok());
+  EXPECT_THAT(GetFiles(server.Answer("file a.cc")), IsEmpty());
+  EXPECT_THAT(GetFiles(server.Answer("file e.cc")), ElementsAre("e.cc"));
+}
+
+TEST_F(QueryServerTest, ReloadAfterModificationTimeChange) {
+  QueryServer server{directory_, snapshot_path_};
+  ASSERT_TRUE(server.Reload().ok());
+  // Same inode and size, only the modification time tells the versions apart.
+  struct stat stat {};
+  ASSERT_EQ(::stat(database_path_.c_str(), &stat), 0);
+  struct timespec times[2] = {stat.st_atim, stat.st_mtim};
+  ++times[1].tv_sec;
+  ASSERT_EQ(::utimensat(AT_FDCWD, database_path_.c_str(), times, 0), 0);
+  ASSERT_EQ(::unlink(snapshot_path_.c_str()), 0);
+  ASSERT_TRUE(server.Reload().ok());
+  EXPECT_TRUE(comp_db_hook::Exists(snapshot_path_));
+  EXPECT_THAT(GetFiles(server.Answer("file a.cc")), ElementsAre("a.cc"));
+}
+
+}  // namespace
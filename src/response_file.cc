@@ -0,0 +1,153 @@
+#include "src/response_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "src/mapped_file.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+bool IsWhitespace(char const ch) {
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\v' || ch == '\f';
+}
+
+// Returns the directory part of `path` including the trailing slash, or an empty string if `path`
+// has no directory part.
+std::string_view GetDirectory(std::string_view const path) {
+  auto const slash = path.rfind('/');
+  if (slash == std::string_view::npos) {
+    return std::string_view();
+  } else {
+    return path.substr(0, slash + 1);
+  }
+}
+
+}  // namespace
+
+std::vector<std::string> TokenizeResponseFile(std::string_view const contents) {
+  std::vector<std::string> tokens;
+  std::string token;
+  // Distinguishes an empty quoted argument from no argument at all.
+  bool in_token = false;
+  size_t const size = contents.size();
+  for (size_t i = 0; i < size; ++i) {
+    char const ch = contents[i];
+    if (ch == '\\' && i + 1 < size) {
+      token.push_back(contents[++i]);
+      in_token = true;
+    } else if (ch == '\'' || ch == '"') {
+      in_token = true;
+      for (++i; i < size && contents[i] != ch; ++i) {
+        if (contents[i] == '\\' && i + 1 < size) {
+          ++i;
+        }
+        token.push_back(contents[i]);
+      }
+    } else if (IsWhitespace(ch)) {
+      if (in_token) {
+        tokens.emplace_back(std::move(token));
+        token.clear();
+        in_token = false;
+      }
+    } else {
+      token.push_back(ch);
+      in_token = true;
+    }
+  }
+  if (in_token) {
+    tokens.emplace_back(std::move(token));
+  }
+  return tokens;
+}
+
+absl::StatusOr<ResponseFileExpander::CachedFile const*> ResponseFileExpander::ReadFile(
+    std::string const& path) {
+  FD const fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  auto const it = cache_.find(path);
+  if (it != cache_.end()) {
+    auto const& cached = it->second;
+    if (cached.device == stat.st_dev && cached.inode == stat.st_ino &&
+        cached.size == stat.st_size && cached.mtime.tv_sec == stat.st_mtim.tv_sec &&
+        cached.mtime.tv_nsec == stat.st_mtim.tv_nsec) {
+      return &cached;
+    }
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  auto& cached = cache_[path];
+  cached.device = stat.st_dev;
+  cached.inode = stat.st_ino;
+  cached.size = stat.st_size;
+  cached.mtime = stat.st_mtim;
+  cached.tokens = TokenizeResponseFile(mapping.contents());
+  return &cached;
+}
+
+void ResponseFileExpander::ExpandInto(absl::Span<std::string const> const args,
+                                      std::string_view const directory,
+                                      std::vector<std::string>* const result) {
+  for (auto const& arg : args) {
+    if (arg.size() < 2 || arg.front() != '@' || stack_.size() >= kMaxDepth) {
+      result->emplace_back(arg);
+      continue;
+    }
+    std::string_view const name = std::string_view(arg).substr(1);
+    std::string const path =
+        name.front() == '/' ? std::string(name) : absl::StrCat(directory, name);
+    auto const status_or_file = ReadFile(path);
+    if (!status_or_file.ok()) {
+      LOG(WARNING) << "Cannot read response file " << path << ": " << status_or_file.status();
+      result->emplace_back(arg);
+      continue;
+    }
+    auto const& file = *status_or_file.value();
+    std::pair<dev_t, ino_t> const id{file.device, file.inode};
+    if (std::find(stack_.begin(), stack_.end(), id) != stack_.end()) {
+      LOG(WARNING) << "Response file " << path << " includes itself.";
+      result->emplace_back(arg);
+      continue;
+    }
+    // NOTE: we need to copy the tokens because the nested expansion may rehash `cache_`.
+    std::vector<std::string> const tokens = file.tokens;
+    stack_.push_back(id);
+    ExpandInto(tokens, GetDirectory(path), result);
+    stack_.pop_back();
+  }
+}
+
+std::vector<std::string> ResponseFileExpander::Expand(absl::Span<std::string const> const args) {
+  std::vector<std::string> result;
+  result.reserve(args.size());
+  if (!args.empty()) {
+    result.emplace_back(args.front());
+    ExpandInto(args.subspan(1), /*directory=*/"", &result);
+  }
+  return result;
+}
+
+}  // namespace comp_db_hook
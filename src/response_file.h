@@ -0,0 +1,80 @@
+#ifndef __COMP_DB_HOOK_RESPONSE_FILE_H__
+#define __COMP_DB_HOOK_RESPONSE_FILE_H__
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+namespace comp_db_hook {
+
+// Splits the contents of a response file into arguments using the GNU rules, which are shared by
+// GCC and Clang on non-Windows hosts:
+//
+//   * arguments are separated by whitespace;
+//   * single and double quotes group characters, including whitespace, into the current argument;
+//   * a backslash escapes the next character, both inside and outside quotes.
+//
+// Unlike Clang's tokenizer, an empty quoted string (`''` or `""`) results in an empty argument.
+std::vector<std::string> TokenizeResponseFile(std::string_view contents);
+
+// Expands `@file` arguments recursively, replacing them with the arguments read from the
+// corresponding files. Relative paths on the command line are resolved against the current working
+// directory, while relative paths in a response file are resolved against the directory of that
+// file like Clang does. As with the compiler driver, an `@file` argument referring to a file that
+// can't be read is kept as-is.
+//
+// Each response file is read through a single `mmap` and its tokens are cached for the lifetime of
+// the expander. A cached file is re-read only if its size, modification time, or inode changed.
+class ResponseFileExpander {
+ public:
+  // Maximum nesting depth of response files. Deeper references, as well as cyclic ones, are kept
+  // as-is.
+  static size_t constexpr kMaxDepth = 32;
+
+  explicit ResponseFileExpander() = default;
+  ~ResponseFileExpander() = default;
+
+  ResponseFileExpander(ResponseFileExpander&&) noexcept = default;
+  ResponseFileExpander& operator=(ResponseFileExpander&&) noexcept = default;
+  ResponseFileExpander(ResponseFileExpander const&) = delete;
+  ResponseFileExpander& operator=(ResponseFileExpander const&) = delete;
+
+  // Returns `args` with all response files expanded. `args[0]` is the compiler name and is never
+  // expanded.
+  std::vector<std::string> Expand(absl::Span<std::string const> args);
+
+ private:
+  struct CachedFile {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    timespec mtime;
+    std::vector<std::string> tokens;
+  };
+
+  // Reads and tokenizes the response file at `path`, or returns the cached entry.
+  absl::StatusOr<CachedFile const*> ReadFile(std::string const& path);
+
+  // Expands `args` into `result`. `directory` is the directory of the response file containing
+  // `args`, including the trailing slash, and is empty for the command line.
+  void ExpandInto(absl::Span<std::string const> args, std::string_view directory,
+                  std::vector<std::string>* result);
+
+  absl::flat_hash_map<std::string, CachedFile> cache_;
+
+  // Inodes of the response files being expanded, used to detect cycles.
+  std::vector<std::pair<dev_t, ino_t>> stack_;
+};
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_RESPONSE_FILE_H__
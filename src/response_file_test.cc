@@ -0,0 +1,155 @@
+#include "src/response_file.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::ResponseFileExpander;
+using ::comp_db_hook::TokenizeResponseFile;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+struct TokenizeTestCase {
+  std::string_view contents;
+  std::vector<std::string> tokens;
+};
+
+TEST(TokenizeResponseFileTest, Tokenize) {
+  TokenizeTestCase const test_cases[] = {
+      {"", {}},
+      {" \t\n ", {}},
+      {"-c foo.cc", {"-c", "foo.cc"}},
+      {"  -c\n\tfoo.cc\r\n", {"-c", "foo.cc"}},
+      {"'a b' c", {"a b", "c"}},
+      {"\"a b\" c", {"a b", "c"}},
+      {"a'b c'd", {"ab cd"}},
+      {"'a \"b\" c'", {"a \"b\" c"}},
+      {"a\\ b", {"a b"}},
+      {"\"a\\\"b\"", {"a\"b"}},
+      {"'a\\'b'", {"a'b"}},
+      {"a\\\\b", {"a\\b"}},
+      {"'' \"\"", {"", ""}},
+      {"-DFOO=\"bar baz\"", {"-DFOO=bar baz"}},
+      {"'unterminated quote", {"unterminated quote"}},
+      {"trailing\\", {"trailing\\"}},
+  };
+  for (auto const& test_case : test_cases) {
+    EXPECT_EQ(TokenizeResponseFile(test_case.contents), test_case.tokens) << test_case.contents;
+  }
+}
+
+class ResponseFileExpanderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/response_file_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+  }
+
+  void TearDown() override {
+    for (auto const& path : files_) {
+      ::unlink(path.c_str());
+    }
+    for (auto it = directories_.rbegin(); it != directories_.rend(); ++it) {
+      ::rmdir(it->c_str());
+    }
+    ::rmdir(directory_.c_str());
+  }
+
+  std::string MakeDirectory(std::string_view const name) {
+    auto path = absl::StrCat(directory_, "/", name);
+    EXPECT_EQ(::mkdir(path.c_str(), 0755), 0);
+    directories_.push_back(path);
+    return path;
+  }
+
+  std::string WriteFile(std::string_view const name, std::string_view const contents) {
+    auto path = absl::StrCat(directory_, "/", name);
+    int const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(::write(fd, contents.data(), contents.size()), contents.size());
+    ::close(fd);
+    files_.push_back(path);
+    return path;
+  }
+
+  std::string directory_;
+  std::vector<std::string> directories_;
+  std::vector<std::string> files_;
+  ResponseFileExpander expander_;
+};
+
+TEST_F(ResponseFileExpanderTest, Empty) { EXPECT_THAT(expander_.Expand({}), IsEmpty()); }
+
+TEST_F(ResponseFileExpanderTest, NoResponseFiles) {
+  std::vector<std::string> const args{"clang++", "-c", "foo.cc", "@"};
+  EXPECT_EQ(expander_.Expand(args), args);
+}
+
+TEST_F(ResponseFileExpanderTest, CompilerNameIsNotExpanded) {
+  auto const path = WriteFile("args", "-c");
+  std::vector<std::string> const args{absl::StrCat("@", path)};
+  EXPECT_EQ(expander_.Expand(args), args);
+}
+
+TEST_F(ResponseFileExpanderTest, Expand) {
+  auto const path = WriteFile("args", "-c 'foo bar.cc'\n-o foo.o\n");
+  EXPECT_THAT(expander_.Expand({"clang++", "-Wall", absl::StrCat("@", path), "-O2"}),
+              ElementsAre("clang++", "-Wall", "-c", "foo bar.cc", "-o", "foo.o", "-O2"));
+}
+
+TEST_F(ResponseFileExpanderTest, MissingFileIsKept) {
+  auto const arg = absl::StrCat("@", directory_, "/missing");
+  EXPECT_THAT(expander_.Expand({"clang++", arg}), ElementsAre("clang++", arg));
+}
+
+TEST_F(ResponseFileExpanderTest, NestedAbsolutePath) {
+  auto const inner = WriteFile("inner", "-c foo.cc");
+  auto const outer = WriteFile("outer", absl::StrCat("-Wall @", inner));
+  EXPECT_THAT(expander_.Expand({"clang++", absl::StrCat("@", outer)}),
+              ElementsAre("clang++", "-Wall", "-c", "foo.cc"));
+}
+
+TEST_F(ResponseFileExpanderTest, NestedRelativePathIsRelativeToIncludingFile) {
+  MakeDirectory("a");
+  MakeDirectory("a/b");
+  WriteFile("a/b/inner", "-c foo.cc");
+  auto const outer = WriteFile("a/outer", "-Wall @b/inner");
+  EXPECT_THAT(expander_.Expand({"clang++", absl::StrCat("@", outer)}),
+              ElementsAre("clang++", "-Wall", "-c", "foo.cc"));
+}
+
+TEST_F(ResponseFileExpanderTest, DeeplyNestedRelativePaths) {
+  MakeDirectory("a");
+  MakeDirectory("a/b");
+  WriteFile("a/b/innermost", "-c foo.cc");
+  WriteFile("a/b/inner", "-O2 @innermost");
+  auto const outer = WriteFile("a/outer", "-Wall @b/inner");
+  EXPECT_THAT(expander_.Expand({"clang++", absl::StrCat("@", outer)}),
+              ElementsAre("clang++", "-Wall", "-O2", "-c", "foo.cc"));
+}
+
+TEST_F(ResponseFileExpanderTest, Cycle) {
+  auto const path = WriteFile("args", "-c @args");
+  EXPECT_THAT(expander_.Expand({"clang++", absl::StrCat("@", path)}),
+              ElementsAre("clang++", "-c", "@args"));
+}
+
+TEST_F(ResponseFileExpanderTest, ModifiedFileIsReRead) {
+  auto const path = WriteFile("args", "-c");
+  auto const arg = absl::StrCat("@", path);
+  EXPECT_THAT(expander_.Expand({"clang++", arg}), ElementsAre("clang++", "-c"));
+  WriteFile("args", "-S -o foo.s");
+  EXPECT_THAT(expander_.Expand({"clang++", arg}), ElementsAre("clang++", "-S", "-o", "foo.s"));
+}
+
+}  // namespace
@@ -0,0 +1,356 @@
+#include "src/shards.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "common/utilities.h"
+#include "io/advisory_file_lock.h"
+#include "io/fd.h"
+#include "src/background_task.h"
+#include "src/change_log.h"
+#include "src/command_database.h"
+#include "src/config.h"
+#include "src/entry_writer.h"
+#include "src/file_io.h"
+#include "src/snapshot.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::ExclusiveFileLock;
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kShardsEnvVar = "COMP_DB_HOOK_SHARDS";
+std::string_view constexpr kConcatDelayEnvVar = "COMP_DB_HOOK_CONCAT_DELAY";
+
+int64_t constexpr kDefaultConcatDelay = 2;
+
+// What `EntryWriter` writes between two entries.
+std::string_view constexpr kEntrySeparator = ",\n  ";
+
+absl::Status MakeDirectory(std::string const& path) {
+  if (::mkdir(path.c_str(), /*mode=*/0775) < 0 && errno != EEXIST) {
+    return absl::ErrnoToStatus(errno, "mkdir");
+  }
+  return absl::OkStatus();
+}
+
+std::string GetShardsRoot(std::string_view const workspace_directory) {
+  return GetSidecarFilePath(workspace_directory, "shards");
+}
+
+std::string GetShardPath(std::string_view const root, size_t const shard) {
+  return JoinPath(root, absl::StrCat(shard));
+}
+
+// Returns the number of shard directories to consider: `num_shards`, or more if there are leftovers
+// of a larger number of shards.
+size_t CountShards(std::string_view const root, size_t const num_shards) {
+  size_t count = num_shards;
+  while (Exists(GetShardPath(root, count))) {
+    ++count;
+  }
+  return count;
+}
+
+// Tells whether `snapshot` has an entry for the source file at `path`.
+absl::StatusOr<bool> Contains(Snapshot const& snapshot, std::string_view const path) {
+  DEFINE_CONST_OR_RETURN(rank, snapshot.LowerBound(path));
+  if (rank >= snapshot.size()) {
+    return false;
+  }
+  DEFINE_CONST_OR_RETURN(entry, snapshot.GetSorted(rank));
+  return entry.path() == path;
+}
+
+// Tells whether the database at `fd` contains `kEntrySeparator` at `offset`, i.e. whether the entry
+// ending there is directly followed by the next one.
+absl::StatusOr<bool> IsSeparatorAt(FD const& fd, uint64_t const offset) {
+  char buffer[kEntrySeparator.size()];
+  ssize_t result;
+  do {
+    result = ::pread(fd.get(), buffer, sizeof(buffer), offset);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0) {
+    return absl::ErrnoToStatus(errno, "pread");
+  }
+  return std::string_view(buffer, result) == kEntrySeparator;
+}
+
+// Returns the last modification time of the shard databases, or 0 if there are none.
+time_t GetLastShardChange(std::string_view const workspace_directory, size_t const num_shards) {
+  time_t last_change = 0;
+  for (auto const& directory : GetShardDirectories(workspace_directory, num_shards)) {
+    struct stat stat {};
+    if (::stat(GetCommandFilePath(directory).c_str(), &stat) == 0) {
+      last_change = std::max(last_change, stat.st_mtime);
+    }
+  }
+  return last_change;
+}
+
+// Splits the workspace database at `fd` into `num_shards` shards under `root`. The shards are
+// written to a temporary directory that is renamed into place, so that hooks never see them
+// partially seeded. The caller must hold the lock of the workspace database.
+absl::Status SeedShards(FD const& fd, std::string_view const workspace_directory,
+                        std::string const& root, size_t const num_shards) {
+  DEFINE_CONST_OR_RETURN(snapshot,
+                         LoadOrBuildSnapshot(GetSidecarFilePath(workspace_directory, "snapshot"),
+                                             fd, workspace_directory, /*validate=*/true));
+  std::string temp_root = absl::StrCat(root, ".XXXXXX");
+  if (::mkdtemp(temp_root.data()) == nullptr) {
+    return absl::ErrnoToStatus(errno, "mkdtemp");
+  }
+  if (::chmod(temp_root.c_str(), /*mode=*/0775) < 0) {
+    return absl::ErrnoToStatus(errno, "chmod");
+  }
+  std::vector<FD> shard_fds;
+  shard_fds.reserve(num_shards);
+  std::vector<EntryWriter> writers;
+  writers.reserve(num_shards);
+  for (size_t i = 0; i < num_shards; ++i) {
+    auto const directory = GetShardPath(temp_root, i);
+    RETURN_IF_ERROR(MakeDirectory(directory));
+    DEFINE_VAR_OR_RETURN(shard_fd, OpenCommandFile(directory));
+    DEFINE_VAR_OR_RETURN(writer, EntryWriter::Create(GetSidecarFilePath(directory, "tmp"),
+                                                     /*prefix_size=*/0));
+    shard_fds.emplace_back(std::move(shard_fd));
+    writers.emplace_back(std::move(writer));
+  }
+  for (size_t i = 0; i < snapshot.size(); ++i) {
+    DEFINE_CONST_OR_RETURN(entry, snapshot.GetEntry(i));
+    auto const path = entry.path();
+    auto const span = entry.span();
+    auto& writer = writers[path.empty() ? 0 : GetShardIndex(path, num_shards)];
+    RETURN_IF_ERROR(writer.CopyEntries(fd, span.offset, span.end()));
+  }
+  for (size_t i = 0; i < num_shards; ++i) {
+    RETURN_IF_ERROR(writers[i].CopyTo(shard_fds[i]));
+  }
+  if (::rename(temp_root.c_str(), root.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rename");
+  }
+  LOG(INFO) << "Split " << snapshot.size() << " entries of compile_commands.json into "
+            << num_shards << " shards.";
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+size_t GetNumShards() {
+  if (IsStagingEnabled()) {
+    return 0;
+  }
+  auto const num_shards = GetIntEnv(kShardsEnvVar, /*default_value=*/0);
+  return num_shards > 1 ? num_shards : 0;
+}
+
+size_t GetShardIndex(std::string_view const path, size_t const num_shards) {
+  return FingerprintPath(path) % num_shards;
+}
+
+absl::StatusOr<std::string> GetShardDirectory(std::string_view const workspace_directory,
+                                              size_t const shard, size_t const num_shards) {
+  auto const root = GetShardsRoot(workspace_directory);
+  if (!Exists(root)) {
+    DEFINE_CONST_OR_RETURN(fd, OpenCommandFile(workspace_directory));
+    DEFINE_OR_RETURN(lock, ExclusiveFileLock::Acquire(fd));
+    // Check again, another process may have seeded the shards while we waited for the lock.
+    if (!Exists(root)) {
+      RETURN_IF_ERROR(SeedShards(fd, workspace_directory, root, num_shards));
+    }
+  }
+  auto path = GetShardPath(root, shard);
+  RETURN_IF_ERROR(MakeDirectory(path));
+  return path;
+}
+
+std::vector<std::string> GetShardDirectories(std::string_view const workspace_directory,
+                                             size_t const num_shards) {
+  auto const root = GetShardsRoot(workspace_directory);
+  size_t const count = CountShards(root, num_shards);
+  std::vector<std::string> directories;
+  directories.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    auto path = GetShardPath(root, i);
+    if (Exists(path)) {
+      directories.emplace_back(std::move(path));
+    }
+  }
+  return directories;
+}
+
+absl::StatusOr<FD> OpenBuildTrackingFile(std::string_view const workspace_directory) {
+  auto const path = GetSidecarFilePath(workspace_directory, "build");
+  FD fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      path.c_str(), /*flags=*/O_RDWR | O_CREAT | O_CLOEXEC, /*mode=*/0664)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  return std::move(fd);
+}
+
+absl::StatusOr<size_t> ConcatenateShards(FD const& fd, std::string_view const workspace_directory,
+                                         size_t const num_shards) {
+  auto const root = GetShardsRoot(workspace_directory);
+  if (!Exists(root)) {
+    // Never concatenate shards that don't exist yet over the workspace database, split it first.
+    RETURN_IF_ERROR(SeedShards(fd, workspace_directory, root, num_shards));
+  }
+  size_t const count = CountShards(root, num_shards);
+  // Hooks wait for the lock of their own shard only, so each shard is locked in turn and only while
+  // its snapshot is loaded or its entries are copied, and at most one shard lock is held at a time.
+  // Snapshots are committed by renaming them into place, so a loaded one stays readable after the
+  // lock is released. The snapshots of all the shards are loaded upfront (which is O(1) unless they
+  // are stale) because the misplaced entries of a shard are checked against their own shard.
+  std::vector<Snapshot> snapshots;
+  snapshots.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    auto const directory = GetShardPath(root, i);
+    RETURN_IF_ERROR(MakeDirectory(directory));
+    DEFINE_CONST_OR_RETURN(shard_fd, OpenCommandFile(directory));
+    DEFINE_OR_RETURN(lock, ExclusiveFileLock::Acquire(shard_fd));
+    DEFINE_VAR_OR_RETURN(snapshot,
+                         LoadOrBuildSnapshot(GetSidecarFilePath(directory, "snapshot"), shard_fd,
+                                             workspace_directory, /*validate=*/true));
+    snapshots.emplace_back(std::move(snapshot));
+  }
+  DEFINE_VAR_OR_RETURN(
+      writer, EntryWriter::Create(GetSidecarFilePath(workspace_directory, "tmp"),
+                                  /*prefix_size=*/0));
+  std::optional<SnapshotWriter> snapshot_writer;
+  auto const snapshot_path = GetSnapshotPath(workspace_directory);
+  if (!snapshot_path.empty()) {
+    DEFINE_VAR_OR_RETURN(new_snapshot_writer, SnapshotWriter::Create(snapshot_path));
+    snapshot_writer.emplace(std::move(new_snapshot_writer));
+  }
+  absl::flat_hash_set<std::string_view> misplaced_paths;
+  size_t num_entries = 0;
+  for (size_t i = 0; i < count; ++i) {
+    auto const directory = GetShardPath(root, i);
+    DEFINE_CONST_OR_RETURN(shard_fd, OpenCommandFile(directory));
+    DEFINE_OR_RETURN(lock, ExclusiveFileLock::Acquire(shard_fd));
+    // The shard may have changed since its snapshot was loaded above.
+    DEFINE_VAR_OR_RETURN(new_snapshot,
+                         LoadOrBuildSnapshot(GetSidecarFilePath(directory, "snapshot"), shard_fd,
+                                             workspace_directory, /*validate=*/true));
+    snapshots[i] = std::move(new_snapshot);
+    auto const& snapshot = snapshots[i];
+    // Runs of adjacent entries [run_begin, end) are copied at once.
+    size_t run_begin = 0;
+    auto const copy_run = [&](size_t const end) -> absl::Status {
+      if (run_begin == end) {
+        return absl::OkStatus();
+      }
+      DEFINE_CONST_OR_RETURN(first_entry, snapshot.GetEntry(run_begin));
+      DEFINE_CONST_OR_RETURN(last_entry, snapshot.GetEntry(end - 1));
+      uint64_t const begin_offset = first_entry.span().offset;
+      uint64_t const end_offset = last_entry.span().end();
+      RETURN_IF_ERROR(writer.CopyEntries(shard_fd, begin_offset, end_offset));
+      num_entries += end - run_begin;
+      if (!snapshot_writer.has_value()) {
+        return absl::OkStatus();
+      }
+      uint64_t const run_offset = writer.position() - (end_offset - begin_offset);
+      for (size_t j = run_begin; j < end; ++j) {
+        DEFINE_CONST_OR_RETURN(entry, snapshot.GetEntry(j));
+        RETURN_IF_ERROR(
+            snapshot_writer->Add(run_offset + (entry.span().offset - begin_offset), entry));
+      }
+      return absl::OkStatus();
+    };
+    for (size_t j = 0; j < snapshot.size(); ++j) {
+      DEFINE_CONST_OR_RETURN(entry, snapshot.GetEntry(j));
+      auto const path = entry.path();
+      bool keep = true;
+      if (!path.empty()) {
+        size_t const shard = GetShardIndex(path, num_shards);
+        if (shard != i) {
+          DEFINE_CONST_OR_RETURN(in_own_shard, Contains(snapshots[shard], path));
+          keep = !in_own_shard && misplaced_paths.insert(path).second;
+        }
+      }
+      bool adjacent = j == run_begin;
+      if (!adjacent) {
+        DEFINE_CONST_OR_RETURN(previous_entry, snapshot.GetEntry(j - 1));
+        auto const previous_end = previous_entry.span().end();
+        if (entry.span().offset == previous_end + kEntrySeparator.size()) {
+          // The snapshot only records the spans of the entries, not what lies between them.
+          DEFINE_CONST_OR_RETURN(separated, IsSeparatorAt(shard_fd, previous_end));
+          adjacent = separated;
+        }
+      }
+      if (!keep || !adjacent) {
+        RETURN_IF_ERROR(copy_run(j));
+        run_begin = keep ? j : j + 1;
+      }
+    }
+    RETURN_IF_ERROR(copy_run(snapshot.size()));
+  }
+  RETURN_IF_ERROR(writer.CopyTo(fd));
+  if (snapshot_writer.has_value()) {
+    RETURN_IF_ERROR(snapshot_writer->Commit(fd));
+  }
+  // The changes of the shards aren't carried over, so consumers of the workspace database have to
+  // start over.
+  RETURN_IF_ERROR(ResetChanges(GetSidecarFilePath(workspace_directory, "generation"),
+                               GetSidecarFilePath(workspace_directory, "changes"))
+                      .status());
+  return num_entries;
+}
+
+absl::StatusOr<size_t> ConcatenateShards(std::string_view const workspace_directory,
+                                         size_t const num_shards) {
+  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile(workspace_directory));
+  DEFINE_OR_RETURN(lock, ExclusiveFileLock::Acquire(fd));
+  return ConcatenateShards(fd, workspace_directory, num_shards);
+}
+
+void ScheduleConcatenation(std::string_view const workspace_directory, size_t const num_shards) {
+  auto const delay = GetIntEnv(kConcatDelayEnvVar, kDefaultConcatDelay);
+  if (delay < 0) {
+    return;
+  }
+  auto const pending_path = GetSidecarFilePath(workspace_directory, "concat");
+  // Concatenations are serialized by the lock of the workspace database.
+  if (!ClaimPendingTask(pending_path, delay)) {
+    return;
+  }
+  bool const started = RunDetached([&] {
+    while (true) {
+      auto const idle_time = ::time(nullptr) - GetLastShardChange(workspace_directory, num_shards);
+      if (idle_time >= delay) {
+        break;
+      }
+      ::utimensat(AT_FDCWD, pending_path.c_str(), nullptr, 0);
+      ::sleep(delay - idle_time);
+    }
+    // Changes committed from now on schedule another concatenation.
+    ::unlink(pending_path.c_str());
+    return ConcatenateShards(workspace_directory, num_shards).ok() ? 0 : 1;
+  });
+  if (!started) {
+    ::unlink(pending_path.c_str());
+  }
+}
+
+}  // namespace comp_db_hook
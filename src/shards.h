@@ -0,0 +1,73 @@
+#ifndef __COMP_DB_HOOK_SHARDS_H__
+#define __COMP_DB_HOOK_SHARDS_H__
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+
+namespace comp_db_hook {
+
+// Sharded storage of the workspace database. When the `COMP_DB_HOOK_SHARDS` environment variable is
+// set to N > 1 the hook doesn't update `compile_commands.json` directly: the entries are stored in
+// N shard databases, each in a directory of its own under `.compile_commands.json.shards`, and
+// every source file goes to the shard selected by the hash of its path. Each shard has its own
+// lock, so hook processes compiling files of different shards commit in parallel.
+//
+// `compile_commands.json` is then assembled by concatenating the shards, which copies their text
+// verbatim without parsing anything. The concatenation runs in a background process a short while
+// after the last change (see `ScheduleConcatenation`) or on demand with `comp_db_hook concat`.
+//
+// Returns the number of shards, or 0 if the database isn't sharded. Sharding is disabled when the
+// database is staged in memory (see `StageDatabase`), which makes commits cheap already.
+size_t GetNumShards();
+
+// Returns the shard of the source file at `path`, a lexically normalized absolute path. The hash is
+// stable across processes and builds of comp_db_hook.
+size_t GetShardIndex(std::string_view path, size_t num_shards);
+
+// Returns the directory of the database of shard `shard`, creating it if needed. The first time the
+// workspace database is sharded the shards are seeded with its entries.
+absl::StatusOr<std::string> GetShardDirectory(std::string_view workspace_directory, size_t shard,
+                                              size_t num_shards);
+
+// Returns the directories of the existing shards. These may be more than `num_shards` if the number
+// of shards was reduced.
+std::vector<std::string> GetShardDirectories(std::string_view workspace_directory,
+                                             size_t num_shards);
+
+// Opens the file whose lock protects the build generation and the last-seen log of a sharded
+// database (see `RecordLastSeen`), which aren't protected by the lock of any shard.
+absl::StatusOr<tsdb2::io::FD> OpenBuildTrackingFile(std::string_view workspace_directory);
+
+// Replaces the content of the workspace database at `fd` with the concatenation of the shards and
+// returns the number of entries. The caller must hold the lock of the workspace database; the locks
+// of the shards are acquired here one at a time, each only while the entries of its shard are
+// copied, so hooks committing to the other shards aren't held up. A change committed to a shard
+// after it was copied is left out, but it schedules another concatenation.
+//
+// The entries of a file may be found in a shard other than its own if the number of shards changed
+// since they were recorded. Such entries are only kept if the shard of the file doesn't have one,
+// so they're superseded as soon as the file is compiled again.
+absl::StatusOr<size_t> ConcatenateShards(tsdb2::io::FD const& fd,
+                                         std::string_view workspace_directory, size_t num_shards);
+
+// Locks the workspace database and concatenates the shards into it.
+absl::StatusOr<size_t> ConcatenateShards(std::string_view workspace_directory, size_t num_shards);
+
+// Debounced concatenation: starts a detached background process that waits until no shard has
+// changed for `COMP_DB_HOOK_CONCAT_DELAY` seconds (2 by default) and then concatenates the shards,
+// unless one is already pending. A negative delay disables the automatic concatenation.
+//
+// The pending concatenation is marked by the `.compile_commands.json.concat` file, which the
+// background process removes right before acquiring the locks, so changes committed after that
+// schedule a new one and are never left out.
+void ScheduleConcatenation(std::string_view workspace_directory, size_t num_shards);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_SHARDS_H__
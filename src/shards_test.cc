@@ -0,0 +1,342 @@
+#include "src/shards.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+#include "src/snapshot.h"
+
+namespace {
+
+using ::comp_db_hook::ConcatenateShards;
+using ::comp_db_hook::GetCommandFilePath;
+using ::comp_db_hook::GetNumShards;
+using ::comp_db_hook::GetShardDirectories;
+using ::comp_db_hook::GetShardDirectory;
+using ::comp_db_hook::GetShardIndex;
+using ::comp_db_hook::GetSidecarFilePath;
+using ::comp_db_hook::kArgumentsField;
+using ::comp_db_hook::kFileField;
+using ::comp_db_hook::Snapshot;
+using ::testing::ElementsAreArray;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAreArray;
+using ::tsdb2::io::FD;
+
+size_t constexpr kNumFiles = 20;
+
+std::string GetFile(size_t const index) { return absl::StrCat("f", index, ".cc"); }
+
+// Returns the shard of `file`, whose entries all have `/w` as their directory.
+size_t ShardOf(std::string_view const file, size_t const num_shards) {
+  return GetShardIndex(absl::StrCat("/w/", file), num_shards);
+}
+
+// Returns the text of an entry for `file` whose last argument is `version`, so that tests can tell
+// which of several entries of the same file won.
+std::string MakeEntry(std::string_view const file, int const version) {
+  return absl::StrCat("{\"directory\": \"/w\", \"arguments\": [\"clang\", \"-DV=", version,
+                      "\"], \"file\": \"", file, "\"}");
+}
+
+// Returns the description of an entry as returned by `ReadEntries`.
+std::string Describe(std::string_view const file, int const version) {
+  return absl::StrCat(file, " -DV=", version);
+}
+
+// Formats a database like `EntryWriter` does.
+std::string MakeDatabase(std::vector<std::string> const& entries) {
+  if (entries.empty()) {
+    return "[]\n";
+  }
+  return absl::StrCat("[\n  ", absl::StrJoin(entries, ",\n  "), "\n]\n");
+}
+
+void WriteFile(std::string const& path, std::string_view const contents) {
+  FD const fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+  ASSERT_TRUE(fd);
+  ASSERT_TRUE(comp_db_hook::WriteAll(fd, contents).ok());
+}
+
+std::string ReadFile(std::string const& path) {
+  auto status_or_contents = comp_db_hook::ReadFile(path);
+  EXPECT_TRUE(status_or_contents.ok()) << status_or_contents.status();
+  return std::move(status_or_contents).value_or(std::nullopt).value_or("<missing>");
+}
+
+// Returns the entries of the database in `directory` as "<file> <last argument>" strings.
+std::vector<std::string> ReadEntries(std::string_view const directory) {
+  std::vector<std::string> descriptions;
+  for (auto const& entry :
+       comp_db_hook::SalvageCommandEntries(ReadFile(GetCommandFilePath(directory)))) {
+    auto const& arguments = entry.get<kArgumentsField>();
+    descriptions.push_back(absl::StrCat(
+        entry.get<kFileField>().value_or(""), " ",
+        arguments.has_value() && !arguments->empty() ? arguments->back() : std::string()));
+  }
+  return descriptions;
+}
+
+int RemoveFile(char const* const path, struct stat const* /*stat*/, int /*type*/,
+               struct FTW* /*ftw*/) {
+  return ::remove(path);
+}
+
+class ShardsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ::unsetenv("COMP_DB_HOOK_STAGING_DIR");
+    ::unsetenv("COMP_DB_HOOK_SNAPSHOT");
+    workspace_directory_ = absl::StrCat(::testing::TempDir(), "/shards_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(workspace_directory_.data()), nullptr);
+  }
+
+  void TearDown() override {
+    ::nftw(workspace_directory_.c_str(), RemoveFile, /*nopenfd=*/16, FTW_DEPTH | FTW_PHYS);
+  }
+
+  // Writes a workspace database with an entry for each of the first `kNumFiles` files.
+  void WriteWorkspaceDatabase() const {
+    std::vector<std::string> entries;
+    for (size_t i = 0; i < kNumFiles; ++i) {
+      entries.push_back(MakeEntry(GetFile(i), 1));
+    }
+    WriteFile(GetCommandFilePath(workspace_directory_), MakeDatabase(entries));
+  }
+
+  // Returns the directory of `shard`, seeding the shards if needed.
+  std::string ShardDirectory(size_t const shard, size_t const num_shards) const {
+    auto status_or_directory = GetShardDirectory(workspace_directory_, shard, num_shards);
+    EXPECT_TRUE(status_or_directory.ok()) << status_or_directory.status();
+    return std::move(status_or_directory).value_or("<missing>");
+  }
+
+  size_t Concatenate(size_t const num_shards) const {
+    auto const status_or_num_entries = ConcatenateShards(workspace_directory_, num_shards);
+    EXPECT_TRUE(status_or_num_entries.ok()) << status_or_num_entries.status();
+    return status_or_num_entries.value_or(0);
+  }
+
+  // Checks that the snapshot of the workspace database locates the text of each entry.
+  void CheckSnapshot() const {
+    auto const contents = ReadFile(GetCommandFilePath(workspace_directory_));
+    auto const status_or_fd = comp_db_hook::OpenCommandFile(workspace_directory_);
+    ASSERT_TRUE(status_or_fd.ok()) << status_or_fd.status();
+    auto const status_or_snapshot =
+        Snapshot::Load(GetSidecarFilePath(workspace_directory_, "snapshot"), status_or_fd.value());
+    ASSERT_TRUE(status_or_snapshot.ok()) << status_or_snapshot.status();
+    ASSERT_TRUE(status_or_snapshot->has_value());
+    auto const& snapshot = status_or_snapshot->value();
+    EXPECT_TRUE(snapshot.Validate().ok());
+    auto const entries = comp_db_hook::SalvageCommandEntries(contents);
+    ASSERT_EQ(snapshot.size(), entries.size());
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+      auto const status_or_entry = snapshot.GetEntry(i);
+      ASSERT_TRUE(status_or_entry.ok()) << status_or_entry.status();
+      auto const span = status_or_entry->span();
+      ASSERT_LE(span.end(), contents.size());
+      auto const text = contents.substr(span.offset, span.size);
+      auto const file = entries[i].get<kFileField>().value_or("");
+      EXPECT_EQ(status_or_entry->file(), file);
+      EXPECT_EQ(text.front(), '{') << text;
+      EXPECT_EQ(text.back(), '}') << text;
+      EXPECT_NE(text.find(absl::StrCat("\"file\": \"", file, "\"")), std::string::npos) << text;
+    }
+  }
+
+  std::string workspace_directory_;
+};
+
+TEST_F(ShardsTest, GetNumShards) {
+  ::unsetenv("COMP_DB_HOOK_SHARDS");
+  EXPECT_EQ(GetNumShards(), 0);
+  ::setenv("COMP_DB_HOOK_SHARDS", "1", /*overwrite=*/1);
+  EXPECT_EQ(GetNumShards(), 0);
+  ::setenv("COMP_DB_HOOK_SHARDS", "4", /*overwrite=*/1);
+  EXPECT_EQ(GetNumShards(), 4);
+  // Staged databases aren't sharded.
+  ::setenv("COMP_DB_HOOK_STAGING_DIR", "/dev/shm", /*overwrite=*/1);
+  EXPECT_EQ(GetNumShards(), 0);
+  ::unsetenv("COMP_DB_HOOK_STAGING_DIR");
+  ::unsetenv("COMP_DB_HOOK_SHARDS");
+}
+
+TEST_F(ShardsTest, SeedOnFirstUse) {
+  WriteWorkspaceDatabase();
+  size_t constexpr kNumShards = 3;
+  ShardDirectory(1, kNumShards);
+  auto const directories = GetShardDirectories(workspace_directory_, kNumShards);
+  ASSERT_EQ(directories.size(), kNumShards);
+  for (size_t shard = 0; shard < kNumShards; ++shard) {
+    std::vector<std::string> expected;
+    for (size_t i = 0; i < kNumFiles; ++i) {
+      if (ShardOf(GetFile(i), kNumShards) == shard) {
+        expected.push_back(Describe(GetFile(i), 1));
+      }
+    }
+    EXPECT_THAT(ReadEntries(directories[shard]), ElementsAreArray(expected)) << shard;
+  }
+  // The shards are only seeded once.
+  WriteFile(GetCommandFilePath(workspace_directory_), "[]\n");
+  auto const directory = ShardDirectory(0, kNumShards);
+  EXPECT_EQ(directory, directories[0]);
+  EXPECT_EQ(ReadEntries(directory).size() + ReadEntries(directories[1]).size() +
+                ReadEntries(directories[2]).size(),
+            kNumFiles);
+}
+
+TEST_F(ShardsTest, SeedEmptyDatabase) {
+  ShardDirectory(0, 2);
+  auto const directories = GetShardDirectories(workspace_directory_, 2);
+  ASSERT_EQ(directories.size(), 2);
+  EXPECT_THAT(ReadEntries(directories[0]), IsEmpty());
+  EXPECT_THAT(ReadEntries(directories[1]), IsEmpty());
+  EXPECT_EQ(Concatenate(2), 0);
+  EXPECT_EQ(ReadFile(GetCommandFilePath(workspace_directory_)), "[]\n");
+}
+
+TEST_F(ShardsTest, RoundTrip) {
+  WriteWorkspaceDatabase();
+  size_t constexpr kNumShards = 3;
+  // Update the shard of the first file only.
+  size_t const updated_shard = ShardOf(GetFile(0), kNumShards);
+  std::vector<std::string> updated_entries;
+  for (size_t i = 0; i < kNumFiles; ++i) {
+    if (ShardOf(GetFile(i), kNumShards) == updated_shard) {
+      updated_entries.push_back(MakeEntry(GetFile(i), i == 0 ? 2 : 1));
+    }
+  }
+  WriteFile(GetCommandFilePath(ShardDirectory(updated_shard, kNumShards)),
+            MakeDatabase(updated_entries));
+  EXPECT_EQ(Concatenate(kNumShards), kNumFiles);
+  // The shards are concatenated in order.
+  std::vector<std::string> expected;
+  for (size_t shard = 0; shard < kNumShards; ++shard) {
+    for (size_t i = 0; i < kNumFiles; ++i) {
+      if (ShardOf(GetFile(i), kNumShards) == shard) {
+        expected.push_back(Describe(GetFile(i), i == 0 ? 2 : 1));
+      }
+    }
+  }
+  EXPECT_THAT(ReadEntries(workspace_directory_), ElementsAreArray(expected));
+  CheckSnapshot();
+  // Concatenating again yields the same database.
+  auto const contents = ReadFile(GetCommandFilePath(workspace_directory_));
+  EXPECT_EQ(Concatenate(kNumShards), kNumFiles);
+  EXPECT_EQ(ReadFile(GetCommandFilePath(workspace_directory_)), contents);
+  CheckSnapshot();
+}
+
+TEST_F(ShardsTest, NonAdjacentEntries) {
+  WriteFile(GetCommandFilePath(workspace_directory_), "[]\n");
+  std::vector<std::string> files;
+  for (size_t i = 0; files.size() < 4; ++i) {
+    if (ShardOf(GetFile(i), 2) == 0) {
+      files.push_back(GetFile(i));
+    }
+  }
+  // The first two entries are as far apart as with the usual separator but separated by other
+  // bytes, and the second and third are separated by more than the usual separator. Neither pair
+  // must be copied as a run.
+  WriteFile(GetCommandFilePath(ShardDirectory(0, 2)),
+            absl::StrCat("[\n  ", MakeEntry(files[0], 1), ",\n\t ", MakeEntry(files[1], 1),
+                         ",\n\n  ", MakeEntry(files[2], 1), ",\n  ", MakeEntry(files[3], 1),
+                         "\n]\n"));
+  EXPECT_EQ(Concatenate(2), 4);
+  EXPECT_EQ(ReadFile(GetCommandFilePath(workspace_directory_)),
+            MakeDatabase({MakeEntry(files[0], 1), MakeEntry(files[1], 1), MakeEntry(files[2], 1),
+                          MakeEntry(files[3], 1)}));
+  CheckSnapshot();
+}
+
+TEST_F(ShardsTest, ShrinkWithMisplacedDuplicates) {
+  WriteWorkspaceDatabase();
+  ShardDirectory(0, 4);
+  // A file of shard 3 recompiled after the number of shards was reduced to 2, and a file recorded
+  // in both leftover shards.
+  std::string updated_file;
+  for (size_t i = 0; i < kNumFiles && updated_file.empty(); ++i) {
+    if (ShardOf(GetFile(i), 4) == 3) {
+      updated_file = GetFile(i);
+    }
+  }
+  ASSERT_FALSE(updated_file.empty());
+  std::string const duplicated_file = "dup.cc";
+  size_t const own_shard = ShardOf(updated_file, 2);
+  std::vector<std::string> own_texts;
+  for (size_t i = 0; i < kNumFiles; ++i) {
+    if (ShardOf(GetFile(i), 4) == own_shard) {
+      own_texts.push_back(MakeEntry(GetFile(i), 1));
+    }
+  }
+  own_texts.push_back(MakeEntry(updated_file, 2));
+  WriteFile(GetCommandFilePath(ShardDirectory(own_shard, 2)), MakeDatabase(own_texts));
+  for (size_t const shard : {2, 3}) {
+    std::vector<std::string> texts;
+    for (size_t i = 0; i < kNumFiles; ++i) {
+      if (ShardOf(GetFile(i), 4) == shard) {
+        texts.push_back(MakeEntry(GetFile(i), 1));
+      }
+    }
+    texts.push_back(MakeEntry(duplicated_file, shard == 2 ? 3 : 4));
+    WriteFile(GetCommandFilePath(ShardDirectory(shard, 4)), MakeDatabase(texts));
+  }
+  // The leftover shards are still found.
+  EXPECT_EQ(GetShardDirectories(workspace_directory_, 2).size(), 4);
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < kNumFiles; ++i) {
+    expected.push_back(Describe(GetFile(i), GetFile(i) == updated_file ? 2 : 1));
+  }
+  // The first misplaced entry of a file that isn't in its own shard wins.
+  expected.push_back(Describe(duplicated_file, 3));
+  EXPECT_EQ(Concatenate(2), kNumFiles + 1);
+  EXPECT_THAT(ReadEntries(workspace_directory_), UnorderedElementsAreArray(expected));
+  CheckSnapshot();
+}
+
+TEST_F(ShardsTest, GrowWithMisplacedEntries) {
+  WriteWorkspaceDatabase();
+  ShardDirectory(0, 2);
+  // All the entries whose shard changed are kept as long as their new shard doesn't have them.
+  EXPECT_EQ(Concatenate(4), kNumFiles);
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < kNumFiles; ++i) {
+    expected.push_back(Describe(GetFile(i), 1));
+  }
+  EXPECT_THAT(ReadEntries(workspace_directory_), UnorderedElementsAreArray(expected));
+  EXPECT_EQ(GetShardDirectories(workspace_directory_, 4).size(), 4);
+  // Then the file is compiled again and recorded in its new shard.
+  size_t updated_index = kNumFiles;
+  for (size_t i = 0; i < kNumFiles && updated_index == kNumFiles; ++i) {
+    if (ShardOf(GetFile(i), 4) >= 2) {
+      updated_index = i;
+    }
+  }
+  ASSERT_LT(updated_index, kNumFiles);
+  auto const updated_file = GetFile(updated_index);
+  WriteFile(GetCommandFilePath(ShardDirectory(ShardOf(updated_file, 4), 4)),
+            MakeDatabase({MakeEntry(updated_file, 2)}));
+  expected[updated_index] = Describe(updated_file, 2);
+  EXPECT_EQ(Concatenate(4), kNumFiles);
+  EXPECT_THAT(ReadEntries(workspace_directory_), UnorderedElementsAreArray(expected));
+  CheckSnapshot();
+}
+
+}  // namespace
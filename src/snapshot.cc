@@ -0,0 +1,541 @@
+#include "src/snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/crc/crc32c.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/command_database.h"
+#include "src/config.h"
+#include "src/entry_index.h"
+#include "src/entry_scanner.h"
+#include "src/file_io.h"
+#include "src/mapped_file.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+namespace json = ::tsdb2::json;
+
+std::string_view constexpr kSnapshotEnvVar = "COMP_DB_HOOK_SNAPSHOT";
+
+char constexpr kMagic[8] = {'C', 'D', 'B', 'S', 'N', 'A', 'P', '2'};
+
+// The snapshot file starts with this header and continues with the records of the entries, followed
+// by a table with the offset of each record and by a table with the positions of the entries sorted
+// by source file path, which allows looking entries up by path with a binary search.
+struct SnapshotHeader {
+  char magic[8];
+  uint64_t inode;
+  uint64_t database_size;
+  int64_t mtime_seconds;
+  int64_t mtime_nanoseconds;
+  uint32_t checksum;
+  uint32_t reserved;
+  uint64_t num_entries;
+  uint64_t table_offset;
+};
+
+// Each record starts with this header and continues with the size of each argument (as uint32_t)
+// and then the path, directory, file and arguments strings, padded to a multiple of 8 bytes.
+struct RecordHeader {
+  uint64_t text_offset;
+  uint64_t text_size;
+  uint32_t path_size;
+  uint32_t directory_size;
+  uint32_t file_size;
+  uint32_t num_arguments;
+  uint32_t flags;
+  uint32_t record_size;
+};
+
+uint32_t constexpr kHasDirectory = 1;
+uint32_t constexpr kHasArguments = 2;
+uint32_t constexpr kHasFile = 4;
+
+// Snapshot writes are flushed to the file whenever the buffer exceeds this size.
+size_t constexpr kBufferSize = 64 * 1024;
+
+// How much of the beginning and of the end of the database is checksummed.
+size_t constexpr kChecksumSampleSize = 64 * 1024;
+
+// How much of the database is scanned before releasing the memory of its mapping.
+size_t constexpr kReleaseInterval = 1 << 20;
+
+absl::Status ExtendChecksum(FD const& fd, off_t const offset, size_t const size,
+                            absl::crc32c_t* const checksum) {
+  std::string buffer(size, '\0');
+  size_t read = 0;
+  while (read < size) {
+    auto const result = ::pread(fd.get(), buffer.data() + read, size - read, offset + read);
+    if (result < 0) {
+      return absl::ErrnoToStatus(errno, "pread");
+    } else if (result == 0) {
+      return absl::DataLossError("unexpected end of file");
+    }
+    read += result;
+  }
+  *checksum = absl::ExtendCrc32c(*checksum, buffer);
+  return absl::OkStatus();
+}
+
+// Computes the checksum of the first and last `kChecksumSampleSize` bytes of a database of `size`
+// bytes. Together with the modification time this is enough to tell versions of the database apart
+// without reading all of it.
+absl::StatusOr<uint32_t> ComputeChecksum(FD const& fd, size_t const size) {
+  absl::crc32c_t checksum{0};
+  size_t const head_size = std::min(size, kChecksumSampleSize);
+  RETURN_IF_ERROR(ExtendChecksum(fd, 0, head_size, &checksum));
+  size_t const tail_size = std::min(size - head_size, kChecksumSampleSize);
+  RETURN_IF_ERROR(ExtendChecksum(fd, size - tail_size, tail_size, &checksum));
+  return static_cast<uint32_t>(checksum);
+}
+
+absl::StatusOr<SnapshotHeader> MakeHeader(FD const& fd, uint64_t const num_entries,
+                                          uint64_t const table_offset) {
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  SnapshotHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.inode = stat.st_ino;
+  header.database_size = stat.st_size;
+  header.mtime_seconds = stat.st_mtim.tv_sec;
+  header.mtime_nanoseconds = stat.st_mtim.tv_nsec;
+  DEFINE_CONST_OR_RETURN(checksum, ComputeChecksum(fd, stat.st_size));
+  header.checksum = checksum;
+  header.num_entries = num_entries;
+  header.table_offset = table_offset;
+  return header;
+}
+
+void AppendString(std::optional<std::string> const& value, std::string* const record) {
+  if (value.has_value()) {
+    record->append(*value);
+  }
+}
+
+// Tells whether the record at `offset` of the snapshot `contents` lies within the records section,
+// which ends at `table_offset`, whether its strings fit in it, and whether its text lies within a
+// database of `database_size` bytes.
+bool IsValidRecord(std::string_view const contents, uint64_t const offset,
+                   uint64_t const table_offset, uint64_t const database_size) {
+  if (offset < sizeof(SnapshotHeader) || offset > table_offset ||
+      table_offset - offset < sizeof(RecordHeader)) {
+    return false;
+  }
+  RecordHeader header{};
+  std::memcpy(&header, contents.data() + offset, sizeof(header));
+  if (header.record_size > table_offset - offset || header.text_offset > database_size ||
+      header.text_size > database_size - header.text_offset) {
+    return false;
+  }
+  // None of the terms can overflow, they're all 32-bit values widened to 64 bits.
+  uint64_t size = sizeof(RecordHeader) + uint64_t{header.num_arguments} * sizeof(uint32_t) +
+                  header.path_size + header.directory_size + header.file_size;
+  if (size > header.record_size) {
+    return false;
+  }
+  char const* const sizes = contents.data() + offset + sizeof(header);
+  for (size_t i = 0; i < header.num_arguments; ++i) {
+    uint32_t argument_size = 0;
+    std::memcpy(&argument_size, sizes + i * sizeof(uint32_t), sizeof(argument_size));
+    size += argument_size;
+    if (size > header.record_size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+EntrySpan Snapshot::Entry::span() const {
+  RecordHeader header{};
+  std::memcpy(&header, record_, sizeof(header));
+  return EntrySpan{.offset = header.text_offset, .size = header.text_size};
+}
+
+std::string_view Snapshot::Entry::path() const {
+  RecordHeader header{};
+  std::memcpy(&header, record_, sizeof(header));
+  char const* const strings = record_ + sizeof(header) + header.num_arguments * sizeof(uint32_t);
+  return {strings, header.path_size};
+}
+
+std::optional<std::string_view> Snapshot::Entry::directory() const {
+  RecordHeader header{};
+  std::memcpy(&header, record_, sizeof(header));
+  if ((header.flags & kHasDirectory) == 0) {
+    return std::nullopt;
+  }
+  char const* const strings = record_ + sizeof(header) + header.num_arguments * sizeof(uint32_t);
+  return std::string_view(strings + header.path_size, header.directory_size);
+}
+
+std::optional<std::string_view> Snapshot::Entry::file() const {
+  RecordHeader header{};
+  std::memcpy(&header, record_, sizeof(header));
+  if ((header.flags & kHasFile) == 0) {
+    return std::nullopt;
+  }
+  char const* const strings = record_ + sizeof(header) + header.num_arguments * sizeof(uint32_t);
+  return std::string_view(strings + header.path_size + header.directory_size, header.file_size);
+}
+
+CommandEntry Snapshot::Entry::ToCommandEntry() const {
+  RecordHeader header{};
+  std::memcpy(&header, record_, sizeof(header));
+  std::optional<std::vector<std::string>> arguments;
+  if ((header.flags & kHasArguments) != 0) {
+    arguments.emplace();
+    arguments->reserve(header.num_arguments);
+    char const* const sizes = record_ + sizeof(header);
+    char const* next = sizes + header.num_arguments * sizeof(uint32_t) + header.path_size +
+                       header.directory_size + header.file_size;
+    for (size_t i = 0; i < header.num_arguments; ++i) {
+      uint32_t size = 0;
+      std::memcpy(&size, sizes + i * sizeof(uint32_t), sizeof(size));
+      arguments->emplace_back(next, size);
+      next += size;
+    }
+  }
+  auto const maybe_directory = directory();
+  auto const maybe_file = file();
+  // NOLINTBEGIN(bugprone-argument-comment)
+  return CommandEntry{
+      json::kInitialize,
+      /*directory=*/maybe_directory.has_value() ? std::make_optional(std::string(*maybe_directory))
+                                                : std::nullopt,
+      /*arguments=*/std::move(arguments),
+      /*file=*/maybe_file.has_value() ? std::make_optional(std::string(*maybe_file)) : std::nullopt,
+  };
+  // NOLINTEND(bugprone-argument-comment)
+}
+
+std::string_view Snapshot::Entry::record() const {
+  RecordHeader header{};
+  std::memcpy(&header, record_, sizeof(header));
+  return {record_, header.record_size};
+}
+
+absl::StatusOr<std::optional<Snapshot>> Snapshot::Load(std::string const& path, FD const& fd) {
+  FD const snapshot_fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!snapshot_fd) {
+    if (errno == ENOENT) {
+      return std::nullopt;
+    } else {
+      return absl::ErrnoToStatus(errno, "open");
+    }
+  }
+  struct stat snapshot_stat {};
+  if (::fstat(snapshot_fd.get(), &snapshot_stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  if (static_cast<size_t>(snapshot_stat.st_size) < sizeof(SnapshotHeader)) {
+    return std::nullopt;
+  }
+  SnapshotHeader header{};
+  auto const num_read = ::pread(snapshot_fd.get(), &header, sizeof(header), 0);
+  if (num_read < 0) {
+    return absl::ErrnoToStatus(errno, "pread");
+  } else if (num_read != sizeof(header)) {
+    // Truncated since the `fstat`.
+    return std::nullopt;
+  }
+  // The size check is written so that it can't overflow with corrupt counts.
+  uint64_t const snapshot_size = snapshot_stat.st_size;
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.table_offset < sizeof(SnapshotHeader) || header.table_offset > snapshot_size ||
+      header.num_entries > (snapshot_size - header.table_offset) / (2 * sizeof(uint64_t)) ||
+      snapshot_size != header.table_offset + 2 * header.num_entries * sizeof(uint64_t)) {
+    return std::nullopt;
+  }
+  // Compare the cheap fields first so that the checksum is only computed for a likely match.
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  if (header.inode != stat.st_ino || header.database_size != stat.st_size ||
+      header.mtime_seconds != stat.st_mtim.tv_sec ||
+      header.mtime_nanoseconds != stat.st_mtim.tv_nsec) {
+    return std::nullopt;
+  }
+  DEFINE_CONST_OR_RETURN(expected, MakeHeader(fd, header.num_entries, header.table_offset));
+  if (std::memcmp(&header, &expected, sizeof(header)) != 0) {
+    return std::nullopt;
+  }
+  DEFINE_VAR_OR_RETURN(mapping, MappedFile::Map(snapshot_fd, snapshot_stat.st_size));
+  return Snapshot(std::move(mapping), header.num_entries, header.table_offset,
+                  header.database_size);
+}
+
+absl::StatusOr<Snapshot::Entry> Snapshot::GetEntry(size_t const index) const {
+  uint64_t offset = 0;
+  std::memcpy(&offset, mapping_.contents().data() + table_offset_ + index * sizeof(uint64_t),
+              sizeof(offset));
+  if (!IsValidRecord(mapping_.contents(), offset, table_offset_, database_size_)) {
+    return absl::DataLossError(absl::StrCat("the snapshot record of entry ", index, " is corrupt"));
+  }
+  return Entry(mapping_.contents().data() + offset);
+}
+
+absl::StatusOr<Snapshot::Entry> Snapshot::GetSorted(size_t const rank) const {
+  DEFINE_CONST_OR_RETURN(index, GetSortedIndex(rank));
+  return GetEntry(index);
+}
+
+absl::StatusOr<size_t> Snapshot::LowerBound(std::string_view const path) const {
+  size_t begin = 0;
+  size_t end = size_;
+  while (begin < end) {
+    size_t const middle = begin + (end - begin) / 2;
+    DEFINE_CONST_OR_RETURN(entry, GetSorted(middle));
+    if (entry.path() < path) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return begin;
+}
+
+absl::Status Snapshot::Validate() const {
+  for (size_t i = 0; i < size_; ++i) {
+    RETURN_IF_ERROR(GetEntry(i).status());
+    RETURN_IF_ERROR(GetSortedIndex(i).status());
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<size_t> Snapshot::GetSortedIndex(size_t const rank) const {
+  uint64_t index = 0;
+  std::memcpy(&index,
+              mapping_.contents().data() + table_offset_ + (size_ + rank) * sizeof(uint64_t),
+              sizeof(index));
+  if (index >= size_) {
+    return absl::DataLossError(absl::StrCat("the snapshot position of rank ", rank, " is corrupt"));
+  }
+  return index;
+}
+
+absl::StatusOr<SnapshotWriter> SnapshotWriter::Create(std::string path) {
+  auto temp_path = absl::StrCat(path, ".tmp");
+  FD fd{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      temp_path.c_str(), /*flags=*/O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, /*mode=*/0664)};
+  if (!fd) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  SnapshotWriter writer{std::move(path), std::move(temp_path), std::move(fd)};
+  // The header is written last, when the database has been written.
+  writer.buffer_.assign(sizeof(SnapshotHeader), '\0');
+  writer.offset_ = sizeof(SnapshotHeader);
+  return std::move(writer);
+}
+
+absl::Status SnapshotWriter::Add(EntrySpan const span, std::string_view const path,
+                                 CommandEntry const& entry) {
+  auto const& maybe_directory = entry.get<kDirectoryField>();
+  auto const& maybe_arguments = entry.get<kArgumentsField>();
+  auto const& maybe_file = entry.get<kFileField>();
+  RecordHeader header{
+      .text_offset = span.offset,
+      .text_size = span.size,
+      .path_size = static_cast<uint32_t>(path.size()),
+      .directory_size = static_cast<uint32_t>(maybe_directory.value_or("").size()),
+      .file_size = static_cast<uint32_t>(maybe_file.value_or("").size()),
+      .num_arguments = static_cast<uint32_t>(maybe_arguments.has_value() ? maybe_arguments->size()
+                                                                         : 0),
+      .flags = 0,
+      .record_size = 0,
+  };
+  if (maybe_directory.has_value()) {
+    header.flags |= kHasDirectory;
+  }
+  if (maybe_arguments.has_value()) {
+    header.flags |= kHasArguments;
+  }
+  if (maybe_file.has_value()) {
+    header.flags |= kHasFile;
+  }
+  std::string record(sizeof(header), '\0');
+  if (maybe_arguments.has_value()) {
+    for (auto const& argument : *maybe_arguments) {
+      auto const size = static_cast<uint32_t>(argument.size());
+      record.append(reinterpret_cast<char const*>(&size), sizeof(size));
+    }
+  }
+  record.append(path);
+  AppendString(maybe_directory, &record);
+  AppendString(maybe_file, &record);
+  if (maybe_arguments.has_value()) {
+    for (auto const& argument : *maybe_arguments) {
+      record.append(argument);
+    }
+  }
+  // Keep records 8-byte aligned.
+  record.resize((record.size() + 7) / 8 * 8, '\0');
+  header.record_size = record.size();
+  std::memcpy(record.data(), &header, sizeof(header));
+  return AddRecord(record);
+}
+
+absl::Status SnapshotWriter::Add(uint64_t const offset, Snapshot::Entry const& entry) {
+  std::string record{entry.record()};
+  RecordHeader header{};
+  std::memcpy(&header, record.data(), sizeof(header));
+  header.text_offset = offset;
+  std::memcpy(record.data(), &header, sizeof(header));
+  return AddRecord(record);
+}
+
+absl::Status SnapshotWriter::Commit(FD const& fd) {
+  uint64_t const table_offset = offset_;
+  buffer_.append(reinterpret_cast<char const*>(table_.data()), table_.size() * sizeof(uint64_t));
+  RETURN_IF_ERROR(Flush());
+  DEFINE_CONST_OR_RETURN(order, SortByPath());
+  buffer_.append(reinterpret_cast<char const*>(order.data()), order.size() * sizeof(uint64_t));
+  RETURN_IF_ERROR(Flush());
+  DEFINE_CONST_OR_RETURN(header, MakeHeader(fd, table_.size(), table_offset));
+  if (::pwrite(fd_.get(), &header, sizeof(header), 0) != sizeof(header)) {
+    return absl::ErrnoToStatus(errno, "pwrite");
+  }
+  if (::rename(temp_path_.c_str(), path_.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rename");
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<uint64_t>> SnapshotWriter::SortByPath() const {
+  std::vector<uint64_t> order(table_.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (table_.empty()) {
+    return order;
+  }
+  // The records have been written, so their paths are read back from the file rather than kept in
+  // memory all along.
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd_, offset_));
+  auto const get_path = [&](uint64_t const index) {
+    return Snapshot::Entry(mapping.contents().data() + table_[index]).path();
+  };
+  bool sorted = true;
+  for (size_t i = 1; i < order.size() && sorted; ++i) {
+    sorted = !(get_path(i) < get_path(i - 1));
+  }
+  if (!sorted) {
+    std::stable_sort(order.begin(), order.end(), [&](uint64_t const lhs, uint64_t const rhs) {
+      return get_path(lhs) < get_path(rhs);
+    });
+  }
+  return order;
+}
+
+absl::Status SnapshotWriter::AddRecord(std::string_view const record) {
+  table_.push_back(offset_);
+  offset_ += record.size();
+  buffer_.append(record);
+  if (buffer_.size() < kBufferSize) {
+    return absl::OkStatus();
+  }
+  return Flush();
+}
+
+absl::Status SnapshotWriter::Flush() {
+  RETURN_IF_ERROR(WriteAll(fd_, buffer_));
+  buffer_.clear();
+  return absl::OkStatus();
+}
+
+absl::Status BuildSnapshot(std::string const& path, FD const& fd,
+                           std::string_view const default_directory) {
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  DEFINE_CONST_OR_RETURN(mapping, MappedFile::Map(fd, stat.st_size));
+  DEFINE_VAR_OR_RETURN(writer, SnapshotWriter::Create(path));
+  size_t released = 0;
+  EntryScanner scanner{mapping.contents()};
+  for (auto maybe_text = scanner.Next(); maybe_text.has_value(); maybe_text = scanner.Next()) {
+    if (scanner.entry_offset() - released >= kReleaseInterval) {
+      mapping.Release(released, scanner.entry_offset());
+      released = scanner.entry_offset();
+    }
+    auto const status_or_entry = json::Parse<CommandEntry>(maybe_text.value());
+    if (!status_or_entry.ok()) {
+      LOG(WARNING) << "Dropping malformed entry at offset " << scanner.entry_offset() << ": "
+                   << status_or_entry.status();
+      scanner.Resync();
+      continue;
+    }
+    RETURN_IF_ERROR(writer.Add(
+        EntrySpan{
+            .offset = scanner.entry_offset(),
+            .size = maybe_text->size(),
+        },
+        GetEntryPath(status_or_entry.value(), default_directory).value_or(""),
+        status_or_entry.value()));
+  }
+  return writer.Commit(fd);
+}
+
+absl::StatusOr<Snapshot> LoadOrBuildSnapshot(std::string const& path, FD const& fd,
+                                             std::string_view const default_directory,
+                                             bool const validate) {
+  DEFINE_VAR_OR_RETURN(maybe_snapshot, Snapshot::Load(path, fd));
+  if (maybe_snapshot.has_value()) {
+    if (!validate) {
+      return std::move(maybe_snapshot).value();
+    }
+    auto const status = maybe_snapshot->Validate();
+    if (status.ok()) {
+      return std::move(maybe_snapshot).value();
+    }
+    LOG(WARNING) << "Ignoring the corrupt snapshot " << path << ": " << status;
+  }
+  LOG(INFO) << "Building the snapshot of compile_commands.json.";
+  RETURN_IF_ERROR(BuildSnapshot(path, fd, default_directory));
+  DEFINE_VAR_OR_RETURN(rebuilt_snapshot, Snapshot::Load(path, fd));
+  if (!rebuilt_snapshot.has_value()) {
+    return absl::InternalError("failed to build the snapshot of compile_commands.json");
+  }
+  return std::move(rebuilt_snapshot).value();
+}
+
+absl::StatusOr<std::string> GetSnapshotPath() {
+  DEFINE_CONST_OR_RETURN(database_directory, GetDatabaseDirectory());
+  return GetSnapshotPath(database_directory);
+}
+
+std::string GetSnapshotPath(std::string_view const database_directory) {
+  if (!GetBoolEnv(kSnapshotEnvVar, /*default_value=*/true)) {
+    return std::string();
+  }
+  return GetSidecarFilePath(database_directory, "snapshot");
+}
+
+}  // namespace comp_db_hook
@@ -0,0 +1,185 @@
+#ifndef __COMP_DB_HOOK_SNAPSHOT_H__
+#define __COMP_DB_HOOK_SNAPSHOT_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/entry_index.h"
+#include "src/mapped_file.h"
+
+namespace comp_db_hook {
+
+// Binary snapshot of a parsed compilation database, stored in the `.compile_commands.json.snapshot`
+// sidecar file. It has a flat, offset-based layout that is used in place through a memory mapping,
+// so that reading the database doesn't require parsing its JSON text.
+//
+// For every entry the snapshot records the span of its text in the database, the path of its
+// source file as returned by `GetEntryPath`, and its fields. The snapshot is bound to a version of
+// the database through its inode, size, modification time and a CRC32C checksum of its first and
+// last 64 KiB, so that matching it costs O(1) rather than a read of the whole database. A snapshot
+// that doesn't match the database is stale and ignored.
+//
+// The snapshot also sorts the entries by source file path, so they can be looked up by path or by
+// directory without parsing anything even if the database itself isn't sorted.
+class Snapshot {
+ public:
+  // An entry of the snapshot. It refers to the mapping, so it's only valid as long as the snapshot.
+  class Entry {
+   public:
+    ~Entry() = default;
+
+    Entry(Entry const&) = default;
+    Entry& operator=(Entry const&) = default;
+    Entry(Entry&&) noexcept = default;
+    Entry& operator=(Entry&&) noexcept = default;
+
+    EntrySpan span() const;
+
+    // Normalized absolute path of the source file, or an empty string if the entry has no `file`
+    // field.
+    std::string_view path() const;
+
+    std::optional<std::string_view> directory() const;
+    std::optional<std::string_view> file() const;
+
+    // Materializes the entry. This is only needed to access its arguments.
+    CommandEntry ToCommandEntry() const;
+
+   private:
+    friend class Snapshot;
+    friend class SnapshotWriter;
+
+    explicit Entry(char const* const record) : record_(record) {}
+
+    std::string_view record() const;
+
+    char const* record_;
+  };
+
+  // Loads the snapshot at `path` if it matches the database at `fd`. Returns an empty optional if
+  // there's no snapshot or it's stale. This takes O(1) time: the records and tables of the
+  // snapshot are only checked when they're accessed, see `GetEntry`.
+  static absl::StatusOr<std::optional<Snapshot>> Load(std::string const& path,
+                                                      tsdb2::io::FD const& fd);
+
+  Snapshot() = default;
+  ~Snapshot() = default;
+
+  Snapshot(Snapshot&&) noexcept = default;
+  Snapshot& operator=(Snapshot&&) noexcept = default;
+  Snapshot(Snapshot const&) = delete;
+  Snapshot& operator=(Snapshot const&) = delete;
+
+  size_t size() const { return size_; }
+
+  // Returns the entry at position `index` in the order of the database. Fails with `DataLoss` if
+  // the snapshot is corrupt, i.e. if the record of the entry or its text span is out of range, so
+  // that a truncated or otherwise damaged snapshot is treated as stale rather than read out of
+  // range. Only the accessed record is checked, in time proportional to its number of arguments.
+  absl::StatusOr<Entry> GetEntry(size_t index) const;
+
+  // Returns the entry at position `rank` in the order of the source file paths. Entries without a
+  // `file` field come first. Fails with `DataLoss` if the snapshot is corrupt, like `GetEntry`.
+  absl::StatusOr<Entry> GetSorted(size_t rank) const;
+
+  // Returns the rank of the first entry whose source file path isn't less than `path`, or `size()`
+  // if there's none. Takes O(log N) path comparisons and parses nothing.
+  absl::StatusOr<size_t> LowerBound(std::string_view path) const;
+
+  // Checks all records and tables like accessing every entry would, in one pass over the record
+  // headers. Callers that go through all entries anyway can use this to treat a corrupt snapshot as
+  // stale up front rather than fail halfway.
+  absl::Status Validate() const;
+
+ private:
+  explicit Snapshot(MappedFile mapping, size_t const size, size_t const table_offset,
+                    uint64_t const database_size)
+      : mapping_(std::move(mapping)),
+        size_(size),
+        table_offset_(table_offset),
+        database_size_(database_size) {}
+
+  // Returns the position in the order of the database of the entry of rank `rank`.
+  absl::StatusOr<size_t> GetSortedIndex(size_t rank) const;
+
+  MappedFile mapping_;
+  size_t size_ = 0;
+  size_t table_offset_ = 0;
+  uint64_t database_size_ = 0;
+};
+
+// Writes a snapshot one entry at a time, usually along with the database. The snapshot is written
+// to a temporary file and renamed over the old one on `Commit`.
+class SnapshotWriter {
+ public:
+  static absl::StatusOr<SnapshotWriter> Create(std::string path);
+
+  ~SnapshotWriter() = default;
+
+  SnapshotWriter(SnapshotWriter&&) noexcept = default;
+  SnapshotWriter& operator=(SnapshotWriter&&) noexcept = default;
+  SnapshotWriter(SnapshotWriter const&) = delete;
+  SnapshotWriter& operator=(SnapshotWriter const&) = delete;
+
+  // Appends `entry`, whose text is at `span` of the database. `path` is the path of its source file
+  // as returned by `GetEntryPath`, or an empty string if it has none. Entries must be added in
+  // order.
+  absl::Status Add(EntrySpan span, std::string_view path, CommandEntry const& entry);
+
+  // Appends an entry of another snapshot whose text has moved to `offset`, without materializing
+  // it.
+  absl::Status Add(uint64_t offset, Snapshot::Entry const& entry);
+
+  // Finishes the snapshot, binding it to the database at `fd`, which must have been written.
+  absl::Status Commit(tsdb2::io::FD const& fd);
+
+ private:
+  explicit SnapshotWriter(std::string path, std::string temp_path, tsdb2::io::FD fd)
+      : path_(std::move(path)), temp_path_(std::move(temp_path)), fd_(std::move(fd)) {}
+
+  // Returns the positions of the written records sorted by source file path.
+  absl::StatusOr<std::vector<uint64_t>> SortByPath() const;
+
+  absl::Status AddRecord(std::string_view record);
+  absl::Status Flush();
+
+  std::string path_;
+  std::string temp_path_;
+  tsdb2::io::FD fd_;
+  std::string buffer_;
+  uint64_t offset_ = 0;
+  std::vector<uint64_t> table_;
+};
+
+// Builds the snapshot of the database at `fd` from scratch and writes it to `path`. Entries without
+// a `directory` field are resolved against `default_directory`.
+absl::Status BuildSnapshot(std::string const& path, tsdb2::io::FD const& fd,
+                           std::string_view default_directory);
+
+// Loads the snapshot at `path` like `Snapshot::Load`, but rebuilds it first with `BuildSnapshot` if
+// it's missing or stale. If `validate` is true a snapshot that fails `Snapshot::Validate` is
+// rebuilt too, which is worth it when all entries are about to be read. The caller must hold the
+// database lock.
+absl::StatusOr<Snapshot> LoadOrBuildSnapshot(std::string const& path, tsdb2::io::FD const& fd,
+                                             std::string_view default_directory, bool validate);
+
+// Returns the path of the snapshot of the database, or an empty string if snapshots are disabled by
+// the `COMP_DB_HOOK_SNAPSHOT` environment variable.
+absl::StatusOr<std::string> GetSnapshotPath();
+
+// Returns the path of the snapshot of the database in `database_directory`, or an empty string if
+// snapshots are disabled.
+std::string GetSnapshotPath(std::string_view database_directory);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_SNAPSHOT_H__
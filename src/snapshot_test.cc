@@ -0,0 +1,265 @@
+#include "src/snapshot.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/command_database.h"
+#include "src/entry_index.h"
+
+namespace {
+
+using ::comp_db_hook::CommandEntry;
+using ::comp_db_hook::EntrySpan;
+using ::comp_db_hook::kArgumentsField;
+using ::comp_db_hook::kDirectoryField;
+using ::comp_db_hook::kFileField;
+using ::comp_db_hook::Snapshot;
+using ::comp_db_hook::SnapshotWriter;
+using ::testing::ElementsAre;
+using ::testing::Optional;
+using ::tsdb2::io::FD;
+
+// Positions in the snapshot file format, see `SnapshotHeader` and `RecordHeader`.
+size_t constexpr kTableOffsetPosition = 56;
+size_t constexpr kRecordPathSizePosition = 16;
+
+// Returns the path of the entry of rank `rank` of `snapshot`, or "<corrupt>" if it can't be read.
+std::string GetSortedPath(Snapshot const& snapshot, size_t const rank) {
+  auto const status_or_entry = snapshot.GetSorted(rank);
+  if (!status_or_entry.ok()) {
+    return "<corrupt>";
+  }
+  return std::string(status_or_entry->path());
+}
+
+size_t LowerBound(Snapshot const& snapshot, std::string_view const path) {
+  auto const status_or_rank = snapshot.LowerBound(path);
+  EXPECT_TRUE(status_or_rank.ok()) << status_or_rank.status();
+  return status_or_rank.value_or(snapshot.size() + 1);
+}
+
+struct TestEntry {
+  std::string path;
+  std::string text;
+};
+
+class SnapshotTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = absl::StrCat(::testing::TempDir(), "/snapshot_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(directory_.data()), nullptr);
+    database_path_ = absl::StrCat(directory_, "/compile_commands.json");
+    snapshot_path_ = absl::StrCat(directory_, "/compile_commands.json.snapshot");
+  }
+
+  void TearDown() override {
+    ::unlink(database_path_.c_str());
+    ::unlink(snapshot_path_.c_str());
+    ::rmdir(directory_.c_str());
+  }
+
+  // Writes a database with `entries` and its snapshot.
+  void WriteDatabase(std::vector<TestEntry> const& entries) {
+    std::string contents = "[\n  ";
+    std::vector<EntrySpan> spans;
+    for (auto const& entry : entries) {
+      if (!spans.empty()) {
+        contents.append(",\n  ");
+      }
+      spans.push_back(EntrySpan{.offset = contents.size(), .size = entry.text.size()});
+      contents.append(entry.text);
+    }
+    contents.append("\n]\n");
+    fd_ = FD(::open(database_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    ASSERT_TRUE(fd_);
+    ASSERT_EQ(::write(fd_.get(), contents.data(), contents.size()), contents.size());
+    auto status_or_writer = SnapshotWriter::Create(snapshot_path_);
+    ASSERT_TRUE(status_or_writer.ok()) << status_or_writer.status();
+    for (size_t i = 0; i < entries.size(); ++i) {
+      CommandEntry const entry{
+          tsdb2::json::kInitialize,
+          /*directory=*/std::make_optional<std::string>("/workspace"),
+          /*arguments=*/std::make_optional<std::vector<std::string>>({"clang", "-c", "foo.cc"}),
+          /*file=*/std::make_optional(entries[i].path),
+      };
+      ASSERT_TRUE(status_or_writer->Add(spans[i], entries[i].path, entry).ok());
+    }
+    ASSERT_TRUE(status_or_writer->Commit(fd_).ok());
+  }
+
+  std::optional<Snapshot> Load() {
+    auto status_or_snapshot = Snapshot::Load(snapshot_path_, fd_);
+    EXPECT_TRUE(status_or_snapshot.ok()) << status_or_snapshot.status();
+    return std::move(status_or_snapshot).value_or(std::nullopt);
+  }
+
+  uint64_t ReadSnapshotWord(size_t const position) const {
+    FD const fd{::open(snapshot_path_.c_str(), O_RDONLY | O_CLOEXEC)};
+    uint64_t value = 0;
+    EXPECT_EQ(::pread(fd.get(), &value, sizeof(value), position), sizeof(value));
+    return value;
+  }
+
+  template <typename Value>
+  void OverwriteSnapshot(size_t const position, Value const value) const {
+    FD const fd{::open(snapshot_path_.c_str(), O_WRONLY | O_CLOEXEC)};
+    ASSERT_EQ(::pwrite(fd.get(), &value, sizeof(value), position), sizeof(value));
+  }
+
+  std::string directory_;
+  std::string database_path_;
+  std::string snapshot_path_;
+  FD fd_;
+};
+
+TEST_F(SnapshotTest, RoundTrip) {
+  WriteDatabase({
+      {"/workspace/b.cc", R"({"directory": "/workspace", "file": "b.cc"})"},
+      {"/workspace/a.cc", R"({"directory": "/workspace", "file": "a.cc"})"},
+      {"", R"({"directory": "/workspace"})"},
+  });
+  auto const snapshot = Load();
+  ASSERT_TRUE(snapshot.has_value());
+  ASSERT_EQ(snapshot->size(), 3);
+  EXPECT_TRUE(snapshot->Validate().ok());
+  auto const first = snapshot->GetEntry(0);
+  ASSERT_TRUE(first.ok()) << first.status();
+  EXPECT_EQ(first->path(), "/workspace/b.cc");
+  EXPECT_THAT(first->file(), Optional(std::string_view("/workspace/b.cc")));
+  EXPECT_THAT(first->directory(), Optional(std::string_view("/workspace")));
+  auto const second = snapshot->GetEntry(1);
+  ASSERT_TRUE(second.ok()) << second.status();
+  EXPECT_EQ(second->span().offset, first->span().end() + 4);
+  auto const entry = second->ToCommandEntry();
+  EXPECT_THAT(entry.get<kDirectoryField>(), Optional(std::string("/workspace")));
+  EXPECT_THAT(entry.get<kArgumentsField>(), Optional(ElementsAre("clang", "-c", "foo.cc")));
+  EXPECT_THAT(entry.get<kFileField>(), Optional(std::string("/workspace/a.cc")));
+  EXPECT_EQ(GetSortedPath(*snapshot, 0), "");
+  EXPECT_EQ(GetSortedPath(*snapshot, 1), "/workspace/a.cc");
+  EXPECT_EQ(GetSortedPath(*snapshot, 2), "/workspace/b.cc");
+  EXPECT_EQ(LowerBound(*snapshot, "/workspace/a.cc"), 1);
+  EXPECT_EQ(LowerBound(*snapshot, "/workspace/aa.cc"), 2);
+  EXPECT_EQ(LowerBound(*snapshot, "/workspace/c.cc"), 3);
+}
+
+TEST_F(SnapshotTest, Empty) {
+  WriteDatabase({});
+  auto const snapshot = Load();
+  ASSERT_TRUE(snapshot.has_value());
+  EXPECT_EQ(snapshot->size(), 0);
+  EXPECT_EQ(LowerBound(*snapshot, "/workspace/a.cc"), 0);
+}
+
+TEST_F(SnapshotTest, Missing) {
+  fd_ = FD(::open(database_path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+  EXPECT_EQ(Load(), std::nullopt);
+}
+
+TEST_F(SnapshotTest, StaleAfterDatabaseChange) {
+  WriteDatabase({{"/workspace/a.cc", R"({"file": "a.cc"})"}});
+  ASSERT_EQ(::pwrite(fd_.get(), "X", 1, 0), 1);
+  EXPECT_EQ(Load(), std::nullopt);
+}
+
+TEST_F(SnapshotTest, StaleAfterDatabaseGrows) {
+  WriteDatabase({{"/workspace/a.cc", R"({"file": "a.cc"})"}});
+  ASSERT_EQ(::pwrite(fd_.get(), "\n", 1, ::lseek(fd_.get(), 0, SEEK_END)), 1);
+  EXPECT_EQ(Load(), std::nullopt);
+}
+
+TEST_F(SnapshotTest, TruncatedIsStale) {
+  WriteDatabase({
+      {"/workspace/a.cc", R"({"file": "a.cc"})"},
+      {"/workspace/b.cc", R"({"file": "b.cc"})"},
+  });
+  struct stat stat {};
+  ASSERT_EQ(::stat(snapshot_path_.c_str(), &stat), 0);
+  for (off_t const size : {off_t{0}, off_t{16}, stat.st_size / 2, stat.st_size - 8}) {
+    ASSERT_EQ(::truncate(snapshot_path_.c_str(), size), 0);
+    EXPECT_EQ(Load(), std::nullopt) << size;
+  }
+}
+
+TEST_F(SnapshotTest, CorruptRecordOffsetIsDataLoss) {
+  WriteDatabase({{"/workspace/a.cc", R"({"file": "a.cc"})"}});
+  uint64_t const table_offset = ReadSnapshotWord(kTableOffsetPosition);
+  OverwriteSnapshot(table_offset, uint64_t{1} << 40);
+  // Loading doesn't walk the records, reading the corrupt one fails.
+  auto const snapshot = Load();
+  ASSERT_TRUE(snapshot.has_value());
+  EXPECT_EQ(snapshot->GetEntry(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->GetSorted(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->Validate().code(), absl::StatusCode::kDataLoss);
+}
+
+TEST_F(SnapshotTest, RecordOffsetIntoTableIsDataLoss) {
+  WriteDatabase({{"/workspace/a.cc", R"({"file": "a.cc"})"}});
+  uint64_t const table_offset = ReadSnapshotWord(kTableOffsetPosition);
+  OverwriteSnapshot(table_offset, table_offset);
+  // Loading doesn't walk the records, reading the corrupt one fails.
+  auto const snapshot = Load();
+  ASSERT_TRUE(snapshot.has_value());
+  EXPECT_EQ(snapshot->GetEntry(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->GetSorted(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->Validate().code(), absl::StatusCode::kDataLoss);
+}
+
+TEST_F(SnapshotTest, CorruptRecordSizesAreDataLoss) {
+  WriteDatabase({{"/workspace/a.cc", R"({"file": "a.cc"})"}});
+  uint64_t const record_offset = ReadSnapshotWord(ReadSnapshotWord(kTableOffsetPosition));
+  OverwriteSnapshot(record_offset + kRecordPathSizePosition, uint32_t{0xFFFFFFFF});
+  // Loading doesn't walk the records, reading the corrupt one fails.
+  auto const snapshot = Load();
+  ASSERT_TRUE(snapshot.has_value());
+  EXPECT_EQ(snapshot->GetEntry(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->GetSorted(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->Validate().code(), absl::StatusCode::kDataLoss);
+}
+
+TEST_F(SnapshotTest, CorruptTextSpanIsDataLoss) {
+  WriteDatabase({{"/workspace/a.cc", R"({"file": "a.cc"})"}});
+  uint64_t const record_offset = ReadSnapshotWord(ReadSnapshotWord(kTableOffsetPosition));
+  OverwriteSnapshot(record_offset, uint64_t{1} << 40);
+  // Loading doesn't walk the records, reading the corrupt one fails.
+  auto const snapshot = Load();
+  ASSERT_TRUE(snapshot.has_value());
+  EXPECT_EQ(snapshot->GetEntry(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->GetSorted(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->Validate().code(), absl::StatusCode::kDataLoss);
+}
+
+TEST_F(SnapshotTest, CorruptSortedIndexIsDataLoss) {
+  WriteDatabase({{"/workspace/a.cc", R"({"file": "a.cc"})"}});
+  uint64_t const table_offset = ReadSnapshotWord(kTableOffsetPosition);
+  OverwriteSnapshot(table_offset + sizeof(uint64_t), uint64_t{1});
+  auto const snapshot = Load();
+  ASSERT_TRUE(snapshot.has_value());
+  EXPECT_TRUE(snapshot->GetEntry(0).ok());
+  EXPECT_EQ(snapshot->GetSorted(0).status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->LowerBound("/workspace/a.cc").status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(snapshot->Validate().code(), absl::StatusCode::kDataLoss);
+}
+
+TEST_F(SnapshotTest, CorruptEntryCountIsStale) {
+  WriteDatabase({{"/workspace/a.cc", R"({"file": "a.cc"})"}});
+  // `num_entries` precedes `table_offset` in the header.
+  OverwriteSnapshot(kTableOffsetPosition - sizeof(uint64_t), uint64_t{1} << 62);
+  EXPECT_EQ(Load(), std::nullopt);
+}
+
+}  // namespace
@@ -0,0 +1,109 @@
+#include "src/source_language.h"
+
+#include <optional>
+#include <string_view>
+
+#include "src/perfect_hash.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+auto constexpr kLanguagesByExtension = MakePerfectHashMap<SourceLanguage>({
+    {"c", SourceLanguage::kC},
+    {"i", SourceLanguage::kCPreprocessed},
+    {"C", SourceLanguage::kCxx},
+    {"cc", SourceLanguage::kCxx},
+    {"cp", SourceLanguage::kCxx},
+    {"cpp", SourceLanguage::kCxx},
+    {"CPP", SourceLanguage::kCxx},
+    {"cxx", SourceLanguage::kCxx},
+    {"c++", SourceLanguage::kCxx},
+    {"ii", SourceLanguage::kCxxPreprocessed},
+    {"cppm", SourceLanguage::kCxxModule},
+    {"ccm", SourceLanguage::kCxxModule},
+    {"cxxm", SourceLanguage::kCxxModule},
+    {"c++m", SourceLanguage::kCxxModule},
+    {"m", SourceLanguage::kObjC},
+    {"mi", SourceLanguage::kObjCPreprocessed},
+    {"M", SourceLanguage::kObjCxx},
+    {"mm", SourceLanguage::kObjCxx},
+    {"mii", SourceLanguage::kObjCxxPreprocessed},
+    {"cu", SourceLanguage::kCuda},
+    {"hip", SourceLanguage::kHip},
+    {"cl", SourceLanguage::kOpenCL},
+    {"s", SourceLanguage::kAssembler},
+    {"S", SourceLanguage::kAssemblerWithCpp},
+    {"sx", SourceLanguage::kAssemblerWithCpp},
+    {"h", SourceLanguage::kCHeader},
+    {"H", SourceLanguage::kCxxHeader},
+    {"hh", SourceLanguage::kCxxHeader},
+    {"hp", SourceLanguage::kCxxHeader},
+    {"hpp", SourceLanguage::kCxxHeader},
+    {"HPP", SourceLanguage::kCxxHeader},
+    {"hxx", SourceLanguage::kCxxHeader},
+    {"h++", SourceLanguage::kCxxHeader},
+    {"tcc", SourceLanguage::kCxxHeader},
+    {"cuh", SourceLanguage::kCxxHeader},
+});
+
+// Values accepted by `-x`, from both Clang and GCC.
+auto constexpr kLanguagesByName = MakePerfectHashMap<SourceLanguage>({
+    {"c", SourceLanguage::kC},
+    {"c++", SourceLanguage::kCxx},
+    {"objective-c", SourceLanguage::kObjC},
+    {"objective-c++", SourceLanguage::kObjCxx},
+    {"cuda", SourceLanguage::kCuda},
+    {"hip", SourceLanguage::kHip},
+    {"cl", SourceLanguage::kOpenCL},
+    {"assembler", SourceLanguage::kAssembler},
+    {"assembler-with-cpp", SourceLanguage::kAssemblerWithCpp},
+    {"c-header", SourceLanguage::kCHeader},
+    {"c++-header", SourceLanguage::kCxxHeader},
+    {"c++-system-header", SourceLanguage::kCxxHeader},
+    {"c++-user-header", SourceLanguage::kCxxHeader},
+    {"objective-c-header", SourceLanguage::kObjCHeader},
+    {"objective-c++-header", SourceLanguage::kObjCxxHeader},
+    {"cpp-output", SourceLanguage::kCPreprocessed},
+    {"c-cpp-output", SourceLanguage::kCPreprocessed},
+    {"c++-cpp-output", SourceLanguage::kCxxPreprocessed},
+    {"objective-c-cpp-output", SourceLanguage::kObjCPreprocessed},
+    {"objc-cpp-output", SourceLanguage::kObjCPreprocessed},
+    {"objective-c++-cpp-output", SourceLanguage::kObjCxxPreprocessed},
+    {"objc++-cpp-output", SourceLanguage::kObjCxxPreprocessed},
+    {"c++-module", SourceLanguage::kCxxModule},
+});
+
+}  // namespace
+
+SourceLanguage GetLanguageFromPath(std::string_view const path) {
+  auto const dot = path.rfind('.');
+  if (dot == std::string_view::npos) {
+    return SourceLanguage::kUnknown;
+  }
+  auto const extension = path.substr(dot + 1);
+  if (extension.find('/') != std::string_view::npos) {
+    // The dot is in a directory name.
+    return SourceLanguage::kUnknown;
+  }
+  auto const* const language = kLanguagesByExtension.Find(extension);
+  if (language != nullptr) {
+    return *language;
+  } else {
+    return SourceLanguage::kUnknown;
+  }
+}
+
+std::optional<SourceLanguage> GetLanguageFromName(std::string_view const name) {
+  if (name == "none") {
+    return std::nullopt;
+  }
+  auto const* const language = kLanguagesByName.Find(name);
+  if (language != nullptr) {
+    return *language;
+  } else {
+    return SourceLanguage::kUnknown;
+  }
+}
+
+}  // namespace comp_db_hook
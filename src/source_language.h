@@ -0,0 +1,46 @@
+#ifndef __COMP_DB_HOOK_SOURCE_LANGUAGE_H__
+#define __COMP_DB_HOOK_SOURCE_LANGUAGE_H__
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace comp_db_hook {
+
+// Languages of the inputs a compiler driver can compile. `kUnknown` is used for everything that is
+// not a translation unit, e.g. object files, libraries, linker scripts, or languages not handled by
+// Clang-based tools.
+enum class SourceLanguage : uint8_t {
+  kUnknown,
+  kC,
+  kCxx,
+  kObjC,
+  kObjCxx,
+  kCuda,
+  kHip,
+  kOpenCL,
+  kAssembler,
+  kAssemblerWithCpp,
+  kCHeader,
+  kCxxHeader,
+  kObjCHeader,
+  kObjCxxHeader,
+  kCPreprocessed,
+  kCxxPreprocessed,
+  kObjCPreprocessed,
+  kObjCxxPreprocessed,
+  kCxxModule,
+};
+
+// Infers the language of an input file from its extension, the same way the driver does when no
+// `-x` option is in effect. The extension is case sensitive (`.c` is C while `.C` is C++).
+SourceLanguage GetLanguageFromPath(std::string_view path);
+
+// Parses the value of a `-x` option. Returns an empty optional for `-x none`, which restores the
+// extension-based detection for the following inputs, and `kUnknown` for languages not listed in
+// `SourceLanguage`.
+std::optional<SourceLanguage> GetLanguageFromName(std::string_view name);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_SOURCE_LANGUAGE_H__
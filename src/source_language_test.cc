@@ -0,0 +1,142 @@
+#include "src/source_language.h"
+
+#include <optional>
+#include <string_view>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using ::comp_db_hook::GetLanguageFromName;
+using ::comp_db_hook::GetLanguageFromPath;
+using ::comp_db_hook::SourceLanguage;
+
+TEST(SourceLanguageTest, Extensions) {
+  EXPECT_EQ(GetLanguageFromPath("a.c"), SourceLanguage::kC);
+  EXPECT_EQ(GetLanguageFromPath("a.i"), SourceLanguage::kCPreprocessed);
+  EXPECT_EQ(GetLanguageFromPath("a.cc"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.cp"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.cpp"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.CPP"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.cxx"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.c++"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.ii"), SourceLanguage::kCxxPreprocessed);
+  EXPECT_EQ(GetLanguageFromPath("a.cppm"), SourceLanguage::kCxxModule);
+  EXPECT_EQ(GetLanguageFromPath("a.ccm"), SourceLanguage::kCxxModule);
+  EXPECT_EQ(GetLanguageFromPath("a.cxxm"), SourceLanguage::kCxxModule);
+  EXPECT_EQ(GetLanguageFromPath("a.c++m"), SourceLanguage::kCxxModule);
+  EXPECT_EQ(GetLanguageFromPath("a.m"), SourceLanguage::kObjC);
+  EXPECT_EQ(GetLanguageFromPath("a.mi"), SourceLanguage::kObjCPreprocessed);
+  EXPECT_EQ(GetLanguageFromPath("a.mm"), SourceLanguage::kObjCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.mii"), SourceLanguage::kObjCxxPreprocessed);
+  EXPECT_EQ(GetLanguageFromPath("a.cu"), SourceLanguage::kCuda);
+  EXPECT_EQ(GetLanguageFromPath("a.hip"), SourceLanguage::kHip);
+  EXPECT_EQ(GetLanguageFromPath("a.cl"), SourceLanguage::kOpenCL);
+  EXPECT_EQ(GetLanguageFromPath("a.s"), SourceLanguage::kAssembler);
+  EXPECT_EQ(GetLanguageFromPath("a.sx"), SourceLanguage::kAssemblerWithCpp);
+  EXPECT_EQ(GetLanguageFromPath("a.h"), SourceLanguage::kCHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.hh"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.hp"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.hpp"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.HPP"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.hxx"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.h++"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.tcc"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.cuh"), SourceLanguage::kCxxHeader);
+}
+
+TEST(SourceLanguageTest, CaseSensitiveExtensions) {
+  EXPECT_EQ(GetLanguageFromPath("a.c"), SourceLanguage::kC);
+  EXPECT_EQ(GetLanguageFromPath("a.C"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.m"), SourceLanguage::kObjC);
+  EXPECT_EQ(GetLanguageFromPath("a.M"), SourceLanguage::kObjCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.s"), SourceLanguage::kAssembler);
+  EXPECT_EQ(GetLanguageFromPath("a.S"), SourceLanguage::kAssemblerWithCpp);
+  EXPECT_EQ(GetLanguageFromPath("a.h"), SourceLanguage::kCHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.H"), SourceLanguage::kCxxHeader);
+  // Only the spellings in the table are recognized.
+  EXPECT_EQ(GetLanguageFromPath("a.CC"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.Cpp"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.CXX"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.MM"), SourceLanguage::kUnknown);
+}
+
+TEST(SourceLanguageTest, Directories) {
+  EXPECT_EQ(GetLanguageFromPath("/w/src/a.cc"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("foo.c/bar.cc"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("/w/v1.2/a.c"), SourceLanguage::kC);
+}
+
+TEST(SourceLanguageTest, DottedDirectoriesWithExtensionlessFiles) {
+  EXPECT_EQ(GetLanguageFromPath("foo.c/bar"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("/w/lib.cc/include/vector"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("./a"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("../a"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("foo.h/"), SourceLanguage::kUnknown);
+}
+
+TEST(SourceLanguageTest, MultipleDots) {
+  EXPECT_EQ(GetLanguageFromPath("a.pb.cc"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromPath("a.pb.h"), SourceLanguage::kCHeader);
+  EXPECT_EQ(GetLanguageFromPath("a.c.o"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.cc.d"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.o.c"), SourceLanguage::kC);
+  EXPECT_EQ(GetLanguageFromPath("a..cc"), SourceLanguage::kCxx);
+}
+
+TEST(SourceLanguageTest, UnknownExtensions) {
+  EXPECT_EQ(GetLanguageFromPath("a.o"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("liba.a"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("liba.so"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.ld"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.pch"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.rs"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a.ccc"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a."), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath("a"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromPath(""), SourceLanguage::kUnknown);
+}
+
+TEST(SourceLanguageTest, HiddenFiles) {
+  EXPECT_EQ(GetLanguageFromPath(".c"), SourceLanguage::kC);
+  EXPECT_EQ(GetLanguageFromPath("/w/.bashrc"), SourceLanguage::kUnknown);
+}
+
+TEST(SourceLanguageTest, Names) {
+  EXPECT_EQ(GetLanguageFromName("c"), SourceLanguage::kC);
+  EXPECT_EQ(GetLanguageFromName("c++"), SourceLanguage::kCxx);
+  EXPECT_EQ(GetLanguageFromName("objective-c"), SourceLanguage::kObjC);
+  EXPECT_EQ(GetLanguageFromName("objective-c++"), SourceLanguage::kObjCxx);
+  EXPECT_EQ(GetLanguageFromName("cuda"), SourceLanguage::kCuda);
+  EXPECT_EQ(GetLanguageFromName("hip"), SourceLanguage::kHip);
+  EXPECT_EQ(GetLanguageFromName("cl"), SourceLanguage::kOpenCL);
+  EXPECT_EQ(GetLanguageFromName("assembler"), SourceLanguage::kAssembler);
+  EXPECT_EQ(GetLanguageFromName("assembler-with-cpp"), SourceLanguage::kAssemblerWithCpp);
+  EXPECT_EQ(GetLanguageFromName("c-header"), SourceLanguage::kCHeader);
+  EXPECT_EQ(GetLanguageFromName("c++-header"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromName("c++-system-header"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromName("c++-user-header"), SourceLanguage::kCxxHeader);
+  EXPECT_EQ(GetLanguageFromName("objective-c-header"), SourceLanguage::kObjCHeader);
+  EXPECT_EQ(GetLanguageFromName("objective-c++-header"), SourceLanguage::kObjCxxHeader);
+  EXPECT_EQ(GetLanguageFromName("cpp-output"), SourceLanguage::kCPreprocessed);
+  EXPECT_EQ(GetLanguageFromName("c-cpp-output"), SourceLanguage::kCPreprocessed);
+  EXPECT_EQ(GetLanguageFromName("c++-cpp-output"), SourceLanguage::kCxxPreprocessed);
+  EXPECT_EQ(GetLanguageFromName("objective-c-cpp-output"), SourceLanguage::kObjCPreprocessed);
+  EXPECT_EQ(GetLanguageFromName("objc-cpp-output"), SourceLanguage::kObjCPreprocessed);
+  EXPECT_EQ(GetLanguageFromName("objective-c++-cpp-output"), SourceLanguage::kObjCxxPreprocessed);
+  EXPECT_EQ(GetLanguageFromName("objc++-cpp-output"), SourceLanguage::kObjCxxPreprocessed);
+  EXPECT_EQ(GetLanguageFromName("c++-module"), SourceLanguage::kCxxModule);
+}
+
+TEST(SourceLanguageTest, None) { EXPECT_EQ(GetLanguageFromName("none"), std::nullopt); }
+
+TEST(SourceLanguageTest, UnknownNames) {
+  EXPECT_EQ(GetLanguageFromName("f95"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromName("ada"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromName("C"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromName("C++"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromName("None"), SourceLanguage::kUnknown);
+  EXPECT_EQ(GetLanguageFromName(""), SourceLanguage::kUnknown);
+}
+
+}  // namespace
@@ -0,0 +1,296 @@
+#include "src/staging.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "absl/functional/function_ref.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "common/utilities.h"
+#include "io/advisory_file_lock.h"
+#include "io/fd.h"
+#include "src/background_task.h"
+#include "src/command_database.h"
+#include "src/config.h"
+#include "src/file_io.h"
+#include "src/snapshot.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::ExclusiveFileLock;
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kPersistAfterEnvVar = "COMP_DB_HOOK_PERSIST_AFTER";
+
+int64_t constexpr kDefaultPersistAfter = 30;
+
+// How many times the staged database is updated before giving up if it keeps being persisted
+// concurrently (see `RetryStagedUpdate`).
+int constexpr kMaxStagingAttempts = 3;
+
+// The sidecar files that follow the database to the staging directory and back. The index and the
+// snapshot are bound to the database file and are rebuilt or rebound instead, and the garbage
+// collection timestamp only matters in the workspace.
+std::string_view constexpr kStagedSidecars[] = {"generation", "changes", "build", "seen", "paths"};
+
+// Removes the directory at `path` and the files in it. Staging directories have no subdirectories.
+absl::Status RemoveDirectory(std::string const& path) {
+  DIR* const directory = ::opendir(path.c_str());
+  if (directory == nullptr) {
+    return absl::ErrnoToStatus(errno, "opendir");
+  }
+  for (auto* entry = ::readdir(directory); entry != nullptr; entry = ::readdir(directory)) {
+    std::string_view const name = entry->d_name;
+    if (name != "." && name != ".." && ::unlinkat(::dirfd(directory), entry->d_name, 0) < 0) {
+      auto const status = absl::ErrnoToStatus(errno, "unlinkat");
+      ::closedir(directory);
+      return status;
+    }
+  }
+  ::closedir(directory);
+  if (::rmdir(path.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rmdir");
+  }
+  return absl::OkStatus();
+}
+
+// Creates an empty directory next to `path` and returns its name.
+absl::StatusOr<std::string> MakeTemporaryDirectory(std::string_view const path) {
+  std::string temp_path = absl::StrCat(path, ".XXXXXX");
+  if (::mkdtemp(temp_path.data()) == nullptr) {
+    return absl::ErrnoToStatus(errno, "mkdtemp");
+  }
+  if (::chmod(temp_path.c_str(), /*mode=*/0775) < 0) {
+    return absl::ErrnoToStatus(errno, "chmod");
+  }
+  return temp_path;
+}
+
+// Replaces the content of the file at `destination` with the content of the file at `source`. Like
+// `EntryWriter::CopyTo` the file is overwritten first and truncated later.
+absl::Status CopyContents(FD const& source, FD const& destination) {
+  struct stat stat {};
+  if (::fstat(source.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  if (::lseek(destination.get(), 0, SEEK_SET) < 0) {
+    return absl::ErrnoToStatus(errno, "lseek");
+  }
+  off_t offset = 0;
+  while (offset < stat.st_size) {
+    auto const result = ::sendfile(destination.get(), source.get(), &offset, stat.st_size - offset);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::ErrnoToStatus(errno, "sendfile");
+    } else if (result == 0) {
+      return absl::DataLossError("unexpected end of file");
+    }
+  }
+  if (::ftruncate(destination.get(), stat.st_size) < 0) {
+    return absl::ErrnoToStatus(errno, "ftruncate");
+  }
+  return absl::OkStatus();
+}
+
+// Copies the sidecar file of kind `kind` from `source_directory` to `destination_directory`, if it
+// exists.
+absl::Status CopySidecar(std::string_view const source_directory,
+                         std::string_view const destination_directory,
+                         std::string_view const kind) {
+  auto const source_path = GetSidecarFilePath(source_directory, kind);
+  FD const source{::open(source_path.c_str(), O_RDONLY | O_CLOEXEC)};  // NOLINT
+  if (!source) {
+    return errno == ENOENT ? absl::OkStatus() : absl::ErrnoToStatus(errno, "open");
+  }
+  auto const destination_path = GetSidecarFilePath(destination_directory, kind);
+  FD const destination{::open(  // NOLINT(cppcoreguidelines-pro-type-vararg)
+      destination_path.c_str(), /*flags=*/O_WRONLY | O_CREAT | O_CLOEXEC, /*mode=*/0664)};
+  if (!destination) {
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  return CopyContents(source, destination);
+}
+
+// Copies the database at `source_fd` in `source_directory` to the one at `destination_fd` in
+// `destination_directory`, along with its sidecar files. The snapshot is rebound to the copy by
+// re-adding its entries as they are, which doesn't parse anything. The caller must hold the locks
+// of both databases.
+absl::Status CopyDatabase(FD const& source_fd, std::string_view const source_directory,
+                          FD const& destination_fd, std::string_view const destination_directory) {
+  RETURN_IF_ERROR(CopyContents(source_fd, destination_fd));
+  for (auto const kind : kStagedSidecars) {
+    RETURN_IF_ERROR(CopySidecar(source_directory, destination_directory, kind));
+  }
+  auto const snapshot_path = GetSnapshotPath(source_directory);
+  if (snapshot_path.empty()) {
+    return absl::OkStatus();
+  }
+  DEFINE_CONST_OR_RETURN(maybe_snapshot, Snapshot::Load(snapshot_path, source_fd));
+  if (!maybe_snapshot.has_value() || !maybe_snapshot->Validate().ok()) {
+    // The copy gets a new snapshot the next time it's needed.
+    return absl::OkStatus();
+  }
+  DEFINE_VAR_OR_RETURN(snapshot_writer,
+                       SnapshotWriter::Create(GetSnapshotPath(destination_directory)));
+  for (size_t i = 0; i < maybe_snapshot->size(); ++i) {
+    DEFINE_CONST_OR_RETURN(entry, maybe_snapshot->GetEntry(i));
+    RETURN_IF_ERROR(snapshot_writer.Add(entry.span().offset, entry));
+  }
+  return snapshot_writer.Commit(destination_fd);
+}
+
+// Populates the new staging directory `temp_directory` with a copy of the workspace database at
+// `fd`, which must be locked by the caller.
+absl::Status PopulateStagingDirectory(FD const& fd, std::string_view const workspace_directory,
+                                      std::string_view const temp_directory) {
+  DEFINE_CONST_OR_RETURN(staged_fd, OpenCommandFile(temp_directory));
+  return CopyDatabase(fd, workspace_directory, staged_fd, temp_directory);
+}
+
+}  // namespace
+
+absl::Status StageDatabase(std::string_view const workspace_directory,
+                           std::string const& staging_directory) {
+  auto const staged_path = GetCommandFilePath(staging_directory);
+  if (Exists(staged_path)) {
+    return absl::OkStatus();
+  }
+  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile(workspace_directory));
+  DEFINE_OR_RETURN(lock, ExclusiveFileLock::Acquire(fd));
+  // Check again, another process may have staged the database while we waited for the lock.
+  if (Exists(staged_path)) {
+    return absl::OkStatus();
+  }
+  if (Exists(staging_directory)) {
+    // Leftover of a process that died while persisting.
+    RETURN_IF_ERROR(RemoveDirectory(staging_directory));
+  }
+  DEFINE_CONST_OR_RETURN(temp_directory, MakeTemporaryDirectory(staging_directory));
+  auto status = PopulateStagingDirectory(fd, workspace_directory, temp_directory);
+  if (status.ok() && ::rename(temp_directory.c_str(), staging_directory.c_str()) < 0) {
+    status = absl::ErrnoToStatus(errno, "rename");
+  }
+  if (!status.ok()) {
+    if (auto const cleanup_status = RemoveDirectory(temp_directory); !cleanup_status.ok()) {
+      LOG(WARNING) << "Failed to remove " << temp_directory << ": " << cleanup_status;
+    }
+    return status;
+  }
+  LOG(INFO) << "Staged compile_commands.json in " << staging_directory << ".";
+  return absl::OkStatus();
+}
+
+absl::StatusOr<bool> PersistDatabase(std::string_view const workspace_directory,
+                                     std::string const& staging_directory) {
+  auto const staged_path = GetCommandFilePath(staging_directory);
+  FD const staged_fd{::open(staged_path.c_str(), O_RDWR | O_CLOEXEC)};  // NOLINT
+  if (!staged_fd) {
+    if (errno == ENOENT) {
+      return false;
+    }
+    return absl::ErrnoToStatus(errno, "open");
+  }
+  // The staged database is always locked before the workspace one, while staging only locks the
+  // latter, so this can't deadlock.
+  DEFINE_OR_RETURN(staged_lock, ExclusiveFileLock::Acquire(staged_fd));
+  struct stat stat {};
+  if (::fstat(staged_fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  if (stat.st_nlink == 0) {
+    // Persisted by another process while we waited for the lock.
+    return false;
+  }
+  DEFINE_CONST_OR_RETURN(fd, OpenCommandFile(workspace_directory));
+  DEFINE_OR_RETURN(lock, ExclusiveFileLock::Acquire(fd));
+  RETURN_IF_ERROR(CopyDatabase(staged_fd, staging_directory, fd, workspace_directory));
+  // Move the staging directory out of the way before emptying it, so that hooks that haven't opened
+  // the staged database yet fail to open it rather than create a new one.
+  DEFINE_CONST_OR_RETURN(temp_directory, MakeTemporaryDirectory(staging_directory));
+  if (::rename(staging_directory.c_str(), temp_directory.c_str()) < 0) {
+    return absl::ErrnoToStatus(errno, "rename");
+  }
+  RETURN_IF_ERROR(RemoveDirectory(temp_directory));
+  LOG(INFO) << "Persisted the staged compile_commands.json to " << workspace_directory << ".";
+  return true;
+}
+
+absl::StatusOr<struct stat> StatLockedDatabase(FD const& fd) {
+  struct stat stat {};
+  if (::fstat(fd.get(), &stat) < 0) {
+    return absl::ErrnoToStatus(errno, "fstat");
+  }
+  if (stat.st_nlink == 0) {
+    return absl::AbortedError("compile_commands.json was removed while waiting for the lock");
+  }
+  return stat;
+}
+
+absl::StatusOr<bool> RetryStagedUpdate(std::string_view const directory,
+                                       std::string const& staging_directory,
+                                       absl::FunctionRef<absl::StatusOr<bool>()> const update) {
+  for (int attempt = 1;; ++attempt) {
+    RETURN_IF_ERROR(StageDatabase(directory, staging_directory));
+    auto status_or_result = update();
+    // `NotFound` means that the staging directory was already gone when opening the database.
+    auto const& status = status_or_result.status();
+    if (status.ok() || (!absl::IsAborted(status) && !absl::IsNotFound(status)) ||
+        attempt >= kMaxStagingAttempts) {
+      return status_or_result;
+    }
+  }
+}
+
+void SchedulePersistence(std::string_view const workspace_directory,
+                         std::string const& staging_directory) {
+  auto const delay = GetIntEnv(kPersistAfterEnvVar, kDefaultPersistAfter);
+  if (delay <= 0) {
+    return;
+  }
+  auto const pending_path = GetSidecarFilePath(staging_directory, "persist");
+  // Persistence is serialized by the database locks.
+  if (!ClaimPendingTask(pending_path, delay)) {
+    return;
+  }
+  bool const started = RunDetached([&] {
+    auto const staged_path = GetCommandFilePath(staging_directory);
+    while (true) {
+      struct stat stat {};
+      if (::stat(staged_path.c_str(), &stat) < 0) {
+        // Persisted already.
+        return 0;
+      }
+      auto const idle_time = ::time(nullptr) - stat.st_mtime;
+      if (idle_time >= delay) {
+        break;
+      }
+      ::utimensat(AT_FDCWD, pending_path.c_str(), nullptr, 0);
+      ::sleep(delay - idle_time);
+    }
+    // Changes committed from now on schedule another persistence.
+    ::unlink(pending_path.c_str());
+    return PersistDatabase(workspace_directory, staging_directory).ok() ? 0 : 1;
+  });
+  if (!started) {
+    ::unlink(pending_path.c_str());
+  }
+}
+
+}  // namespace comp_db_hook
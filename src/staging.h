@@ -0,0 +1,71 @@
+#ifndef __COMP_DB_HOOK_STAGING_H__
+#define __COMP_DB_HOOK_STAGING_H__
+
+#include <sys/stat.h>
+
+#include <string>
+#include <string_view>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "io/fd.h"
+
+namespace comp_db_hook {
+
+// In-memory staging of the workspace database. When the `COMP_DB_HOOK_STAGING_DIR` environment
+// variable is set to a directory backed by RAM (e.g. `/dev/shm`) the hook doesn't update the
+// database in the workspace during a build: the first hook process copies it to a staging directory
+// there (see `GetStagingDirectory`) and every commit goes to the copy, so that rewriting the
+// database never touches the disk. The copy is written back to the workspace when the build is over
+// (see `SchedulePersistence`) or on demand with `comp_db_hook persist`.
+//
+// While the database is staged the subcommands that read or write the live database (e.g. `query`,
+// `gc` and `merge`) operate on the copy, except the query server, which keeps serving the one in
+// the workspace. The databases of the package roots (see `PackageRoots`) are staged the same way,
+// each in the staging directory of its root.
+//
+// Copies the database of `workspace_directory` to `staging_directory` along with its change log,
+// build tracking data and snapshot, unless it's staged already. The staging directory is populated
+// under a temporary name and renamed into place, so the staged database is never seen partially
+// copied.
+absl::Status StageDatabase(std::string_view workspace_directory,
+                           std::string const& staging_directory);
+
+// Copies the database staged in `staging_directory` back to `workspace_directory` and removes the
+// staging directory. Returns false if there was nothing to persist.
+//
+// The workspace database is overwritten in place, like every other rewrite. Hook processes that
+// were waiting for the lock on the staged database find it unlinked when they get it, and start
+// over by staging the database again.
+absl::StatusOr<bool> PersistDatabase(std::string_view workspace_directory,
+                                     std::string const& staging_directory);
+
+// Stats the database at `fd`, which the caller has just locked. Fails with `Aborted` if it was
+// unlinked in the meantime, which is what happens to a staged database persisted by another process
+// while waiting for its lock.
+absl::StatusOr<struct stat> StatLockedDatabase(tsdb2::io::FD const& fd);
+
+// Runs `update` on the copy of the database of `directory` staged in `staging_directory`, staging it
+// first if needed, and returns its result. If the staged database is persisted concurrently, which
+// `update` reports by failing with `Aborted` (see `StatLockedDatabase`) or with `NotFound` if the
+// staging directory was already gone, the database is staged again and `update` runs again, up to
+// 3 times in all.
+absl::StatusOr<bool> RetryStagedUpdate(std::string_view directory,
+                                       std::string const& staging_directory,
+                                       absl::FunctionRef<absl::StatusOr<bool>()> update);
+
+// Debounced persistence: starts a detached background process that persists the staged database as
+// soon as it hasn't changed for `COMP_DB_HOOK_PERSIST_AFTER` seconds (30 by default), which is
+// taken as the end of the build, unless one is already pending. Zero or a negative value disables
+// the automatic persistence, leaving it to `comp_db_hook persist`.
+//
+// The pending persistence is marked by the `.compile_commands.json.persist` file in the staging
+// directory, which the background process touches while it waits and removes right before
+// persisting, so changes committed after that schedule a new one and are never left out.
+void SchedulePersistence(std::string_view workspace_directory,
+                         std::string const& staging_directory);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_STAGING_H__
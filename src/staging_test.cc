@@ -0,0 +1,265 @@
+#include "src/staging.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "src/command_database.h"
+#include "src/file_io.h"
+#include "src/snapshot.h"
+
+namespace {
+
+using ::comp_db_hook::GetCommandFilePath;
+using ::comp_db_hook::GetSidecarFilePath;
+using ::comp_db_hook::PersistDatabase;
+using ::comp_db_hook::RetryStagedUpdate;
+using ::comp_db_hook::Snapshot;
+using ::comp_db_hook::StageDatabase;
+using ::comp_db_hook::StatLockedDatabase;
+using ::tsdb2::io::FD;
+
+std::string_view constexpr kDatabase = "[\n  {\"directory\": \"/w\", \"file\": \"a.cc\"}\n]\n";
+
+// Removes `path` and the files in it, if it exists.
+void RemoveDirectory(std::string const& path) {
+  DIR* const directory = ::opendir(path.c_str());
+  if (directory == nullptr) {
+    return;
+  }
+  for (auto* entry = ::readdir(directory); entry != nullptr; entry = ::readdir(directory)) {
+    std::string_view const name = entry->d_name;
+    if (name != "." && name != "..") {
+      ::unlinkat(::dirfd(directory), entry->d_name, 0);
+    }
+  }
+  ::closedir(directory);
+  ::rmdir(path.c_str());
+}
+
+void WriteFile(std::string const& path, std::string_view const contents) {
+  FD const fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+  ASSERT_TRUE(fd);
+  ASSERT_TRUE(comp_db_hook::WriteAll(fd, contents).ok());
+}
+
+std::string ReadFile(std::string const& path) {
+  auto status_or_contents = comp_db_hook::ReadFile(path);
+  EXPECT_TRUE(status_or_contents.ok()) << status_or_contents.status();
+  return std::move(status_or_contents).value_or(std::nullopt).value_or("<missing>");
+}
+
+class StagingTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ::unsetenv("COMP_DB_HOOK_SNAPSHOT");
+    workspace_directory_ = absl::StrCat(::testing::TempDir(), "/staging_test.XXXXXX");
+    ASSERT_NE(::mkdtemp(workspace_directory_.data()), nullptr);
+    staging_root_ = absl::StrCat(::testing::TempDir(), "/staging_test_root.XXXXXX");
+    ASSERT_NE(::mkdtemp(staging_root_.data()), nullptr);
+    staging_directory_ = absl::StrCat(staging_root_, "/comp_db_hook.0123456789abcdef");
+    WriteFile(GetCommandFilePath(workspace_directory_), kDatabase);
+  }
+
+  void TearDown() override {
+    RemoveDirectory(staging_directory_);
+    RemoveDirectory(staging_root_);
+    RemoveDirectory(workspace_directory_);
+  }
+
+  std::string GetWorkspacePath(std::string_view const kind) const {
+    return GetSidecarFilePath(workspace_directory_, kind);
+  }
+
+  std::string GetStagedPath(std::string_view const kind) const {
+    return GetSidecarFilePath(staging_directory_, kind);
+  }
+
+  void Stage() const {
+    auto const status = StageDatabase(workspace_directory_, staging_directory_);
+    ASSERT_TRUE(status.ok()) << status;
+  }
+
+  bool Persist() const {
+    auto const status_or_persisted = PersistDatabase(workspace_directory_, staging_directory_);
+    EXPECT_TRUE(status_or_persisted.ok()) << status_or_persisted.status();
+    return status_or_persisted.value_or(false);
+  }
+
+  std::string workspace_directory_;
+  std::string staging_root_;
+  std::string staging_directory_;
+};
+
+TEST_F(StagingTest, StageAndPersist) {
+  Stage();
+  auto const staged_path = GetCommandFilePath(staging_directory_);
+  EXPECT_EQ(ReadFile(staged_path), kDatabase);
+  std::string_view constexpr kNewDatabase =
+      "[\n  {\"directory\": \"/w\", \"file\": \"b.cc\"}\n]\n";
+  WriteFile(staged_path, kNewDatabase);
+  EXPECT_TRUE(Persist());
+  EXPECT_EQ(ReadFile(GetCommandFilePath(workspace_directory_)), kNewDatabase);
+  EXPECT_FALSE(comp_db_hook::Exists(staging_directory_));
+  // Nothing left to persist.
+  EXPECT_FALSE(Persist());
+}
+
+TEST_F(StagingTest, PersistShrinksDatabase) {
+  Stage();
+  WriteFile(GetCommandFilePath(staging_directory_), "[]\n");
+  EXPECT_TRUE(Persist());
+  EXPECT_EQ(ReadFile(GetCommandFilePath(workspace_directory_)), "[]\n");
+}
+
+TEST_F(StagingTest, StageOnlyOnce) {
+  Stage();
+  WriteFile(GetCommandFilePath(staging_directory_), "[]\n");
+  Stage();
+  EXPECT_EQ(ReadFile(GetCommandFilePath(staging_directory_)), "[]\n");
+}
+
+TEST_F(StagingTest, ReplacesLeftoverStagingDirectory) {
+  // What a process that died while persisting leaves behind: the staging directory without the
+  // database.
+  ASSERT_EQ(::mkdir(staging_directory_.c_str(), 0775), 0);
+  WriteFile(GetStagedPath("changes"), "stale");
+  Stage();
+  EXPECT_EQ(ReadFile(GetCommandFilePath(staging_directory_)), kDatabase);
+  EXPECT_FALSE(comp_db_hook::Exists(GetStagedPath("changes")));
+}
+
+TEST_F(StagingTest, CopiesSidecars) {
+  for (std::string_view const kind : {"generation", "changes", "build", "seen", "paths"}) {
+    WriteFile(GetWorkspacePath(kind), absl::StrCat("workspace ", kind));
+  }
+  // The index is bound to the database file and the garbage collection timestamp only matters in
+  // the workspace, so they stay behind.
+  WriteFile(GetWorkspacePath("index"), "workspace index");
+  WriteFile(GetWorkspacePath("gc"), "workspace gc");
+  Stage();
+  for (std::string_view const kind : {"generation", "changes", "build", "seen", "paths"}) {
+    EXPECT_EQ(ReadFile(GetStagedPath(kind)), absl::StrCat("workspace ", kind));
+  }
+  EXPECT_FALSE(comp_db_hook::Exists(GetStagedPath("index")));
+  EXPECT_FALSE(comp_db_hook::Exists(GetStagedPath("gc")));
+  // The sidecars of the staged database win when persisting, even if they're shorter.
+  WriteFile(GetStagedPath("generation"), "staged");
+  WriteFile(GetStagedPath("paths"), "staged paths");
+  EXPECT_TRUE(Persist());
+  EXPECT_EQ(ReadFile(GetWorkspacePath("generation")), "staged");
+  EXPECT_EQ(ReadFile(GetWorkspacePath("paths")), "staged paths");
+  EXPECT_EQ(ReadFile(GetWorkspacePath("changes")), "workspace changes");
+  EXPECT_EQ(ReadFile(GetWorkspacePath("index")), "workspace index");
+}
+
+TEST_F(StagingTest, RebindsSnapshot) {
+  {
+    auto const status_or_fd = comp_db_hook::OpenCommandFile(workspace_directory_);
+    ASSERT_TRUE(status_or_fd.ok()) << status_or_fd.status();
+    ASSERT_TRUE(comp_db_hook::BuildSnapshot(GetWorkspacePath("snapshot"), status_or_fd.value(),
+                                            workspace_directory_)
+                    .ok());
+  }
+  Stage();
+  auto const status_or_fd = comp_db_hook::OpenCommandFile(staging_directory_);
+  ASSERT_TRUE(status_or_fd.ok()) << status_or_fd.status();
+  auto const status_or_snapshot = Snapshot::Load(GetStagedPath("snapshot"), status_or_fd.value());
+  ASSERT_TRUE(status_or_snapshot.ok()) << status_or_snapshot.status();
+  ASSERT_TRUE(status_or_snapshot->has_value());
+  ASSERT_EQ(status_or_snapshot->value().size(), 1);
+  auto const status_or_entry = status_or_snapshot->value().GetEntry(0);
+  ASSERT_TRUE(status_or_entry.ok()) << status_or_entry.status();
+  EXPECT_EQ(status_or_entry->path(), "/w/a.cc");
+}
+
+TEST_F(StagingTest, StatLockedDatabase) {
+  Stage();
+  auto const staged_path = GetCommandFilePath(staging_directory_);
+  FD const fd{::open(staged_path.c_str(), O_RDWR | O_CLOEXEC)};
+  ASSERT_TRUE(fd);
+  auto const status_or_stat = StatLockedDatabase(fd);
+  ASSERT_TRUE(status_or_stat.ok()) << status_or_stat.status();
+  EXPECT_EQ(status_or_stat->st_size, static_cast<off_t>(kDatabase.size()));
+  EXPECT_TRUE(Persist());
+  EXPECT_EQ(StatLockedDatabase(fd).status().code(), absl::StatusCode::kAborted);
+}
+
+TEST_F(StagingTest, RetriesUpdateOfPersistedDatabase) {
+  int attempts = 0;
+  auto const status_or_result = RetryStagedUpdate(
+      workspace_directory_, staging_directory_, [&]() -> absl::StatusOr<bool> {
+        ++attempts;
+        auto const staged_path = GetCommandFilePath(staging_directory_);
+        FD const fd{::open(staged_path.c_str(), O_RDWR | O_CLOEXEC)};
+        if (!fd) {
+          return absl::ErrnoToStatus(errno, "open");
+        }
+        if (attempts == 1) {
+          // As if another process persisted the database while we waited for the lock.
+          EXPECT_TRUE(Persist());
+        }
+        auto const status_or_stat = StatLockedDatabase(fd);
+        if (!status_or_stat.ok()) {
+          return status_or_stat.status();
+        }
+        return ::ftruncate(fd.get(), 0) == 0 && comp_db_hook::WriteAll(fd, "[]\n").ok();
+      });
+  ASSERT_TRUE(status_or_result.ok()) << status_or_result.status();
+  EXPECT_TRUE(status_or_result.value());
+  EXPECT_EQ(attempts, 2);
+  // The update went to the database staged again, not to the persisted one.
+  EXPECT_EQ(ReadFile(GetCommandFilePath(staging_directory_)), "[]\n");
+  EXPECT_EQ(ReadFile(GetCommandFilePath(workspace_directory_)), kDatabase);
+}
+
+TEST_F(StagingTest, RetriesWhenStagingDirectoryIsGone) {
+  int attempts = 0;
+  auto const status_or_result = RetryStagedUpdate(
+      workspace_directory_, staging_directory_, [&]() -> absl::StatusOr<bool> {
+        if (++attempts == 1) {
+          return absl::NotFoundError("open");
+        }
+        return false;
+      });
+  ASSERT_TRUE(status_or_result.ok()) << status_or_result.status();
+  EXPECT_FALSE(status_or_result.value());
+  EXPECT_EQ(attempts, 2);
+}
+
+TEST_F(StagingTest, GivesUpAfterRepeatedPersistence) {
+  int attempts = 0;
+  auto const status_or_result =
+      RetryStagedUpdate(workspace_directory_, staging_directory_, [&]() -> absl::StatusOr<bool> {
+        ++attempts;
+        return absl::AbortedError("persisted");
+      });
+  EXPECT_EQ(status_or_result.status().code(), absl::StatusCode::kAborted);
+  EXPECT_EQ(attempts, 3);
+}
+
+TEST_F(StagingTest, DoesNotRetryOtherErrors) {
+  int attempts = 0;
+  auto const status_or_result =
+      RetryStagedUpdate(workspace_directory_, staging_directory_, [&]() -> absl::StatusOr<bool> {
+        ++attempts;
+        return absl::DataLossError("corrupt");
+      });
+  EXPECT_EQ(status_or_result.status().code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(attempts, 1);
+}
+
+}  // namespace
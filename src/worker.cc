@@ -0,0 +1,220 @@
+#include "src/worker.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "common/utilities.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/file_io.h"
+
+namespace comp_db_hook {
+
+namespace {
+
+using ::tsdb2::io::FD;
+
+namespace json = ::tsdb2::json;
+
+std::string_view constexpr kPersistentWorkerFlag = "--persistent_worker";
+
+// How much is read at a time from the input of the worker and from the output of the compiler.
+size_t constexpr kReadSize = 64 * 1024;
+
+// Write end of the self-pipe of `WorkRequestReader::StopOnSignals`.
+int stop_pipe_write_fd = -1;
+
+void HandleStopSignal(int const signal_number) {
+  int const saved_errno = errno;
+  char const byte = static_cast<char>(signal_number);
+  // The pipe is non-blocking: if it's full (`EAGAIN`) a signal is pending already, and there's no
+  // way to report any other error from a signal handler.
+  [[maybe_unused]] ssize_t const result = ::write(stop_pipe_write_fd, &byte, 1);
+  errno = saved_errno;
+}
+
+// Reports the failure of `function` to the compiler output on `fd` and exits the child process of
+// `RunCompiler` with the status shells use for commands that can't be run.
+[[noreturn]] void ExitChild(int const fd, std::string_view const function) {
+  auto const message = absl::StrCat(function, ": ", ::strerror(errno), "\n");
+  std::string_view remaining = message;
+  while (!remaining.empty()) {
+    auto const size = ::write(fd, remaining.data(), remaining.size());
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      // The exit status still tells the failure.
+      break;
+    }
+    remaining.remove_prefix(size);
+  }
+  ::_exit(127);
+}
+
+}  // namespace
+
+bool IsPersistentWorker(absl::Span<char* const> const arguments) {
+  for (auto const argument : arguments) {
+    if (std::string_view(argument) == kPersistentWorkerFlag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+absl::Status WorkRequestReader::StopOnSignals() {
+  int pipe_fds[2];
+  if (::pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+    return absl::ErrnoToStatus(errno, "pipe2");
+  }
+  stop_fd_ = FD(pipe_fds[0]);
+  // The write end is never closed, the handlers may run until the process exits.
+  stop_pipe_write_fd = pipe_fds[1];
+  struct sigaction action {};
+  action.sa_handler = HandleStopSignal;
+  action.sa_flags = SA_RESTART;
+  ::sigemptyset(&action.sa_mask);
+  for (int const signal_number : {SIGTERM, SIGINT}) {
+    if (::sigaction(signal_number, &action, nullptr) < 0) {
+      return absl::ErrnoToStatus(errno, "sigaction");
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::optional<WorkRequest>> WorkRequestReader::Next(int const timeout_ms) {
+  while (true) {
+    if (stop_signal_ != 0) {
+      return absl::CancelledError(absl::StrCat("received signal ", stop_signal_));
+    }
+    auto const newline = buffer_.find('\n');
+    if (newline != std::string::npos) {
+      std::string const line = buffer_.substr(0, newline);
+      buffer_.erase(0, newline + 1);
+      if (absl::StripAsciiWhitespace(line).empty()) {
+        continue;
+      }
+      DEFINE_VAR_OR_RETURN(request, json::Parse<WorkRequest>(line));
+      return std::move(request);
+    }
+    // A negative descriptor is ignored by `poll`, so there's no need to tell whether `stop_fd_` is
+    // set.
+    struct pollfd pollfds[2] = {
+        {.fd = fd_.get(), .events = POLLIN, .revents = 0},
+        {.fd = stop_fd_.get(), .events = POLLIN, .revents = 0},
+    };
+    auto const num_ready = ::poll(pollfds, 2, timeout_ms);
+    if (num_ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::ErrnoToStatus(errno, "poll");
+    } else if (num_ready == 0) {
+      return std::nullopt;
+    }
+    if (pollfds[1].revents != 0) {
+      char signal_number = 0;
+      if (::read(stop_fd_.get(), &signal_number, 1) == 1) {
+        stop_signal_ = signal_number;
+      }
+      continue;
+    }
+    char buffer[kReadSize];
+    auto const size = ::read(fd_.get(), buffer, sizeof(buffer));
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::ErrnoToStatus(errno, "read");
+    } else if (size == 0) {
+      return absl::OutOfRangeError("end of the work requests");
+    }
+    buffer_.append(buffer, size);
+  }
+}
+
+absl::Status WriteWorkResponse(FD const& fd, WorkResponse const& response) {
+  return WriteAll(fd, absl::StrCat(json::Stringify(response), "\n"));
+}
+
+absl::StatusOr<int> RunCompiler(absl::Span<std::string const> const arguments,
+                                std::string* const output) {
+  std::vector<char*> argv;
+  argv.reserve(arguments.size() + 1);
+  for (auto const& argument : arguments) {
+    argv.push_back(const_cast<char*>(argument.c_str()));  // NOLINT
+  }
+  argv.push_back(nullptr);
+  int pipe_fds[2];
+  if (::pipe2(pipe_fds, O_CLOEXEC) < 0) {
+    return absl::ErrnoToStatus(errno, "pipe2");
+  }
+  FD const read_end{pipe_fds[0]};
+  FD write_end{pipe_fds[1]};
+  pid_t const pid = ::fork();
+  if (pid < 0) {
+    return absl::ErrnoToStatus(errno, "fork");
+  } else if (pid == 0) {
+    // The standard input of the worker carries the work requests, keep the compiler off it.
+    FD const null{::open("/dev/null", O_RDONLY | O_CLOEXEC)};  // NOLINT
+    if (!null) {
+      ExitChild(write_end.get(), "open");
+    }
+    // Failures are reported to the write end rather than to the standard error, which may not be
+    // redirected yet.
+    if (::dup2(null.get(), STDIN_FILENO) < 0 || ::dup2(write_end.get(), STDOUT_FILENO) < 0 ||
+        ::dup2(write_end.get(), STDERR_FILENO) < 0) {
+      ExitChild(write_end.get(), "dup2");
+    }
+    ::execvp(argv[0], argv.data());
+    ExitChild(write_end.get(), "execvp");
+  }
+  // Close our copy of the write end, or reading would never reach the end of the output.
+  write_end = FD();
+  char buffer[kReadSize];
+  while (true) {
+    auto const size = ::read(read_end.get(), buffer, sizeof(buffer));
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::ErrnoToStatus(errno, "read");
+    } else if (size == 0) {
+      break;
+    }
+    output->append(buffer, size);
+  }
+  int status = 0;
+  while (::waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return absl::ErrnoToStatus(errno, "waitpid");
+    }
+  }
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  } else {
+    return 1;
+  }
+}
+
+}  // namespace comp_db_hook
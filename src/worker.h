@@ -0,0 +1,87 @@
+#ifndef __COMP_DB_HOOK_WORKER_H__
+#define __COMP_DB_HOOK_WORKER_H__
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "io/fd.h"
+#include "json/json.h"
+
+namespace comp_db_hook {
+
+// Messages of the Bazel JSON worker protocol, exchanged as one JSON object per line over the
+// standard input and output of the worker. Only the fields used by the hook are declared, the
+// others (e.g. the `inputs` of a request) are ignored.
+inline char constexpr kWorkArgumentsField[] = "arguments";
+inline char constexpr kRequestIdField[] = "requestId";
+inline char constexpr kExitCodeField[] = "exitCode";
+inline char constexpr kOutputField[] = "output";
+
+using WorkRequest = tsdb2::json::Object<
+    tsdb2::json::Field<std::optional<std::vector<std::string>>, kWorkArgumentsField>,
+    tsdb2::json::Field<std::optional<int64_t>, kRequestIdField>>;
+
+using WorkResponse =
+    tsdb2::json::Object<tsdb2::json::Field<int64_t, kExitCodeField>,
+                        tsdb2::json::Field<std::string, kOutputField>,
+                        tsdb2::json::Field<int64_t, kRequestIdField>>;
+
+// Tells whether the hook was started by Bazel as a persistent worker, i.e. with the
+// `--persistent_worker` flag, in which case it receives the compiler arguments as work requests
+// rather than on its command line.
+bool IsPersistentWorker(absl::Span<char* const> arguments);
+
+// Reads the work requests sent by Bazel.
+class WorkRequestReader {
+ public:
+  explicit WorkRequestReader(tsdb2::io::FD fd) : fd_(std::move(fd)) {}
+
+  ~WorkRequestReader() = default;
+
+  WorkRequestReader(WorkRequestReader&&) noexcept = default;
+  WorkRequestReader& operator=(WorkRequestReader&&) noexcept = default;
+  WorkRequestReader(WorkRequestReader const&) = delete;
+  WorkRequestReader& operator=(WorkRequestReader const&) = delete;
+
+  // Installs handlers for SIGTERM and SIGINT that wake `Next` up through a self-pipe, so that the
+  // worker can shut down cleanly when it's killed rather than when its input ends. Must be called
+  // at most once per process.
+  absl::Status StopOnSignals();
+
+  // Waits up to `timeout_ms` milliseconds for the next request, or indefinitely if `timeout_ms` is
+  // negative. Returns an empty optional on timeout, `OutOfRange` at the end of the input, which is
+  // how Bazel shuts its workers down, and `Cancelled` once one of the signals of `StopOnSignals` is
+  // received (see `stop_signal`).
+  absl::StatusOr<std::optional<WorkRequest>> Next(int timeout_ms);
+
+  // The signal that stopped the reader, or 0.
+  int stop_signal() const { return stop_signal_; }
+
+ private:
+  tsdb2::io::FD fd_;
+
+  // Read end of the self-pipe written by the signal handlers, if `StopOnSignals` was called.
+  tsdb2::io::FD stop_fd_;
+  int stop_signal_ = 0;
+
+  // Input read past the last returned request.
+  std::string buffer_;
+};
+
+// Writes `response` to `fd` on a line of its own.
+absl::Status WriteWorkResponse(tsdb2::io::FD const& fd, WorkResponse const& response);
+
+// Runs the compiler in a child process with `arguments`, the first of which is the name of the
+// compiler, and appends its standard output and error to `output`. Returns its exit status, or 128
+// plus the number of the signal that killed it like shells do.
+absl::StatusOr<int> RunCompiler(absl::Span<std::string const> arguments, std::string* output);
+
+}  // namespace comp_db_hook
+
+#endif  // __COMP_DB_HOOK_WORKER_H__
@@ -0,0 +1,226 @@
+#include "src/worker.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "io/fd.h"
+#include "json/json.h"
+#include "src/file_io.h"
+
+namespace {
+
+using ::comp_db_hook::IsPersistentWorker;
+using ::comp_db_hook::kExitCodeField;
+using ::comp_db_hook::kOutputField;
+using ::comp_db_hook::kRequestIdField;
+using ::comp_db_hook::kWorkArgumentsField;
+using ::comp_db_hook::RunCompiler;
+using ::comp_db_hook::WorkRequestReader;
+using ::comp_db_hook::WorkResponse;
+using ::comp_db_hook::WriteWorkResponse;
+using ::testing::ElementsAre;
+using ::testing::Optional;
+using ::tsdb2::io::FD;
+
+class WorkRequestReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    int pipe_fds[2];
+    ASSERT_EQ(::pipe2(pipe_fds, O_CLOEXEC), 0);
+    reader_.emplace(FD(pipe_fds[0]));
+    write_end_ = FD(pipe_fds[1]);
+  }
+
+  void Write(std::string_view const text) const {
+    ASSERT_TRUE(comp_db_hook::WriteAll(write_end_, text).ok());
+  }
+
+  // Returns the ID of the next request, or -1 if there's none before the timeout.
+  int64_t NextId(int const timeout_ms = 0) {
+    auto const status_or_request = reader_->Next(timeout_ms);
+    EXPECT_TRUE(status_or_request.ok()) << status_or_request.status();
+    if (!status_or_request.ok() || !status_or_request->has_value()) {
+      return -1;
+    }
+    return status_or_request->value().get<kRequestIdField>().value_or(0);
+  }
+
+  std::optional<WorkRequestReader> reader_;
+  FD write_end_;
+};
+
+TEST_F(WorkRequestReaderTest, Request) {
+  Write("{\"arguments\": [\"clang\", \"-c\", \"a.cc\"], \"requestId\": 42, \"inputs\": []}\n");
+  auto const status_or_request = reader_->Next(0);
+  ASSERT_TRUE(status_or_request.ok()) << status_or_request.status();
+  ASSERT_TRUE(status_or_request->has_value());
+  auto const& request = status_or_request->value();
+  EXPECT_THAT(request.get<kWorkArgumentsField>(), Optional(ElementsAre("clang", "-c", "a.cc")));
+  EXPECT_THAT(request.get<kRequestIdField>(), Optional(42));
+}
+
+TEST_F(WorkRequestReaderTest, Timeout) {
+  EXPECT_EQ(NextId(), -1);
+  EXPECT_EQ(NextId(10), -1);
+}
+
+TEST_F(WorkRequestReaderTest, PartialReads) {
+  Write("{\"requestId\": ");
+  EXPECT_EQ(NextId(), -1);
+  Write("1}");
+  // A request is only complete at the end of its line.
+  EXPECT_EQ(NextId(), -1);
+  Write("\n{\"requestId\"");
+  EXPECT_EQ(NextId(), 1);
+  EXPECT_EQ(NextId(), -1);
+  Write(": 2}\n");
+  EXPECT_EQ(NextId(), 2);
+}
+
+TEST_F(WorkRequestReaderTest, SeveralRequestsInOneRead) {
+  Write("{\"requestId\": 1}\n{\"requestId\": 2}\n{\"requestId\": 3}\n");
+  EXPECT_EQ(NextId(), 1);
+  EXPECT_EQ(NextId(), 2);
+  EXPECT_EQ(NextId(), 3);
+  EXPECT_EQ(NextId(), -1);
+}
+
+TEST_F(WorkRequestReaderTest, SkipsBlankLines) {
+  Write("\n  \r\n{\"requestId\": 1}\n\n\t\n{\"requestId\": 2}\n\n");
+  EXPECT_EQ(NextId(), 1);
+  EXPECT_EQ(NextId(), 2);
+  EXPECT_EQ(NextId(), -1);
+}
+
+TEST_F(WorkRequestReaderTest, EndOfInput) {
+  Write("{\"requestId\": 1}\n");
+  write_end_ = FD();
+  EXPECT_EQ(NextId(), 1);
+  EXPECT_EQ(reader_->Next(0).status().code(), absl::StatusCode::kOutOfRange);
+}
+
+TEST_F(WorkRequestReaderTest, EndOfInputInsideRequest) {
+  Write("{\"requestId\": 1}");
+  write_end_ = FD();
+  EXPECT_EQ(reader_->Next(-1).status().code(), absl::StatusCode::kOutOfRange);
+}
+
+TEST_F(WorkRequestReaderTest, MalformedRequest) {
+  Write("{\"requestId\": \"one\"}\n{\"requestId\": 2}\n");
+  EXPECT_FALSE(reader_->Next(0).ok());
+  // The malformed line was consumed.
+  EXPECT_EQ(NextId(), 2);
+}
+
+TEST_F(WorkRequestReaderTest, StopOnSignals) {
+  // The handlers stay installed for the rest of the process, so this is the only test doing this.
+  ASSERT_TRUE(reader_->StopOnSignals().ok());
+  EXPECT_EQ(reader_->stop_signal(), 0);
+  Write("{\"requestId\": 1}\n");
+  EXPECT_EQ(NextId(), 1);
+  ASSERT_EQ(::raise(SIGTERM), 0);
+  auto const status_or_request = reader_->Next(-1);
+  EXPECT_EQ(status_or_request.status().code(), absl::StatusCode::kCancelled);
+  EXPECT_EQ(reader_->stop_signal(), SIGTERM);
+  // Pending requests are dropped once stopped.
+  Write("{\"requestId\": 2}\n");
+  EXPECT_EQ(reader_->Next(0).status().code(), absl::StatusCode::kCancelled);
+}
+
+TEST(WorkerTest, IsPersistentWorker) {
+  std::string flag = "--persistent_worker";
+  std::string other = "-c";
+  std::vector<char*> arguments{other.data()};
+  EXPECT_FALSE(IsPersistentWorker(arguments));
+  arguments.push_back(flag.data());
+  EXPECT_TRUE(IsPersistentWorker(arguments));
+}
+
+TEST(WorkerTest, WriteWorkResponse) {
+  int pipe_fds[2];
+  ASSERT_EQ(::pipe2(pipe_fds, O_CLOEXEC), 0);
+  FD const read_end{pipe_fds[0]};
+  FD write_end{pipe_fds[1]};
+  WorkResponse response;
+  response.get<kExitCodeField>() = 1;
+  response.get<kOutputField>() = "first line\nsecond line\n";
+  response.get<kRequestIdField>() = 42;
+  ASSERT_TRUE(WriteWorkResponse(write_end, response).ok());
+  write_end = FD();
+  std::string text;
+  char buffer[4096];
+  for (auto size = ::read(read_end.get(), buffer, sizeof(buffer)); size > 0;
+       size = ::read(read_end.get(), buffer, sizeof(buffer))) {
+    text.append(buffer, size);
+  }
+  // One response per line, with the newlines of the output escaped.
+  ASSERT_TRUE(absl::EndsWith(text, "\n"));
+  EXPECT_EQ(text.find('\n'), text.size() - 1);
+  auto const status_or_response =
+      tsdb2::json::Parse<WorkResponse>(std::string_view(text).substr(0, text.size() - 1));
+  ASSERT_TRUE(status_or_response.ok()) << status_or_response.status();
+  EXPECT_EQ(status_or_response->get<kExitCodeField>(), 1);
+  EXPECT_EQ(status_or_response->get<kOutputField>(), "first line\nsecond line\n");
+  EXPECT_EQ(status_or_response->get<kRequestIdField>(), 42);
+}
+
+// Runs `script` with the shell and returns its exit code, or -1 on error.
+int RunShell(std::string const& script, std::string* const output) {
+  std::vector<std::string> const arguments{"sh", "-c", script};
+  auto const status_or_exit_code = RunCompiler(arguments, output);
+  EXPECT_TRUE(status_or_exit_code.ok()) << status_or_exit_code.status();
+  return status_or_exit_code.value_or(-1);
+}
+
+TEST(RunCompilerTest, Success) {
+  std::string output;
+  EXPECT_EQ(RunShell("exit 0", &output), 0);
+  EXPECT_EQ(output, "");
+}
+
+TEST(RunCompilerTest, ExitCode) {
+  std::string output;
+  EXPECT_EQ(RunShell("exit 3", &output), 3);
+  EXPECT_EQ(RunShell("exit 255", &output), 255);
+}
+
+TEST(RunCompilerTest, Signal) {
+  std::string output;
+  EXPECT_EQ(RunShell("kill -TERM $$", &output), 128 + SIGTERM);
+  EXPECT_EQ(RunShell("kill -KILL $$", &output), 128 + SIGKILL);
+}
+
+TEST(RunCompilerTest, CapturesOutput) {
+  std::string output = "previous\n";
+  EXPECT_EQ(RunShell("echo out; echo err >&2; echo more", &output), 0);
+  EXPECT_EQ(output, "previous\nout\nerr\nmore\n");
+}
+
+TEST(RunCompilerTest, InputIsEmpty) {
+  std::string output;
+  EXPECT_EQ(RunShell("cat", &output), 0);
+  EXPECT_EQ(output, "");
+}
+
+TEST(RunCompilerTest, MissingCompiler) {
+  std::vector<std::string> const arguments{"/nonexistent/compiler", "-c", "a.cc"};
+  std::string output;
+  auto const status_or_exit_code = RunCompiler(arguments, &output);
+  ASSERT_TRUE(status_or_exit_code.ok()) << status_or_exit_code.status();
+  EXPECT_EQ(status_or_exit_code.value(), 127);
+  EXPECT_TRUE(absl::StartsWith(output, "execvp: ")) << output;
+}
+
+}  // namespace